@@ -21,32 +21,126 @@
 /*                                                                        */
 /**************************************************************************/
 
-#include <ittia/db.h>
 
-#include <stdio.h>
-#include <time.h>
-
-/* Performance test settings. */
-
-#define EXAMPLE_DATABASE "performance.ittiadb"
-
-const int ROW_COUNT = 100;
-
-#define GENERATE_ID(i) ((i) * 1103515245 + 12345)
-
-/* Current time offset in milliseconds. */
-time_t milliseconds();
+/** @file performance.c
+ *
+ * Benchmark of basic ITTIA DB SQL table operations.
+ *
+ * Usage:
+ *
+ *   performance_c [options] [database | idb+shm://server/database]
+ *
+ *   --rows N          rows inserted by each iteration (default 100)
+ *   --iterations N    measured iterations of the phase set (default 1)
+ *   --warmup N        unmeasured iterations run first (default 0)
+ *   --phases LIST     comma-separated phases to measure (default all):
+ *                     insert,table_scan,index_scan,seek,update,delete
+ *   --json FILE       also write results as JSON to FILE ("-" for stdout)
+ *   --storage S       file or memory storage (default file)
+ *   --memory-size N   memory storage size in bytes (default 64M)
+ *   --counters        count CPU and OS events in each phase (Linux only)
+ *   --baseline FILE   save the results of each iteration to FILE
+ *   --compare FILE    compare the results with a baseline saved in FILE
+ *   --threshold P     smallest change in percent reported as a
+ *                     regression by --compare (default 5)
+ *   --sdk-version V   SDK version recorded in the baseline
+ *   --page-size N     database page size in bytes, K and M suffixes allowed
+ *   --cache-size N    page cache size in bytes, K and M suffixes allowed
+ *   --mode MODE       benchmark to run (default phases):
+ *                     phases   all phases on one connection
+ *                     threads  insert, seek, and update on 1..N threads
+ *                     batch    rows per transaction by completion mode
+ *                     sweep    phase set by page size and cache size
+ *                     keys     seek and update by key distribution
+ *                     ycsb     mixed read/write workload
+ *                     scale    stream rows into a large table
+ *                     recovery time to reopen after a crash
+ *                     blob     write and read BLOBs in chunks
+ *                     replay   run a SQL script from concurrent clients
+ *   --threads N       maximum thread count for threads mode, or client
+ *                     count for replay mode (default 4)
+ *   --key-ranges R    threads mode key ranges, disjoint or overlap
+ *                     (default disjoint)
+ *   --batch-sizes L   batch mode rows per transaction (default
+ *                     1,10,100,1000,10000)
+ *   --completions L   batch mode completion modes (default all):
+ *                     default,lazy,group,flush
+ *   --flush-interval N  commits between db_flush_tx() calls in flush
+ *                     completion mode (default 100)
+ *   --page-sizes L    sweep mode page sizes (default 1K,4K,16K)
+ *   --cache-sizes L   sweep mode cache sizes (default 256K,1M,4M)
+ *   --cache-ratios L  sweep mode dataset sizes as percentages of the
+ *                     cache size (default 50,200)
+ *   --distributions L keys mode distributions (default all):
+ *                     uniform,zipfian,latest,hotspot
+ *   --operations N    keys mode operations per phase (default --rows)
+ *   --theta X         Zipfian skew, 0 < X < 1 (default 0.99)
+ *   --hot-rows P      percent of rows in the hotspot (default 20)
+ *   --hot-operations P  percent of operations on the hotspot (default 80)
+ *   --seed N          random number generator seed (default 1)
+ *   --workload W      ycsb mode preset, a to f (default a)
+ *   --mix LIST        ycsb mode operation weights, for example
+ *                     read=95,update=5 (read,update,insert,scan,rmw)
+ *   --request-keys D  ycsb mode key distribution (default from preset)
+ *   --scan-length N   ycsb mode maximum rows per scan (default 100)
+ *   --duration S      ycsb and replay mode run time in seconds instead
+ *                     of --operations or one pass over the script
+ *   --schema S        scale mode table, t or storage (default t)
+ *   --max-rows N      scale mode rows to insert (default 1000000)
+ *   --tx-rows N       scale and recovery mode rows per transaction
+ *                     (default 1000)
+ *   --seek-samples N  scale mode seeks per checkpoint (default 10000)
+ *   --db-rows L       recovery mode database sizes in rows (default
+ *                     10000,100000)
+ *   --pending-rows L  recovery mode rows written before a crash (default
+ *                     1000,10000)
+ *   --cases L         recovery mode cases (default all):
+ *                     clean,uncommitted,killed
+ *   --blob-sizes L    blob mode BLOB sizes (default 4K,64K,1M,16M,64M)
+ *   --chunk-sizes L   blob mode bytes per read or write call (default
+ *                     1K,16K,256K,4M)
+ *   --storages L      blob mode storage types (default file,memory)
+ *   --script FILE     replay mode SQL script
+ *   --script-format F replay mode script format, sql (statements end with
+ *                     semicolons) or lines (one statement per line)
+ *                     (default sql)
+ *   --think-time MS   replay mode mean pause after each statement
+ *                     (default 0)
+ *   --rate N          replay mode statements per second of all clients
+ *                     (default 0, no limit)
+ *
+ * Every operation is timed with a monotonic clock. For each phase the
+ * throughput and the p50/p95/p99/p99.9 latency are reported. With
+ * --counters, CPU cycles, instructions, cache misses, branch misses, page
+ * faults, and context switches per operation are also reported, which
+ * shows whether a phase is bound by computation or by memory access. See
+ * performance_counters.c.
+ *
+ * With --baseline or --compare, phases mode keeps the throughput and p99
+ * latency of each of its --iterations, which should be at least 2. A
+ * comparison reports the mean and 95% confidence interval of every
+ * metric and exits with status 2 if any of them is significantly worse
+ * than the baseline by more than the threshold. See performance_baseline.c.
+ *
+ * In threads mode each worker thread opens its own connection to the
+ * database file. See performance_threads.c. Batch mode is described in
+ * performance_batch.c, sweep mode in performance_sweep.c, keys mode in
+ * performance_keys.c, ycsb mode in performance_ycsb.c, scale mode in
+ * performance_scale.c, recovery mode in performance_recovery.c, blob
+ * mode in performance_blob.c, and replay mode in performance_replay.c.
+ */
+
+#include "performance.h"
+
+#include <stdlib.h>
+#include <string.h>
 
 /* Database schema: table, field, and index definitions. */
 
-#define T_ID 0
-#define T_N 1
-#define T_S 2
-
 db_fielddef_t table_t_fields[] = {
     { T_ID, "ID", DB_COLTYPE_UINT32,    0, 0, DB_NOT_NULL, NULL, 0 },
     { T_N,  "N",  DB_COLTYPE_SINT32,    0, 0, DB_NULLABLE, NULL, 0 },
-    { T_S,  "S",  DB_COLTYPE_UTF8STR, 100, 0, DB_NULLABLE, NULL, 0 }
+    { T_S,  "S",  DB_COLTYPE_UTF8STR, T_S_SIZE, 0, DB_NULLABLE, NULL, 0 }
 };
 db_tabledef_t table_t = {
     DB_ALLOC_INITIALIZER(),
@@ -70,211 +164,1314 @@ db_indexdef_t index_t_id = {
     index_t_id_fields,
 };
 
-/* Main program. */
+/* Command-line parsing. */
 
-int example_main(int argc, char* argv[])
+static void
+print_usage(const char * program)
 {
-    const char * const example_database = argc > 1 ? argv[1] : EXAMPLE_DATABASE;
+    printf("Usage:\n"
+           "  %s [options] [database | idb+shm://server/database]\n"
+           "\n"
+           "  --rows N          rows inserted by each iteration (default 100)\n"
+           "  --iterations N    measured iterations of the phase set (default 1)\n"
+           "  --warmup N        unmeasured iterations run first (default 0)\n"
+           "  --phases LIST     comma-separated phases to measure (default all):\n"
+           "                    insert,table_scan,index_scan,seek,update,delete\n"
+           "  --json FILE       also write results as JSON to FILE (\"-\" for stdout)\n"
+           "  --storage S       file or memory storage (default file)\n"
+           "  --memory-size N   memory storage size in bytes (default 64M)\n"
+           "  --counters        count CPU and OS events in each phase (Linux only)\n"
+           "  --baseline FILE   save the results of each iteration to FILE\n"
+           "  --compare FILE    compare the results with a baseline saved in FILE\n"
+           "  --threshold P     smallest change in percent reported as a\n"
+           "                    regression by --compare (default 5)\n"
+           "  --sdk-version V   SDK version recorded in the baseline\n"
+           "  --page-size N     database page size in bytes, K and M suffixes allowed\n"
+           "  --cache-size N    page cache size in bytes, K and M suffixes allowed\n"
+           "  --mode MODE       benchmark to run (default phases):\n"
+           "                    phases   all phases on one connection\n"
+           "                    threads  insert, seek, and update on 1..N threads\n"
+           "                    batch    rows per transaction by completion mode\n"
+           "                    sweep    phase set by page size and cache size\n"
+           "                    keys     seek and update by key distribution\n"
+           "                    ycsb     mixed read/write workload\n"
+           "                    scale    stream rows into a large table\n"
+           "                    recovery time to reopen after a crash\n"
+           "                    blob     write and read BLOBs in chunks\n"
+           "                    replay   run a SQL script from concurrent clients\n"
+           "  --threads N       maximum thread count for threads mode, or client\n"
+           "                    count for replay mode (default 4)\n"
+           "  --key-ranges R    threads mode key ranges, disjoint or overlap\n"
+           "                    (default disjoint)\n"
+           "  --batch-sizes L   batch mode rows per transaction (default\n"
+           "                    1,10,100,1000,10000)\n"
+           "  --completions L   batch mode completion modes (default all):\n"
+           "                    default,lazy,group,flush\n"
+           "  --flush-interval N  commits between db_flush_tx() calls in flush\n"
+           "                    completion mode (default 100)\n"
+           "  --page-sizes L    sweep mode page sizes (default 1K,4K,16K)\n"
+           "  --cache-sizes L   sweep mode cache sizes (default 256K,1M,4M)\n"
+           "  --cache-ratios L  sweep mode dataset sizes as percentages of the\n"
+           "                    cache size (default 50,200)\n"
+           "  --distributions L keys mode distributions (default all):\n"
+           "                    uniform,zipfian,latest,hotspot\n"
+           "  --operations N    keys mode operations per phase (default --rows)\n"
+           "  --theta X         Zipfian skew, 0 < X < 1 (default 0.99)\n"
+           "  --hot-rows P      percent of rows in the hotspot (default 20)\n"
+           "  --hot-operations P  percent of operations on the hotspot (default 80)\n"
+           "  --seed N          random number generator seed (default 1)\n"
+           "  --workload W      ycsb mode preset, a to f (default a)\n"
+           "  --mix LIST        ycsb mode operation weights, for example\n"
+           "                    read=95,update=5 (read,update,insert,scan,rmw)\n"
+           "  --request-keys D  ycsb mode key distribution (default from preset)\n"
+           "  --scan-length N   ycsb mode maximum rows per scan (default 100)\n"
+           "  --duration S      ycsb and replay mode run time in seconds instead\n"
+           "                    of --operations or one pass over the script\n"
+           "  --schema S        scale mode table, t or storage (default t)\n"
+           "  --max-rows N      scale mode rows to insert (default 1000000)\n"
+           "  --tx-rows N       scale and recovery mode rows per transaction\n"
+           "                    (default 1000)\n"
+           "  --seek-samples N  scale mode seeks per checkpoint (default 10000)\n"
+           "  --db-rows L       recovery mode database sizes in rows (default\n"
+           "                    10000,100000)\n"
+           "  --pending-rows L  recovery mode rows written before a crash (default\n"
+           "                    1000,10000)\n"
+           "  --cases L         recovery mode cases (default all):\n"
+           "                    clean,uncommitted,killed\n"
+           "  --blob-sizes L    blob mode BLOB sizes (default 4K,64K,1M,16M,64M)\n"
+           "  --chunk-sizes L   blob mode bytes per read or write call (default\n"
+           "                    1K,16K,256K,4M)\n"
+           "  --storages L      blob mode storage types (default file,memory)\n"
+           "  --script FILE     replay mode SQL script\n"
+           "  --script-format F replay mode script format, sql (statements end with\n"
+           "                    semicolons) or lines (one statement per line)\n"
+           "                    (default sql)\n"
+           "  --think-time MS   replay mode mean pause after each statement\n"
+           "                    (default 0)\n"
+           "  --rate N          replay mode statements per second of all clients\n"
+           "                    (default 0, no limit)\n",
+           program);
+}
 
-    db_file_storage_config_t config;
-    db_t database;
-    db_cursor_t t_cursor, t_ordered_cursor;
-    db_row_t t_row;
-    db_table_cursor_t ordered_cursor_def;
-    time_t start;
+/* Parse a comma-separated list of names into a bit mask of their indexes. */
+static int
+parse_name_list(const char * kind, const char * list,
+                const char * const * names, int name_count, unsigned int * mask)
+{
+    *mask = 0;
+
+    while (*list) {
+        size_t len = strcspn(list, ",");
+        int i;
+
+        for (i = 0; i < name_count; i++) {
+            if (strlen(names[i]) == len && 0 == strncmp(list, names[i], len)) {
+                *mask |= 1u << i;
+                break;
+            }
+        }
+        if (i == name_count) {
+            printf("Unknown %s: %.*s\n", kind, (int)len, list);
+            return -1;
+        }
+
+        list += len;
+        if (*list == ',') {
+            list++;
+        }
+    }
+
+    return *mask != 0 ? 0 : -1;
+}
+
+/* Parse a single name into its index. */
+static int
+parse_name(const char * kind, const char * value,
+           const char * const * names, int name_count, int * index)
+{
     int i;
 
-    /* Bind database fields to local variables. */
+    for (i = 0; i < name_count; i++) {
+        if (0 == strcmp(value, names[i])) {
+            *index = i;
+            return 0;
+        }
+    }
 
-    uint32_t id;
-    int32_t n;
-    char s[100];
+    printf("Unknown %s: %s\n", kind, value);
+    return -1;
+}
 
-    db_bind_t t_binds[] = {
-        DB_BIND_VAR(T_ID, DB_VARTYPE_UINT32,  id),
-        DB_BIND_VAR(T_N,  DB_VARTYPE_SINT32,  n),
-        DB_BIND_STR(T_S,  DB_VARTYPE_UTF8STR, s)
-    };
+static int
+parse_count(const char * name, const char * value, int minimum, int * count)
+{
+    char * end;
+    long n = strtol(value, &end, 10);
 
-    t_row = db_alloc_row(t_binds, DB_ARRAY_DIM(t_binds));
+    if (*value == '\0' || *end != '\0' || n < minimum || n > 0x7FFFFFFF) {
+        printf("Invalid value for %s: %s\n", name, value);
+        return -1;
+    }
 
-    /* Create the database, table, and index. */
+    *count = (int)n;
+    return 0;
+}
+
+/* Parse a number strictly between minimum and maximum. */
+static int
+parse_real(const char * name, const char * value, double minimum, double maximum, double * real)
+{
+    char * end;
+    double x = strtod(value, &end);
+
+    if (*value == '\0' || *end != '\0' || !(x > minimum && x < maximum)) {
+        printf("Invalid value for %s: %s\n", name, value);
+        return -1;
+    }
+
+    *real = x;
+    return 0;
+}
 
-    db_file_storage_config_init(&config);
+/* Parse a byte size with an optional K or M suffix. */
+static int
+parse_size(const char * name, const char * value, int * size)
+{
+    char * end;
+    long n = strtol(value, &end, 10);
+    long scale = 1;
+
+    if (*end == 'k' || *end == 'K') {
+        scale = 1024;
+        end++;
+    }
+    else if (*end == 'm' || *end == 'M') {
+        scale = 1024 * 1024;
+        end++;
+    }
+
+    if (*value == '\0' || *end != '\0' || n < 1 || n > 0x7FFFFFFF / scale) {
+        printf("Invalid value for %s: %s\n", name, value);
+        return -1;
+    }
+
+    *size = (int)(n * scale);
+    return 0;
+}
+
+/* Parse a comma-separated list of counts or sizes. */
+static int
+parse_count_list(const char * name, const char * list, int sizes,
+                 int * counts, int max_count, int * count)
+{
+    *count = 0;
+
+    while (*list) {
+        char value[16];
+        size_t len = strcspn(list, ",");
+
+        if (*count == max_count || len == 0 || len >= sizeof(value)) {
+            printf("Invalid value for %s: %s\n", name, list);
+            return -1;
+        }
+        memcpy(value, list, len);
+        value[len] = '\0';
+        if (0 != (sizes ? parse_size(name, value, &counts[*count])
+                        : parse_count(name, value, 1, &counts[*count])))
+        {
+            return -1;
+        }
+        (*count)++;
+
+        list += len;
+        if (*list == ',') {
+            list++;
+        }
+    }
+
+    return *count != 0 ? 0 : -1;
+}
+
+/* Parse operation weights such as "read=95,insert=5". */
+static int
+parse_mix(const char * list, int * mix)
+{
+    int op;
+
+    for (op = 0; op < OP_COUNT; op++) {
+        mix[op] = 0;
+    }
+
+    while (*list) {
+        size_t len = strcspn(list, ",");
+        size_t name_len = strcspn(list, "=,");
+        char value[16];
+
+        for (op = 0; op < OP_COUNT; op++) {
+            if (strlen(perf_op_names[op]) == name_len && 0 == strncmp(list, perf_op_names[op], name_len)) {
+                break;
+            }
+        }
+        if (op == OP_COUNT || name_len == len || len - name_len - 1 >= sizeof(value)) {
+            printf("Invalid operation weight: %.*s\n", (int)len, list);
+            return -1;
+        }
+
+        memcpy(value, list + name_len + 1, len - name_len - 1);
+        value[len - name_len - 1] = '\0';
+        if (parse_count("--mix", value, 0, &mix[op]) != 0) {
+            return -1;
+        }
+
+        list += len;
+        if (*list == ',') {
+            list++;
+        }
+    }
+
+    return 0;
+}
+
+static int
+parse_options(int argc, char * argv[], perf_options_t * options)
+{
+    int i;
+
+    options->database = EXAMPLE_DATABASE;
+    options->row_count = 100;
+    options->iterations = 1;
+    options->warmup = 0;
+    options->phases = PHASE_ALL;
+    options->json_file = NULL;
+    options->mode = MODE_PHASES;
+    options->threads = 4;
+    options->overlap = 0;
 #ifdef PAGE_SIZE
-    /* Set permanent storage I/O block size for this database file. */
-    config.page_size = PAGE_SIZE;
+    options->page_size = PAGE_SIZE;
+#else
+    options->page_size = 0;
 #endif
 #ifdef PAGE_CACHE_SIZE
-    /* Limit page cache memory footprint. */
-    config.buffer_count = PAGE_CACHE_SIZE / config.page_size;
+    options->cache_size = PAGE_CACHE_SIZE;
+#else
+    options->cache_size = 0;
+#endif
+    options->sweep_page_sizes[0] = 1024;
+    options->sweep_page_sizes[1] = 4096;
+    options->sweep_page_sizes[2] = 16384;
+    options->sweep_page_size_count = 3;
+    options->sweep_cache_sizes[0] = 256 * 1024;
+    options->sweep_cache_sizes[1] = 1024 * 1024;
+    options->sweep_cache_sizes[2] = 4096 * 1024;
+    options->sweep_cache_size_count = 3;
+    options->sweep_ratios[0] = 50;
+    options->sweep_ratios[1] = 200;
+    options->sweep_ratio_count = 2;
+    options->distributions = KEYS_ALL;
+    options->operations = 0;
+    options->theta = 0.99;
+    options->hot_rows = 20;
+    options->hot_operations = 80;
+    options->seed = 1;
+    options->storage = PERF_STORAGE_FILE;
+    options->memory_size = 64 * 1024 * 1024;
+    perf_ycsb_preset("a", options);
+    options->scan_length = 100;
+    options->duration = 0;
+    options->schema = PERF_SCHEMA_T;
+    options->max_rows = 1000000;
+    options->tx_rows = 1000;
+    options->seek_samples = 10000;
+    options->recovery_db_rows[0] = 10000;
+    options->recovery_db_rows[1] = 100000;
+    options->recovery_db_rows_count = 2;
+    options->recovery_pending_rows[0] = 1000;
+    options->recovery_pending_rows[1] = 10000;
+    options->recovery_pending_count = 2;
+    options->recovery_cases = RECOVERY_ALL;
+    options->blob_sizes[0] = 4 * 1024;
+    options->blob_sizes[1] = 64 * 1024;
+    options->blob_sizes[2] = 1024 * 1024;
+    options->blob_sizes[3] = 16 * 1024 * 1024;
+    options->blob_sizes[4] = 64 * 1024 * 1024;
+    options->blob_size_count = 5;
+    options->chunk_sizes[0] = 1024;
+    options->chunk_sizes[1] = 16 * 1024;
+    options->chunk_sizes[2] = 256 * 1024;
+    options->chunk_sizes[3] = 4 * 1024 * 1024;
+    options->chunk_size_count = 4;
+    options->storages = (1u << PERF_STORAGE_COUNT) - 1;
+    options->counters = 0;
+    options->baseline_file = NULL;
+    options->compare_file = NULL;
+    options->threshold = 5.0;
+#ifdef PERF_SDK_VERSION
+    options->sdk_version = PERF_SDK_VERSION;
+#else
+    options->sdk_version = "unknown";
 #endif
+    options->script_file = NULL;
+    options->script_lines = 0;
+    options->think_time = 0;
+    options->rate = 0;
+    options->batch_sizes[0] = 1;
+    options->batch_sizes[1] = 10;
+    options->batch_sizes[2] = 100;
+    options->batch_sizes[3] = 1000;
+    options->batch_sizes[4] = 10000;
+    options->batch_size_count = 5;
+    options->completions = COMPLETION_ALL;
+    options->flush_interval = 100;
+
+    for (i = 1; i < argc; i++) {
+        const char * arg = argv[i];
+        const char * value = i + 1 < argc ? argv[i + 1] : NULL;
+        int rc = 0;
+
+        if (arg[0] != '-' || arg[1] == '\0') {
+            options->database = arg;
+            continue;
+        }
+
+        if (0 == strcmp(arg, "--help") || 0 == strcmp(arg, "-h")) {
+            return -1;
+        }
+
+        /* Options without a value. */
+        if (0 == strcmp(arg, "--counters")) {
+            options->counters = 1;
+            continue;
+        }
+
+        if (value == NULL) {
+            printf("Missing value for %s\n", arg);
+            return -1;
+        }
+
+        if (0 == strcmp(arg, "--rows")) {
+            rc = parse_count(arg, value, 1, &options->row_count);
+        }
+        else if (0 == strcmp(arg, "--iterations")) {
+            rc = parse_count(arg, value, 1, &options->iterations);
+        }
+        else if (0 == strcmp(arg, "--warmup")) {
+            rc = parse_count(arg, value, 0, &options->warmup);
+        }
+        else if (0 == strcmp(arg, "--phases")) {
+            rc = parse_name_list("phase", value, perf_phase_names, PHASE_COUNT, &options->phases);
+        }
+        else if (0 == strcmp(arg, "--json")) {
+            options->json_file = value;
+        }
+        else if (0 == strcmp(arg, "--mode")) {
+            int mode = MODE_PHASES;
+            rc = parse_name("mode", value, perf_mode_names, MODE_COUNT, &mode);
+            options->mode = (perf_mode_t)mode;
+        }
+        else if (0 == strcmp(arg, "--threads")) {
+            rc = parse_count(arg, value, 1, &options->threads);
+        }
+        else if (0 == strcmp(arg, "--batch-sizes")) {
+            rc = parse_count_list(arg, value, 0, options->batch_sizes, PERF_MAX_BATCH_SIZES, &options->batch_size_count);
+        }
+        else if (0 == strcmp(arg, "--completions")) {
+            rc = parse_name_list("completion mode", value, perf_completion_names, COMPLETION_COUNT, &options->completions);
+        }
+        else if (0 == strcmp(arg, "--flush-interval")) {
+            rc = parse_count(arg, value, 1, &options->flush_interval);
+        }
+        else if (0 == strcmp(arg, "--storage")) {
+            if (0 == strcmp(value, "file")) {
+                options->storage = PERF_STORAGE_FILE;
+            }
+            else if (0 == strcmp(value, "memory")) {
+                options->storage = PERF_STORAGE_MEMORY;
+            }
+            else {
+                printf("Unknown storage: %s\n", value);
+                rc = -1;
+            }
+        }
+        else if (0 == strcmp(arg, "--memory-size")) {
+            rc = parse_size(arg, value, &options->memory_size);
+        }
+        else if (0 == strcmp(arg, "--page-size")) {
+            rc = parse_size(arg, value, &options->page_size);
+        }
+        else if (0 == strcmp(arg, "--cache-size")) {
+            rc = parse_size(arg, value, &options->cache_size);
+        }
+        else if (0 == strcmp(arg, "--page-sizes")) {
+            rc = parse_count_list(arg, value, 1, options->sweep_page_sizes, PERF_MAX_SWEEP_VALUES, &options->sweep_page_size_count);
+        }
+        else if (0 == strcmp(arg, "--cache-sizes")) {
+            rc = parse_count_list(arg, value, 1, options->sweep_cache_sizes, PERF_MAX_SWEEP_VALUES, &options->sweep_cache_size_count);
+        }
+        else if (0 == strcmp(arg, "--cache-ratios")) {
+            rc = parse_count_list(arg, value, 0, options->sweep_ratios, PERF_MAX_SWEEP_VALUES, &options->sweep_ratio_count);
+        }
+        else if (0 == strcmp(arg, "--distributions")) {
+            rc = parse_name_list("key distribution", value, perf_keys_names, KEYS_COUNT, &options->distributions);
+        }
+        else if (0 == strcmp(arg, "--operations")) {
+            rc = parse_count(arg, value, 1, &options->operations);
+        }
+        else if (0 == strcmp(arg, "--theta")) {
+            rc = parse_real(arg, value, 0.0, 1.0, &options->theta);
+        }
+        else if (0 == strcmp(arg, "--hot-rows")) {
+            rc = parse_count(arg, value, 1, &options->hot_rows);
+            if (rc == 0 && options->hot_rows > 100) {
+                printf("Invalid value for %s: %s\n", arg, value);
+                rc = -1;
+            }
+        }
+        else if (0 == strcmp(arg, "--hot-operations")) {
+            rc = parse_count(arg, value, 0, &options->hot_operations);
+            if (rc == 0 && options->hot_operations > 100) {
+                printf("Invalid value for %s: %s\n", arg, value);
+                rc = -1;
+            }
+        }
+        else if (0 == strcmp(arg, "--seed")) {
+            int seed;
+            rc = parse_count(arg, value, 0, &seed);
+            options->seed = (unsigned int)seed;
+        }
+        else if (0 == strcmp(arg, "--workload")) {
+            rc = perf_ycsb_preset(value, options);
+        }
+        else if (0 == strcmp(arg, "--mix")) {
+            rc = parse_mix(value, options->op_mix);
+        }
+        else if (0 == strcmp(arg, "--request-keys")) {
+            int keys = KEYS_UNIFORM;
+            rc = parse_name("key distribution", value, perf_keys_names, KEYS_COUNT, &keys);
+            options->request_keys = (perf_keys_t)keys;
+        }
+        else if (0 == strcmp(arg, "--scan-length")) {
+            rc = parse_count(arg, value, 1, &options->scan_length);
+        }
+        else if (0 == strcmp(arg, "--duration")) {
+            rc = parse_count(arg, value, 1, &options->duration);
+        }
+        else if (0 == strcmp(arg, "--schema")) {
+            if (0 == strcmp(value, "t")) {
+                options->schema = PERF_SCHEMA_T;
+            }
+            else if (0 == strcmp(value, "storage")) {
+                options->schema = PERF_SCHEMA_STORAGE;
+            }
+            else {
+                printf("Unknown schema: %s\n", value);
+                rc = -1;
+            }
+        }
+        else if (0 == strcmp(arg, "--max-rows")) {
+            rc = parse_count(arg, value, 1, &options->max_rows);
+        }
+        else if (0 == strcmp(arg, "--tx-rows")) {
+            rc = parse_count(arg, value, 1, &options->tx_rows);
+        }
+        else if (0 == strcmp(arg, "--seek-samples")) {
+            rc = parse_count(arg, value, 1, &options->seek_samples);
+        }
+        else if (0 == strcmp(arg, "--db-rows")) {
+            rc = parse_count_list(arg, value, 0, options->recovery_db_rows, PERF_MAX_SWEEP_VALUES, &options->recovery_db_rows_count);
+        }
+        else if (0 == strcmp(arg, "--pending-rows")) {
+            rc = parse_count_list(arg, value, 0, options->recovery_pending_rows, PERF_MAX_SWEEP_VALUES, &options->recovery_pending_count);
+        }
+        else if (0 == strcmp(arg, "--cases")) {
+            rc = parse_name_list("recovery case", value, perf_recovery_names, RECOVERY_COUNT, &options->recovery_cases);
+        }
+        else if (0 == strcmp(arg, "--blob-sizes")) {
+            rc = parse_count_list(arg, value, 1, options->blob_sizes, PERF_MAX_SWEEP_VALUES, &options->blob_size_count);
+        }
+        else if (0 == strcmp(arg, "--chunk-sizes")) {
+            rc = parse_count_list(arg, value, 1, options->chunk_sizes, PERF_MAX_SWEEP_VALUES, &options->chunk_size_count);
+        }
+        else if (0 == strcmp(arg, "--storages")) {
+            rc = parse_name_list("storage", value, perf_storage_names, PERF_STORAGE_COUNT, &options->storages);
+        }
+        else if (0 == strcmp(arg, "--baseline")) {
+            options->baseline_file = value;
+        }
+        else if (0 == strcmp(arg, "--compare")) {
+            options->compare_file = value;
+        }
+        else if (0 == strcmp(arg, "--threshold")) {
+            rc = parse_real(arg, value, 0.0, 1000.0, &options->threshold);
+        }
+        else if (0 == strcmp(arg, "--sdk-version")) {
+            options->sdk_version = value;
+        }
+        else if (0 == strcmp(arg, "--script")) {
+            options->script_file = value;
+        }
+        else if (0 == strcmp(arg, "--script-format")) {
+            if (0 == strcmp(value, "sql")) {
+                options->script_lines = 0;
+            }
+            else if (0 == strcmp(value, "lines")) {
+                options->script_lines = 1;
+            }
+            else {
+                printf("Unknown script format: %s\n", value);
+                rc = -1;
+            }
+        }
+        else if (0 == strcmp(arg, "--think-time")) {
+            rc = parse_count(arg, value, 0, &options->think_time);
+        }
+        else if (0 == strcmp(arg, "--rate")) {
+            rc = parse_count(arg, value, 0, &options->rate);
+        }
+        else if (0 == strcmp(arg, "--key-ranges")) {
+            if (0 == strcmp(value, "disjoint")) {
+                options->overlap = 0;
+            }
+            else if (0 == strcmp(value, "overlap")) {
+                options->overlap = 1;
+            }
+            else {
+                printf("Unknown key range sharing: %s\n", value);
+                rc = -1;
+            }
+        }
+        else {
+            printf("Unknown option: %s\n", arg);
+            rc = -1;
+        }
+
+        if (rc != 0) {
+            return -1;
+        }
+        i++;
+    }
 
-    database = db_create_file_storage(example_database, &config);
-    db_file_storage_config_destroy(&config);
+    return 0;
+}
 
-    if (database == NULL)
-    {
-        printf("Error opening database: %d", (int) get_db_error());
-        return 1;
+/* Benchmark phases.
+ *
+ * Each phase function runs over the rows in its range once. When stats is
+ * NULL, the phase is only used to prepare data for the phases that follow
+ * it, and no timing is recorded.
+ *
+ * When ctx->tolerate_conflicts is set, an operation that fails because
+ * another connection holds a lock on the row is rolled back and counted
+ * in stats->conflicts instead of stopping the phase.
+ */
+
+/* Row number visited at position k of a range. */
+static int
+range_row(const perf_range_t * range, int k)
+{
+    if (range->keys != NULL) {
+        return perf_keygen_next(range->keys);
     }
+    return (int)(((int64_t)range->first - 1 + (int64_t)k * range->stride) % range->row_count) + 1;
+}
 
-    db_create_table(database, table_t.table_name, &table_t, 0);
-    db_create_index(database, table_t.table_name, index_t_id.index_name, &index_t_id);
+static int
+is_conflict(perf_context_t * ctx, perf_stats_t * stats)
+{
+    if (!ctx->tolerate_conflicts || get_db_error() != DB_ELOCKED) {
+        return 0;
+    }
+    if (stats) {
+        stats->conflicts++;
+    }
+    return 1;
+}
 
-    /* Configure transactions. */
-    db_set_tx_default(database, DB_GROUP_COMPLETION | DB_READ_COMMITTED);
+void
+perf_fill_row(perf_context_t * ctx, int row_count, int i)
+{
+    ctx->id = GENERATE_ID(i);
+    ctx->n = row_count / 2 - i;
+    sprintf(ctx->s, "%d", i);
+}
 
-    /* Open unordered table cursor. */
-    t_cursor = db_open_table_cursor(database, table_t.table_name, NULL);
+/// Change the fetched row for an update.
+/** Rows can be updated many times, so the first digit of the string
+ *  cycles through the decimal digits and always stays valid text. */
+void
+perf_modify_row(perf_context_t * ctx)
+{
+    ctx->n = -ctx->n;
+    ctx->s[0] = (char)('0' + (ctx->s[0] - '0' + 1) % 10);
+}
 
-    /* Open table cursor ordered by the fields in the ID index. */
-    db_table_cursor_init(&ordered_cursor_def);
-    ordered_cursor_def.index = index_t_id.index_name;
-    ordered_cursor_def.flags = DB_CAN_MODIFY;
-    t_ordered_cursor = db_open_table_cursor(database, table_t.table_name, &ordered_cursor_def);
-    db_table_cursor_destroy(&ordered_cursor_def);
+int
+perf_run_insert(perf_context_t * ctx, const perf_range_t * range, perf_stats_t * stats)
+{
+    uint64_t phase_start = perf_clock_ns();
+    int k;
 
-    /* Insert rows. */
+    if (stats) {
+        perf_counters_start();
+    }
 
-    printf("Insert %d rows: ", ROW_COUNT);
-    fflush(stdout);
-    start = milliseconds();
+    for (k = 0; k < range->count; k++) {
+        uint64_t start = perf_clock_ns();
+        db_result_t rc;
+
+        db_begin_tx(ctx->database, 0);
+
+        perf_fill_row(ctx, range->row_count, range_row(range, k));
+        rc = db_insert(ctx->t_cursor, ctx->t_row, NULL, 0);
+
+        if (DB_OK == rc) {
+            db_commit_tx(ctx->database, 0);
+        }
+        else {
+            db_abort_tx(ctx->database, 0);
+            if (is_conflict(ctx, stats)) {
+                continue;
+            }
+            printf("Insert error: %d\n", (int)get_db_error());
+            return -1;
+        }
+        if (stats) {
+            perf_stats_record(stats, perf_clock_ns() - start);
+        }
+    }
 
-    for(i = 1; i <= ROW_COUNT; i++) {
-        db_begin_tx(database, 0);
+    if (stats) {
+        stats->elapsed_ns += perf_clock_ns() - phase_start;
+        perf_counters_stop(stats->counters);
+    }
+    return 0;
+}
 
-        id = GENERATE_ID(i);
-        n = ROW_COUNT / 2 - i;
-        sprintf(s, "%d", i);
-        db_insert(t_cursor, t_row, NULL, 0);
+int
+perf_run_scan(perf_context_t * ctx, db_cursor_t cursor, perf_stats_t * stats)
+{
+    uint64_t phase_start = perf_clock_ns();
+    uint64_t start;
 
-        db_commit_tx(database, 0);
+    if (stats) {
+        perf_counters_start();
     }
 
-    printf("%d milliseconds\n", (int) (milliseconds() - start));
+    db_begin_tx(ctx->database, 0);
 
-    /* Table scan: iterate over all rows in unspecified order. */
+    start = perf_clock_ns();
+    for (db_seek_first(cursor); !db_eof(cursor); db_seek_next(cursor))
+    {
+        db_fetch(cursor, ctx->t_row, NULL);
+
+        /* Each row costs one fetch and the seek to the following row. */
+        if (stats) {
+            uint64_t now = perf_clock_ns();
+            perf_stats_record(stats, now - start);
+            start = now;
+        }
+    }
+    db_commit_tx(ctx->database, 0);
 
-    printf("Table scan %d rows: ", ROW_COUNT);
-    fflush(stdout);
-    start = milliseconds();
+    if (stats) {
+        stats->elapsed_ns += perf_clock_ns() - phase_start;
+        perf_counters_stop(stats->counters);
+    }
+    return 0;
+}
 
-    db_begin_tx(database, 0);
-    for (db_seek_first(t_cursor); !db_eof(t_cursor); db_seek_next(t_cursor))
-    {
-        db_fetch(t_cursor, t_row, NULL);
+int
+perf_run_seek(perf_context_t * ctx, const perf_range_t * range, perf_stats_t * stats)
+{
+    uint64_t phase_start = perf_clock_ns();
+    int k;
+
+    if (stats) {
+        perf_counters_start();
+    }
+
+    db_begin_tx(ctx->database, 0);
+    for (k = 0; k < range->count; k++) {
+        uint64_t start = perf_clock_ns();
+
+        ctx->id = GENERATE_ID(range_row(range, k));
+        if (DB_OK != db_seek(ctx->t_ordered_cursor, DB_SEEK_EQUAL, ctx->t_row, NULL, 1)
+            || DB_OK != db_fetch(ctx->t_ordered_cursor, ctx->t_row, NULL))
+        {
+            if (is_conflict(ctx, stats)) {
+                continue;
+            }
+            printf("Seek error: %d\n", (int)get_db_error());
+            db_abort_tx(ctx->database, 0);
+            return -1;
+        }
+
+        if (stats) {
+            perf_stats_record(stats, perf_clock_ns() - start);
+        }
+    }
+    db_commit_tx(ctx->database, 0);
+
+    if (stats) {
+        stats->elapsed_ns += perf_clock_ns() - phase_start;
+        perf_counters_stop(stats->counters);
     }
-    db_commit_tx(database, 0);
+    return 0;
+}
+
+int
+perf_run_update(perf_context_t * ctx, const perf_range_t * range, perf_stats_t * stats)
+{
+    uint64_t phase_start = perf_clock_ns();
+    int k;
 
-    printf("%d milliseconds\n", (int) (milliseconds() - start));
+    if (stats) {
+        perf_counters_start();
+    }
 
-    /* Index scan: iterate over all rows in ID order. */
+    for (k = 0; k < range->count; k++) {
+        uint64_t start = perf_clock_ns();
+        db_result_t rc;
+
+        db_begin_tx(ctx->database, 0);
+
+        ctx->id = GENERATE_ID(range_row(range, k));
+        rc = db_seek(ctx->t_ordered_cursor, DB_SEEK_EQUAL, ctx->t_row, NULL, 1);
+        if (DB_OK == rc) {
+            rc = db_fetch(ctx->t_ordered_cursor, ctx->t_row, NULL);
+        }
+        if (DB_OK == rc) {
+            perf_modify_row(ctx);
+            rc = db_update(ctx->t_ordered_cursor, ctx->t_row, NULL);
+        }
+
+        if (DB_OK == rc) {
+            db_commit_tx(ctx->database, 0);
+        }
+        else {
+            db_abort_tx(ctx->database, 0);
+            if (is_conflict(ctx, stats)) {
+                continue;
+            }
+            printf("Update error: %d\n", (int)get_db_error());
+            return -1;
+        }
+
+        if (stats) {
+            perf_stats_record(stats, perf_clock_ns() - start);
+        }
+    }
 
-    printf("Index scan %d rows: ", ROW_COUNT);
-    fflush(stdout);
-    start = milliseconds();
+    if (stats) {
+        stats->elapsed_ns += perf_clock_ns() - phase_start;
+        perf_counters_stop(stats->counters);
+    }
+    return 0;
+}
+
+int
+perf_run_delete(perf_context_t * ctx, perf_stats_t * stats)
+{
+    uint64_t phase_start = perf_clock_ns();
+
+    if (stats) {
+        perf_counters_start();
+    }
 
-    db_begin_tx(database, 0);
-    for (db_seek_first(t_ordered_cursor); !db_eof(t_ordered_cursor); db_seek_next(t_ordered_cursor))
+    db_seek_first(ctx->t_cursor);
+    while (!db_eof(ctx->t_cursor))
     {
-        db_fetch(t_ordered_cursor, t_row, NULL);
+        uint64_t start = perf_clock_ns();
+        db_result_t rc;
+
+        db_begin_tx(ctx->database, 0);
+        rc = db_delete(ctx->t_cursor, DB_DELETE_SEEK_NEXT);
+        db_commit_tx(ctx->database, 0);
+
+        if (DB_OK != rc) {
+            printf("Delete error: %d\n", (int)get_db_error());
+            return -1;
+        }
+        if (stats) {
+            perf_stats_record(stats, perf_clock_ns() - start);
+        }
     }
-    db_commit_tx(database, 0);
 
-    printf("%d milliseconds\n", (int) (milliseconds() - start));
+    if (stats) {
+        stats->elapsed_ns += perf_clock_ns() - phase_start;
+        perf_counters_stop(stats->counters);
+    }
+    return 0;
+}
+
+/// Run all phases once, recording into stats[] only if it is not NULL.
+int
+perf_run_phase_set(perf_context_t * ctx, const perf_options_t * options, perf_stats_t * stats)
+{
+    perf_range_t range;
+    int rc = 0;
 
-    /* Select each row by index seek. */
+    range.first = 1;
+    range.count = options->row_count;
+    range.stride = 1;
+    range.row_count = options->row_count;
+    range.keys = NULL;
 
-    printf("Index seek %d rows: ", ROW_COUNT);
-    fflush(stdout);
-    start = milliseconds();
+#define PHASE_STATS(phase) \
+    (stats != NULL && (options->phases & PHASE_BIT(phase)) ? &stats[phase] : NULL)
 
-    db_begin_tx(database, 0);
-    for(i = 1; i <= ROW_COUNT; i++) {
-        id = GENERATE_ID(i);
-        db_seek(t_ordered_cursor, DB_SEEK_EQUAL, t_row, NULL, 1);
-        db_fetch(t_ordered_cursor, t_row, NULL);
+    /* Rows are always inserted and deleted, so each iteration starts from an
+     * empty table. Only the selected phases are measured. */
+    rc = rc ? rc : perf_run_insert(ctx, &range, PHASE_STATS(PHASE_INSERT));
+
+    if (options->phases & PHASE_BIT(PHASE_TABLE_SCAN)) {
+        rc = rc ? rc : perf_run_scan(ctx, ctx->t_cursor, PHASE_STATS(PHASE_TABLE_SCAN));
+    }
+    if (options->phases & PHASE_BIT(PHASE_INDEX_SCAN)) {
+        rc = rc ? rc : perf_run_scan(ctx, ctx->t_ordered_cursor, PHASE_STATS(PHASE_INDEX_SCAN));
+    }
+    if (options->phases & PHASE_BIT(PHASE_SEEK)) {
+        rc = rc ? rc : perf_run_seek(ctx, &range, PHASE_STATS(PHASE_SEEK));
+    }
+    if (options->phases & PHASE_BIT(PHASE_UPDATE)) {
+        rc = rc ? rc : perf_run_update(ctx, &range, PHASE_STATS(PHASE_UPDATE));
     }
-    db_commit_tx(database, 0);
 
-    printf("%d milliseconds\n", (int) (milliseconds() - start));
+    rc = rc ? rc : perf_run_delete(ctx, PHASE_STATS(PHASE_DELETE));
 
-    /* Update each row in the table by index seek. */
+#undef PHASE_STATS
 
-    printf("Update %d table rows: ", ROW_COUNT);
-    fflush(stdout);
-    start = milliseconds();
+    return rc;
+}
 
-    for(i = 1; i <= ROW_COUNT; i++) {
-        db_begin_tx(database, 0);
+/* Reports. */
 
-        id = GENERATE_ID(i);
-        db_seek(t_ordered_cursor, DB_SEEK_EQUAL, t_row, NULL, 1);
-        db_fetch(t_ordered_cursor, t_row, NULL);
+static void
+print_report(FILE * out, const perf_options_t * options, const perf_stats_t * stats)
+{
+    int phase;
 
-        n = -n;
-        s[0] += '\x30';
-        db_update(t_ordered_cursor, t_row, NULL);
+    perf_report_table_header(out);
+    for (phase = 0; phase < PHASE_COUNT; phase++) {
+        if (options->phases & PHASE_BIT(phase)) {
+            perf_report_table_row(out, &stats[phase]);
+        }
+    }
 
-        db_commit_tx(database, 0);
+    if (perf_counters_enabled()) {
+        fprintf(out, "\n");
+        perf_report_counters_header(out);
+        for (phase = 0; phase < PHASE_COUNT; phase++) {
+            if (options->phases & PHASE_BIT(phase)) {
+                perf_report_counters_row(out, &stats[phase]);
+            }
+        }
     }
+}
 
-    printf("%d milliseconds\n", (int) (milliseconds() - start));
+static int
+write_json_report(const perf_options_t * options, const perf_stats_t * stats)
+{
+    FILE * out = 0 == strcmp(options->json_file, "-") ? stdout : fopen(options->json_file, "w");
+    int phase;
+    int first = 1;
 
-    /* Delete all rows. */
+    if (out == NULL) {
+        printf("Unable to open JSON report file: %s\n", options->json_file);
+        return -1;
+    }
 
-    printf("Delete %d rows: ", ROW_COUNT);
-    fflush(stdout);
-    start = milliseconds();
+    fprintf(out, "{\n  \"benchmark\": \"performance\",\n  \"config\": { \"database\": ");
+    perf_report_json_string(out, options->database);
+    fprintf(out, ", \"rows\": %d, \"iterations\": %d, \"warmup\": %d },\n",
+            options->row_count, options->iterations, options->warmup);
+    fprintf(out, "  \"phases\": [\n");
+    for (phase = 0; phase < PHASE_COUNT; phase++) {
+        if (options->phases & PHASE_BIT(phase)) {
+            fprintf(out, first ? "    " : ",\n    ");
+            perf_report_json_stats(out, &stats[phase]);
+            first = 0;
+        }
+    }
+    fprintf(out, "\n  ]\n}\n");
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
+
+/* Database and connection setup. */
 
-    db_seek_first(t_cursor);
-    while (!db_eof(t_cursor))
+/* True if the database name is a server URI, such as idb+shm://... */
+static int
+is_server_uri(const char * database)
+{
+    return strstr(database, "://") != NULL;
+}
+
+/// Create the benchmark database with table T and its ID index.
+/** A server URI names a database that already exists, so it is opened
+ *  instead, and table T is created if it is missing and emptied. */
+db_t
+perf_create_database(const perf_options_t * options)
+{
+    db_t database;
+
+    if (is_server_uri(options->database)) {
+        database = perf_open_database(options);
+    }
+    else if (options->storage == PERF_STORAGE_MEMORY) {
+        db_memory_storage_config_t config;
+
+        db_memory_storage_config_init(&config);
+        /* Specify the amount of memory to allocate for tables and indexes. */
+        config.memory_storage_size = options->memory_size;
+        database = db_create_memory_storage(options->database, &config);
+        db_memory_storage_config_destroy(&config);
+    }
+    else {
+        db_file_storage_config_t config;
+
+        db_file_storage_config_init(&config);
+        if (options->page_size != 0) {
+            /* Set permanent storage I/O block size for this database file. */
+            config.page_size = options->page_size;
+        }
+        if (options->cache_size != 0) {
+            /* Limit page cache memory footprint. */
+            config.buffer_count = options->cache_size / config.page_size;
+        }
+
+        database = db_create_file_storage(options->database, &config);
+        db_file_storage_config_destroy(&config);
+    }
+
+    if (database == NULL)
     {
-        db_begin_tx(database, 0);
-        db_delete(t_cursor, DB_DELETE_SEEK_NEXT);
-        db_commit_tx(database, 0);
+        printf("Error opening database: %d\n", (int) get_db_error());
+        return NULL;
     }
 
-    printf("%d milliseconds\n", (int) (milliseconds() - start));
+    /* These fail harmlessly if a server database already has the schema. */
+    db_create_table(database, table_t.table_name, &table_t, 0);
+    db_create_index(database, table_t.table_name, index_t_id.index_name, &index_t_id);
 
-    db_close_cursor(t_cursor);
-    db_close_cursor(t_ordered_cursor);
+    /* Configure transactions. */
+    db_set_tx_default(database, DB_GROUP_COMPLETION | DB_READ_COMMITTED);
 
-    db_shutdown(database, 0, NULL);
+    if (is_server_uri(options->database)) {
+        perf_context_t ctx;
+        int rc = perf_open_context(&ctx, database);
+
+        if (rc == 0) {
+            rc = perf_run_delete(&ctx, NULL);
+            perf_close_context(&ctx);
+        }
+        if (rc != 0) {
+            db_shutdown(database, 0, NULL);
+            return NULL;
+        }
+    }
 
-    db_free_row(t_row);
+    return database;
+}
 
-    return 0;
+/// Open another connection to the benchmark database.
+db_t
+perf_open_database(const perf_options_t * options)
+{
+    db_t database;
+
+    if (options->storage == PERF_STORAGE_MEMORY) {
+        database = db_open_memory_storage(options->database, NULL);
+    }
+    else if (options->cache_size != 0) {
+        db_file_storage_config_t config;
+
+        db_file_storage_config_init(&config);
+        if (options->page_size != 0) {
+            config.page_size = options->page_size;
+        }
+        /* Keep the page cache the size it was when the database was created. */
+        config.buffer_count = options->cache_size / config.page_size;
+        database = db_open_file_storage(options->database, &config);
+        db_file_storage_config_destroy(&config);
+    }
+    else {
+        database = db_open_file_storage(options->database, NULL);
+    }
+
+    if (database == NULL) {
+        printf("Error opening database: %d\n", (int)get_db_error());
+        return NULL;
+    }
+
+    db_set_tx_default(database, DB_GROUP_COMPLETION | DB_READ_COMMITTED);
+    return database;
 }
 
+/// Bind row variables and open cursors on table T for a connection.
+/** The row is bound to fields of ctx, so ctx must not move until
+ *  perf_close_context() is called. */
+int
+perf_open_context(perf_context_t * ctx, db_t database)
+{
+    db_table_cursor_t ordered_cursor_def;
+
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->database = database;
 
-/* Utility functions. */
+    /* Bind database fields to local variables. */
+    {
+        db_bind_t t_binds[] = {
+            DB_BIND_VAR(T_ID, DB_VARTYPE_UINT32,  ctx->id),
+            DB_BIND_VAR(T_N,  DB_VARTYPE_SINT32,  ctx->n),
+            DB_BIND_STR(T_S,  DB_VARTYPE_UTF8STR, ctx->s)
+        };
 
-#if defined(_WIN32)
-#include <windows.h>
+        ctx->t_row = db_alloc_row(t_binds, DB_ARRAY_DIM(t_binds));
+    }
+
+    /* Open unordered table cursor. */
+    ctx->t_cursor = db_open_table_cursor(database, table_t.table_name, NULL);
 
-time_t milliseconds()
+    /* Open table cursor ordered by the fields in the ID index. */
+    db_table_cursor_init(&ordered_cursor_def);
+    ordered_cursor_def.index = index_t_id.index_name;
+    ordered_cursor_def.flags = DB_CAN_MODIFY;
+    ctx->t_ordered_cursor = db_open_table_cursor(database, table_t.table_name, &ordered_cursor_def);
+    db_table_cursor_destroy(&ordered_cursor_def);
+
+    if (ctx->t_row == NULL || ctx->t_cursor == NULL || ctx->t_ordered_cursor == NULL) {
+        printf("Error opening table cursors: %d\n", (int)get_db_error());
+        perf_close_context(ctx);
+        return -1;
+    }
+
+    return 0;
+}
+
+/// Close cursors and free the row opened by perf_open_context().
+/** The database connection itself is left open. */
+void
+perf_close_context(perf_context_t * ctx)
 {
-    return GetTickCount();
+    if (ctx->t_cursor != NULL) {
+        db_close_cursor(ctx->t_cursor);
+        ctx->t_cursor = NULL;
+    }
+    if (ctx->t_ordered_cursor != NULL) {
+        db_close_cursor(ctx->t_ordered_cursor);
+        ctx->t_ordered_cursor = NULL;
+    }
+    if (ctx->t_row != NULL) {
+        db_free_row(ctx->t_row);
+        ctx->t_row = NULL;
+    }
 }
-#elif defined(OS_UCOS_III)
-#include <os.h>
 
-time_t milliseconds()
+/* Benchmark modes. */
+
+/* Save or compare the per-iteration results of phases mode. */
+static int
+check_baseline(const perf_options_t * options, const perf_baseline_t * current)
 {
-    OS_ERR err;
-    /* Tick rate should fall in the range 10 to 1000 Hz. */
-    return OSTimeGet(&err) * (1000 / OS_CFG_TICK_RATE_HZ);
+    perf_baseline_t * baseline;
+    int rc = 0;
+
+    if (options->baseline_file != NULL) {
+        rc = perf_baseline_save(current, options->baseline_file);
+        if (rc == 0) {
+            printf("\nSaved %d runs to baseline %s\n", current->run_count, options->baseline_file);
+        }
+    }
+
+    if (rc == 0 && options->compare_file != NULL) {
+        baseline = (perf_baseline_t *)malloc(sizeof(perf_baseline_t));
+        if (baseline == NULL) {
+            printf("Out of memory for baseline\n");
+            return -1;
+        }
+
+        rc = perf_baseline_load(baseline, options->compare_file);
+        if (rc == 0) {
+            int regressions;
+
+            printf("\n");
+            regressions = perf_baseline_compare(stdout, baseline, current, options->threshold);
+            if (regressions < 0) {
+                rc = -1;
+            }
+            else if (regressions > 0) {
+                rc = PERF_EXIT_REGRESSION;
+            }
+        }
+        free(baseline);
+    }
+
+    return rc;
 }
 
-#else
-#include <sys/time.h>
+static int
+run_phases(const perf_options_t * options)
+{
+    perf_context_t ctx;
+    perf_stats_t * stats;
+    perf_stats_t * run = NULL;
+    perf_baseline_t * current = NULL;
+    db_t database;
+    int rc = 0;
+    int i;
+
+    stats = (perf_stats_t *)malloc(PHASE_COUNT * sizeof(perf_stats_t));
+    if (stats == NULL) {
+        printf("Out of memory for statistics\n");
+        return -1;
+    }
+    for (i = 0; i < PHASE_COUNT; i++) {
+        perf_stats_init(&stats[i], perf_phase_names[i]);
+    }
+
+    /* Baselines need the results of each iteration on their own. */
+    if (options->baseline_file != NULL || options->compare_file != NULL) {
+        run = (perf_stats_t *)malloc(PHASE_COUNT * sizeof(perf_stats_t));
+        current = (perf_baseline_t *)malloc(sizeof(perf_baseline_t));
+        if (run == NULL || current == NULL) {
+            printf("Out of memory for baseline\n");
+            free(current);
+            free(run);
+            free(stats);
+            return -1;
+        }
+        perf_baseline_init(current, options);
+    }
+
+    database = perf_create_database(options);
+    if (database == NULL || perf_open_context(&ctx, database) != 0) {
+        if (database != NULL) {
+            db_shutdown(database, 0, NULL);
+        }
+        free(current);
+        free(run);
+        free(stats);
+        return -1;
+    }
 
-time_t milliseconds()
+    printf("Benchmark %d rows, %d iterations, %d warmup\n",
+           options->row_count, options->iterations, options->warmup);
+    fflush(stdout);
+
+    for (i = 0; i < options->warmup && rc == 0; i++) {
+        rc = perf_run_phase_set(&ctx, options, NULL);
+    }
+    for (i = 0; i < options->iterations && rc == 0; i++) {
+        if (run != NULL) {
+            int phase;
+
+            for (phase = 0; phase < PHASE_COUNT; phase++) {
+                perf_stats_init(&run[phase], perf_phase_names[phase]);
+            }
+            rc = perf_run_phase_set(&ctx, options, run);
+            for (phase = 0; phase < PHASE_COUNT; phase++) {
+                perf_stats_merge(&stats[phase], &run[phase]);
+            }
+            perf_baseline_add_run(current, run);
+        }
+        else {
+            rc = perf_run_phase_set(&ctx, options, stats);
+        }
+    }
+
+    if (rc == 0) {
+        print_report(stdout, options, stats);
+        if (options->json_file != NULL) {
+            rc = write_json_report(options, stats);
+        }
+    }
+
+    perf_close_context(&ctx);
+    db_shutdown(database, 0, NULL);
+
+    if (rc == 0 && current != NULL) {
+        rc = check_baseline(options, current);
+    }
+
+    free(current);
+    free(run);
+    free(stats);
+
+    return rc;
+}
+
+/* Main program. */
+
+int example_main(int argc, char* argv[])
 {
-    struct timeval tm;
-    gettimeofday(&tm, NULL);
-    return (time_t)(tm.tv_sec * 1000 + tm.tv_usec / 1000);
+    perf_options_t options;
+    int rc;
+
+    if (parse_options(argc, argv, &options) != 0) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if ((options.baseline_file != NULL || options.compare_file != NULL)
+        && (options.mode != MODE_PHASES || options.iterations < 2 || options.iterations > PERF_MAX_RUNS))
+    {
+        printf("Baselines need phases mode and 2 to %d iterations\n", PERF_MAX_RUNS);
+        return EXIT_FAILURE;
+    }
+
+    if (options.counters) {
+        if (options.mode == MODE_THREADS || options.mode == MODE_BATCH
+            || options.mode == MODE_YCSB || options.mode == MODE_SCALE
+            || options.mode == MODE_RECOVERY || options.mode == MODE_BLOB
+            || options.mode == MODE_REPLAY)
+        {
+            printf("Event counters are only collected in phases, sweep, and keys modes\n");
+        }
+        else if (perf_counters_open() == 0) {
+            printf("Event counters are not available on this system\n");
+        }
+    }
+
+    switch (options.mode) {
+    case MODE_THREADS:
+        rc = perf_run_threads(&options);
+        break;
+    case MODE_BATCH:
+        rc = perf_run_batch(&options);
+        break;
+    case MODE_SWEEP:
+        rc = perf_run_sweep(&options);
+        break;
+    case MODE_KEYS:
+        rc = perf_run_keys(&options);
+        break;
+    case MODE_YCSB:
+        rc = perf_run_ycsb(&options);
+        break;
+    case MODE_SCALE:
+        rc = perf_run_scale(&options);
+        break;
+    case MODE_RECOVERY:
+        rc = perf_run_recovery(&options);
+        break;
+    case MODE_BLOB:
+        rc = perf_run_blob(&options);
+        break;
+    case MODE_REPLAY:
+        rc = perf_run_replay(&options);
+        break;
+    default:
+        rc = run_phases(&options);
+        break;
+    }
+
+    perf_counters_close();
+
+    if (rc == PERF_EXIT_REGRESSION) {
+        return PERF_EXIT_REGRESSION;
+    }
+    return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
-#endif
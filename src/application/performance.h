@@ -0,0 +1,387 @@
+/**************************************************************************/
+/*                                                                        */
+/*      Copyright (c) 2005-2019 by ITTIA L.L.C. All rights reserved.      */
+/*                                                                        */
+/*  This software is copyrighted by and is the sole property of ITTIA     */
+/*  L.L.C.  All rights, title, ownership, or other interests in the       */
+/*  software remain the property of ITTIA L.L.C.  This software may only  */
+/*  be used in accordance with the corresponding license agreement.  Any  */
+/*  unauthorized use, duplication, transmission, distribution, or         */
+/*  disclosure of this software is expressly forbidden.                   */
+/*                                                                        */
+/*  This Copyright notice may not be removed or modified without prior    */
+/*  written consent of ITTIA L.L.C.                                       */
+/*                                                                        */
+/*  ITTIA L.L.C. reserves the right to modify this software without       */
+/*  notice.                                                               */
+/*                                                                        */
+/*  info@ittia.com                                                        */
+/*  http://www.ittia.com                                                  */
+/*                                                                        */
+/*                                                                        */
+/**************************************************************************/
+
+/** @file performance.h
+ *
+ * Shared declarations for the performance benchmark example.
+ */
+
+#ifndef PERFORMANCE_H_INCLUDED
+#define PERFORMANCE_H_INCLUDED
+
+#include <ittia/db.h>
+
+#include <stdio.h>
+
+#define EXAMPLE_DATABASE "performance.ittiadb"
+
+#define GENERATE_ID(i) ((i) * 1103515245 + 12345)
+
+/* Database schema: table, field, and index definitions. */
+
+#define T_ID 0
+#define T_N 1
+#define T_S 2
+
+#define T_S_SIZE 100
+
+extern db_tabledef_t table_t;
+extern db_indexdef_t index_t_id;
+
+/* Benchmark phases, in the order they are run. */
+
+typedef enum {
+    PHASE_INSERT,
+    PHASE_TABLE_SCAN,
+    PHASE_INDEX_SCAN,
+    PHASE_SEEK,
+    PHASE_UPDATE,
+    PHASE_DELETE,
+    PHASE_COUNT
+} perf_phase_t;
+
+#define PHASE_BIT(phase) (1u << (phase))
+#define PHASE_ALL ((1u << PHASE_COUNT) - 1)
+
+extern const char * const perf_phase_names[PHASE_COUNT];
+
+/* Benchmark modes. */
+
+typedef enum {
+    MODE_PHASES,                ///< Run the phase set on one connection
+    MODE_THREADS,               ///< Scale the phase set over 1..N threads
+    MODE_BATCH,                 ///< Rows per transaction by completion mode
+    MODE_SWEEP,                 ///< Phase set by page size and cache size
+    MODE_KEYS,                  ///< Seek and update by key distribution
+    MODE_YCSB,                  ///< Mixed YCSB-style workload
+    MODE_SCALE,                 ///< Stream rows into a large table with checkpoints
+    MODE_RECOVERY,              ///< Time to reopen after clean and unclean shutdowns
+    MODE_BLOB,                  ///< Write and read BLOBs in chunks
+    MODE_REPLAY,                ///< Replay a SQL script from concurrent clients
+    MODE_COUNT
+} perf_mode_t;
+
+extern const char * const perf_mode_names[MODE_COUNT];
+
+/* Transaction completion modes compared by batch mode. */
+
+typedef enum {
+    COMPLETION_DEFAULT,         ///< Library default completion
+    COMPLETION_LAZY,            ///< DB_LAZY_COMPLETION
+    COMPLETION_GROUP,           ///< DB_GROUP_COMPLETION
+    COMPLETION_FLUSH,           ///< DB_LAZY_COMPLETION with periodic db_flush_tx()
+    COMPLETION_COUNT
+} perf_completion_t;
+
+#define COMPLETION_ALL ((1u << COMPLETION_COUNT) - 1)
+
+extern const char * const perf_completion_names[COMPLETION_COUNT];
+
+/* Key distributions used to choose rows for seek and update. */
+
+typedef enum {
+    KEYS_UNIFORM,               ///< Every row equally likely
+    KEYS_ZIPFIAN,               ///< Zipfian by row number, row 1 is hottest
+    KEYS_LATEST,                ///< Zipfian by age, the last inserted row is hottest
+    KEYS_HOTSPOT,               ///< A fixed fraction of operations on a hot set of rows
+    KEYS_COUNT
+} perf_keys_t;
+
+#define KEYS_ALL ((1u << KEYS_COUNT) - 1)
+
+extern const char * const perf_keys_names[KEYS_COUNT];
+
+/* Operations of the mixed workload. */
+
+typedef enum {
+    OP_READ,                    ///< Read one row by key
+    OP_UPDATE,                  ///< Overwrite one row by key
+    OP_INSERT,                  ///< Insert a new row
+    OP_SCAN,                    ///< Read a run of rows in key order
+    OP_READ_MODIFY_WRITE,       ///< Read and update one row in one transaction
+    OP_COUNT
+} perf_op_t;
+
+extern const char * const perf_op_names[OP_COUNT];
+
+/* How the last writer stopped before recovery mode reopens the database. */
+
+typedef enum {
+    RECOVERY_CLEAN,             ///< Normal shutdown
+    RECOVERY_UNCOMMITTED,       ///< Shutdown with a transaction open
+    RECOVERY_KILLED,            ///< Writer process killed with a transaction open
+    RECOVERY_COUNT
+} perf_recovery_t;
+
+#define RECOVERY_ALL ((1u << RECOVERY_COUNT) - 1)
+
+extern const char * const perf_recovery_names[RECOVERY_COUNT];
+
+/* Storage types. */
+
+#define PERF_STORAGE_FILE   0
+#define PERF_STORAGE_MEMORY 1
+#define PERF_STORAGE_COUNT  2
+
+extern const char * const perf_storage_names[PERF_STORAGE_COUNT];
+
+/* Tables filled by scale mode. */
+
+#define PERF_SCHEMA_T       0   ///< Table T of this benchmark
+#define PERF_SCHEMA_STORAGE 1   ///< Table "storage" of file_storage/db_schema.h
+
+#define PERF_MAX_BATCH_SIZES 16
+#define PERF_MAX_SWEEP_VALUES 16
+
+/* Command-line settings shared by all benchmark modes. */
+
+typedef struct {
+    perf_mode_t mode;           ///< Benchmark to run
+    const char * database;      ///< Database file name
+    int row_count;              ///< Rows inserted by each iteration (per thread in threads mode)
+    int iterations;             ///< Measured iterations of the phase set
+    int warmup;                 ///< Unmeasured iterations run first
+    unsigned int phases;        ///< Bit mask of PHASE_BIT() values
+    const char * json_file;     ///< JSON report file name, "-" for stdout
+    int threads;                ///< Maximum worker thread count
+    int overlap;                ///< Threads share key ranges instead of disjoint ones
+    int batch_sizes[PERF_MAX_BATCH_SIZES];  ///< Rows per transaction in batch mode
+    int batch_size_count;
+    unsigned int completions;   ///< Bit mask of perf_completion_t values
+    int flush_interval;         ///< Commits between flushes in COMPLETION_FLUSH mode
+    int page_size;              ///< Database page size, 0 for the library default
+    int cache_size;             ///< Page cache size in bytes, 0 for the library default
+    int sweep_page_sizes[PERF_MAX_SWEEP_VALUES];    ///< Page sizes in sweep mode
+    int sweep_page_size_count;
+    int sweep_cache_sizes[PERF_MAX_SWEEP_VALUES];   ///< Cache sizes in sweep mode
+    int sweep_cache_size_count;
+    int sweep_ratios[PERF_MAX_SWEEP_VALUES];        ///< Dataset sizes in percent of the cache
+    int sweep_ratio_count;
+    unsigned int distributions; ///< Bit mask of perf_keys_t values in keys mode
+    int operations;             ///< Operations per phase in keys mode, 0 for one per row
+    double theta;               ///< Zipfian skew, between 0 and 1
+    int hot_rows;               ///< Percent of rows in the hot set
+    int hot_operations;         ///< Percent of operations on the hot set
+    unsigned int seed;          ///< Random number generator seed
+    int storage;                ///< PERF_STORAGE_FILE or PERF_STORAGE_MEMORY
+    int memory_size;            ///< Memory storage size in bytes
+    int op_mix[OP_COUNT];       ///< Relative weight of each operation in ycsb mode
+    perf_keys_t request_keys;   ///< Key distribution of ycsb mode requests
+    int scan_length;            ///< Maximum rows read by one scan
+    int duration;               ///< Seconds to run ycsb mode, 0 to run --operations
+    int schema;                 ///< PERF_SCHEMA_T or PERF_SCHEMA_STORAGE in scale mode
+    int max_rows;               ///< Rows inserted by scale mode
+    int tx_rows;                ///< Rows per transaction in scale and recovery modes
+    int seek_samples;           ///< Seeks timed at each scale mode checkpoint
+    int recovery_db_rows[PERF_MAX_SWEEP_VALUES];        ///< Database sizes in recovery mode
+    int recovery_db_rows_count;
+    int recovery_pending_rows[PERF_MAX_SWEEP_VALUES];   ///< Rows written before each recovery
+    int recovery_pending_count;
+    unsigned int recovery_cases;    ///< Bit mask of perf_recovery_t values
+    int blob_sizes[PERF_MAX_SWEEP_VALUES];      ///< BLOB sizes in blob mode
+    int blob_size_count;
+    int chunk_sizes[PERF_MAX_SWEEP_VALUES];     ///< Bytes per db_update() or db_fetch() in blob mode
+    int chunk_size_count;
+    unsigned int storages;      ///< Bit mask of PERF_STORAGE_ values in blob mode
+    int counters;               ///< Collect hardware and software event counters
+    const char * baseline_file; ///< Save phases mode results as a baseline to this file
+    const char * compare_file;  ///< Compare phases mode results with this baseline file
+    double threshold;           ///< Smallest change in percent reported as a regression
+    const char * sdk_version;   ///< SDK version recorded in baselines
+    const char * script_file;   ///< SQL script run by replay mode
+    int script_lines;           ///< One statement per line instead of separated by semicolons
+    int think_time;             ///< Mean pause after each replayed statement, in milliseconds
+    int rate;                   ///< Replayed statements per second of all clients, 0 for no limit
+} perf_options_t;
+
+/* Monotonic clock. */
+
+/// Current time offset in nanoseconds from an arbitrary fixed point.
+uint64_t perf_clock_ns(void);
+
+/// Size of a file in bytes, or 0 if it is not available.
+uint64_t perf_file_size(const char * path);
+
+/* Hardware and software event counters. */
+
+typedef enum {
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_CACHE_MISSES,
+    COUNTER_BRANCH_MISSES,
+    COUNTER_PAGE_FAULTS,
+    COUNTER_CONTEXT_SWITCHES,
+    COUNTER_COUNT
+} perf_counter_t;
+
+extern const char * const perf_counter_names[COUNTER_COUNT];
+
+int perf_counters_open(void);
+void perf_counters_close(void);
+int perf_counters_available(perf_counter_t counter);
+int perf_counters_enabled(void);
+void perf_counters_start(void);
+void perf_counters_stop(uint64_t * values);
+
+/* Latency statistics.
+ *
+ * Operation latencies are accumulated in a log-linear histogram, so memory
+ * use is constant no matter how many operations are measured. Each bucket
+ * spans at most 1/32 of its value, which bounds the percentile error.
+ */
+
+#define PERF_HIST_SUB_BITS 5
+#define PERF_HIST_SUB (1 << PERF_HIST_SUB_BITS)
+#define PERF_HIST_BUCKETS ((64 - PERF_HIST_SUB_BITS + 1) * PERF_HIST_SUB)
+
+typedef struct {
+    const char * name;          ///< Phase or operation name
+    uint64_t count;             ///< Operations recorded
+    uint64_t sum_ns;            ///< Sum of recorded latencies
+    uint64_t min_ns;            ///< Fastest operation
+    uint64_t max_ns;            ///< Slowest operation
+    uint64_t elapsed_ns;        ///< Wall-clock time spent in the phase
+    uint64_t conflicts;         ///< Operations rolled back due to lock conflicts
+    uint64_t counters[COUNTER_COUNT];   ///< Event counts while the phase ran
+    uint64_t buckets[PERF_HIST_BUCKETS];
+} perf_stats_t;
+
+void perf_stats_init(perf_stats_t * stats, const char * name);
+void perf_stats_record(perf_stats_t * stats, uint64_t latency_ns);
+void perf_stats_merge(perf_stats_t * into, const perf_stats_t * from);
+uint64_t perf_stats_percentile(const perf_stats_t * stats, double percentile);
+double perf_stats_throughput(const perf_stats_t * stats);
+
+/* Baselines. */
+
+#define PERF_MAX_RUNS 100
+
+/// Exit code of a comparison that found a regression.
+#define PERF_EXIT_REGRESSION 2
+
+/// Per-iteration results of the phase set, with where they were measured.
+typedef struct {
+    char sdk[64];
+    char host[160];
+    char config[160];
+    unsigned int phases;        ///< Bit mask of PHASE_BIT() values
+    int run_count;
+    double ops_per_sec[PHASE_COUNT][PERF_MAX_RUNS];
+    double p99_us[PHASE_COUNT][PERF_MAX_RUNS];
+} perf_baseline_t;
+
+void perf_baseline_init(perf_baseline_t * baseline, const perf_options_t * options);
+void perf_baseline_add_run(perf_baseline_t * baseline, const perf_stats_t * stats);
+int perf_baseline_save(const perf_baseline_t * baseline, const char * path);
+int perf_baseline_load(perf_baseline_t * baseline, const char * path);
+int perf_baseline_compare(FILE * out, const perf_baseline_t * baseline,
+                          const perf_baseline_t * current, double threshold);
+
+/* Key generators. */
+
+typedef struct {
+    perf_keys_t distribution;
+    int row_count;
+    uint64_t state;             ///< Random number generator state
+
+    /* Zipfian constants, see Gray et al., "Quickly Generating
+     * Billion-Record Synthetic Databases", SIGMOD 1994. */
+    double theta;
+    double zeta_n;
+    double alpha;
+    double eta;
+
+    int hot_rows;               ///< Rows in the hot set
+    double hot_probability;     ///< Probability of an operation on the hot set
+} perf_keygen_t;
+
+void perf_keygen_init(perf_keygen_t * gen, perf_keys_t distribution,
+                      int row_count, const perf_options_t * options);
+int perf_keygen_next(perf_keygen_t * gen);
+void perf_keygen_grow(perf_keygen_t * gen, int row_count);
+double perf_keygen_uniform(perf_keygen_t * gen);
+
+/* Connection, cursors, and bound row variables used by every phase. */
+
+typedef struct {
+    db_t database;
+    db_cursor_t t_cursor;
+    db_cursor_t t_ordered_cursor;
+    db_row_t t_row;
+    int tolerate_conflicts;     ///< Count lock conflicts instead of failing
+
+    uint32_t id;
+    int32_t n;
+    char s[T_S_SIZE];
+} perf_context_t;
+
+/// Row numbers visited by a phase.
+/** Visits count row numbers, starting at first and advancing by stride,
+ *  wrapped into the range 1..row_count. When keys is not NULL, the count
+ *  row numbers are drawn from the key generator instead. */
+typedef struct {
+    int first;
+    int count;
+    int stride;
+    int row_count;
+    perf_keygen_t * keys;
+} perf_range_t;
+
+db_t perf_create_database(const perf_options_t * options);
+db_t perf_open_database(const perf_options_t * options);
+int perf_open_context(perf_context_t * ctx, db_t database);
+void perf_close_context(perf_context_t * ctx);
+void perf_fill_row(perf_context_t * ctx, int row_count, int i);
+void perf_modify_row(perf_context_t * ctx);
+
+int perf_run_insert(perf_context_t * ctx, const perf_range_t * range, perf_stats_t * stats);
+int perf_run_scan(perf_context_t * ctx, db_cursor_t cursor, perf_stats_t * stats);
+int perf_run_seek(perf_context_t * ctx, const perf_range_t * range, perf_stats_t * stats);
+int perf_run_update(perf_context_t * ctx, const perf_range_t * range, perf_stats_t * stats);
+int perf_run_delete(perf_context_t * ctx, perf_stats_t * stats);
+int perf_run_phase_set(perf_context_t * ctx, const perf_options_t * options, perf_stats_t * stats);
+
+/* Benchmark modes, each implemented in its own file. */
+
+int perf_run_threads(const perf_options_t * options);
+int perf_run_batch(const perf_options_t * options);
+int perf_run_sweep(const perf_options_t * options);
+int perf_run_keys(const perf_options_t * options);
+int perf_run_ycsb(const perf_options_t * options);
+int perf_ycsb_preset(const char * name, perf_options_t * options);
+int perf_run_scale(const perf_options_t * options);
+int perf_run_recovery(const perf_options_t * options);
+int perf_run_blob(const perf_options_t * options);
+int perf_run_replay(const perf_options_t * options);
+
+/* Reports. */
+
+void perf_report_table_header(FILE * out);
+void perf_report_table_row(FILE * out, const perf_stats_t * stats);
+void perf_report_json_stats(FILE * out, const perf_stats_t * stats);
+void perf_report_json_string(FILE * out, const char * value);
+void perf_report_counters_header(FILE * out);
+void perf_report_counters_row(FILE * out, const perf_stats_t * stats);
+void perf_report_json_counters(FILE * out, const perf_stats_t * stats);
+
+#endif
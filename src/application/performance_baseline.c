@@ -0,0 +1,506 @@
+/**************************************************************************/
+/*                                                                        */
+/*      Copyright (c) 2005-2019 by ITTIA L.L.C. All rights reserved.      */
+/*                                                                        */
+/*  This software is copyrighted by and is the sole property of ITTIA     */
+/*  L.L.C.  All rights, title, ownership, or other interests in the       */
+/*  software remain the property of ITTIA L.L.C.  This software may only  */
+/*  be used in accordance with the corresponding license agreement.  Any  */
+/*  unauthorized use, duplication, transmission, distribution, or         */
+/*  disclosure of this software is expressly forbidden.                   */
+/*                                                                        */
+/*  This Copyright notice may not be removed or modified without prior    */
+/*  written consent of ITTIA L.L.C.                                       */
+/*                                                                        */
+/*  ITTIA L.L.C. reserves the right to modify this software without       */
+/*  notice.                                                               */
+/*                                                                        */
+/*  info@ittia.com                                                        */
+/*  http://www.ittia.com                                                  */
+/*                                                                        */
+/*                                                                        */
+/**************************************************************************/
+
+
+/** @file performance_baseline.c
+ *
+ * Baseline files and regression comparison for the performance benchmark.
+ *
+ * A baseline keeps the throughput and p99 latency of every measured
+ * iteration of the phase set, together with the SDK version, benchmark
+ * configuration, and host it was measured on. Comparing a new run with a
+ * baseline uses the spread of the repeated iterations: the mean of each
+ * metric is reported with a 95% confidence interval, and a change is a
+ * regression only if it exceeds the threshold and Welch's t-test finds it
+ * significant at the 95% level. Changes inside the run-to-run noise are
+ * not reported, however large the threshold.
+ *
+ * The baseline file is plain text, one record per line:
+ *
+ *   format 1
+ *   sdk 7.2.1
+ *   host Linux 5.4.0 x86_64 buildhost cpus=8
+ *   config rows=100 storage=file page_size=0 cache_size=0
+ *   phases insert,seek
+ *   run insert 48211.5 41.200
+ *   run seek 250112.0 5.100
+ *   ...
+ *
+ * Each "run" line holds the throughput in operations per second and the
+ * p99 latency in microseconds of one phase in one iteration.
+ */
+
+#include "performance.h"
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_MSC_VER) && _MSC_VER < 1900
+static int snprintf( char *outBuf, size_t size, const char *format, ... )
+{
+    int count = -1;
+    va_list ap;
+
+    va_start( ap, format );
+    if (size != 0) {
+        count = _vsnprintf_s( outBuf, size, _TRUNCATE, format, ap );
+    }
+    if (count == -1) {
+        count = _vscprintf( format, ap );
+    }
+    va_end( ap );
+
+    return count;
+}
+#endif
+
+#define BASELINE_FORMAT 1
+
+/* Host fingerprint. */
+
+#if defined(_WIN32)
+#include <windows.h>
+
+static void
+host_fingerprint(char * host, size_t size)
+{
+    char name[MAX_COMPUTERNAME_LENGTH + 1];
+    DWORD name_size = sizeof(name);
+    SYSTEM_INFO info;
+
+    if (!GetComputerNameA(name, &name_size)) {
+        strcpy(name, "unknown");
+    }
+    GetSystemInfo(&info);
+    snprintf(host, size, "Windows %s cpus=%lu", name, (unsigned long)info.dwNumberOfProcessors);
+}
+#elif defined(OS_UCOS_III)
+
+static void
+host_fingerprint(char * host, size_t size)
+{
+    snprintf(host, size, "uC/OS-III");
+}
+#else
+#include <sys/utsname.h>
+#include <unistd.h>
+
+static void
+host_fingerprint(char * host, size_t size)
+{
+    struct utsname name;
+
+    if (uname(&name) != 0) {
+        snprintf(host, size, "unknown");
+        return;
+    }
+    snprintf(host, size, "%s %s %s %s cpus=%ld",
+             name.sysname, name.release, name.machine, name.nodename,
+             (long)sysconf(_SC_NPROCESSORS_ONLN));
+}
+#endif
+
+/// Start an empty baseline for the current SDK, configuration, and host.
+void
+perf_baseline_init(perf_baseline_t * baseline, const perf_options_t * options)
+{
+    memset(baseline, 0, sizeof(*baseline));
+    snprintf(baseline->sdk, sizeof(baseline->sdk), "%s", options->sdk_version);
+    host_fingerprint(baseline->host, sizeof(baseline->host));
+    snprintf(baseline->config, sizeof(baseline->config),
+             "rows=%d storage=%s page_size=%d cache_size=%d",
+             options->row_count,
+             options->storage == PERF_STORAGE_MEMORY ? "memory" : "file",
+             options->page_size, options->cache_size);
+    baseline->phases = options->phases;
+}
+
+/// Add the statistics of one iteration of the phase set.
+/** stats holds PHASE_COUNT entries, as passed to perf_run_phase_set(). */
+void
+perf_baseline_add_run(perf_baseline_t * baseline, const perf_stats_t * stats)
+{
+    int phase;
+
+    if (baseline->run_count >= PERF_MAX_RUNS) {
+        return;
+    }
+    for (phase = 0; phase < PHASE_COUNT; phase++) {
+        baseline->ops_per_sec[phase][baseline->run_count] = perf_stats_throughput(&stats[phase]);
+        baseline->p99_us[phase][baseline->run_count] = (double)perf_stats_percentile(&stats[phase], 99.0) / 1000.0;
+    }
+    baseline->run_count++;
+}
+
+int
+perf_baseline_save(const perf_baseline_t * baseline, const char * path)
+{
+    FILE * out = fopen(path, "w");
+    int phase;
+    int run;
+    int first = 1;
+
+    if (out == NULL) {
+        printf("Unable to open baseline file: %s\n", path);
+        return -1;
+    }
+
+    fprintf(out, "format %d\n", BASELINE_FORMAT);
+    fprintf(out, "sdk %s\n", baseline->sdk);
+    fprintf(out, "host %s\n", baseline->host);
+    fprintf(out, "config %s\n", baseline->config);
+    fprintf(out, "phases ");
+    for (phase = 0; phase < PHASE_COUNT; phase++) {
+        if (baseline->phases & PHASE_BIT(phase)) {
+            fprintf(out, first ? "%s" : ",%s", perf_phase_names[phase]);
+            first = 0;
+        }
+    }
+    fprintf(out, "\n");
+
+    for (run = 0; run < baseline->run_count; run++) {
+        for (phase = 0; phase < PHASE_COUNT; phase++) {
+            if (baseline->phases & PHASE_BIT(phase)) {
+                fprintf(out, "run %s %.1f %.3f\n", perf_phase_names[phase],
+                        baseline->ops_per_sec[phase][run], baseline->p99_us[phase][run]);
+            }
+        }
+    }
+
+    if (fclose(out) != 0) {
+        printf("Error writing baseline file: %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/* Copy the rest of a line, without the line break, into a string field. */
+static void
+copy_value(char * field, size_t size, const char * value)
+{
+    size_t len = strcspn(value, "\r\n");
+
+    if (len >= size) {
+        len = size - 1;
+    }
+    memcpy(field, value, len);
+    field[len] = '\0';
+}
+
+static int
+find_phase(const char * name, size_t len)
+{
+    int phase;
+
+    for (phase = 0; phase < PHASE_COUNT; phase++) {
+        if (strlen(perf_phase_names[phase]) == len && 0 == strncmp(perf_phase_names[phase], name, len)) {
+            return phase;
+        }
+    }
+    return -1;
+}
+
+int
+perf_baseline_load(perf_baseline_t * baseline, const char * path)
+{
+    FILE * in = fopen(path, "r");
+    char line[512];
+    int runs[PHASE_COUNT];
+    int line_number = 0;
+    int phase;
+    int rc = 0;
+
+    if (in == NULL) {
+        printf("Unable to open baseline file: %s\n", path);
+        return -1;
+    }
+
+    memset(baseline, 0, sizeof(*baseline));
+    memset(runs, 0, sizeof(runs));
+
+    while (rc == 0 && fgets(line, sizeof(line), in) != NULL) {
+        const char * value = strchr(line, ' ');
+
+        line_number++;
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r') {
+            continue;
+        }
+        if (value == NULL) {
+            rc = -1;
+            break;
+        }
+        value++;
+
+        if (0 == strncmp(line, "format ", 7)) {
+            if (atoi(value) != BASELINE_FORMAT) {
+                printf("Unsupported baseline format in %s: %d\n", path, atoi(value));
+                rc = -1;
+            }
+        }
+        else if (0 == strncmp(line, "sdk ", 4)) {
+            copy_value(baseline->sdk, sizeof(baseline->sdk), value);
+        }
+        else if (0 == strncmp(line, "host ", 5)) {
+            copy_value(baseline->host, sizeof(baseline->host), value);
+        }
+        else if (0 == strncmp(line, "config ", 7)) {
+            copy_value(baseline->config, sizeof(baseline->config), value);
+        }
+        else if (0 == strncmp(line, "phases ", 7)) {
+            while (*value != '\0' && *value != '\r' && *value != '\n') {
+                size_t len = strcspn(value, ",\r\n");
+
+                phase = find_phase(value, len);
+                if (phase < 0) {
+                    rc = -1;
+                    break;
+                }
+                baseline->phases |= PHASE_BIT(phase);
+                value += len;
+                if (*value == ',') {
+                    value++;
+                }
+            }
+        }
+        else if (0 == strncmp(line, "run ", 4)) {
+            double ops_per_sec;
+            double p99_us;
+
+            phase = find_phase(value, strcspn(value, " "));
+            value += strcspn(value, " ");
+            if (phase < 0 || runs[phase] >= PERF_MAX_RUNS
+                || sscanf(value, "%lf %lf", &ops_per_sec, &p99_us) != 2)
+            {
+                rc = -1;
+                break;
+            }
+            baseline->ops_per_sec[phase][runs[phase]] = ops_per_sec;
+            baseline->p99_us[phase][runs[phase]] = p99_us;
+            runs[phase]++;
+        }
+        else {
+            rc = -1;
+        }
+    }
+
+    fclose(in);
+
+    if (rc != 0) {
+        printf("Invalid baseline file %s at line %d\n", path, line_number);
+        return -1;
+    }
+
+    /* Every phase in the baseline must have the same number of runs. */
+    baseline->run_count = -1;
+    for (phase = 0; phase < PHASE_COUNT; phase++) {
+        if (baseline->phases & PHASE_BIT(phase)) {
+            if (baseline->run_count >= 0 && runs[phase] != baseline->run_count) {
+                printf("Invalid baseline file %s: phases have different run counts\n", path);
+                return -1;
+            }
+            baseline->run_count = runs[phase];
+        }
+    }
+    if (baseline->run_count < 0) {
+        baseline->run_count = 0;
+    }
+
+    return 0;
+}
+
+/* Statistics of repeated runs. */
+
+typedef struct {
+    int n;
+    double mean;
+    double variance;            ///< Sample variance
+} sample_t;
+
+static sample_t
+summarize(const double * values, int n)
+{
+    sample_t sample;
+    int i;
+
+    sample.n = n;
+    sample.mean = 0.0;
+    sample.variance = 0.0;
+    for (i = 0; i < n; i++) {
+        sample.mean += values[i];
+    }
+    if (n > 0) {
+        sample.mean /= n;
+    }
+    for (i = 0; i < n; i++) {
+        sample.variance += (values[i] - sample.mean) * (values[i] - sample.mean);
+    }
+    if (n > 1) {
+        sample.variance /= n - 1;
+    }
+    return sample;
+}
+
+/* Two-sided 97.5% quantile of Student's t distribution. */
+static double
+t_critical(double df)
+{
+    static const double table[30] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+    };
+
+    if (df < 1.0) {
+        return table[0];
+    }
+    if (df <= 30.0) {
+        /* Rounding the degrees of freedom down is conservative. */
+        return table[(int)df - 1];
+    }
+    if (df < 40.0) {
+        return 2.021;
+    }
+    if (df < 60.0) {
+        return 2.000;
+    }
+    if (df < 120.0) {
+        return 1.980;
+    }
+    return 1.960;
+}
+
+/* Half-width of the 95% confidence interval of the mean. */
+static double
+confidence_interval(const sample_t * sample)
+{
+    if (sample->n < 2) {
+        return 0.0;
+    }
+    return t_critical(sample->n - 1) * sqrt(sample->variance / sample->n);
+}
+
+/* Welch's t-test for a difference between the means of two samples. */
+static int
+is_significant(const sample_t * a, const sample_t * b)
+{
+    double va;
+    double vb;
+    double se2;
+    double df;
+
+    if (a->n < 2 || b->n < 2) {
+        return 0;
+    }
+
+    va = a->variance / a->n;
+    vb = b->variance / b->n;
+    se2 = va + vb;
+    if (se2 == 0.0) {
+        /* No noise at all, so any difference is real. */
+        return a->mean != b->mean;
+    }
+
+    /* Welch-Satterthwaite degrees of freedom. */
+    df = se2 * se2 / (va * va / (a->n - 1) + vb * vb / (b->n - 1));
+    return fabs(a->mean - b->mean) / sqrt(se2) > t_critical(df);
+}
+
+/* Compare one metric and print a row. Returns 1 for a regression. */
+static int
+compare_metric(FILE * out, const char * phase, const char * metric,
+               const double * base_values, int base_n,
+               const double * values, int n,
+               int higher_is_better, double threshold)
+{
+    sample_t base = summarize(base_values, base_n);
+    sample_t current = summarize(values, n);
+    double change = base.mean != 0.0 ? (current.mean - base.mean) * 100.0 / base.mean : 0.0;
+    double worse = higher_is_better ? -change : change;
+    const char * result = "-";
+    int regression = 0;
+
+    if (is_significant(&base, &current)) {
+        if (worse > threshold) {
+            result = "REGRESSION";
+            regression = 1;
+        }
+        else if (-worse > threshold) {
+            result = "improved";
+        }
+    }
+
+    fprintf(out, "%-12s %-8s %12.1f %9.1f %12.1f %9.1f %+8.1f%%  %s\n",
+            phase, metric,
+            base.mean, confidence_interval(&base),
+            current.mean, confidence_interval(&current),
+            change, result);
+    return regression;
+}
+
+/// Compare a run with a baseline and print the differences.
+/** threshold is the smallest change, in percent, that is reported.
+ *  Returns the number of regressions found, or -1 if the two cannot be
+ *  compared. */
+int
+perf_baseline_compare(FILE * out, const perf_baseline_t * baseline,
+                      const perf_baseline_t * current, double threshold)
+{
+    int regressions = 0;
+    int phase;
+
+    if (baseline->run_count < 2 || current->run_count < 2) {
+        printf("Comparison needs at least 2 runs in the baseline and in the current run\n");
+        return -1;
+    }
+
+    fprintf(out, "Baseline: sdk %s, %d runs, host %s\n", baseline->sdk, baseline->run_count, baseline->host);
+    fprintf(out, "Current:  sdk %s, %d runs, host %s\n", current->sdk, current->run_count, current->host);
+    if (0 != strcmp(baseline->config, current->config)) {
+        fprintf(out, "Warning: configuration differs from the baseline\n");
+        fprintf(out, "  baseline: %s\n  current:  %s\n", baseline->config, current->config);
+    }
+    if (0 != strcmp(baseline->host, current->host)) {
+        fprintf(out, "Warning: host differs from the baseline\n");
+    }
+    fprintf(out, "\n%-12s %-8s %12s %9s %12s %9s %9s  %s\n",
+            "phase", "metric", "baseline", "+/-95%", "current", "+/-95%", "change", "result");
+
+    for (phase = 0; phase < PHASE_COUNT; phase++) {
+        if (!(baseline->phases & current->phases & PHASE_BIT(phase))) {
+            continue;
+        }
+        regressions += compare_metric(out, perf_phase_names[phase], "ops/sec",
+                                      baseline->ops_per_sec[phase], baseline->run_count,
+                                      current->ops_per_sec[phase], current->run_count,
+                                      1, threshold);
+        regressions += compare_metric(out, perf_phase_names[phase], "p99 us",
+                                      baseline->p99_us[phase], baseline->run_count,
+                                      current->p99_us[phase], current->run_count,
+                                      0, threshold);
+    }
+
+    fprintf(out, "\n%d regressions beyond %.1f%%\n", regressions, threshold);
+    return regressions;
+}
@@ -0,0 +1,327 @@
+/**************************************************************************/
+/*                                                                        */
+/*      Copyright (c) 2005-2019 by ITTIA L.L.C. All rights reserved.      */
+/*                                                                        */
+/*  This software is copyrighted by and is the sole property of ITTIA     */
+/*  L.L.C.  All rights, title, ownership, or other interests in the       */
+/*  software remain the property of ITTIA L.L.C.  This software may only  */
+/*  be used in accordance with the corresponding license agreement.  Any  */
+/*  unauthorized use, duplication, transmission, distribution, or         */
+/*  disclosure of this software is expressly forbidden.                   */
+/*                                                                        */
+/*  This Copyright notice may not be removed or modified without prior    */
+/*  written consent of ITTIA L.L.C.                                       */
+/*                                                                        */
+/*  ITTIA L.L.C. reserves the right to modify this software without       */
+/*  notice.                                                               */
+/*                                                                        */
+/*  info@ittia.com                                                        */
+/*  http://www.ittia.com                                                  */
+/*                                                                        */
+/*                                                                        */
+/**************************************************************************/
+
+
+/** @file performance_batch.c
+ *
+ * Transaction batching mode of the performance benchmark.
+ *
+ * Rows are inserted, updated, and deleted in transactions of a fixed size,
+ * for each combination of rows per transaction and completion mode:
+ *
+ *   default   library default completion, durable on commit
+ *   lazy      DB_LAZY_COMPLETION, commits are written to the journal later
+ *   group     DB_GROUP_COMPLETION, concurrent commits share journal writes
+ *   flush     DB_LAZY_COMPLETION with db_flush_tx() after every
+ *             --flush-interval commits
+ *
+ * For each cell the data throughput in rows per second and the latency of
+ * db_commit_tx() are reported. In flush mode, the time spent in
+ * db_flush_tx() is charged to the commit that triggered it.
+ */
+
+#include "performance.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Operations measured in each cell. */
+static const perf_phase_t batch_phases[] = {
+    PHASE_INSERT,
+    PHASE_UPDATE,
+    PHASE_DELETE,
+};
+
+#define BATCH_PHASE_COUNT ((int)(sizeof(batch_phases) / sizeof(batch_phases[0])))
+
+typedef struct {
+    int batch_size;
+    perf_completion_t completion;
+    perf_phase_t phase;
+    uint64_t rows;
+    perf_stats_t commit;        ///< Commit latency and phase wall-clock time
+} batch_cell_t;
+
+static int
+completion_tx_flags(perf_completion_t completion)
+{
+    switch (completion) {
+    case COMPLETION_LAZY:
+    case COMPLETION_FLUSH:
+        return DB_LAZY_COMPLETION;
+    case COMPLETION_GROUP:
+        return DB_GROUP_COMPLETION;
+    default:
+        return DB_DEFAULT_COMPLETION;
+    }
+}
+
+/* Apply one operation to row i inside the current transaction. */
+static db_result_t
+batch_operation(perf_context_t * ctx, perf_phase_t phase, int row_count, int i)
+{
+    db_result_t rc;
+
+    switch (phase) {
+    case PHASE_INSERT:
+        perf_fill_row(ctx, row_count, i);
+        return db_insert(ctx->t_cursor, ctx->t_row, NULL, 0);
+
+    case PHASE_UPDATE:
+        ctx->id = GENERATE_ID(i);
+        rc = db_seek(ctx->t_ordered_cursor, DB_SEEK_EQUAL, ctx->t_row, NULL, 1);
+        if (DB_OK == rc) {
+            rc = db_fetch(ctx->t_ordered_cursor, ctx->t_row, NULL);
+        }
+        if (DB_OK == rc) {
+            perf_modify_row(ctx);
+            rc = db_update(ctx->t_ordered_cursor, ctx->t_row, NULL);
+        }
+        return rc;
+
+    case PHASE_DELETE:
+        return db_delete(ctx->t_cursor, DB_DELETE_SEEK_NEXT);
+
+    default:
+        return DB_FAIL;
+    }
+}
+
+/* Run one operation over all rows in transactions of batch_size rows. */
+static int
+run_batched(perf_context_t * ctx, const perf_options_t * options,
+            perf_phase_t phase, int batch_size, perf_completion_t completion,
+            batch_cell_t * cell)
+{
+    uint64_t phase_start = perf_clock_ns();
+    int row_count = options->row_count;
+    int commits = 0;
+    int i = 1;
+
+    if (phase == PHASE_DELETE) {
+        db_seek_first(ctx->t_cursor);
+    }
+
+    while (i <= row_count) {
+        int end = row_count - i < batch_size ? row_count + 1 : i + batch_size;
+        uint64_t start;
+        db_result_t rc = DB_OK;
+
+        db_begin_tx(ctx->database, 0);
+        for (; i < end && DB_OK == rc; i++) {
+            rc = batch_operation(ctx, phase, row_count, i);
+        }
+        if (DB_OK != rc) {
+            printf("%s error: %d\n", perf_phase_names[phase], (int)get_db_error());
+            db_abort_tx(ctx->database, 0);
+            return -1;
+        }
+
+        start = perf_clock_ns();
+        db_commit_tx(ctx->database, 0);
+        commits++;
+        if (completion == COMPLETION_FLUSH && commits % options->flush_interval == 0) {
+            db_flush_tx(ctx->database, DB_FLUSH_JOURNAL);
+        }
+
+        if (cell) {
+            perf_stats_record(&cell->commit, perf_clock_ns() - start);
+        }
+    }
+
+    /* Make sure lazy commits do not spill into the next measurement. */
+    if (completion == COMPLETION_FLUSH || completion == COMPLETION_LAZY) {
+        db_flush_tx(ctx->database, DB_FLUSH_JOURNAL);
+    }
+
+    if (cell) {
+        cell->rows += row_count;
+        cell->commit.elapsed_ns += perf_clock_ns() - phase_start;
+    }
+    return 0;
+}
+
+/* Run insert, update, and delete once, recording into cells if not NULL. */
+static int
+run_round(perf_context_t * ctx, const perf_options_t * options,
+          int batch_size, perf_completion_t completion, batch_cell_t * cells)
+{
+    int rc = 0;
+    int p;
+
+    for (p = 0; p < BATCH_PHASE_COUNT && rc == 0; p++) {
+        rc = run_batched(ctx, options, batch_phases[p], batch_size, completion,
+                         cells != NULL ? &cells[p] : NULL);
+    }
+
+    return rc;
+}
+
+/* Reports. */
+
+static double
+rows_per_sec(const batch_cell_t * cell)
+{
+    if (cell->commit.elapsed_ns == 0) {
+        return 0.0;
+    }
+    return (double)cell->rows * 1e9 / (double)cell->commit.elapsed_ns;
+}
+
+static void
+print_batch_header(FILE * out)
+{
+    fprintf(out, "%8s %-10s %-8s %10s %12s %10s %12s %12s %12s\n",
+            "rows/tx", "completion", "phase", "rows", "rows/sec", "commits",
+            "commit p50", "commit p99", "commit max");
+}
+
+static void
+print_batch_row(FILE * out, const batch_cell_t * cell)
+{
+    fprintf(out, "%8d %-10s %-8s %10lu %12.0f %10lu %10.1fus %10.1fus %10.1fus\n",
+            cell->batch_size,
+            perf_completion_names[cell->completion],
+            perf_phase_names[cell->phase],
+            (unsigned long)cell->rows,
+            rows_per_sec(cell),
+            (unsigned long)cell->commit.count,
+            (double)perf_stats_percentile(&cell->commit, 50.0) / 1000.0,
+            (double)perf_stats_percentile(&cell->commit, 99.0) / 1000.0,
+            (double)(cell->commit.count ? cell->commit.max_ns : 0) / 1000.0);
+}
+
+static int
+write_json_report(const perf_options_t * options, const batch_cell_t * cells, int cell_count)
+{
+    FILE * out = 0 == strcmp(options->json_file, "-") ? stdout : fopen(options->json_file, "w");
+    int i;
+
+    if (out == NULL) {
+        printf("Unable to open JSON report file: %s\n", options->json_file);
+        return -1;
+    }
+
+    fprintf(out, "{\n  \"benchmark\": \"performance\",\n  \"mode\": \"batch\",\n  \"config\": { \"database\": ");
+    perf_report_json_string(out, options->database);
+    fprintf(out, ", \"rows\": %d, \"iterations\": %d, \"warmup\": %d, \"flush_interval\": %d },\n",
+            options->row_count, options->iterations, options->warmup, options->flush_interval);
+    fprintf(out, "  \"cells\": [\n");
+    for (i = 0; i < cell_count; i++) {
+        const batch_cell_t * cell = &cells[i];
+
+        fprintf(out, "    { \"rows_per_tx\": %d, \"completion\": \"%s\", \"phase\": \"%s\", \"rows\": %lu, \"rows_per_sec\": %.1f, \"commit\": ",
+                cell->batch_size,
+                perf_completion_names[cell->completion],
+                perf_phase_names[cell->phase],
+                (unsigned long)cell->rows,
+                rows_per_sec(cell));
+        perf_report_json_stats(out, &cell->commit);
+        fprintf(out, " }%s\n", i + 1 < cell_count ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
+
+int
+perf_run_batch(const perf_options_t * options)
+{
+    batch_cell_t * cells;
+    perf_context_t ctx;
+    db_t database;
+    int cell_count = 0;
+    int rc = 0;
+    int b;
+    int c;
+
+    cells = (batch_cell_t *)malloc(options->batch_size_count * COMPLETION_COUNT * BATCH_PHASE_COUNT * sizeof(batch_cell_t));
+    if (cells == NULL) {
+        printf("Out of memory for statistics\n");
+        return -1;
+    }
+
+    database = perf_create_database(options);
+    if (database == NULL || perf_open_context(&ctx, database) != 0) {
+        if (database != NULL) {
+            db_shutdown(database, 0, NULL);
+        }
+        free(cells);
+        return -1;
+    }
+
+    printf("Batch benchmark %d rows, %d iterations, %d warmup\n",
+           options->row_count, options->iterations, options->warmup);
+    print_batch_header(stdout);
+    fflush(stdout);
+
+    for (b = 0; b < options->batch_size_count && rc == 0; b++) {
+        for (c = 0; c < COMPLETION_COUNT && rc == 0; c++) {
+            batch_cell_t * row = &cells[cell_count];
+            int p;
+            int i;
+
+            if (!(options->completions & (1u << c))) {
+                continue;
+            }
+
+            for (p = 0; p < BATCH_PHASE_COUNT; p++) {
+                row[p].batch_size = options->batch_sizes[b];
+                row[p].completion = (perf_completion_t)c;
+                row[p].phase = batch_phases[p];
+                row[p].rows = 0;
+                perf_stats_init(&row[p].commit, perf_phase_names[batch_phases[p]]);
+            }
+
+            db_set_tx_default(database, completion_tx_flags((perf_completion_t)c) | DB_READ_COMMITTED);
+
+            for (i = 0; i < options->warmup && rc == 0; i++) {
+                rc = run_round(&ctx, options, options->batch_sizes[b], (perf_completion_t)c, NULL);
+            }
+            for (i = 0; i < options->iterations && rc == 0; i++) {
+                rc = run_round(&ctx, options, options->batch_sizes[b], (perf_completion_t)c, row);
+            }
+
+            for (p = 0; p < BATCH_PHASE_COUNT && rc == 0; p++) {
+                print_batch_row(stdout, &row[p]);
+            }
+            fflush(stdout);
+
+            cell_count += BATCH_PHASE_COUNT;
+        }
+    }
+
+    if (rc == 0 && options->json_file != NULL) {
+        rc = write_json_report(options, cells, cell_count);
+    }
+
+    perf_close_context(&ctx);
+    db_shutdown(database, 0, NULL);
+
+    free(cells);
+
+    return rc;
+}
@@ -0,0 +1,528 @@
+/**************************************************************************/
+/*                                                                        */
+/*      Copyright (c) 2005-2019 by ITTIA L.L.C. All rights reserved.      */
+/*                                                                        */
+/*  This software is copyrighted by and is the sole property of ITTIA     */
+/*  L.L.C.  All rights, title, ownership, or other interests in the       */
+/*  software remain the property of ITTIA L.L.C.  This software may only  */
+/*  be used in accordance with the corresponding license agreement.  Any  */
+/*  unauthorized use, duplication, transmission, distribution, or         */
+/*  disclosure of this software is expressly forbidden.                   */
+/*                                                                        */
+/*  This Copyright notice may not be removed or modified without prior    */
+/*  written consent of ITTIA L.L.C.                                       */
+/*                                                                        */
+/*  ITTIA L.L.C. reserves the right to modify this software without       */
+/*  notice.                                                               */
+/*                                                                        */
+/*  info@ittia.com                                                        */
+/*  http://www.ittia.com                                                  */
+/*                                                                        */
+/*                                                                        */
+/**************************************************************************/
+
+
+/** @file performance_blob.c
+ *
+ * BLOB streaming mode of the performance benchmark.
+ *
+ * BLOBs of each size in --blob-sizes are written to and read back from a
+ * table with one BLOB field, one chunk at a time, for each chunk size in
+ * --chunk-sizes that is not larger than the BLOB. This is the access
+ * pattern of update_contact_picture() and export_picture() in
+ * phonebook.c, which use one db_update() or db_fetch() call per chunk.
+ * Every storage type in --storages is measured.
+ *
+ * Each iteration inserts a row, writes its BLOB chunk by chunk in one
+ * transaction, reads it back, and deletes the row. Three passes are timed:
+ *
+ *   write      db_update() of each chunk, including the commit
+ *   cold read  db_fetch() of each chunk after the database is reopened,
+ *              so the page cache starts empty (file storage only)
+ *   warm read  the same reads again, served from the page cache when the
+ *              BLOB fits in it
+ *
+ * For each pass the throughput in MB/s and the per-chunk latency
+ * percentiles are reported. The difference between cold and warm reads,
+ * shown against the BLOB size as a percentage of --cache-size, is the
+ * page cache's contribution. Memory storage is given at least enough
+ * space for two copies of the largest BLOB.
+ */
+
+#include "performance.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Table B: one BLOB per row. */
+
+#define B_ID   0
+#define B_DATA 1
+
+static db_fielddef_t table_b_fields[] = {
+    { B_ID,   "ID",   DB_COLTYPE_UINT32, 0, 0, DB_NOT_NULL, NULL, 0 },
+    { B_DATA, "DATA", DB_COLTYPE_BLOB,   0, 0, DB_NULLABLE, NULL, 0 }
+};
+static db_tabledef_t table_b = {
+    DB_ALLOC_INITIALIZER(),
+    DB_TABLETYPE_DEFAULT,
+    "B",
+    DB_ARRAY_DIM(table_b_fields),
+    table_b_fields,
+    0,
+    NULL
+};
+
+static db_indexfield_t index_b_id_fields[] = {
+    { B_ID, 0 }
+};
+static db_indexdef_t index_b_id = {
+    DB_ALLOC_INITIALIZER(),
+    DB_INDEXTYPE_DEFAULT,
+    "B_ID",
+    DB_UNIQUE_INDEX,
+    DB_ARRAY_DIM(index_b_id_fields),
+    index_b_id_fields,
+};
+
+/* Passes over each BLOB. */
+typedef enum {
+    BLOB_WRITE,
+    BLOB_COLD_READ,
+    BLOB_WARM_READ,
+    BLOB_PASS_COUNT
+} blob_pass_t;
+
+static const char * const blob_pass_names[BLOB_PASS_COUNT] = {
+    "write",
+    "cold_read",
+    "warm_read",
+};
+
+typedef struct {
+    int storage;
+    int blob_size;
+    int chunk_size;
+    perf_stats_t stats[BLOB_PASS_COUNT];    ///< Per-chunk latency of each pass
+} blob_cell_t;
+
+/* Connection, cursor, and bound variables for table B. */
+typedef struct {
+    db_t database;
+    db_cursor_t cursor;
+    db_row_t key_row;           ///< ID and BLOB, to seek and fetch the BLOB size
+    db_row_t blob_row;          ///< BLOB only, to write and read chunks
+    uint32_t id;
+    db_blob_t blob;
+} blob_context_t;
+
+static void
+close_blob_context(blob_context_t * ctx)
+{
+    if (ctx->cursor != NULL) {
+        db_close_cursor(ctx->cursor);
+        ctx->cursor = NULL;
+    }
+    if (ctx->key_row != NULL) {
+        db_free_row(ctx->key_row);
+        ctx->key_row = NULL;
+    }
+    if (ctx->blob_row != NULL) {
+        db_free_row(ctx->blob_row);
+        ctx->blob_row = NULL;
+    }
+}
+
+/* The bound variables are fields of ctx, so ctx must not move until
+ * close_blob_context() is called. */
+static int
+open_blob_context(blob_context_t * ctx, db_t database)
+{
+    db_table_cursor_t cursor_def;
+
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->database = database;
+
+    {
+        db_bind_t key_binds[] = {
+            DB_BIND_VAR(B_ID,   DB_VARTYPE_UINT32, ctx->id),
+            DB_BIND_VAR(B_DATA, DB_VARTYPE_BLOB,   ctx->blob),
+        };
+        db_bind_t blob_binds[] = {
+            DB_BIND_VAR(B_DATA, DB_VARTYPE_BLOB,   ctx->blob),
+        };
+
+        ctx->key_row = db_alloc_row(key_binds, DB_ARRAY_DIM(key_binds));
+        ctx->blob_row = db_alloc_row(blob_binds, DB_ARRAY_DIM(blob_binds));
+    }
+
+    db_table_cursor_init(&cursor_def);
+    cursor_def.index = index_b_id.index_name;
+    cursor_def.flags = DB_CAN_MODIFY | DB_LOCK_EXCLUSIVE;
+    ctx->cursor = db_open_table_cursor(database, table_b.table_name, &cursor_def);
+    db_table_cursor_destroy(&cursor_def);
+
+    if (ctx->key_row == NULL || ctx->blob_row == NULL || ctx->cursor == NULL) {
+        printf("Error opening table cursors: %d\n", (int)get_db_error());
+        close_blob_context(ctx);
+        return -1;
+    }
+    return 0;
+}
+
+/* Insert a row with an empty BLOB and write the BLOB one chunk at a time. */
+static int
+write_blob(blob_context_t * ctx, uint32_t id, char * buffer, const blob_cell_t * cell, perf_stats_t * stats)
+{
+    uint64_t phase_start = perf_clock_ns();
+    uint64_t start = phase_start;
+    int64_t offset;
+
+    db_begin_tx(ctx->database, 0);
+
+    ctx->id = id;
+    db_set_null(ctx->key_row, B_DATA);
+    if (DB_OK != db_insert(ctx->cursor, ctx->key_row, NULL, DB_INSERT_SEEK_NEW)) {
+        printf("Insert error: %d\n", (int)get_db_error());
+        db_abort_tx(ctx->database, 0);
+        return -1;
+    }
+
+    for (offset = 0; offset < cell->blob_size; offset += cell->chunk_size) {
+        int64_t remaining = cell->blob_size - offset;
+
+        /* Vary the data so every chunk is distinct; the buffer may be
+         * smaller than the offset. */
+        memcpy(buffer, &offset, (size_t)cell->chunk_size < sizeof(offset) ? (size_t)cell->chunk_size : sizeof(offset));
+
+        ctx->blob.chunk_data = buffer;
+        ctx->blob.chunk_size = (db_len_t)(remaining < cell->chunk_size ? remaining : cell->chunk_size);
+        ctx->blob.offset = offset;
+        if (DB_OK != db_update(ctx->cursor, ctx->blob_row, NULL)) {
+            printf("BLOB write error: %d\n", (int)get_db_error());
+            db_abort_tx(ctx->database, 0);
+            return -1;
+        }
+
+        /* The commit is counted in the latency of the last chunk. */
+        if (offset + cell->chunk_size < cell->blob_size) {
+            uint64_t now = perf_clock_ns();
+            perf_stats_record(stats, now - start);
+            start = now;
+        }
+    }
+
+    db_commit_tx(ctx->database, 0);
+
+    perf_stats_record(stats, perf_clock_ns() - start);
+    stats->elapsed_ns += perf_clock_ns() - phase_start;
+    return 0;
+}
+
+/* Find the row and read its BLOB one chunk at a time. */
+static int
+read_blob(blob_context_t * ctx, uint32_t id, char * buffer, const blob_cell_t * cell, perf_stats_t * stats)
+{
+    uint64_t phase_start = perf_clock_ns();
+    int64_t offset;
+    int rc = 0;
+
+    db_begin_tx(ctx->database, 0);
+
+    /* Fetch with no buffer to get the BLOB size. */
+    ctx->id = id;
+    memset(&ctx->blob, 0, sizeof(ctx->blob));
+    if (DB_OK != db_seek(ctx->cursor, DB_SEEK_EQUAL, ctx->key_row, NULL, 1)
+        || DB_OK != db_fetch(ctx->cursor, ctx->key_row, NULL))
+    {
+        printf("Seek error: %d\n", (int)get_db_error());
+        db_abort_tx(ctx->database, 0);
+        return -1;
+    }
+    if (ctx->blob.blob_size != cell->blob_size) {
+        printf("BLOB size is %ld, expected %d\n", (long)ctx->blob.blob_size, cell->blob_size);
+        rc = -1;
+    }
+
+    ctx->blob.chunk_data = buffer;
+    ctx->blob.chunk_size = cell->chunk_size;
+    for (offset = 0; offset < cell->blob_size && rc == 0; offset += cell->chunk_size) {
+        uint64_t start = perf_clock_ns();
+
+        ctx->blob.offset = offset;
+        if (DB_OK != db_fetch(ctx->cursor, ctx->blob_row, NULL)) {
+            printf("BLOB read error: %d\n", (int)get_db_error());
+            rc = -1;
+        }
+        perf_stats_record(stats, perf_clock_ns() - start);
+    }
+
+    db_commit_tx(ctx->database, 0);
+
+    stats->elapsed_ns += perf_clock_ns() - phase_start;
+    return rc;
+}
+
+static int
+delete_blob(blob_context_t * ctx, uint32_t id)
+{
+    db_begin_tx(ctx->database, 0);
+
+    ctx->id = id;
+    if (DB_OK != db_seek(ctx->cursor, DB_SEEK_EQUAL, ctx->key_row, NULL, 1)
+        || DB_OK != db_delete(ctx->cursor, 0))
+    {
+        printf("Delete error: %d\n", (int)get_db_error());
+        db_abort_tx(ctx->database, 0);
+        return -1;
+    }
+
+    db_commit_tx(ctx->database, 0);
+    return 0;
+}
+
+/* Open the database and table B with the settings of one cell. */
+static db_t
+open_blob_database(const perf_options_t * options, int create, blob_context_t * ctx)
+{
+    db_t database = create ? perf_create_database(options) : perf_open_database(options);
+
+    if (database == NULL) {
+        return NULL;
+    }
+    if (create) {
+        db_create_table(database, table_b.table_name, &table_b, 0);
+        db_create_index(database, table_b.table_name, index_b_id.index_name, &index_b_id);
+    }
+    if (open_blob_context(ctx, database) != 0) {
+        db_shutdown(database, 0, NULL);
+        return NULL;
+    }
+    return database;
+}
+
+static int
+run_cell(const perf_options_t * options, blob_cell_t * cell, char * buffer)
+{
+    perf_options_t cell_options = *options;
+    blob_context_t ctx;
+    db_t database;
+    int rc = 0;
+    int i;
+
+    cell_options.storage = cell->storage;
+    if (cell->storage == PERF_STORAGE_MEMORY) {
+        int64_t needed = (int64_t)cell->blob_size * 2 + 16 * 1024 * 1024;
+
+        if (needed > 0x7FFFFFFF) {
+            needed = 0x7FFFFFFF;
+        }
+        if (cell_options.memory_size < needed) {
+            cell_options.memory_size = (int)needed;
+        }
+    }
+
+    for (i = 0; i < BLOB_PASS_COUNT; i++) {
+        perf_stats_init(&cell->stats[i], blob_pass_names[i]);
+    }
+
+    database = open_blob_database(&cell_options, 1, &ctx);
+    if (database == NULL) {
+        return -1;
+    }
+
+    for (i = -options->warmup; i < options->iterations && rc == 0; i++) {
+        /* Negative iterations are warmup and are not recorded. */
+        perf_stats_t warmup;
+        perf_stats_t * stats[BLOB_PASS_COUNT];
+        uint32_t id = (uint32_t)(i + options->warmup + 1);
+        int p;
+
+        perf_stats_init(&warmup, "warmup");
+        for (p = 0; p < BLOB_PASS_COUNT; p++) {
+            stats[p] = i < 0 ? &warmup : &cell->stats[p];
+        }
+
+        rc = write_blob(&ctx, id, buffer, cell, stats[BLOB_WRITE]);
+
+        /* Reopen a file database so the page cache starts empty. Memory
+         * storage does not persist after shutdown, so it has no cold read. */
+        if (rc == 0 && cell->storage == PERF_STORAGE_FILE) {
+            close_blob_context(&ctx);
+            db_shutdown(database, 0, NULL);
+            database = open_blob_database(&cell_options, 0, &ctx);
+            if (database == NULL) {
+                return -1;
+            }
+            rc = read_blob(&ctx, id, buffer, cell, stats[BLOB_COLD_READ]);
+        }
+
+        rc = rc ? rc : read_blob(&ctx, id, buffer, cell, stats[BLOB_WARM_READ]);
+        rc = rc ? rc : delete_blob(&ctx, id);
+    }
+
+    close_blob_context(&ctx);
+    db_shutdown(database, 0, NULL);
+
+    return rc;
+}
+
+/* Reports. */
+
+static double
+blob_mb_per_sec(const blob_cell_t * cell, const perf_stats_t * stats, int iterations)
+{
+    if (stats->elapsed_ns == 0) {
+        return 0.0;
+    }
+    return (double)cell->blob_size * iterations / (1024.0 * 1024.0) * 1e9 / (double)stats->elapsed_ns;
+}
+
+static void
+print_blob_header(FILE * out)
+{
+    fprintf(out, "%-7s %10s %8s %7s %-10s %10s %10s %10s %10s %10s\n",
+            "storage", "blob", "chunk", "cache%", "pass", "MB/s",
+            "p50 us", "p99 us", "max us", "chunks");
+}
+
+static void
+print_blob_row(FILE * out, const perf_options_t * options, const blob_cell_t * cell)
+{
+    int p;
+
+    for (p = 0; p < BLOB_PASS_COUNT; p++) {
+        const perf_stats_t * stats = &cell->stats[p];
+
+        if (stats->count == 0) {
+            continue;
+        }
+        fprintf(out, "%-7s %9dK %7dK ",
+                perf_storage_names[cell->storage], cell->blob_size / 1024, cell->chunk_size / 1024);
+        if (cell->storage == PERF_STORAGE_FILE && options->cache_size != 0) {
+            fprintf(out, "%6.0f%% ", 100.0 * cell->blob_size / options->cache_size);
+        }
+        else {
+            fprintf(out, "%7s ", "-");
+        }
+        fprintf(out, "%-10s %10.1f %10.1f %10.1f %10.1f %10lu\n",
+                stats->name,
+                blob_mb_per_sec(cell, stats, options->iterations),
+                (double)perf_stats_percentile(stats, 50.0) / 1000.0,
+                (double)perf_stats_percentile(stats, 99.0) / 1000.0,
+                (double)stats->max_ns / 1000.0,
+                (unsigned long)stats->count);
+    }
+}
+
+static int
+write_json_report(const perf_options_t * options, const blob_cell_t * cells, int cell_count)
+{
+    FILE * out = 0 == strcmp(options->json_file, "-") ? stdout : fopen(options->json_file, "w");
+    int i;
+    int p;
+
+    if (out == NULL) {
+        printf("Unable to open JSON report file: %s\n", options->json_file);
+        return -1;
+    }
+
+    fprintf(out, "{\n  \"benchmark\": \"performance\",\n  \"mode\": \"blob\",\n  \"config\": { \"database\": ");
+    perf_report_json_string(out, options->database);
+    fprintf(out, ", \"page_size\": %d, \"cache_size\": %d, \"iterations\": %d, \"warmup\": %d },\n",
+            options->page_size, options->cache_size, options->iterations, options->warmup);
+    fprintf(out, "  \"blobs\": [\n");
+    for (i = 0; i < cell_count; i++) {
+        const blob_cell_t * cell = &cells[i];
+        int first = 1;
+
+        fprintf(out, "    { \"storage\": \"%s\", \"blob_size\": %d, \"chunk_size\": %d, \"passes\": [",
+                perf_storage_names[cell->storage], cell->blob_size, cell->chunk_size);
+        for (p = 0; p < BLOB_PASS_COUNT; p++) {
+            if (cell->stats[p].count == 0) {
+                continue;
+            }
+            fprintf(out, first ? "\n      { \"mb_per_sec\": %.2f, \"stats\": " : ",\n      { \"mb_per_sec\": %.2f, \"stats\": ",
+                    blob_mb_per_sec(cell, &cell->stats[p], options->iterations));
+            perf_report_json_stats(out, &cell->stats[p]);
+            fprintf(out, " }");
+            first = 0;
+        }
+        fprintf(out, " ] }%s\n", i + 1 < cell_count ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
+
+int
+perf_run_blob(const perf_options_t * options)
+{
+    blob_cell_t * cells;
+    char * buffer;
+    int max_chunk = 0;
+    int cell_count = 0;
+    int rc = 0;
+    int s;
+    int b;
+    int c;
+
+    for (c = 0; c < options->chunk_size_count; c++) {
+        if (options->chunk_sizes[c] > max_chunk) {
+            max_chunk = options->chunk_sizes[c];
+        }
+    }
+
+    cells = (blob_cell_t *)malloc(PERF_STORAGE_COUNT * options->blob_size_count
+                                  * options->chunk_size_count * sizeof(blob_cell_t));
+    buffer = (char *)malloc(max_chunk);
+    if (cells == NULL || buffer == NULL) {
+        printf("Out of memory for BLOB buffers\n");
+        free(buffer);
+        free(cells);
+        return -1;
+    }
+    memset(buffer, 'x', max_chunk);
+
+    printf("BLOB benchmark, %d iterations, %d warmup\n", options->iterations, options->warmup);
+    print_blob_header(stdout);
+    fflush(stdout);
+
+    for (s = 0; s < PERF_STORAGE_COUNT && rc == 0; s++) {
+        if (!(options->storages & (1u << s))) {
+            continue;
+        }
+        for (b = 0; b < options->blob_size_count && rc == 0; b++) {
+            for (c = 0; c < options->chunk_size_count && rc == 0; c++) {
+                blob_cell_t * cell = &cells[cell_count];
+
+                if (options->chunk_sizes[c] > options->blob_sizes[b]) {
+                    continue;
+                }
+
+                cell->storage = s;
+                cell->blob_size = options->blob_sizes[b];
+                cell->chunk_size = options->chunk_sizes[c];
+
+                rc = run_cell(options, cell, buffer);
+                if (rc == 0) {
+                    print_blob_row(stdout, options, cell);
+                    fflush(stdout);
+                    cell_count++;
+                }
+            }
+        }
+    }
+
+    if (rc == 0 && options->json_file != NULL) {
+        rc = write_json_report(options, cells, cell_count);
+    }
+
+    free(buffer);
+    free(cells);
+
+    return rc;
+}
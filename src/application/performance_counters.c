@@ -0,0 +1,281 @@
+/**************************************************************************/
+/*                                                                        */
+/*      Copyright (c) 2005-2019 by ITTIA L.L.C. All rights reserved.      */
+/*                                                                        */
+/*  This software is copyrighted by and is the sole property of ITTIA     */
+/*  L.L.C.  All rights, title, ownership, or other interests in the       */
+/*  software remain the property of ITTIA L.L.C.  This software may only  */
+/*  be used in accordance with the corresponding license agreement.  Any  */
+/*  unauthorized use, duplication, transmission, distribution, or         */
+/*  disclosure of this software is expressly forbidden.                   */
+/*                                                                        */
+/*  This Copyright notice may not be removed or modified without prior    */
+/*  written consent of ITTIA L.L.C.                                       */
+/*                                                                        */
+/*  ITTIA L.L.C. reserves the right to modify this software without       */
+/*  notice.                                                               */
+/*                                                                        */
+/*  info@ittia.com                                                        */
+/*  http://www.ittia.com                                                  */
+/*                                                                        */
+/*                                                                        */
+/**************************************************************************/
+
+
+/** @file performance_counters.c
+ *
+ * Hardware and software event counters for the performance benchmark.
+ *
+ * On Linux, perf_event_open() counts CPU cycles, retired instructions,
+ * cache misses, branch misses, page faults, and context switches of the
+ * calling thread while a phase runs. Counters the kernel or the CPU does
+ * not support, for example hardware events in many virtual machines, are
+ * reported as unavailable. On other systems no counters are available.
+ *
+ * Counters belong to the thread that opened them, so they are only used
+ * by benchmark modes that measure phases on the main thread.
+ */
+
+#include "performance.h"
+
+const char * const perf_counter_names[COUNTER_COUNT] = {
+    "cycles",
+    "instructions",
+    "cache_misses",
+    "branch_misses",
+    "page_faults",
+    "context_switches",
+};
+
+#if defined(__linux__)
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <string.h>
+#include <unistd.h>
+
+static int counter_fd[COUNTER_COUNT] = { -1, -1, -1, -1, -1, -1 };
+
+static int
+open_counter(uint32_t type, uint64_t config, int exclude_kernel)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = exclude_kernel;
+    attr.exclude_hv = 1;
+    /* Scale for time the counter was not scheduled when counters are multiplexed. */
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    /* Count the calling thread on any CPU. */
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/// Open all counters. Returns the number of counters available.
+int
+perf_counters_open(void)
+{
+    static const struct {
+        uint32_t type;
+        uint64_t config;
+    } events[COUNTER_COUNT] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+    };
+    int available = 0;
+    int i;
+
+    for (i = 0; i < COUNTER_COUNT; i++) {
+        /* Context switches and page faults are handled by the kernel, so
+         * try to include kernel mode for software events. This needs more
+         * privileges on systems that restrict perf_event_open(). */
+        counter_fd[i] = -1;
+        if (events[i].type == PERF_TYPE_SOFTWARE) {
+            counter_fd[i] = open_counter(events[i].type, events[i].config, 0);
+        }
+        if (counter_fd[i] < 0) {
+            counter_fd[i] = open_counter(events[i].type, events[i].config, 1);
+        }
+        if (counter_fd[i] >= 0) {
+            available++;
+        }
+    }
+
+    return available;
+}
+
+void
+perf_counters_close(void)
+{
+    int i;
+
+    for (i = 0; i < COUNTER_COUNT; i++) {
+        if (counter_fd[i] >= 0) {
+            close(counter_fd[i]);
+            counter_fd[i] = -1;
+        }
+    }
+}
+
+int
+perf_counters_available(perf_counter_t counter)
+{
+    return counter_fd[counter] >= 0;
+}
+
+/// Reset and start all open counters.
+void
+perf_counters_start(void)
+{
+    int i;
+
+    for (i = 0; i < COUNTER_COUNT; i++) {
+        if (counter_fd[i] >= 0) {
+            ioctl(counter_fd[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(counter_fd[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+/// Stop all open counters and add their counts to values.
+void
+perf_counters_stop(uint64_t * values)
+{
+    int i;
+
+    for (i = 0; i < COUNTER_COUNT; i++) {
+        uint64_t reading[3];    /* value, time enabled, time running */
+
+        if (counter_fd[i] < 0) {
+            continue;
+        }
+
+        ioctl(counter_fd[i], PERF_EVENT_IOC_DISABLE, 0);
+        if (read(counter_fd[i], reading, sizeof(reading)) != (ssize_t)sizeof(reading)) {
+            continue;
+        }
+
+        if (reading[2] != 0 && reading[2] < reading[1]) {
+            reading[0] = (uint64_t)((double)reading[0] * reading[1] / reading[2]);
+        }
+        values[i] += reading[0];
+    }
+}
+
+#else
+
+int
+perf_counters_open(void)
+{
+    return 0;
+}
+
+void
+perf_counters_close(void)
+{
+}
+
+int
+perf_counters_available(perf_counter_t counter)
+{
+    (void)counter;
+    return 0;
+}
+
+void
+perf_counters_start(void)
+{
+}
+
+void
+perf_counters_stop(uint64_t * values)
+{
+    (void)values;
+}
+
+#endif
+
+/// True if any counter is open.
+int
+perf_counters_enabled(void)
+{
+    int i;
+
+    for (i = 0; i < COUNTER_COUNT; i++) {
+        if (perf_counters_available((perf_counter_t)i)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Reports. */
+
+static void
+print_per_op(FILE * out, const perf_stats_t * stats, perf_counter_t counter, int width)
+{
+    if (!perf_counters_available(counter)) {
+        fprintf(out, " %*s", width, "-");
+    }
+    else {
+        fprintf(out, " %*.2f", width,
+                stats->count ? (double)stats->counters[counter] / (double)stats->count : 0.0);
+    }
+}
+
+void
+perf_report_counters_header(FILE * out)
+{
+    fprintf(out, "%-12s %12s %12s %6s %12s %12s %10s %10s\n",
+            "phase", "cycles/op", "instr/op", "IPC",
+            "cache mis/op", "br miss/op", "faults/op", "ctx sw/op");
+}
+
+void
+perf_report_counters_row(FILE * out, const perf_stats_t * stats)
+{
+    fprintf(out, "%-12s", stats->name);
+    print_per_op(out, stats, COUNTER_CYCLES, 12);
+    print_per_op(out, stats, COUNTER_INSTRUCTIONS, 12);
+    if (perf_counters_available(COUNTER_CYCLES) && perf_counters_available(COUNTER_INSTRUCTIONS)
+        && stats->counters[COUNTER_CYCLES] != 0)
+    {
+        fprintf(out, " %6.2f", (double)stats->counters[COUNTER_INSTRUCTIONS] / (double)stats->counters[COUNTER_CYCLES]);
+    }
+    else {
+        fprintf(out, " %6s", "-");
+    }
+    print_per_op(out, stats, COUNTER_CACHE_MISSES, 12);
+    print_per_op(out, stats, COUNTER_BRANCH_MISSES, 12);
+    print_per_op(out, stats, COUNTER_PAGE_FAULTS, 10);
+    print_per_op(out, stats, COUNTER_CONTEXT_SWITCHES, 10);
+    fprintf(out, "\n");
+}
+
+/// Write per-operation counters as a JSON object, null where unavailable.
+void
+perf_report_json_counters(FILE * out, const perf_stats_t * stats)
+{
+    int i;
+
+    fprintf(out, "{ ");
+    for (i = 0; i < COUNTER_COUNT; i++) {
+        fprintf(out, "%s\"%s_per_op\": ", i ? ", " : "", perf_counter_names[i]);
+        if (perf_counters_available((perf_counter_t)i)) {
+            fprintf(out, "%.3f", stats->count ? (double)stats->counters[i] / (double)stats->count : 0.0);
+        }
+        else {
+            fprintf(out, "null");
+        }
+    }
+    fprintf(out, " }");
+}
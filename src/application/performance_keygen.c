@@ -0,0 +1,167 @@
+/**************************************************************************/
+/*                                                                        */
+/*      Copyright (c) 2005-2019 by ITTIA L.L.C. All rights reserved.      */
+/*                                                                        */
+/*  This software is copyrighted by and is the sole property of ITTIA     */
+/*  L.L.C.  All rights, title, ownership, or other interests in the       */
+/*  software remain the property of ITTIA L.L.C.  This software may only  */
+/*  be used in accordance with the corresponding license agreement.  Any  */
+/*  unauthorized use, duplication, transmission, distribution, or         */
+/*  disclosure of this software is expressly forbidden.                   */
+/*                                                                        */
+/*  This Copyright notice may not be removed or modified without prior    */
+/*  written consent of ITTIA L.L.C.                                       */
+/*                                                                        */
+/*  ITTIA L.L.C. reserves the right to modify this software without       */
+/*  notice.                                                               */
+/*                                                                        */
+/*  info@ittia.com                                                        */
+/*  http://www.ittia.com                                                  */
+/*                                                                        */
+/*                                                                        */
+/**************************************************************************/
+
+
+/** @file performance_keygen.c
+ *
+ * Key generators for the performance benchmark example.
+ *
+ * Each generator returns row numbers in the range 1..row_count, which are
+ * mapped to keys of table T with GENERATE_ID(). The random number
+ * generator is local to each generator, so results are repeatable for a
+ * given seed and generators can be used from several threads.
+ */
+
+#include "performance.h"
+
+#include <math.h>
+
+const char * const perf_keys_names[KEYS_COUNT] = {
+    "uniform",
+    "zipfian",
+    "latest",
+    "hotspot",
+};
+
+/* xorshift64* generator: fast, and good enough for choosing keys. */
+static uint64_t
+next_random(perf_keygen_t * gen)
+{
+    gen->state ^= gen->state >> 12;
+    gen->state ^= gen->state << 25;
+    gen->state ^= gen->state >> 27;
+    return gen->state * 2685821657736338717u;
+}
+
+/// Uniform random number in [0, 1).
+double
+perf_keygen_uniform(perf_keygen_t * gen)
+{
+    return (double)(next_random(gen) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double
+zeta(int n, double theta)
+{
+    double sum = 0.0;
+    int i;
+
+    for (i = 1; i <= n; i++) {
+        sum += 1.0 / pow((double)i, theta);
+    }
+    return sum;
+}
+
+void
+perf_keygen_init(perf_keygen_t * gen, perf_keys_t distribution,
+                 int row_count, const perf_options_t * options)
+{
+    gen->distribution = distribution;
+    gen->row_count = row_count;
+
+    /* The state must never be zero. */
+    gen->state = ((uint64_t)options->seed + 1) * 0x9E3779B97F4A7C15u;
+    if (gen->state == 0) {
+        gen->state = 1;
+    }
+
+    gen->theta = options->theta;
+    gen->zeta_n = 0.0;
+    gen->alpha = 0.0;
+    gen->eta = 0.0;
+    if (distribution == KEYS_ZIPFIAN || distribution == KEYS_LATEST) {
+        /* Computing zeta(n) is linear in the row count, so it is done once. */
+        gen->zeta_n = zeta(row_count, gen->theta);
+        gen->alpha = 1.0 / (1.0 - gen->theta);
+        gen->eta = (1.0 - pow(2.0 / row_count, 1.0 - gen->theta))
+            / (1.0 - zeta(2, gen->theta) / gen->zeta_n);
+    }
+
+    gen->hot_rows = (int)((int64_t)row_count * options->hot_rows / 100);
+    if (gen->hot_rows < 1) {
+        gen->hot_rows = 1;
+    }
+    gen->hot_probability = options->hot_operations / 100.0;
+}
+
+/// Extend the key range to 1..row_count after rows are inserted.
+void
+perf_keygen_grow(perf_keygen_t * gen, int row_count)
+{
+    if (row_count <= gen->row_count) {
+        return;
+    }
+
+    if (gen->distribution == KEYS_ZIPFIAN || gen->distribution == KEYS_LATEST) {
+        /* Extend zeta(n) incrementally instead of recomputing it. */
+        int i;
+
+        for (i = gen->row_count + 1; i <= row_count; i++) {
+            gen->zeta_n += 1.0 / pow((double)i, gen->theta);
+        }
+        gen->eta = (1.0 - pow(2.0 / row_count, 1.0 - gen->theta))
+            / (1.0 - zeta(2, gen->theta) / gen->zeta_n);
+    }
+
+    gen->row_count = row_count;
+}
+
+static int
+next_zipfian(perf_keygen_t * gen)
+{
+    double u = perf_keygen_uniform(gen);
+    double uz = u * gen->zeta_n;
+    int row;
+
+    if (uz < 1.0) {
+        return 1;
+    }
+    if (uz < 1.0 + pow(0.5, gen->theta)) {
+        return 2;
+    }
+
+    row = 1 + (int)(gen->row_count * pow(gen->eta * u - gen->eta + 1.0, gen->alpha));
+    return row > gen->row_count ? gen->row_count : row;
+}
+
+/// Next row number, in the range 1..row_count.
+int
+perf_keygen_next(perf_keygen_t * gen)
+{
+    switch (gen->distribution) {
+    case KEYS_ZIPFIAN:
+        return next_zipfian(gen);
+
+    case KEYS_LATEST:
+        return gen->row_count + 1 - next_zipfian(gen);
+
+    case KEYS_HOTSPOT:
+        if (gen->hot_rows >= gen->row_count || perf_keygen_uniform(gen) < gen->hot_probability) {
+            return 1 + (int)(perf_keygen_uniform(gen) * gen->hot_rows);
+        }
+        return gen->hot_rows + 1 + (int)(perf_keygen_uniform(gen) * (gen->row_count - gen->hot_rows));
+
+    default:
+        return 1 + (int)(perf_keygen_uniform(gen) * gen->row_count);
+    }
+}
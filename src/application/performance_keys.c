@@ -0,0 +1,334 @@
+/**************************************************************************/
+/*                                                                        */
+/*      Copyright (c) 2005-2019 by ITTIA L.L.C. All rights reserved.      */
+/*                                                                        */
+/*  This software is copyrighted by and is the sole property of ITTIA     */
+/*  L.L.C.  All rights, title, ownership, or other interests in the       */
+/*  software remain the property of ITTIA L.L.C.  This software may only  */
+/*  be used in accordance with the corresponding license agreement.  Any  */
+/*  unauthorized use, duplication, transmission, distribution, or         */
+/*  disclosure of this software is expressly forbidden.                   */
+/*                                                                        */
+/*  This Copyright notice may not be removed or modified without prior    */
+/*  written consent of ITTIA L.L.C.                                       */
+/*                                                                        */
+/*  ITTIA L.L.C. reserves the right to modify this software without       */
+/*  notice.                                                               */
+/*                                                                        */
+/*  info@ittia.com                                                        */
+/*  http://www.ittia.com                                                  */
+/*                                                                        */
+/*                                                                        */
+/**************************************************************************/
+
+
+/** @file performance_keys.c
+ *
+ * Key distribution mode of the performance benchmark.
+ *
+ * The table is filled with --rows rows, then the seek and update phases
+ * are run with rows chosen by each of the uniform, Zipfian, latest, and
+ * hotspot key generators. Latency percentiles are reported for each
+ * distribution together with measures of locality:
+ *
+ *   distinct   percent of the table's rows touched by the phase, which
+ *              is the working set the page cache has to hold
+ *   blk in     file system block reads per 1000 operations
+ *   maj flt    major page faults per 1000 operations
+ *
+ * Block reads and page faults are collected with getrusage() and are only
+ * available on POSIX systems. Reads served by the ITTIA DB page cache or
+ * by the operating system's file cache do not count as block reads.
+ */
+
+#include "performance.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32) && !defined(OS_UCOS_III)
+#include <sys/resource.h>
+#define HAVE_GETRUSAGE
+#endif
+
+/* Phases run for each distribution. */
+static const perf_phase_t keys_phases[] = {
+    PHASE_SEEK,
+    PHASE_UPDATE,
+};
+
+#define KEYS_PHASE_COUNT ((int)(sizeof(keys_phases) / sizeof(keys_phases[0])))
+
+typedef struct {
+    long block_reads;
+    long major_faults;
+} io_counters_t;
+
+typedef struct {
+    perf_keys_t distribution;
+    perf_stats_t stats;
+    int distinct_rows;
+    io_counters_t io;           ///< Counter increase over the measured runs
+} keys_cell_t;
+
+static void
+read_io_counters(io_counters_t * counters)
+{
+#ifdef HAVE_GETRUSAGE
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    counters->block_reads = usage.ru_inblock;
+    counters->major_faults = usage.ru_majflt;
+#else
+    counters->block_reads = 0;
+    counters->major_faults = 0;
+#endif
+}
+
+/* Count the rows a generator visits in count operations. Generators are
+ * deterministic, so this replays the sequence a phase will use without
+ * adding any work to the measured loop. */
+static int
+count_distinct_rows(perf_keys_t distribution, int row_count, int count, const perf_options_t * options)
+{
+    unsigned char * seen = (unsigned char *)calloc(row_count / 8 + 1, 1);
+    perf_keygen_t gen;
+    int distinct = 0;
+    int k;
+
+    if (seen == NULL) {
+        return -1;
+    }
+
+    perf_keygen_init(&gen, distribution, row_count, options);
+    for (k = 0; k < count; k++) {
+        int row = perf_keygen_next(&gen);
+        unsigned char bit = (unsigned char)(1u << (row % 8));
+
+        if (!(seen[row / 8] & bit)) {
+            seen[row / 8] |= bit;
+            distinct++;
+        }
+    }
+
+    free(seen);
+    return distinct;
+}
+
+/* Run one phase with rows drawn from a new generator for the distribution.
+ * When cell is NULL, nothing is recorded. */
+static int
+run_distribution(perf_context_t * ctx, const perf_options_t * options,
+                 perf_keys_t distribution, perf_phase_t phase, keys_cell_t * cell)
+{
+    perf_stats_t * stats = cell != NULL ? &cell->stats : NULL;
+    perf_keygen_t gen;
+    perf_range_t range;
+    io_counters_t before;
+    io_counters_t after;
+    int rc;
+
+    perf_keygen_init(&gen, distribution, options->row_count, options);
+
+    range.first = 1;
+    range.count = options->operations != 0 ? options->operations : options->row_count;
+    range.stride = 1;
+    range.row_count = options->row_count;
+    range.keys = &gen;
+
+    read_io_counters(&before);
+    if (phase == PHASE_SEEK) {
+        rc = perf_run_seek(ctx, &range, stats);
+    }
+    else {
+        rc = perf_run_update(ctx, &range, stats);
+    }
+    read_io_counters(&after);
+
+    if (cell != NULL) {
+        cell->io.block_reads += after.block_reads - before.block_reads;
+        cell->io.major_faults += after.major_faults - before.major_faults;
+    }
+
+    return rc;
+}
+
+/* Reports. */
+
+static double
+per_thousand(long count, uint64_t operations)
+{
+    return operations ? (double)count * 1000.0 / (double)operations : 0.0;
+}
+
+static void
+print_keys_header(FILE * out)
+{
+    fprintf(out, "%-8s %-8s %10s %12s %10s %10s %10s %10s %9s %9s %9s\n",
+            "keys", "phase", "ops", "ops/sec",
+            "p50 us", "p95 us", "p99 us", "p99.9 us",
+            "distinct", "blk in", "maj flt");
+}
+
+static void
+print_keys_row(FILE * out, const perf_options_t * options, const keys_cell_t * cell)
+{
+    const perf_stats_t * stats = &cell->stats;
+
+    fprintf(out, "%-8s %-8s %10lu %12.0f %10.1f %10.1f %10.1f %10.1f %8.1f%% %9.2f %9.2f\n",
+            perf_keys_names[cell->distribution],
+            stats->name,
+            (unsigned long)stats->count,
+            perf_stats_throughput(stats),
+            (double)perf_stats_percentile(stats, 50.0) / 1000.0,
+            (double)perf_stats_percentile(stats, 95.0) / 1000.0,
+            (double)perf_stats_percentile(stats, 99.0) / 1000.0,
+            (double)perf_stats_percentile(stats, 99.9) / 1000.0,
+            100.0 * cell->distinct_rows / options->row_count,
+            per_thousand(cell->io.block_reads, stats->count),
+            per_thousand(cell->io.major_faults, stats->count));
+}
+
+static int
+write_json_report(const perf_options_t * options, const keys_cell_t * cells, int cell_count)
+{
+    FILE * out = 0 == strcmp(options->json_file, "-") ? stdout : fopen(options->json_file, "w");
+    int i;
+
+    if (out == NULL) {
+        printf("Unable to open JSON report file: %s\n", options->json_file);
+        return -1;
+    }
+
+    fprintf(out, "{\n  \"benchmark\": \"performance\",\n  \"mode\": \"keys\",\n  \"config\": { \"database\": ");
+    perf_report_json_string(out, options->database);
+    fprintf(out, ", \"rows\": %d, \"operations\": %d, \"theta\": %g, \"hot_rows\": %d, \"hot_operations\": %d, \"seed\": %u, \"iterations\": %d, \"warmup\": %d },\n",
+            options->row_count,
+            options->operations != 0 ? options->operations : options->row_count,
+            options->theta, options->hot_rows, options->hot_operations, options->seed,
+            options->iterations, options->warmup);
+    fprintf(out, "  \"distributions\": [\n");
+    for (i = 0; i < cell_count; i++) {
+        const keys_cell_t * cell = &cells[i];
+
+        fprintf(out, "    { \"keys\": \"%s\", \"distinct_rows\": %d, \"block_reads\": %ld, \"major_faults\": %ld, \"stats\": ",
+                perf_keys_names[cell->distribution], cell->distinct_rows,
+                cell->io.block_reads, cell->io.major_faults);
+        perf_report_json_stats(out, &cell->stats);
+        fprintf(out, " }%s\n", i + 1 < cell_count ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
+
+int
+perf_run_keys(const perf_options_t * options)
+{
+    keys_cell_t * cells;
+    perf_context_t ctx;
+    perf_range_t range;
+    db_t database;
+    int operations = options->operations != 0 ? options->operations : options->row_count;
+    int cell_count = 0;
+    int rc = 0;
+    int d;
+
+    cells = (keys_cell_t *)malloc(KEYS_COUNT * KEYS_PHASE_COUNT * sizeof(keys_cell_t));
+    if (cells == NULL) {
+        printf("Out of memory for statistics\n");
+        return -1;
+    }
+
+    database = perf_create_database(options);
+    if (database == NULL || perf_open_context(&ctx, database) != 0) {
+        if (database != NULL) {
+            db_shutdown(database, 0, NULL);
+        }
+        free(cells);
+        return -1;
+    }
+
+    /* Fill the table once; the key distributions only read and update it. */
+    range.first = 1;
+    range.count = options->row_count;
+    range.stride = 1;
+    range.row_count = options->row_count;
+    range.keys = NULL;
+    rc = perf_run_insert(&ctx, &range, NULL);
+
+    printf("Key distribution benchmark %d rows, %d operations, %d iterations, %d warmup\n",
+           options->row_count, operations, options->iterations, options->warmup);
+    print_keys_header(stdout);
+    fflush(stdout);
+
+    for (d = 0; d < KEYS_COUNT && rc == 0; d++) {
+        int distinct;
+        int p;
+
+        if (!(options->distributions & (1u << d))) {
+            continue;
+        }
+
+        distinct = count_distinct_rows((perf_keys_t)d, options->row_count, operations, options);
+
+        for (p = 0; p < KEYS_PHASE_COUNT && rc == 0; p++) {
+            keys_cell_t * cell = &cells[cell_count];
+            int i;
+
+            if (!(options->phases & PHASE_BIT(keys_phases[p]))) {
+                continue;
+            }
+
+            cell->distribution = (perf_keys_t)d;
+            cell->distinct_rows = distinct;
+            cell->io.block_reads = 0;
+            cell->io.major_faults = 0;
+            perf_stats_init(&cell->stats, perf_phase_names[keys_phases[p]]);
+
+            for (i = 0; i < options->warmup && rc == 0; i++) {
+                rc = run_distribution(&ctx, options, (perf_keys_t)d, keys_phases[p], NULL);
+            }
+            for (i = 0; i < options->iterations && rc == 0; i++) {
+                rc = run_distribution(&ctx, options, (perf_keys_t)d, keys_phases[p], cell);
+            }
+
+            if (rc == 0) {
+                print_keys_row(stdout, options, cell);
+                fflush(stdout);
+                cell_count++;
+            }
+        }
+    }
+
+    if (rc == 0 && perf_counters_enabled()) {
+        printf("\n");
+        perf_report_counters_header(stdout);
+        for (d = 0; d < cell_count; d++) {
+            char name[32];
+            perf_stats_t * stats = &cells[d].stats;
+            const char * phase = stats->name;
+
+            /* Label each row with its distribution as well as its phase. */
+            sprintf(name, "%.7s/%.6s", perf_keys_names[cells[d].distribution], phase);
+            stats->name = name;
+            perf_report_counters_row(stdout, stats);
+            stats->name = phase;
+        }
+    }
+
+    if (rc == 0 && options->json_file != NULL) {
+        rc = write_json_report(options, cells, cell_count);
+    }
+
+    perf_close_context(&ctx);
+    db_shutdown(database, 0, NULL);
+
+    free(cells);
+
+    return rc;
+}
@@ -0,0 +1,576 @@
+/**************************************************************************/
+/*                                                                        */
+/*      Copyright (c) 2005-2019 by ITTIA L.L.C. All rights reserved.      */
+/*                                                                        */
+/*  This software is copyrighted by and is the sole property of ITTIA     */
+/*  L.L.C.  All rights, title, ownership, or other interests in the       */
+/*  software remain the property of ITTIA L.L.C.  This software may only  */
+/*  be used in accordance with the corresponding license agreement.  Any  */
+/*  unauthorized use, duplication, transmission, distribution, or         */
+/*  disclosure of this software is expressly forbidden.                   */
+/*                                                                        */
+/*  This Copyright notice may not be removed or modified without prior    */
+/*  written consent of ITTIA L.L.C.                                       */
+/*                                                                        */
+/*  ITTIA L.L.C. reserves the right to modify this software without       */
+/*  notice.                                                               */
+/*                                                                        */
+/*  info@ittia.com                                                        */
+/*  http://www.ittia.com                                                  */
+/*                                                                        */
+/*                                                                        */
+/**************************************************************************/
+
+
+/** @file performance_recovery.c
+ *
+ * Cold-open and crash-recovery mode of the performance benchmark.
+ *
+ * For each database size in --db-rows, a database is built with that many
+ * rows of table T and shut down cleanly. Then the time taken by
+ * db_open_file_storage() is measured in three cases:
+ *
+ *   clean        the database was shut down normally
+ *   uncommitted  a writer inserted --pending-rows rows, committing every
+ *                --tx-rows rows, and shut down with its last transaction
+ *                still open
+ *   killed       the same writer runs in a child process and is killed
+ *                with SIGKILL while its last transaction is open
+ *
+ * The database is rebuilt before every measured open of the uncommitted
+ * and killed cases, and the operating system's file cache is dropped for
+ * the database files where posix_fadvise() allows it, so each open starts
+ * cold. Opens are repeated --iterations times.
+ *
+ * Alongside the open time, the report shows the size of the database file
+ * after it was built and the journal size, which is how much the database
+ * files grew between the clean shutdown and the reopen: the work recovery
+ * may have to replay or roll back. Rows found in table T after recovery
+ * are counted to check that committed rows survived and uncommitted ones
+ * were discarded.
+ *
+ * The killed case needs fork() and is skipped on systems without it.
+ */
+
+#include "performance.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif !defined(OS_UCOS_III)
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define HAVE_FORK
+#endif
+
+const char * const perf_recovery_names[RECOVERY_COUNT] = {
+    "clean",
+    "uncommitted",
+    "killed",
+};
+
+typedef struct {
+    perf_recovery_t recovery;
+    int db_rows;
+    int pending_rows;           ///< 0 in the clean case
+    uint64_t db_bytes;          ///< Database file size after the clean build
+    uint64_t journal_bytes;     ///< Mean growth of the database files before reopen
+    int recovered_rows;         ///< Rows in table T after the last reopen
+    perf_stats_t stats;         ///< Open latency
+} recovery_cell_t;
+
+/* Database files.
+ *
+ * The journal may be kept in the database file or next to it, so sizes
+ * are summed over every file in the same directory whose name starts with
+ * the database file name. */
+
+#if defined(_WIN32)
+
+static uint64_t
+database_files_size(const char * database)
+{
+    char pattern[MAX_PATH];
+    WIN32_FIND_DATAA data;
+    HANDLE find;
+    uint64_t total = 0;
+
+    if (strlen(database) + 2 > sizeof(pattern)) {
+        return perf_file_size(database);
+    }
+    strcpy(pattern, database);
+    strcat(pattern, "*");
+
+    find = FindFirstFileA(pattern, &data);
+    if (find == INVALID_HANDLE_VALUE) {
+        return 0;
+    }
+    do {
+        total += ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+    } while (FindNextFileA(find, &data));
+    FindClose(find);
+
+    return total;
+}
+
+static void
+drop_file_cache(const char * database)
+{
+    (void)database;
+}
+
+#elif defined(HAVE_FORK)
+
+/* Call fn for every database file. */
+static void
+for_each_database_file(const char * database, void (*fn)(const char * path, void * arg), void * arg)
+{
+    const char * slash = strrchr(database, '/');
+    const char * base = slash != NULL ? slash + 1 : database;
+    size_t dir_len = slash != NULL ? (size_t)(slash - database) + 1 : 0;
+    size_t base_len = strlen(base);
+    char path[1024];
+    struct dirent * entry;
+    DIR * dir;
+
+    if (dir_len + base_len >= sizeof(path)) {
+        return;
+    }
+    memcpy(path, database, dir_len);
+    path[dir_len] = '\0';
+
+    dir = opendir(dir_len != 0 ? path : ".");
+    if (dir == NULL) {
+        return;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        if (0 == strncmp(entry->d_name, base, base_len)
+            && dir_len + strlen(entry->d_name) < sizeof(path))
+        {
+            strcpy(path + dir_len, entry->d_name);
+            fn(path, arg);
+        }
+    }
+    closedir(dir);
+}
+
+static void
+add_file_size(const char * path, void * arg)
+{
+    *(uint64_t *)arg += perf_file_size(path);
+}
+
+static uint64_t
+database_files_size(const char * database)
+{
+    uint64_t total = 0;
+
+    for_each_database_file(database, add_file_size, &total);
+    return total;
+}
+
+static void
+drop_one_file_cache(const char * path, void * arg)
+{
+#if defined(POSIX_FADV_DONTNEED)
+    int fd = open(path, O_RDONLY);
+
+    (void)arg;
+
+    if (fd >= 0) {
+        /* Only clean pages can be dropped, so write dirty ones first. */
+        fsync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+#else
+    (void)path;
+    (void)arg;
+#endif
+}
+
+static void
+drop_file_cache(const char * database)
+{
+    for_each_database_file(database, drop_one_file_cache, NULL);
+}
+
+#else
+
+static uint64_t
+database_files_size(const char * database)
+{
+    return perf_file_size(database);
+}
+
+static void
+drop_file_cache(const char * database)
+{
+    (void)database;
+}
+
+#endif
+
+/* Insert rows first..first+count-1, committing every tx_rows rows. When
+ * leave_open is set, the last transaction is not committed. */
+static int
+insert_rows(perf_context_t * ctx, int first, int count, int tx_rows, int leave_open)
+{
+    int k;
+
+    for (k = 0; k < count; k++) {
+        if (k % tx_rows == 0) {
+            db_begin_tx(ctx->database, 0);
+        }
+
+        perf_fill_row(ctx, first + count, first + k);
+        if (DB_OK != db_insert(ctx->t_cursor, ctx->t_row, NULL, 0)) {
+            printf("Insert error: %d\n", (int)get_db_error());
+            db_abort_tx(ctx->database, 0);
+            return -1;
+        }
+
+        if ((k + 1) % tx_rows == 0 && (!leave_open || k + 1 < count)) {
+            db_commit_tx(ctx->database, 0);
+        }
+    }
+
+    if (count % tx_rows != 0 && !leave_open) {
+        db_commit_tx(ctx->database, 0);
+    }
+    return 0;
+}
+
+/* Create the database with db_rows rows and shut it down cleanly. */
+static int
+build_database(const perf_options_t * options, int db_rows)
+{
+    perf_context_t ctx;
+    db_t database;
+    int rc;
+
+    database = perf_create_database(options);
+    if (database == NULL) {
+        return -1;
+    }
+
+    rc = perf_open_context(&ctx, database);
+    if (rc == 0) {
+        rc = insert_rows(&ctx, 1, db_rows, options->tx_rows, 0);
+        perf_close_context(&ctx);
+    }
+
+    db_shutdown(database, 0, NULL);
+    return rc;
+}
+
+/* Insert the pending rows and shut down with the last transaction open. */
+static int
+write_pending(const perf_options_t * options, int db_rows, int pending_rows)
+{
+    perf_context_t ctx;
+    db_t database;
+    int rc;
+
+    database = perf_open_database(options);
+    if (database == NULL) {
+        return -1;
+    }
+
+    rc = perf_open_context(&ctx, database);
+    if (rc == 0) {
+        rc = insert_rows(&ctx, db_rows + 1, pending_rows, options->tx_rows, 1);
+        perf_close_context(&ctx);
+    }
+
+    /* Shut down without committing the open transaction. */
+    db_shutdown(database, DB_SOFT_SHUTDOWN, NULL);
+    return rc;
+}
+
+#ifdef HAVE_FORK
+/* Insert the pending rows in a child process and kill it with the last
+ * transaction open. The database must not be open in this process. */
+static int
+kill_pending_writer(const perf_options_t * options, int db_rows, int pending_rows)
+{
+    int ready[2];
+    char byte = 0;
+    pid_t pid;
+    int status;
+
+    if (pipe(ready) != 0) {
+        printf("Unable to create pipe\n");
+        return -1;
+    }
+
+    fflush(stdout);
+    pid = fork();
+    if (pid < 0) {
+        printf("Unable to fork writer process\n");
+        close(ready[0]);
+        close(ready[1]);
+        return -1;
+    }
+
+    if (pid == 0) {
+        /* Writer: do the pending work, report it is done, and wait to be killed. */
+        perf_context_t ctx;
+        db_t database;
+
+        close(ready[0]);
+        database = perf_open_database(options);
+        if (database == NULL || perf_open_context(&ctx, database) != 0
+            || insert_rows(&ctx, db_rows + 1, pending_rows, options->tx_rows, 1) != 0)
+        {
+            _exit(EXIT_FAILURE);
+        }
+        byte = 1;
+        if (write(ready[1], &byte, 1) != 1) {
+            _exit(EXIT_FAILURE);
+        }
+        for (;;) {
+            pause();
+        }
+    }
+
+    close(ready[1]);
+    if (read(ready[0], &byte, 1) != 1 || byte != 1) {
+        printf("Writer process failed\n");
+        byte = 0;
+    }
+    close(ready[0]);
+
+    kill(pid, SIGKILL);
+    waitpid(pid, &status, 0);
+
+    return byte == 1 ? 0 : -1;
+}
+#endif
+
+/* Count the rows of table T. */
+static int
+count_rows(db_t database)
+{
+    perf_context_t ctx;
+    int count = 0;
+    db_result_t rc;
+
+    if (perf_open_context(&ctx, database) != 0) {
+        return -1;
+    }
+    for (rc = db_seek_first(ctx.t_cursor); DB_OK == rc && !db_eof(ctx.t_cursor); rc = db_seek_next(ctx.t_cursor)) {
+        count++;
+    }
+    perf_close_context(&ctx);
+
+    return DB_OK == rc ? count : -1;
+}
+
+/* Time one cold open, then count the rows and shut down. */
+static int
+measure_open(const perf_options_t * options, recovery_cell_t * cell, uint64_t clean_bytes)
+{
+    uint64_t size = database_files_size(options->database);
+    uint64_t start;
+    uint64_t latency;
+    db_t database;
+
+    cell->journal_bytes += size > clean_bytes ? size - clean_bytes : 0;
+    drop_file_cache(options->database);
+
+    /* Open with the cache and page settings of the benchmark. */
+    start = perf_clock_ns();
+    database = perf_open_database(options);
+    latency = perf_clock_ns() - start;
+    if (database == NULL) {
+        return -1;
+    }
+    perf_stats_record(&cell->stats, latency);
+    cell->stats.elapsed_ns += latency;
+
+    cell->recovered_rows = count_rows(database);
+    db_shutdown(database, 0, NULL);
+
+    return cell->recovered_rows < 0 ? -1 : 0;
+}
+
+static int
+run_cell(const perf_options_t * options, recovery_cell_t * cell)
+{
+    uint64_t clean_bytes = 0;
+    int rc = 0;
+    int i;
+
+    perf_stats_init(&cell->stats, perf_recovery_names[cell->recovery]);
+
+    for (i = 0; i < options->iterations && rc == 0; i++) {
+        /* The clean case reopens the same database every time. */
+        if (i == 0 || cell->recovery != RECOVERY_CLEAN) {
+            rc = build_database(options, cell->db_rows);
+            cell->db_bytes = perf_file_size(options->database);
+            clean_bytes = database_files_size(options->database);
+        }
+
+        if (rc == 0 && cell->recovery == RECOVERY_UNCOMMITTED) {
+            rc = write_pending(options, cell->db_rows, cell->pending_rows);
+        }
+#ifdef HAVE_FORK
+        if (rc == 0 && cell->recovery == RECOVERY_KILLED) {
+            rc = kill_pending_writer(options, cell->db_rows, cell->pending_rows);
+        }
+#endif
+
+        rc = rc ? rc : measure_open(options, cell, clean_bytes);
+    }
+
+    if (options->iterations > 0) {
+        cell->journal_bytes /= (uint64_t)options->iterations;
+    }
+    return rc;
+}
+
+/* Reports. */
+
+static void
+print_recovery_header(FILE * out)
+{
+    fprintf(out, "%-12s %10s %10s %10s %10s %6s %10s %10s %10s %10s\n",
+            "case", "db rows", "pending", "db KB", "journal KB", "opens",
+            "mean ms", "p50 ms", "max ms", "rows");
+}
+
+static void
+print_recovery_row(FILE * out, const recovery_cell_t * cell)
+{
+    const perf_stats_t * stats = &cell->stats;
+
+    fprintf(out, "%-12s %10d %10d %10.0f %10.0f %6lu %10.2f %10.2f %10.2f %10d\n",
+            perf_recovery_names[cell->recovery],
+            cell->db_rows,
+            cell->pending_rows,
+            (double)cell->db_bytes / 1024.0,
+            (double)cell->journal_bytes / 1024.0,
+            (unsigned long)stats->count,
+            stats->count ? (double)stats->sum_ns / (double)stats->count / 1e6 : 0.0,
+            (double)perf_stats_percentile(stats, 50.0) / 1e6,
+            (double)stats->max_ns / 1e6,
+            cell->recovered_rows);
+}
+
+static int
+write_json_report(const perf_options_t * options, const recovery_cell_t * cells, int cell_count)
+{
+    FILE * out = 0 == strcmp(options->json_file, "-") ? stdout : fopen(options->json_file, "w");
+    int i;
+
+    if (out == NULL) {
+        printf("Unable to open JSON report file: %s\n", options->json_file);
+        return -1;
+    }
+
+    fprintf(out, "{\n  \"benchmark\": \"performance\",\n  \"mode\": \"recovery\",\n  \"config\": { \"database\": ");
+    perf_report_json_string(out, options->database);
+    fprintf(out, ", \"tx_rows\": %d, \"page_size\": %d, \"cache_size\": %d, \"iterations\": %d },\n",
+            options->tx_rows, options->page_size, options->cache_size, options->iterations);
+    fprintf(out, "  \"recovery\": [\n");
+    for (i = 0; i < cell_count; i++) {
+        const recovery_cell_t * cell = &cells[i];
+
+        fprintf(out, "    { \"case\": \"%s\", \"db_rows\": %d, \"pending_rows\": %d, \"db_bytes\": %lu, \"journal_bytes\": %lu, \"recovered_rows\": %d, \"open\": ",
+                perf_recovery_names[cell->recovery], cell->db_rows, cell->pending_rows,
+                (unsigned long)cell->db_bytes, (unsigned long)cell->journal_bytes,
+                cell->recovered_rows);
+        perf_report_json_stats(out, &cell->stats);
+        fprintf(out, " }%s\n", i + 1 < cell_count ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
+
+int
+perf_run_recovery(const perf_options_t * options)
+{
+    recovery_cell_t * cells;
+    int cell_count = 0;
+    int rc = 0;
+    int d;
+
+    if (options->storage != PERF_STORAGE_FILE || strstr(options->database, "://") != NULL) {
+        printf("Recovery mode needs a local database file\n");
+        return -1;
+    }
+
+#ifndef HAVE_FORK
+    if (options->recovery_cases & (1u << RECOVERY_KILLED)) {
+        printf("The killed case needs fork() and is skipped on this system\n");
+    }
+#endif
+
+    cells = (recovery_cell_t *)malloc(options->recovery_db_rows_count
+                                      * (1 + RECOVERY_COUNT * options->recovery_pending_count)
+                                      * sizeof(recovery_cell_t));
+    if (cells == NULL) {
+        printf("Out of memory for statistics\n");
+        return -1;
+    }
+
+    printf("Recovery benchmark, %d rows per transaction, %d opens per case\n",
+           options->tx_rows, options->iterations);
+    print_recovery_header(stdout);
+    fflush(stdout);
+
+    for (d = 0; d < options->recovery_db_rows_count && rc == 0; d++) {
+        int r;
+
+        for (r = 0; r < RECOVERY_COUNT && rc == 0; r++) {
+            int p;
+
+            if (!(options->recovery_cases & (1u << r))) {
+                continue;
+            }
+#ifndef HAVE_FORK
+            if (r == RECOVERY_KILLED) {
+                continue;
+            }
+#endif
+
+            /* The clean case has no pending rows, so it runs once. */
+            for (p = 0; p < (r == RECOVERY_CLEAN ? 1 : options->recovery_pending_count) && rc == 0; p++) {
+                recovery_cell_t * cell = &cells[cell_count];
+
+                cell->recovery = (perf_recovery_t)r;
+                cell->db_rows = options->recovery_db_rows[d];
+                cell->pending_rows = r == RECOVERY_CLEAN ? 0 : options->recovery_pending_rows[p];
+                cell->db_bytes = 0;
+                cell->journal_bytes = 0;
+                cell->recovered_rows = 0;
+
+                rc = run_cell(options, cell);
+                if (rc == 0) {
+                    print_recovery_row(stdout, cell);
+                    fflush(stdout);
+                    cell_count++;
+                }
+            }
+        }
+    }
+
+    if (rc == 0 && options->json_file != NULL) {
+        rc = write_json_report(options, cells, cell_count);
+    }
+
+    free(cells);
+
+    return rc;
+}
@@ -0,0 +1,739 @@
+/**************************************************************************/
+/*                                                                        */
+/*      Copyright (c) 2005-2019 by ITTIA L.L.C. All rights reserved.      */
+/*                                                                        */
+/*  This software is copyrighted by and is the sole property of ITTIA     */
+/*  L.L.C.  All rights, title, ownership, or other interests in the       */
+/*  software remain the property of ITTIA L.L.C.  This software may only  */
+/*  be used in accordance with the corresponding license agreement.  Any  */
+/*  unauthorized use, duplication, transmission, distribution, or         */
+/*  disclosure of this software is expressly forbidden.                   */
+/*                                                                        */
+/*  This Copyright notice may not be removed or modified without prior    */
+/*  written consent of ITTIA L.L.C.                                       */
+/*                                                                        */
+/*  ITTIA L.L.C. reserves the right to modify this software without       */
+/*  notice.                                                               */
+/*                                                                        */
+/*  info@ittia.com                                                        */
+/*  http://www.ittia.com                                                  */
+/*                                                                        */
+/*                                                                        */
+/**************************************************************************/
+
+
+/** @file performance_replay.c
+ *
+ * Script replay mode of the performance benchmark.
+ *
+ * The SQL statements in --script are run by --threads client threads at
+ * once, each with its own connection to the database. The database is
+ * usually a server URI such as idb+tcp://localhost/eds.ittiadb or
+ * idb+shm://server/database, for example the database shared by the
+ * embedded_database_server example, so the load goes through the server.
+ * The database must already exist; replay mode does not create or empty
+ * any tables, though the script may.
+ *
+ * A script in the default sql format is split into statements at each
+ * semicolon outside of quotes and comments, like a dump written by the
+ * sql_export example. In the lines format every line is one statement,
+ * like the input of a dbs_sql_line_shell() session; lines that start with
+ * a period are shell commands and are skipped.
+ *
+ * Each client runs the whole script once per iteration, starting at a
+ * different statement so that clients do not run in lockstep, or runs it
+ * repeatedly for --duration seconds. Every statement is committed on its
+ * own. Statements that fail, for example inserts of a key another client
+ * already inserted, are counted and the replay continues.
+ *
+ * --think-time adds a random pause after each statement, exponentially
+ * distributed with the given mean, as a client application would.
+ * --rate limits the statements per second of all clients together. With a
+ * rate, statements are started on a fixed schedule and their latency is
+ * measured from the scheduled start, so time spent waiting behind a slow
+ * statement is included in the latency rather than hidden.
+ *
+ * Statements are grouped into templates by replacing numbers and quoted
+ * strings with ?, so every INSERT INTO T VALUES (n, 'text') falls into
+ * one template. Each template has its own latency histogram.
+ */
+
+#include "performance.h"
+#include "../shared_access/thread_utils.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Templates beyond this many share the last histogram. */
+#define REPLAY_MAX_TEMPLATES 64
+
+typedef struct {
+    char * text;
+    char name[8];               ///< T1, T2, ...
+} replay_template_t;
+
+/* Statements of the script, split in place. */
+typedef struct {
+    char * data;
+    char ** statements;
+    int * template_of;          ///< Template index of each statement
+    int statement_count;
+    replay_template_t templates[REPLAY_MAX_TEMPLATES + 1];
+    int template_count;
+    int other;                  ///< Some statements share the last histogram
+} replay_script_t;
+
+typedef struct {
+    const perf_options_t * options;
+    const replay_script_t * script;
+    int client;
+    perf_stats_t * stats;       ///< One per template, NULL for warmup rounds
+
+    os_thread_t * thread;
+    uint64_t start_ns;
+    uint64_t end_ns;
+    uint64_t errors;            ///< Failed statements, other than lock conflicts
+    int rc;
+} client_t;
+
+/* Sleep. */
+
+#if defined(_WIN32)
+#include <windows.h>
+
+static void
+sleep_ns(uint64_t ns)
+{
+    Sleep((DWORD)(ns / 1000000u));
+}
+#elif defined(OS_UCOS_III)
+#include <os.h>
+
+static void
+sleep_ns(uint64_t ns)
+{
+    OS_ERR err;
+    OSTimeDly((OS_TICK)(ns / (1000000000u / OS_CFG_TICK_RATE_HZ)), OS_OPT_TIME_DLY, &err);
+}
+#else
+#include <time.h>
+
+static void
+sleep_ns(uint64_t ns)
+{
+    struct timespec ts;
+
+    ts.tv_sec = (time_t)(ns / 1000000000u);
+    ts.tv_nsec = (long)(ns % 1000000000u);
+    nanosleep(&ts, NULL);
+}
+#endif
+
+/* Script loading. */
+
+static char *
+read_file(const char * path)
+{
+    FILE * file = fopen(path, "rb");
+    char * data = NULL;
+    size_t length = 0;
+    size_t size = 0;
+    size_t n;
+
+    if (file == NULL) {
+        printf("Unable to open script: %s\n", path);
+        return NULL;
+    }
+
+    do {
+        if (size - length < 4096) {
+            char * grown = (char *)realloc(data, size = size * 2 + 65536);
+            if (grown == NULL) {
+                printf("Out of memory for script\n");
+                free(data);
+                fclose(file);
+                return NULL;
+            }
+            data = grown;
+        }
+        n = fread(data + length, 1, size - length - 1, file);
+        length += n;
+    } while (n > 0);
+
+    fclose(file);
+    data[length] = '\0';
+    return data;
+}
+
+/* Template of a statement: numbers and quoted strings are replaced with ?,
+ * and runs of whitespace with one space. */
+static void
+make_template(const char * sql, char * template_text)
+{
+    char * out = template_text;
+    char prev = ' ';
+
+    while (*sql != '\0') {
+        char c = *sql;
+
+        if (c == '\'') {
+            /* A doubled quote inside the string continues it. */
+            do {
+                for (sql++; *sql != '\0' && *sql != '\''; sql++) {
+                }
+                if (*sql == '\'') {
+                    sql++;
+                }
+            } while (*sql == '\'');
+            *out++ = '?';
+        }
+        else if (isdigit((unsigned char)c) && !isalnum((unsigned char)prev) && prev != '_') {
+            while (isalnum((unsigned char)*sql) || *sql == '.'
+                   || ((*sql == '+' || *sql == '-') && (sql[-1] == 'e' || sql[-1] == 'E'))) {
+                sql++;
+            }
+            *out++ = '?';
+        }
+        else if (isspace((unsigned char)c)) {
+            while (isspace((unsigned char)*sql)) {
+                sql++;
+            }
+            if (*sql != '\0') {
+                *out++ = ' ';
+            }
+        }
+        else {
+            *out++ = c;
+            sql++;
+        }
+        prev = out[-1];
+    }
+    *out = '\0';
+}
+
+/* Add a statement and its template. Returns -1 if out of memory. */
+static int
+add_statement(replay_script_t * script, char * sql)
+{
+    char * template_text;
+    int t;
+
+    while (isspace((unsigned char)*sql)) {
+        sql++;
+    }
+    if (*sql == '\0') {
+        return 0;
+    }
+
+    template_text = (char *)malloc(strlen(sql) + 1);
+    if (template_text == NULL) {
+        return -1;
+    }
+    make_template(sql, template_text);
+
+    for (t = 0; t < script->template_count; t++) {
+        if (0 == strcmp(script->templates[t].text, template_text)) {
+            break;
+        }
+    }
+    if (t < script->template_count) {
+        free(template_text);
+    }
+    else if (t < REPLAY_MAX_TEMPLATES) {
+        script->templates[t].text = template_text;
+        sprintf(script->templates[t].name, "T%d", t + 1);
+        script->template_count++;
+    }
+    else {
+        free(template_text);
+        script->other = 1;
+    }
+
+    script->statements[script->statement_count] = sql;
+    script->template_of[script->statement_count] = t;
+    script->statement_count++;
+    return 0;
+}
+
+/* Split SQL text into statements in place: each statement is terminated
+ * at its semicolon, and comments are blanked out. Returns -1 if out of
+ * memory. */
+static int
+split_sql(char * p, replay_script_t * script)
+{
+    char * statement = p;
+    char quote = '\0';
+
+    for (; *p != '\0'; p++) {
+        if (quote != '\0') {
+            if (*p == quote) {
+                quote = '\0';
+            }
+        }
+        else if (*p == '\'' || *p == '"') {
+            quote = *p;
+        }
+        else if (p[0] == '-' && p[1] == '-') {
+            for (; *p != '\0' && *p != '\n'; p++) {
+                *p = ' ';
+            }
+            if (*p == '\0') {
+                break;
+            }
+        }
+        else if (p[0] == '/' && p[1] == '*') {
+            for (; *p != '\0' && !(p[0] == '*' && p[1] == '/'); p++) {
+                *p = ' ';
+            }
+            if (*p == '\0') {
+                break;
+            }
+            p[0] = ' ';
+            p[1] = ' ';
+            p++;
+        }
+        else if (*p == ';') {
+            *p = '\0';
+            if (add_statement(script, statement) != 0) {
+                return -1;
+            }
+            statement = p + 1;
+        }
+    }
+    return add_statement(script, statement);
+}
+
+/* Split text into one statement per line, skipping shell commands.
+ * Returns -1 if out of memory. */
+static int
+split_lines(char * p, replay_script_t * script)
+{
+    while (*p != '\0') {
+        char * line = p;
+        char * end;
+
+        p += strcspn(p, "\n");
+        if (*p != '\0') {
+            *p++ = '\0';
+        }
+
+        /* A trailing semicolon is optional. */
+        end = line + strlen(line);
+        while (end > line && (isspace((unsigned char)end[-1]) || end[-1] == ';')) {
+            *--end = '\0';
+        }
+        while (isspace((unsigned char)*line)) {
+            line++;
+        }
+        if (*line != '.' && add_statement(script, line) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void
+free_script(replay_script_t * script)
+{
+    int t;
+
+    for (t = 0; t <= REPLAY_MAX_TEMPLATES; t++) {
+        free(script->templates[t].text);
+    }
+    free(script->template_of);
+    free(script->statements);
+    free(script->data);
+}
+
+static int
+load_script(const perf_options_t * options, replay_script_t * script)
+{
+    size_t max_statements = 1;
+    const char * p;
+
+    memset(script, 0, sizeof(*script));
+
+    script->data = read_file(options->script_file);
+    if (script->data == NULL) {
+        return -1;
+    }
+
+    /* Every statement ends with a separator, except perhaps the last. */
+    for (p = script->data; *p != '\0'; p++) {
+        if (*p == ';' || *p == '\n') {
+            max_statements++;
+        }
+    }
+    script->statements = (char **)malloc(max_statements * sizeof(char *));
+    script->template_of = (int *)malloc(max_statements * sizeof(int));
+    if (script->statements == NULL || script->template_of == NULL) {
+        printf("Out of memory for script\n");
+        free_script(script);
+        return -1;
+    }
+
+    if ((options->script_lines ? split_lines(script->data, script) : split_sql(script->data, script)) != 0) {
+        printf("Out of memory for script\n");
+        free_script(script);
+        return -1;
+    }
+
+    if (script->statement_count == 0) {
+        printf("No statements in script: %s\n", options->script_file);
+        free_script(script);
+        return -1;
+    }
+    if (script->other) {
+        /* Report the shared histogram as one more template. */
+        replay_template_t * other = &script->templates[REPLAY_MAX_TEMPLATES];
+
+        other->text = (char *)malloc(sizeof("(other templates)"));
+        if (other->text == NULL) {
+            printf("Out of memory for script\n");
+            free_script(script);
+            return -1;
+        }
+        strcpy(other->text, "(other templates)");
+        strcpy(other->name, "other");
+        script->template_count = REPLAY_MAX_TEMPLATES + 1;
+    }
+    return 0;
+}
+
+/* Clients. */
+
+/* Prepare and run one statement in its own transaction, reading every
+ * row of a query. Returns DB_NOERROR, or the error of the statement as
+ * it was before the transaction was aborted. */
+static int
+run_statement(db_t database, const char * sql)
+{
+    db_cursor_t cursor;
+    db_result_t rc = DB_FAIL;
+    int error = DB_NOERROR;
+
+    cursor = db_prepare_sql_cursor(database, sql, DB_CURSOR_ENCODING_UTF8);
+    if (cursor != NULL && db_is_prepared(cursor) > 0) {
+        rc = db_execute(cursor, NULL, NULL);
+        if (DB_OK == rc && db_is_browsable(cursor) > 0) {
+            db_row_t row = db_alloc_cursor_row(cursor);
+
+            for (rc = db_seek_first(cursor); DB_OK == rc && !db_eof(cursor); rc = db_seek_next(cursor)) {
+                rc = db_fetch(cursor, row, NULL);
+                if (DB_OK != rc) {
+                    break;
+                }
+            }
+            db_free_row(row);
+        }
+    }
+    if (DB_OK != rc) {
+        /* Read the error first: closing the cursor and aborting can change it. */
+        error = get_db_error();
+    }
+    if (cursor != NULL) {
+        db_close_cursor(cursor);
+    }
+
+    if (DB_OK == rc && db_is_active_tx(database)) {
+        rc = db_commit_tx(database, 0);
+        error = DB_OK == rc ? DB_NOERROR : get_db_error();
+    }
+    if (DB_OK != rc) {
+        if (db_is_active_tx(database)) {
+            db_abort_tx(database, 0);
+        }
+        return error != DB_NOERROR ? error : -1;
+    }
+    return DB_NOERROR;
+}
+
+static void
+client_proc(client_t * client)
+{
+    const perf_options_t * options = client->options;
+    const replay_script_t * script = client->script;
+    perf_keygen_t random;
+    uint64_t deadline;
+    uint64_t interval_ns = 0;
+    uint64_t next;
+    int first;
+    int error;
+    int i;
+    db_t database;
+
+    client->rc = -1;
+    client->errors = 0;
+
+    database = perf_open_database(options);
+    if (database == NULL) {
+        return;
+    }
+
+    perf_keygen_init(&random, KEYS_UNIFORM, 1, options);
+    /* A different random sequence for each client. */
+    random.state ^= (uint64_t)(client->client + 1) * 0x9E3779B97F4A7C15u;
+
+    if (options->rate != 0) {
+        interval_ns = (uint64_t)options->threads * 1000000000u / (uint64_t)options->rate;
+    }
+    first = (int)((int64_t)client->client * script->statement_count / options->threads);
+
+    client->start_ns = perf_clock_ns();
+    deadline = client->start_ns + (uint64_t)options->duration * 1000000000u;
+    next = client->start_ns;
+
+    for (i = 0; options->duration != 0 ? next < deadline : i < script->statement_count; i++) {
+        int k = (first + i) % script->statement_count;
+        uint64_t start = perf_clock_ns();
+        uint64_t now;
+
+        if (interval_ns != 0) {
+            if (next > start) {
+                sleep_ns(next - start);
+            }
+            start = next;
+            next += interval_ns;
+        }
+
+        error = run_statement(database, script->statements[k]);
+        if (error != DB_NOERROR) {
+            if (error == DB_ELOCKED) {
+                if (client->stats) {
+                    client->stats[script->template_of[k]].conflicts++;
+                }
+            }
+            else {
+                client->errors++;
+            }
+        }
+        else if (client->stats) {
+            perf_stats_record(&client->stats[script->template_of[k]], perf_clock_ns() - start);
+        }
+
+        now = perf_clock_ns();
+        if (options->think_time != 0) {
+            /* Exponentially distributed pause with the given mean. */
+            double u = perf_keygen_uniform(&random);
+            sleep_ns((uint64_t)(-log(1.0 - u) * options->think_time * 1e6));
+        }
+        if (interval_ns == 0) {
+            next = now;
+        }
+    }
+
+    client->end_ns = perf_clock_ns();
+    client->rc = 0;
+    db_shutdown(database, 0, NULL);
+}
+
+/* Run the script once on every client and merge their statistics into
+ * stats. Returns -1 if a client could not connect. */
+static int
+run_clients(const perf_options_t * options, const replay_script_t * script,
+            client_t * clients, perf_stats_t * client_stats, perf_stats_t * stats,
+            uint64_t * errors)
+{
+    uint64_t first_start = 0;
+    uint64_t last_end = 0;
+    int spawned;
+    int rc = 0;
+    int c;
+    int t;
+
+    for (spawned = 0; spawned < options->threads; spawned++) {
+        client_t * client = &clients[spawned];
+
+        client->options = options;
+        client->script = script;
+        client->client = spawned;
+        client->stats = NULL;
+        if (stats != NULL) {
+            client->stats = &client_stats[spawned * script->template_count];
+            for (t = 0; t < script->template_count; t++) {
+                perf_stats_init(&client->stats[t], script->templates[t].name);
+            }
+        }
+
+        if (thread_spawn((thread_proc_t)client_proc, client, THREAD_JOINABLE, &client->thread) != 0) {
+            printf("Unable to start client thread\n");
+            rc = -1;
+            break;
+        }
+    }
+
+    for (c = 0; c < spawned; c++) {
+        thread_join(clients[c].thread);
+    }
+
+    for (c = 0; c < spawned && rc == 0; c++) {
+        if (clients[c].rc != 0) {
+            rc = -1;
+        }
+        else if (stats != NULL) {
+            if (c == 0 || clients[c].start_ns < first_start) {
+                first_start = clients[c].start_ns;
+            }
+            if (clients[c].end_ns > last_end) {
+                last_end = clients[c].end_ns;
+            }
+            for (t = 0; t < script->template_count; t++) {
+                perf_stats_merge(&stats[t], &clients[c].stats[t]);
+            }
+            *errors += clients[c].errors;
+        }
+    }
+
+    if (rc == 0 && stats != NULL) {
+        /* Clients overlap in time, so every template is measured over the
+         * wall clock span from the first start to the last finish. */
+        for (t = 0; t < script->template_count; t++) {
+            stats[t].elapsed_ns += last_end - first_start;
+        }
+    }
+
+    return rc;
+}
+
+/* Reports. */
+
+static void
+print_templates(FILE * out, const replay_script_t * script)
+{
+    int t;
+
+    fprintf(out, "Templates:\n");
+    for (t = 0; t < script->template_count; t++) {
+        fprintf(out, "  %-6s %s\n", script->templates[t].name, script->templates[t].text);
+    }
+}
+
+static int
+write_json_report(const perf_options_t * options, const replay_script_t * script,
+                  const perf_stats_t * stats, const perf_stats_t * total, uint64_t errors)
+{
+    FILE * out = 0 == strcmp(options->json_file, "-") ? stdout : fopen(options->json_file, "w");
+    int t;
+
+    if (out == NULL) {
+        printf("Unable to open JSON report file: %s\n", options->json_file);
+        return -1;
+    }
+
+    fprintf(out, "{\n  \"benchmark\": \"performance\",\n  \"mode\": \"replay\",\n  \"config\": { \"database\": ");
+    perf_report_json_string(out, options->database);
+    fprintf(out, ", \"script\": ");
+    perf_report_json_string(out, options->script_file);
+    fprintf(out, ", \"format\": \"%s\", \"statements\": %d, \"clients\": %d, \"think_time_ms\": %d, \"rate\": %d, \"duration_s\": %d, \"iterations\": %d, \"warmup\": %d },\n",
+            options->script_lines ? "lines" : "sql", script->statement_count, options->threads,
+            options->think_time, options->rate, options->duration,
+            options->iterations, options->warmup);
+    fprintf(out, "  \"errors\": %lu,\n  \"total\": ", (unsigned long)errors);
+    perf_report_json_stats(out, total);
+    fprintf(out, ",\n  \"templates\": [");
+    for (t = 0; t < script->template_count; t++) {
+        fprintf(out, t == 0 ? "\n    " : ",\n    ");
+        fprintf(out, "{ \"template\": ");
+        perf_report_json_string(out, script->templates[t].text);
+        fprintf(out, ", \"stats\": ");
+        perf_report_json_stats(out, &stats[t]);
+        fprintf(out, " }");
+    }
+    fprintf(out, "\n  ]\n}\n");
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
+
+int
+perf_run_replay(const perf_options_t * options)
+{
+    replay_script_t script;
+    client_t * clients;
+    perf_stats_t * client_stats;
+    perf_stats_t * stats;
+    perf_stats_t total;
+    uint64_t errors = 0;
+    int rc = 0;
+    int t;
+    int i;
+
+    if (options->script_file == NULL) {
+        printf("Replay mode needs a --script\n");
+        return -1;
+    }
+    if (load_script(options, &script) != 0) {
+        return -1;
+    }
+
+    clients = (client_t *)calloc(options->threads, sizeof(client_t));
+    client_stats = (perf_stats_t *)malloc((size_t)options->threads * script.template_count * sizeof(perf_stats_t));
+    stats = (perf_stats_t *)malloc(script.template_count * sizeof(perf_stats_t));
+    if (clients == NULL || client_stats == NULL || stats == NULL) {
+        printf("Out of memory for statistics\n");
+        free(stats);
+        free(client_stats);
+        free(clients);
+        free_script(&script);
+        return -1;
+    }
+    for (t = 0; t < script.template_count; t++) {
+        perf_stats_init(&stats[t], script.templates[t].name);
+    }
+    perf_stats_init(&total, "total");
+
+    printf("Replay benchmark %s, %d statements, %d templates, %d clients",
+           options->script_file, script.statement_count, script.template_count, options->threads);
+    if (options->think_time != 0) {
+        printf(", %d ms think time", options->think_time);
+    }
+    if (options->rate != 0) {
+        printf(", %d statements/sec", options->rate);
+    }
+    if (options->duration != 0) {
+        printf(", %d seconds", options->duration);
+    }
+    printf(", %d iterations, %d warmup\n", options->iterations, options->warmup);
+    fflush(stdout);
+
+    for (i = 0; i < options->warmup && rc == 0; i++) {
+        rc = run_clients(options, &script, clients, client_stats, NULL, &errors);
+    }
+    for (i = 0; i < options->iterations && rc == 0; i++) {
+        rc = run_clients(options, &script, clients, client_stats, stats, &errors);
+    }
+
+    if (rc == 0) {
+        for (t = 0; t < script.template_count; t++) {
+            perf_stats_merge(&total, &stats[t]);
+        }
+        /* Every template histogram covers the same wall-clock time. */
+        total.elapsed_ns = stats[0].elapsed_ns;
+
+        print_templates(stdout, &script);
+        perf_report_table_header(stdout);
+        for (t = 0; t < script.template_count; t++) {
+            if (stats[t].count != 0) {
+                perf_report_table_row(stdout, &stats[t]);
+            }
+        }
+        perf_report_table_row(stdout, &total);
+        printf("%lu lock conflicts, %lu failed statements\n",
+               (unsigned long)total.conflicts, (unsigned long)errors);
+
+        if (options->json_file != NULL) {
+            rc = write_json_report(options, &script, stats, &total, errors);
+        }
+    }
+
+    free(stats);
+    free(client_stats);
+    free(clients);
+    free_script(&script);
+
+    return rc;
+}
@@ -0,0 +1,423 @@
+/**************************************************************************/
+/*                                                                        */
+/*      Copyright (c) 2005-2019 by ITTIA L.L.C. All rights reserved.      */
+/*                                                                        */
+/*  This software is copyrighted by and is the sole property of ITTIA     */
+/*  L.L.C.  All rights, title, ownership, or other interests in the       */
+/*  software remain the property of ITTIA L.L.C.  This software may only  */
+/*  be used in accordance with the corresponding license agreement.  Any  */
+/*  unauthorized use, duplication, transmission, distribution, or         */
+/*  disclosure of this software is expressly forbidden.                   */
+/*                                                                        */
+/*  This Copyright notice may not be removed or modified without prior    */
+/*  written consent of ITTIA L.L.C.                                       */
+/*                                                                        */
+/*  ITTIA L.L.C. reserves the right to modify this software without       */
+/*  notice.                                                               */
+/*                                                                        */
+/*  info@ittia.com                                                        */
+/*  http://www.ittia.com                                                  */
+/*                                                                        */
+/*                                                                        */
+/**************************************************************************/
+
+
+/** @file performance_scale.c
+ *
+ * Large dataset mode of the performance benchmark.
+ *
+ * Rows are generated from their row number as they are inserted, so no
+ * dataset is held in memory, and streamed into either table T or the
+ * "storage" table of file_storage/db_schema.h in transactions of
+ * --tx-rows rows until --max-rows rows are stored. Keys are a scrambled
+ * permutation of the row numbers, so index pages fill in random order.
+ *
+ * Checkpoints follow a 1, 2, 5 sequence in each decade from 10^4 rows. At
+ * each checkpoint the benchmark records:
+ *
+ *   - insert rate since the previous checkpoint and insert transaction
+ *     latency
+ *   - database file size and bytes per row
+ *   - latency of --seek-samples seeks to random existing keys, which grows
+ *     with the depth of the index
+ *   - time to scan the full table
+ */
+
+#include "performance.h"
+#include "dbs_schema.h"
+#include "../file_storage/db_schema.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define FIRST_CHECKPOINT 10000
+
+/* Cursors and row buffers for whichever table is being filled. */
+typedef struct {
+    int schema;
+    perf_context_t t;           ///< Table T
+
+    db_row_t storage_row;       ///< Table "storage"
+    db_cursor_t storage_cursor;
+    db_cursor_t storage_pkey_cursor;
+    storage_t storage;
+} scale_target_t;
+
+typedef struct {
+    int rows;
+    double insert_rows_per_sec;
+    perf_stats_t insert_tx;     ///< Latency of insert transactions since the last checkpoint
+    uint64_t file_size;
+    perf_stats_t seek;
+    uint64_t scan_ns;
+} scale_checkpoint_t;
+
+/* Next checkpoint after rows in the sequence 10^4, 2*10^4, 5*10^4, 10^5, ...
+ * The last checkpoint is always max_rows. */
+static int
+next_checkpoint(int rows, int max_rows)
+{
+    static const int steps[] = { 1, 2, 5 };
+    int64_t decade;
+    int64_t next = 0;
+    int i;
+
+    for (decade = FIRST_CHECKPOINT; next == 0; decade *= 10) {
+        for (i = 0; i < 3 && next == 0; i++) {
+            if (decade * steps[i] > rows) {
+                next = decade * steps[i];
+            }
+        }
+    }
+
+    return next > max_rows ? max_rows : (int)next;
+}
+
+/* Scrambled key of a row number. Multiplying by an odd constant is a
+ * permutation of 64-bit integers, so keys stay unique. */
+static int64_t
+storage_key(int row)
+{
+    return (int64_t)((uint64_t)row * 0x9E3779B97F4A7C15u);
+}
+
+static void
+fill_storage_row(storage_t * storage, int row)
+{
+    sprintf(storage->f0, "%08x", (unsigned int)row);
+    storage->f1 = storage_key(row);
+    storage->f2 = row * 0.5;
+    sprintf(storage->f3, "row %d", row);
+}
+
+static int
+open_target(scale_target_t * target, db_t database, int schema)
+{
+    db_table_cursor_t pkey_cursor_def;
+
+    memset(target, 0, sizeof(*target));
+    target->schema = schema;
+
+    if (schema == PERF_SCHEMA_T) {
+        return perf_open_context(&target->t, database);
+    }
+
+    if (dbs_create_schema(database, &db_schema) < 0) {
+        printf("Error creating storage schema: %d\n", (int)get_db_error());
+        return -1;
+    }
+
+    target->t.database = database;
+    target->storage_row = db_alloc_row(binds_def, DB_ARRAY_DIM(binds_def));
+    target->storage_cursor = db_open_table_cursor(database, STORAGE_TABLE, NULL);
+
+    db_table_cursor_init(&pkey_cursor_def);
+    pkey_cursor_def.index = PKEY_INDEX_NAME;
+    target->storage_pkey_cursor = db_open_table_cursor(database, STORAGE_TABLE, &pkey_cursor_def);
+    db_table_cursor_destroy(&pkey_cursor_def);
+
+    if (target->storage_row == NULL || target->storage_cursor == NULL || target->storage_pkey_cursor == NULL) {
+        printf("Error opening storage table cursors: %d\n", (int)get_db_error());
+        return -1;
+    }
+    return 0;
+}
+
+static void
+close_target(scale_target_t * target)
+{
+    if (target->schema == PERF_SCHEMA_T) {
+        perf_close_context(&target->t);
+        return;
+    }
+
+    if (target->storage_cursor != NULL) {
+        db_close_cursor(target->storage_cursor);
+    }
+    if (target->storage_pkey_cursor != NULL) {
+        db_close_cursor(target->storage_pkey_cursor);
+    }
+    if (target->storage_row != NULL) {
+        db_free_row(target->storage_row);
+    }
+}
+
+static db_result_t
+insert_row(scale_target_t * target, int row, int max_rows)
+{
+    if (target->schema == PERF_SCHEMA_T) {
+        perf_fill_row(&target->t, max_rows, row);
+        return db_insert(target->t.t_cursor, target->t.t_row, NULL, 0);
+    }
+
+    fill_storage_row(&target->storage, row);
+    return db_insert(target->storage_cursor, target->storage_row, &target->storage, 0);
+}
+
+static db_result_t
+seek_row(scale_target_t * target, int row)
+{
+    db_result_t rc;
+
+    if (target->schema == PERF_SCHEMA_T) {
+        target->t.id = GENERATE_ID(row);
+        rc = db_seek(target->t.t_ordered_cursor, DB_SEEK_EQUAL, target->t.t_row, NULL, 1);
+        return DB_OK == rc ? db_fetch(target->t.t_ordered_cursor, target->t.t_row, NULL) : rc;
+    }
+
+    target->storage.f1 = storage_key(row);
+    rc = db_seek(target->storage_pkey_cursor, DB_SEEK_EQUAL, target->storage_row, &target->storage, 1);
+    return DB_OK == rc ? db_fetch(target->storage_pkey_cursor, target->storage_row, &target->storage) : rc;
+}
+
+/* Count all rows with an unordered cursor, fetching each one. */
+static int
+scan_table(scale_target_t * target, uint64_t * rows)
+{
+    db_cursor_t cursor = target->schema == PERF_SCHEMA_T ? target->t.t_cursor : target->storage_cursor;
+    db_row_t row = target->schema == PERF_SCHEMA_T ? target->t.t_row : target->storage_row;
+    void * data = target->schema == PERF_SCHEMA_T ? NULL : &target->storage;
+    db_result_t rc = DB_OK;
+
+    *rows = 0;
+    db_begin_tx(target->t.database, 0);
+    for (rc = db_seek_first(cursor); DB_OK == rc && !db_eof(cursor); rc = db_seek_next(cursor)) {
+        rc = db_fetch(cursor, row, data);
+        (*rows)++;
+    }
+    db_commit_tx(target->t.database, 0);
+
+    if (DB_OK != rc) {
+        printf("Scan error: %d\n", (int)get_db_error());
+        return -1;
+    }
+    return 0;
+}
+
+/* Measure seeks, scan, and file size after rows have been inserted. */
+static int
+measure_checkpoint(scale_target_t * target, const perf_options_t * options,
+                   perf_keygen_t * keys, scale_checkpoint_t * checkpoint)
+{
+    uint64_t scanned;
+    uint64_t start;
+    int i;
+
+    perf_keygen_grow(keys, checkpoint->rows);
+
+    perf_stats_init(&checkpoint->seek, "seek");
+    start = perf_clock_ns();
+    db_begin_tx(target->t.database, 0);
+    for (i = 0; i < options->seek_samples; i++) {
+        uint64_t seek_start = perf_clock_ns();
+
+        if (DB_OK != seek_row(target, perf_keygen_next(keys))) {
+            printf("Seek error: %d\n", (int)get_db_error());
+            db_abort_tx(target->t.database, 0);
+            return -1;
+        }
+        perf_stats_record(&checkpoint->seek, perf_clock_ns() - seek_start);
+    }
+    db_commit_tx(target->t.database, 0);
+    checkpoint->seek.elapsed_ns = perf_clock_ns() - start;
+
+    start = perf_clock_ns();
+    if (scan_table(target, &scanned) != 0) {
+        return -1;
+    }
+    checkpoint->scan_ns = perf_clock_ns() - start;
+    if (scanned != (uint64_t)checkpoint->rows) {
+        printf("Scan found %lu rows, expected %d\n", (unsigned long)scanned, checkpoint->rows);
+        return -1;
+    }
+
+    checkpoint->file_size = perf_file_size(options->database);
+    return 0;
+}
+
+/* Reports. */
+
+static void
+print_scale_header(FILE * out)
+{
+    fprintf(out, "%10s %12s %10s %10s %10s %10s %10s %10s %10s\n",
+            "rows", "insert/sec", "tx p99 ms", "file MB", "bytes/row",
+            "seek p50", "seek p99", "seek p99.9", "scan ms");
+}
+
+static void
+print_scale_row(FILE * out, const scale_checkpoint_t * checkpoint)
+{
+    fprintf(out, "%10d %12.0f %10.2f %10.1f %10.1f %8.1fus %8.1fus %8.1fus %10.1f\n",
+            checkpoint->rows,
+            checkpoint->insert_rows_per_sec,
+            (double)perf_stats_percentile(&checkpoint->insert_tx, 99.0) / 1e6,
+            (double)checkpoint->file_size / (1024.0 * 1024.0),
+            (double)checkpoint->file_size / checkpoint->rows,
+            (double)perf_stats_percentile(&checkpoint->seek, 50.0) / 1000.0,
+            (double)perf_stats_percentile(&checkpoint->seek, 99.0) / 1000.0,
+            (double)perf_stats_percentile(&checkpoint->seek, 99.9) / 1000.0,
+            (double)checkpoint->scan_ns / 1e6);
+}
+
+static void
+write_json_checkpoint(FILE * out, const scale_checkpoint_t * checkpoint)
+{
+    fprintf(out, "{ \"rows\": %d, \"insert_rows_per_sec\": %.1f, \"file_size\": %lu, \"scan_ms\": %.3f,\n      \"insert_tx\": ",
+            checkpoint->rows, checkpoint->insert_rows_per_sec,
+            (unsigned long)checkpoint->file_size, (double)checkpoint->scan_ns / 1e6);
+    perf_report_json_stats(out, &checkpoint->insert_tx);
+    fprintf(out, ",\n      \"seek\": ");
+    perf_report_json_stats(out, &checkpoint->seek);
+    fprintf(out, " }");
+}
+
+int
+perf_run_scale(const perf_options_t * options)
+{
+    scale_checkpoint_t * checkpoint;
+    scale_target_t target;
+    perf_keygen_t keys;
+    FILE * json = NULL;
+    db_t database;
+    uint64_t segment_start;
+    int segment_first;
+    int checkpoint_count = 0;
+    int next;
+    int row = 0;
+    int rc = 0;
+
+    checkpoint = (scale_checkpoint_t *)malloc(sizeof(scale_checkpoint_t));
+    if (checkpoint == NULL) {
+        printf("Out of memory for statistics\n");
+        return -1;
+    }
+
+    if (options->json_file != NULL) {
+        json = 0 == strcmp(options->json_file, "-") ? stdout : fopen(options->json_file, "w");
+        if (json == NULL) {
+            printf("Unable to open JSON report file: %s\n", options->json_file);
+            free(checkpoint);
+            return -1;
+        }
+    }
+
+    database = perf_create_database(options);
+    if (database == NULL || open_target(&target, database, options->schema) != 0) {
+        if (database != NULL) {
+            close_target(&target);
+            db_shutdown(database, 0, NULL);
+        }
+        if (json != NULL && json != stdout) {
+            fclose(json);
+        }
+        free(checkpoint);
+        return -1;
+    }
+
+    perf_keygen_init(&keys, KEYS_UNIFORM, 1, options);
+
+    printf("Scale benchmark %d rows into table %s, %d rows per transaction\n",
+           options->max_rows, options->schema == PERF_SCHEMA_T ? "T" : STORAGE_TABLE, options->tx_rows);
+    print_scale_header(stdout);
+    fflush(stdout);
+
+    /* Each checkpoint is written out as soon as it is measured, so results
+     * of a long run are not lost if it is interrupted. */
+    if (json != NULL) {
+        fprintf(json, "{\n  \"benchmark\": \"performance\",\n  \"mode\": \"scale\",\n  \"config\": { \"database\": ");
+        perf_report_json_string(json, options->database);
+        fprintf(json, ", \"table\": \"%s\", \"max_rows\": %d, \"tx_rows\": %d, \"seek_samples\": %d },\n  \"checkpoints\": [",
+                options->schema == PERF_SCHEMA_T ? "T" : STORAGE_TABLE,
+                options->max_rows, options->tx_rows, options->seek_samples);
+        fflush(json);
+    }
+
+    next = next_checkpoint(0, options->max_rows);
+    segment_first = 1;
+    segment_start = perf_clock_ns();
+    perf_stats_init(&checkpoint->insert_tx, "insert_tx");
+
+    while (row < options->max_rows && rc == 0) {
+        uint64_t start = perf_clock_ns();
+        int end = row + options->tx_rows;
+        db_result_t db_rc = DB_OK;
+
+        /* Transactions never span a checkpoint. */
+        if (end > next) {
+            end = next;
+        }
+
+        db_begin_tx(database, 0);
+        while (row < end && DB_OK == db_rc) {
+            db_rc = insert_row(&target, ++row, options->max_rows);
+        }
+        if (DB_OK != db_rc) {
+            printf("Insert error: %d\n", (int)get_db_error());
+            db_abort_tx(database, 0);
+            rc = -1;
+            break;
+        }
+        db_commit_tx(database, 0);
+        perf_stats_record(&checkpoint->insert_tx, perf_clock_ns() - start);
+
+        if (row == next) {
+            uint64_t segment_ns = perf_clock_ns() - segment_start;
+
+            checkpoint->rows = row;
+            checkpoint->insert_tx.elapsed_ns = segment_ns;
+            checkpoint->insert_rows_per_sec = segment_ns ? (double)(row - segment_first + 1) * 1e9 / (double)segment_ns : 0.0;
+
+            rc = measure_checkpoint(&target, options, &keys, checkpoint);
+            if (rc == 0) {
+                print_scale_row(stdout, checkpoint);
+                fflush(stdout);
+                if (json != NULL) {
+                    fprintf(json, checkpoint_count ? ",\n    " : "\n    ");
+                    write_json_checkpoint(json, checkpoint);
+                    fflush(json);
+                }
+                checkpoint_count++;
+            }
+
+            next = next_checkpoint(row, options->max_rows);
+            segment_first = row + 1;
+            segment_start = perf_clock_ns();
+            perf_stats_init(&checkpoint->insert_tx, "insert_tx");
+        }
+    }
+
+    if (json != NULL) {
+        fprintf(json, "\n  ]\n}\n");
+        if (json != stdout) {
+            fclose(json);
+        }
+    }
+
+    close_target(&target);
+    db_shutdown(database, 0, NULL);
+
+    free(checkpoint);
+
+    return rc;
+}
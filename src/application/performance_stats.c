@@ -0,0 +1,344 @@
+/**************************************************************************/
+/*                                                                        */
+/*      Copyright (c) 2005-2019 by ITTIA L.L.C. All rights reserved.      */
+/*                                                                        */
+/*  This software is copyrighted by and is the sole property of ITTIA     */
+/*  L.L.C.  All rights, title, ownership, or other interests in the       */
+/*  software remain the property of ITTIA L.L.C.  This software may only  */
+/*  be used in accordance with the corresponding license agreement.  Any  */
+/*  unauthorized use, duplication, transmission, distribution, or         */
+/*  disclosure of this software is expressly forbidden.                   */
+/*                                                                        */
+/*  This Copyright notice may not be removed or modified without prior    */
+/*  written consent of ITTIA L.L.C.                                       */
+/*                                                                        */
+/*  ITTIA L.L.C. reserves the right to modify this software without       */
+/*  notice.                                                               */
+/*                                                                        */
+/*  info@ittia.com                                                        */
+/*  http://www.ittia.com                                                  */
+/*                                                                        */
+/*                                                                        */
+/**************************************************************************/
+
+/** @file performance_stats.c
+ *
+ * Monotonic clock, latency histograms, and report output for the
+ * performance benchmark example.
+ */
+
+#include "performance.h"
+
+#include <string.h>
+
+const char * const perf_phase_names[PHASE_COUNT] = {
+    "insert",
+    "table_scan",
+    "index_scan",
+    "seek",
+    "update",
+    "delete",
+};
+
+const char * const perf_mode_names[MODE_COUNT] = {
+    "phases",
+    "threads",
+    "batch",
+    "sweep",
+    "keys",
+    "ycsb",
+    "scale",
+    "recovery",
+    "blob",
+    "replay",
+};
+
+const char * const perf_completion_names[COMPLETION_COUNT] = {
+    "default",
+    "lazy",
+    "group",
+    "flush",
+};
+
+const char * const perf_storage_names[PERF_STORAGE_COUNT] = {
+    "file",
+    "memory",
+};
+
+/* Monotonic clock. */
+
+#if defined(_WIN32)
+#include <windows.h>
+
+uint64_t perf_clock_ns(void)
+{
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+
+    if (frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&counter);
+
+    /* Split the conversion to avoid overflow of counter * 10^9. */
+    return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000u
+        + (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000u / (uint64_t)frequency.QuadPart;
+}
+#elif defined(OS_UCOS_III)
+#include <os.h>
+
+uint64_t perf_clock_ns(void)
+{
+    OS_ERR err;
+    /* Resolution is limited to the kernel tick rate. */
+    return (uint64_t)OSTimeGet(&err) * (1000000000u / OS_CFG_TICK_RATE_HZ);
+}
+
+#else
+#include <time.h>
+
+uint64_t perf_clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+#endif
+
+/* File size. */
+
+#if defined(_WIN32)
+#include <sys/types.h>
+#include <sys/stat.h>
+
+uint64_t perf_file_size(const char * path)
+{
+    struct _stati64 st;
+    return _stati64(path, &st) == 0 ? (uint64_t)st.st_size : 0;
+}
+#elif defined(OS_UCOS_III)
+
+uint64_t perf_file_size(const char * path)
+{
+    return 0;
+}
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+
+uint64_t perf_file_size(const char * path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 ? (uint64_t)st.st_size : 0;
+}
+#endif
+
+/* Latency statistics. */
+
+/* Index of the most significant set bit of a non-zero value. */
+static int
+msb_index(uint64_t value)
+{
+    int msb = 0;
+
+    if (value >> 32) { value >>= 32; msb += 32; }
+    if (value >> 16) { value >>= 16; msb += 16; }
+    if (value >> 8)  { value >>= 8;  msb += 8; }
+    if (value >> 4)  { value >>= 4;  msb += 4; }
+    if (value >> 2)  { value >>= 2;  msb += 2; }
+    if (value >> 1)  { msb += 1; }
+
+    return msb;
+}
+
+static int
+bucket_index(uint64_t value)
+{
+    int shift;
+
+    if (value < PERF_HIST_SUB) {
+        return (int)value;
+    }
+
+    shift = msb_index(value) - PERF_HIST_SUB_BITS;
+    return (shift + 1) * PERF_HIST_SUB + (int)((value >> shift) & (PERF_HIST_SUB - 1));
+}
+
+/* Highest value that falls into a bucket. */
+static uint64_t
+bucket_upper_bound(int index)
+{
+    int shift;
+    uint64_t sub;
+
+    if (index < PERF_HIST_SUB) {
+        return (uint64_t)index;
+    }
+
+    shift = index / PERF_HIST_SUB - 1;
+    sub = (uint64_t)(index % PERF_HIST_SUB);
+    return ((PERF_HIST_SUB + sub) << shift) + (((uint64_t)1 << shift) - 1);
+}
+
+void
+perf_stats_init(perf_stats_t * stats, const char * name)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->name = name;
+    stats->min_ns = UINT64_MAX;
+}
+
+void
+perf_stats_record(perf_stats_t * stats, uint64_t latency_ns)
+{
+    stats->buckets[bucket_index(latency_ns)]++;
+    stats->count++;
+    stats->sum_ns += latency_ns;
+    if (latency_ns < stats->min_ns) {
+        stats->min_ns = latency_ns;
+    }
+    if (latency_ns > stats->max_ns) {
+        stats->max_ns = latency_ns;
+    }
+}
+
+void
+perf_stats_merge(perf_stats_t * into, const perf_stats_t * from)
+{
+    int i;
+
+    for (i = 0; i < PERF_HIST_BUCKETS; i++) {
+        into->buckets[i] += from->buckets[i];
+    }
+    into->count += from->count;
+    into->sum_ns += from->sum_ns;
+    into->elapsed_ns += from->elapsed_ns;
+    into->conflicts += from->conflicts;
+    for (i = 0; i < COUNTER_COUNT; i++) {
+        into->counters[i] += from->counters[i];
+    }
+    if (from->min_ns < into->min_ns) {
+        into->min_ns = from->min_ns;
+    }
+    if (from->max_ns > into->max_ns) {
+        into->max_ns = from->max_ns;
+    }
+}
+
+/// Latency at the given percentile (0-100), in nanoseconds.
+uint64_t
+perf_stats_percentile(const perf_stats_t * stats, double percentile)
+{
+    uint64_t rank;
+    uint64_t seen = 0;
+    int i;
+
+    if (stats->count == 0) {
+        return 0;
+    }
+
+    /* Nearest-rank method: smallest value with at least p% of samples at or below it. */
+    rank = (uint64_t)(percentile / 100.0 * (double)stats->count + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    if (rank > stats->count) {
+        rank = stats->count;
+    }
+
+    for (i = 0; i < PERF_HIST_BUCKETS; i++) {
+        seen += stats->buckets[i];
+        if (seen >= rank) {
+            uint64_t value = bucket_upper_bound(i);
+            return value > stats->max_ns ? stats->max_ns : value;
+        }
+    }
+
+    return stats->max_ns;
+}
+
+/// Operations per second over the wall-clock time of the phase.
+double
+perf_stats_throughput(const perf_stats_t * stats)
+{
+    if (stats->elapsed_ns == 0) {
+        return 0.0;
+    }
+    return (double)stats->count * 1e9 / (double)stats->elapsed_ns;
+}
+
+/* Reports. */
+
+#define NS_TO_US(ns) ((double)(ns) / 1000.0)
+
+void
+perf_report_table_header(FILE * out)
+{
+    fprintf(out, "%-12s %10s %10s %12s %10s %10s %10s %10s %10s\n",
+            "phase", "ops", "total ms", "ops/sec",
+            "p50 us", "p95 us", "p99 us", "p99.9 us", "max us");
+}
+
+void
+perf_report_table_row(FILE * out, const perf_stats_t * stats)
+{
+    fprintf(out, "%-12s %10lu %10.1f %12.0f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+            stats->name,
+            (unsigned long)stats->count,
+            (double)stats->elapsed_ns / 1e6,
+            perf_stats_throughput(stats),
+            NS_TO_US(perf_stats_percentile(stats, 50.0)),
+            NS_TO_US(perf_stats_percentile(stats, 95.0)),
+            NS_TO_US(perf_stats_percentile(stats, 99.0)),
+            NS_TO_US(perf_stats_percentile(stats, 99.9)),
+            NS_TO_US(stats->count ? stats->max_ns : 0));
+}
+
+/// Write a string as a JSON string literal.
+void
+perf_report_json_string(FILE * out, const char * value)
+{
+    fputc('"', out);
+    for (; *value; value++) {
+        switch (*value) {
+        case '"':  fputs("\\\"", out); break;
+        case '\\': fputs("\\\\", out); break;
+        case '\n': fputs("\\n", out); break;
+        case '\t': fputs("\\t", out); break;
+        default:
+            if ((unsigned char)*value < 0x20) {
+                fprintf(out, "\\u%04x", (unsigned char)*value);
+            }
+            else {
+                fputc(*value, out);
+            }
+        }
+    }
+    fputc('"', out);
+}
+
+/// Write one statistics record as a JSON object.
+void
+perf_report_json_stats(FILE * out, const perf_stats_t * stats)
+{
+    fprintf(out, "{ \"name\": ");
+    perf_report_json_string(out, stats->name);
+    fprintf(out, ", \"operations\": %lu, \"conflicts\": %lu, \"elapsed_ms\": %.3f, \"ops_per_sec\": %.1f, ",
+            (unsigned long)stats->count,
+            (unsigned long)stats->conflicts,
+            (double)stats->elapsed_ns / 1e6,
+            perf_stats_throughput(stats));
+    fprintf(out, "\"latency_us\": { \"min\": %.3f, \"mean\": %.3f, \"p50\": %.3f, \"p95\": %.3f, \"p99\": %.3f, \"p99_9\": %.3f, \"max\": %.3f }",
+            NS_TO_US(stats->count ? stats->min_ns : 0),
+            stats->count ? NS_TO_US(stats->sum_ns) / (double)stats->count : 0.0,
+            NS_TO_US(perf_stats_percentile(stats, 50.0)),
+            NS_TO_US(perf_stats_percentile(stats, 95.0)),
+            NS_TO_US(perf_stats_percentile(stats, 99.0)),
+            NS_TO_US(perf_stats_percentile(stats, 99.9)),
+            NS_TO_US(stats->max_ns));
+    if (perf_counters_enabled()) {
+        fprintf(out, ", \"counters\": ");
+        perf_report_json_counters(out, stats);
+    }
+    fprintf(out, " }");
+}
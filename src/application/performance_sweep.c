@@ -0,0 +1,224 @@
+/**************************************************************************/
+/*                                                                        */
+/*      Copyright (c) 2005-2019 by ITTIA L.L.C. All rights reserved.      */
+/*                                                                        */
+/*  This software is copyrighted by and is the sole property of ITTIA     */
+/*  L.L.C.  All rights, title, ownership, or other interests in the       */
+/*  software remain the property of ITTIA L.L.C.  This software may only  */
+/*  be used in accordance with the corresponding license agreement.  Any  */
+/*  unauthorized use, duplication, transmission, distribution, or         */
+/*  disclosure of this software is expressly forbidden.                   */
+/*                                                                        */
+/*  This Copyright notice may not be removed or modified without prior    */
+/*  written consent of ITTIA L.L.C.                                       */
+/*                                                                        */
+/*  ITTIA L.L.C. reserves the right to modify this software without       */
+/*  notice.                                                               */
+/*                                                                        */
+/*  info@ittia.com                                                        */
+/*  http://www.ittia.com                                                  */
+/*                                                                        */
+/*                                                                        */
+/**************************************************************************/
+
+
+/** @file performance_sweep.c
+ *
+ * Page size and page cache sweep mode of the performance benchmark.
+ *
+ * The database is recreated for every pair of --page-sizes and
+ * --cache-sizes values, and the phase set is run once for each dataset
+ * size in --cache-ratios. Dataset sizes are given as a percentage of the
+ * cache size, so a sweep measures working sets both smaller and larger
+ * than the page cache. Throughput of each phase is printed as a matrix,
+ * and the JSON report holds the full latency statistics of every cell.
+ */
+
+#include "performance.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Approximate stored size of one row of table T, including its index
+ * entry. Used only to convert a dataset size in bytes to a row count. */
+#define SWEEP_ROW_BYTES 64
+
+typedef struct {
+    int page_size;
+    int cache_size;
+    int row_count;
+    perf_stats_t stats[PHASE_COUNT];
+} sweep_cell_t;
+
+static int
+dataset_rows(int cache_size, int ratio)
+{
+    double rows = (double)cache_size * ratio / 100.0 / SWEEP_ROW_BYTES;
+    return rows < 1.0 ? 1 : rows > 0x7FFFFFFF ? 0x7FFFFFFF : (int)rows;
+}
+
+/* Run the phase set on a new database configured for one cell. */
+static int
+run_cell(const perf_options_t * options, sweep_cell_t * cell)
+{
+    perf_options_t cell_options = *options;
+    perf_context_t ctx;
+    db_t database;
+    int rc = 0;
+    int i;
+
+    cell_options.page_size = cell->page_size;
+    cell_options.cache_size = cell->cache_size;
+    cell_options.row_count = cell->row_count;
+
+    for (i = 0; i < PHASE_COUNT; i++) {
+        perf_stats_init(&cell->stats[i], perf_phase_names[i]);
+    }
+
+    database = perf_create_database(&cell_options);
+    if (database == NULL) {
+        return -1;
+    }
+    if (perf_open_context(&ctx, database) != 0) {
+        db_shutdown(database, 0, NULL);
+        return -1;
+    }
+
+    for (i = 0; i < options->warmup && rc == 0; i++) {
+        rc = perf_run_phase_set(&ctx, &cell_options, NULL);
+    }
+    for (i = 0; i < options->iterations && rc == 0; i++) {
+        rc = perf_run_phase_set(&ctx, &cell_options, cell->stats);
+    }
+
+    perf_close_context(&ctx);
+    db_shutdown(database, 0, NULL);
+
+    return rc;
+}
+
+/* Reports. */
+
+static void
+print_sweep_header(FILE * out, const perf_options_t * options)
+{
+    int phase;
+
+    fprintf(out, "%9s %10s %10s", "page size", "cache size", "rows");
+    for (phase = 0; phase < PHASE_COUNT; phase++) {
+        if (options->phases & PHASE_BIT(phase)) {
+            fprintf(out, " %12s", perf_phase_names[phase]);
+        }
+    }
+    fprintf(out, "   (ops/sec)\n");
+}
+
+static void
+print_sweep_row(FILE * out, const perf_options_t * options, const sweep_cell_t * cell)
+{
+    int phase;
+
+    fprintf(out, "%9d %10d %10d", cell->page_size, cell->cache_size, cell->row_count);
+    for (phase = 0; phase < PHASE_COUNT; phase++) {
+        if (options->phases & PHASE_BIT(phase)) {
+            fprintf(out, " %12.0f", perf_stats_throughput(&cell->stats[phase]));
+        }
+    }
+    fprintf(out, "\n");
+}
+
+static int
+write_json_report(const perf_options_t * options, const sweep_cell_t * cells, int cell_count)
+{
+    FILE * out = 0 == strcmp(options->json_file, "-") ? stdout : fopen(options->json_file, "w");
+    int i;
+    int phase;
+
+    if (out == NULL) {
+        printf("Unable to open JSON report file: %s\n", options->json_file);
+        return -1;
+    }
+
+    fprintf(out, "{\n  \"benchmark\": \"performance\",\n  \"mode\": \"sweep\",\n  \"config\": { \"database\": ");
+    perf_report_json_string(out, options->database);
+    fprintf(out, ", \"iterations\": %d, \"warmup\": %d },\n", options->iterations, options->warmup);
+    fprintf(out, "  \"cells\": [\n");
+    for (i = 0; i < cell_count; i++) {
+        const sweep_cell_t * cell = &cells[i];
+        int first = 1;
+
+        fprintf(out, "    { \"page_size\": %d, \"cache_size\": %d, \"rows\": %d, \"phases\": [",
+                cell->page_size, cell->cache_size, cell->row_count);
+        for (phase = 0; phase < PHASE_COUNT; phase++) {
+            if (options->phases & PHASE_BIT(phase)) {
+                fprintf(out, first ? "\n        " : ",\n        ");
+                perf_report_json_stats(out, &cell->stats[phase]);
+                first = 0;
+            }
+        }
+        fprintf(out, " ] }%s\n", i + 1 < cell_count ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
+
+int
+perf_run_sweep(const perf_options_t * options)
+{
+    sweep_cell_t * cells;
+    int cell_count = 0;
+    int rc = 0;
+    int p;
+    int c;
+    int r;
+
+    cells = (sweep_cell_t *)malloc(options->sweep_page_size_count * options->sweep_cache_size_count
+                                   * options->sweep_ratio_count * sizeof(sweep_cell_t));
+    if (cells == NULL) {
+        printf("Out of memory for statistics\n");
+        return -1;
+    }
+
+    printf("Sweep benchmark %d page sizes, %d cache sizes, %d dataset sizes, %d iterations, %d warmup\n",
+           options->sweep_page_size_count, options->sweep_cache_size_count, options->sweep_ratio_count,
+           options->iterations, options->warmup);
+    print_sweep_header(stdout, options);
+    fflush(stdout);
+
+    for (p = 0; p < options->sweep_page_size_count && rc == 0; p++) {
+        for (c = 0; c < options->sweep_cache_size_count && rc == 0; c++) {
+            for (r = 0; r < options->sweep_ratio_count && rc == 0; r++) {
+                sweep_cell_t * cell = &cells[cell_count];
+
+                cell->page_size = options->sweep_page_sizes[p];
+                cell->cache_size = options->sweep_cache_sizes[c];
+                cell->row_count = dataset_rows(cell->cache_size, options->sweep_ratios[r]);
+
+                if (cell->cache_size < cell->page_size) {
+                    printf("Skipping cache size %d smaller than page size %d\n",
+                           cell->cache_size, cell->page_size);
+                    continue;
+                }
+
+                rc = run_cell(options, cell);
+                if (rc == 0) {
+                    print_sweep_row(stdout, options, cell);
+                    fflush(stdout);
+                    cell_count++;
+                }
+            }
+        }
+    }
+
+    if (rc == 0 && options->json_file != NULL) {
+        rc = write_json_report(options, cells, cell_count);
+    }
+
+    free(cells);
+
+    return rc;
+}
@@ -0,0 +1,376 @@
+/**************************************************************************/
+/*                                                                        */
+/*      Copyright (c) 2005-2019 by ITTIA L.L.C. All rights reserved.      */
+/*                                                                        */
+/*  This software is copyrighted by and is the sole property of ITTIA     */
+/*  L.L.C.  All rights, title, ownership, or other interests in the       */
+/*  software remain the property of ITTIA L.L.C.  This software may only  */
+/*  be used in accordance with the corresponding license agreement.  Any  */
+/*  unauthorized use, duplication, transmission, distribution, or         */
+/*  disclosure of this software is expressly forbidden.                   */
+/*                                                                        */
+/*  This Copyright notice may not be removed or modified without prior    */
+/*  written consent of ITTIA L.L.C.                                       */
+/*                                                                        */
+/*  ITTIA L.L.C. reserves the right to modify this software without       */
+/*  notice.                                                               */
+/*                                                                        */
+/*  info@ittia.com                                                        */
+/*  http://www.ittia.com                                                  */
+/*                                                                        */
+/*                                                                        */
+/**************************************************************************/
+
+
+/** @file performance_threads.c
+ *
+ * Multi-threaded scaling mode of the performance benchmark.
+ *
+ * For each thread count from 1 to --threads, the database is recreated and
+ * the insert, seek, and update phases are run by that many worker threads
+ * at once. Each worker opens its own connection to the database, so
+ * the results show how throughput and tail latency scale with concurrent
+ * connections.
+ *
+ * Each thread inserts --rows rows. With disjoint key ranges, every thread
+ * seeks and updates only the rows it inserted. With overlapping key ranges,
+ * every thread visits the same rows, each starting one row after the
+ * previous thread, so threads contend for the same rows. Operations rolled
+ * back because another connection holds a lock are counted as conflicts.
+ */
+
+#include "performance.h"
+#include "../shared_access/thread_utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Phases run by worker threads. */
+static const perf_phase_t thread_phases[] = {
+    PHASE_INSERT,
+    PHASE_SEEK,
+    PHASE_UPDATE,
+};
+
+#define THREAD_PHASE_COUNT ((int)(sizeof(thread_phases) / sizeof(thread_phases[0])))
+
+typedef struct {
+    const perf_options_t * options;
+    perf_phase_t phase;
+    perf_range_t range;
+    perf_stats_t * stats;       ///< NULL for warmup rounds
+
+    os_thread_t * thread;
+    uint64_t start_ns;
+    uint64_t end_ns;
+    int rc;
+} worker_t;
+
+static void
+worker_proc(worker_t * worker)
+{
+    perf_context_t ctx;
+    db_t database;
+
+    worker->rc = -1;
+
+    database = perf_open_database(worker->options);
+    if (database == NULL) {
+        return;
+    }
+
+    if (perf_open_context(&ctx, database) == 0) {
+        ctx.tolerate_conflicts = 1;
+
+        worker->start_ns = perf_clock_ns();
+        switch (worker->phase) {
+        case PHASE_INSERT:
+            worker->rc = perf_run_insert(&ctx, &worker->range, worker->stats);
+            break;
+        case PHASE_SEEK:
+            worker->rc = perf_run_seek(&ctx, &worker->range, worker->stats);
+            break;
+        case PHASE_UPDATE:
+            worker->rc = perf_run_update(&ctx, &worker->range, worker->stats);
+            break;
+        default:
+            break;
+        }
+        worker->end_ns = perf_clock_ns();
+
+        perf_close_context(&ctx);
+    }
+
+    db_shutdown(database, 0, NULL);
+}
+
+/* Assign each worker its rows for a phase. */
+static void
+assign_ranges(const perf_options_t * options, perf_phase_t phase, worker_t * workers, int thread_count)
+{
+    int w;
+
+    for (w = 0; w < thread_count; w++) {
+        perf_range_t * range = &workers[w].range;
+
+        range->count = options->row_count;
+        range->row_count = options->row_count * thread_count;
+        range->keys = NULL;
+
+        if (!options->overlap) {
+            range->first = w * options->row_count + 1;
+            range->stride = 1;
+        }
+        else if (phase == PHASE_INSERT) {
+            /* Interleave inserts so that every row is still inserted once. */
+            range->first = w + 1;
+            range->stride = thread_count;
+        }
+        else {
+            range->first = w + 1;
+            range->stride = 1;
+        }
+    }
+}
+
+/* Run one phase on all workers and merge their statistics into total. */
+static int
+run_workers(const perf_options_t * options, perf_phase_t phase,
+            worker_t * workers, perf_stats_t * worker_stats, int thread_count,
+            perf_stats_t * total)
+{
+    uint64_t first_start = 0;
+    uint64_t last_end = 0;
+    uint64_t elapsed_ns = total != NULL ? total->elapsed_ns : 0;
+    int spawned;
+    int rc = 0;
+    int w;
+
+    assign_ranges(options, phase, workers, thread_count);
+
+    for (spawned = 0; spawned < thread_count; spawned++) {
+        worker_t * worker = &workers[spawned];
+
+        worker->options = options;
+        worker->phase = phase;
+        worker->stats = NULL;
+        if (total != NULL) {
+            perf_stats_init(&worker_stats[spawned], total->name);
+            worker->stats = &worker_stats[spawned];
+        }
+
+        if (thread_spawn((thread_proc_t)worker_proc, worker, THREAD_JOINABLE, &worker->thread) != 0) {
+            printf("Unable to start worker thread\n");
+            rc = -1;
+            break;
+        }
+    }
+
+    for (w = 0; w < spawned; w++) {
+        thread_join(workers[w].thread);
+    }
+
+    for (w = 0; w < spawned && rc == 0; w++) {
+        if (workers[w].rc != 0) {
+            rc = -1;
+        }
+        else if (total != NULL) {
+            if (w == 0 || workers[w].start_ns < first_start) {
+                first_start = workers[w].start_ns;
+            }
+            if (workers[w].end_ns > last_end) {
+                last_end = workers[w].end_ns;
+            }
+            perf_stats_merge(total, &worker_stats[w]);
+        }
+    }
+
+    if (rc == 0 && total != NULL) {
+        /* Workers overlap in time, so throughput is measured over the wall
+         * clock span from the first start to the last finish. */
+        total->elapsed_ns = elapsed_ns + (last_end - first_start);
+    }
+
+    return rc;
+}
+
+/* Reports. */
+
+static void
+print_scaling_header(FILE * out)
+{
+    fprintf(out, "%7s %-8s %10s %12s %8s %10s %10s %10s %10s %10s\n",
+            "threads", "phase", "ops", "ops/sec", "speedup",
+            "p50 us", "p99 us", "p99.9 us", "max us", "conflicts");
+}
+
+static void
+print_scaling_row(FILE * out, int thread_count, const perf_stats_t * stats, double speedup)
+{
+    fprintf(out, "%7d %-8s %10lu %12.0f %7.2fx %10.1f %10.1f %10.1f %10.1f %10lu\n",
+            thread_count,
+            stats->name,
+            (unsigned long)stats->count,
+            perf_stats_throughput(stats),
+            speedup,
+            (double)perf_stats_percentile(stats, 50.0) / 1000.0,
+            (double)perf_stats_percentile(stats, 99.0) / 1000.0,
+            (double)perf_stats_percentile(stats, 99.9) / 1000.0,
+            (double)(stats->count ? stats->max_ns : 0) / 1000.0,
+            (unsigned long)stats->conflicts);
+}
+
+static double
+speedup_of(const perf_stats_t * stats, const perf_stats_t * single)
+{
+    double base = perf_stats_throughput(single);
+    return base > 0.0 ? perf_stats_throughput(stats) / base : 0.0;
+}
+
+static int
+write_json_report(const perf_options_t * options, const perf_stats_t * results)
+{
+    FILE * out = 0 == strcmp(options->json_file, "-") ? stdout : fopen(options->json_file, "w");
+    int t;
+    int p;
+
+    if (out == NULL) {
+        printf("Unable to open JSON report file: %s\n", options->json_file);
+        return -1;
+    }
+
+    fprintf(out, "{\n  \"benchmark\": \"performance\",\n  \"mode\": \"threads\",\n  \"config\": { \"database\": ");
+    perf_report_json_string(out, options->database);
+    fprintf(out, ", \"rows_per_thread\": %d, \"threads\": %d, \"key_ranges\": \"%s\", \"iterations\": %d, \"warmup\": %d },\n",
+            options->row_count, options->threads, options->overlap ? "overlap" : "disjoint",
+            options->iterations, options->warmup);
+    fprintf(out, "  \"scaling\": [\n");
+    for (t = 0; t < options->threads; t++) {
+        const perf_stats_t * row = &results[t * THREAD_PHASE_COUNT];
+        int first = 1;
+
+        fprintf(out, "    { \"threads\": %d, \"phases\": [", t + 1);
+        for (p = 0; p < THREAD_PHASE_COUNT; p++) {
+            if (options->phases & PHASE_BIT(thread_phases[p])) {
+                fprintf(out, first ? "\n        " : ",\n        ");
+                fprintf(out, "{ \"speedup\": %.3f, \"stats\": ", speedup_of(&row[p], &results[p]));
+                perf_report_json_stats(out, &row[p]);
+                fprintf(out, " }");
+                first = 0;
+            }
+        }
+        fprintf(out, " ] }%s\n", t + 1 < options->threads ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
+
+/* Run all selected phases once on thread_count workers. */
+static int
+run_round(const perf_options_t * options, perf_context_t * ctx,
+          worker_t * workers, perf_stats_t * worker_stats, int thread_count,
+          perf_stats_t * totals)
+{
+    int rc = 0;
+    int p;
+
+    for (p = 0; p < THREAD_PHASE_COUNT && rc == 0; p++) {
+        perf_phase_t phase = thread_phases[p];
+        perf_stats_t * total = totals != NULL && (options->phases & PHASE_BIT(phase)) ? &totals[p] : NULL;
+
+        /* Rows are always inserted, so the other phases have data. */
+        if (phase == PHASE_INSERT || (options->phases & PHASE_BIT(phase))) {
+            rc = run_workers(options, phase, workers, worker_stats, thread_count, total);
+        }
+    }
+
+    /* Empty the table for the next round, without measuring. */
+    if (rc == 0) {
+        rc = perf_run_delete(ctx, NULL);
+    }
+
+    return rc;
+}
+
+int
+perf_run_threads(const perf_options_t * options)
+{
+    perf_stats_t * results;
+    perf_stats_t * worker_stats;
+    worker_t * workers;
+    int thread_count;
+    int rc = 0;
+    int i;
+
+    results = (perf_stats_t *)malloc(options->threads * THREAD_PHASE_COUNT * sizeof(perf_stats_t));
+    worker_stats = (perf_stats_t *)malloc(options->threads * sizeof(perf_stats_t));
+    workers = (worker_t *)calloc(options->threads, sizeof(worker_t));
+    if (results == NULL || worker_stats == NULL || workers == NULL) {
+        printf("Out of memory for statistics\n");
+        free(results);
+        free(worker_stats);
+        free(workers);
+        return -1;
+    }
+
+    printf("Scaling benchmark %d rows per thread, 1..%d threads, %s key ranges, %d iterations, %d warmup\n",
+           options->row_count, options->threads, options->overlap ? "overlapping" : "disjoint",
+           options->iterations, options->warmup);
+    print_scaling_header(stdout);
+    fflush(stdout);
+
+    for (thread_count = 1; thread_count <= options->threads && rc == 0; thread_count++) {
+        perf_stats_t * totals = &results[(thread_count - 1) * THREAD_PHASE_COUNT];
+        perf_context_t ctx;
+        db_t database;
+        int p;
+
+        for (p = 0; p < THREAD_PHASE_COUNT; p++) {
+            perf_stats_init(&totals[p], perf_phase_names[thread_phases[p]]);
+        }
+
+        /* Start each thread count from a new database. This connection stays
+         * open between rounds and empties the table after each one. */
+        database = perf_create_database(options);
+        if (database == NULL) {
+            rc = -1;
+            break;
+        }
+        if (perf_open_context(&ctx, database) != 0) {
+            db_shutdown(database, 0, NULL);
+            rc = -1;
+            break;
+        }
+
+        for (i = 0; i < options->warmup && rc == 0; i++) {
+            rc = run_round(options, &ctx, workers, worker_stats, thread_count, NULL);
+        }
+        for (i = 0; i < options->iterations && rc == 0; i++) {
+            rc = run_round(options, &ctx, workers, worker_stats, thread_count, totals);
+        }
+
+        perf_close_context(&ctx);
+        db_shutdown(database, 0, NULL);
+
+        for (p = 0; p < THREAD_PHASE_COUNT && rc == 0; p++) {
+            if (options->phases & PHASE_BIT(thread_phases[p])) {
+                print_scaling_row(stdout, thread_count, &totals[p], speedup_of(&totals[p], &results[p]));
+            }
+        }
+        fflush(stdout);
+    }
+
+    if (rc == 0 && options->json_file != NULL) {
+        rc = write_json_report(options, results);
+    }
+
+    free(results);
+    free(worker_stats);
+    free(workers);
+
+    return rc;
+}
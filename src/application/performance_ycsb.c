@@ -0,0 +1,403 @@
+/**************************************************************************/
+/*                                                                        */
+/*      Copyright (c) 2005-2019 by ITTIA L.L.C. All rights reserved.      */
+/*                                                                        */
+/*  This software is copyrighted by and is the sole property of ITTIA     */
+/*  L.L.C.  All rights, title, ownership, or other interests in the       */
+/*  software remain the property of ITTIA L.L.C.  This software may only  */
+/*  be used in accordance with the corresponding license agreement.  Any  */
+/*  unauthorized use, duplication, transmission, distribution, or         */
+/*  disclosure of this software is expressly forbidden.                   */
+/*                                                                        */
+/*  This Copyright notice may not be removed or modified without prior    */
+/*  written consent of ITTIA L.L.C.                                       */
+/*                                                                        */
+/*  ITTIA L.L.C. reserves the right to modify this software without       */
+/*  notice.                                                               */
+/*                                                                        */
+/*  info@ittia.com                                                        */
+/*  http://www.ittia.com                                                  */
+/*                                                                        */
+/*                                                                        */
+/**************************************************************************/
+
+
+/** @file performance_ycsb.c
+ *
+ * Mixed workload mode of the performance benchmark, modeled on the Yahoo!
+ * Cloud Serving Benchmark (YCSB) core workloads.
+ *
+ * The table T is loaded with --rows rows, then a sequence of operations
+ * is run, each in its own transaction. Operations are chosen at random
+ * with the relative weights given by --mix or a --workload preset:
+ *
+ *   A  update heavy       read 50, update 50, Zipfian keys
+ *   B  read mostly        read 95, update 5, Zipfian keys
+ *   C  read only          read 100, Zipfian keys
+ *   D  read latest        read 95, insert 5, latest keys
+ *   E  short ranges       scan 95, insert 5, Zipfian keys
+ *   F  read-modify-write  read 50, rmw 50, Zipfian keys
+ *
+ * A scan reads between 1 and --scan-length rows in ID index order. The
+ * run ends after --operations operations or, if --duration is given,
+ * after that many seconds. Each operation type has its own latency
+ * histogram.
+ */
+
+#include "performance.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+const char * const perf_op_names[OP_COUNT] = {
+    "read",
+    "update",
+    "insert",
+    "scan",
+    "rmw",
+};
+
+typedef struct {
+    const char * name;
+    int mix[OP_COUNT];          ///< read, update, insert, scan, rmw
+    perf_keys_t request_keys;
+} ycsb_preset_t;
+
+static const ycsb_preset_t ycsb_presets[] = {
+    { "a", { 50, 50, 0,  0,  0 }, KEYS_ZIPFIAN },
+    { "b", { 95,  5, 0,  0,  0 }, KEYS_ZIPFIAN },
+    { "c", { 100, 0, 0,  0,  0 }, KEYS_ZIPFIAN },
+    { "d", { 95,  0, 5,  0,  0 }, KEYS_LATEST },
+    { "e", {  0,  0, 5, 95,  0 }, KEYS_ZIPFIAN },
+    { "f", { 50,  0, 0,  0, 50 }, KEYS_ZIPFIAN },
+};
+
+#define YCSB_PRESET_COUNT ((int)(sizeof(ycsb_presets) / sizeof(ycsb_presets[0])))
+
+/// Apply a YCSB core workload preset, A to F, to the options.
+int
+perf_ycsb_preset(const char * name, perf_options_t * options)
+{
+    int i;
+
+    for (i = 0; i < YCSB_PRESET_COUNT; i++) {
+        if ((name[0] | 0x20) == ycsb_presets[i].name[0] && name[1] == '\0') {
+            memcpy(options->op_mix, ycsb_presets[i].mix, sizeof(options->op_mix));
+            options->request_keys = ycsb_presets[i].request_keys;
+            return 0;
+        }
+    }
+
+    printf("Unknown workload: %s\n", name);
+    return -1;
+}
+
+/* State of one workload run. */
+typedef struct {
+    perf_context_t * ctx;
+    const perf_options_t * options;
+    perf_keygen_t keys;         ///< Chooses rows for requests
+    perf_keygen_t choice;       ///< Chooses operations and scan lengths
+    int row_count;              ///< Rows in the table, including inserts
+    int mix_total;
+} ycsb_run_t;
+
+static perf_op_t
+choose_operation(ycsb_run_t * run)
+{
+    int pick = (int)(perf_keygen_uniform(&run->choice) * run->mix_total);
+    int op;
+
+    for (op = 0; op < OP_COUNT - 1; op++) {
+        if (pick < run->options->op_mix[op]) {
+            break;
+        }
+        pick -= run->options->op_mix[op];
+    }
+    return (perf_op_t)op;
+}
+
+/* Position the ordered cursor on the row with the given row number. */
+static db_result_t
+seek_row(perf_context_t * ctx, int row)
+{
+    ctx->id = GENERATE_ID(row);
+    return db_seek(ctx->t_ordered_cursor, DB_SEEK_EQUAL, ctx->t_row, NULL, 1);
+}
+
+static db_result_t
+run_operation(ycsb_run_t * run, perf_op_t op)
+{
+    perf_context_t * ctx = run->ctx;
+    db_result_t rc = DB_OK;
+    int row;
+    int length;
+
+    db_begin_tx(ctx->database, 0);
+
+    switch (op) {
+    case OP_READ:
+        rc = seek_row(ctx, perf_keygen_next(&run->keys));
+        if (DB_OK == rc) {
+            rc = db_fetch(ctx->t_ordered_cursor, ctx->t_row, NULL);
+        }
+        break;
+
+    case OP_UPDATE:
+        row = perf_keygen_next(&run->keys);
+        rc = seek_row(ctx, row);
+        if (DB_OK == rc) {
+            /* Overwrite the row without reading it first. */
+            perf_fill_row(ctx, run->row_count, row);
+            ctx->n = -ctx->n;
+            rc = db_update(ctx->t_ordered_cursor, ctx->t_row, NULL);
+        }
+        break;
+
+    case OP_INSERT:
+        row = run->row_count + 1;
+        perf_fill_row(ctx, row, row);
+        rc = db_insert(ctx->t_cursor, ctx->t_row, NULL, 0);
+        if (DB_OK == rc) {
+            run->row_count = row;
+            perf_keygen_grow(&run->keys, row);
+        }
+        break;
+
+    case OP_SCAN:
+        length = 1 + (int)(perf_keygen_uniform(&run->choice) * run->options->scan_length);
+        ctx->id = GENERATE_ID(perf_keygen_next(&run->keys));
+        rc = db_seek(ctx->t_ordered_cursor, DB_SEEK_GREATER_OR_EQUAL, ctx->t_row, NULL, 1);
+        for (; DB_OK == rc && length > 0 && !db_eof(ctx->t_ordered_cursor); length--) {
+            rc = db_fetch(ctx->t_ordered_cursor, ctx->t_row, NULL);
+            if (DB_OK == rc) {
+                rc = db_seek_next(ctx->t_ordered_cursor);
+            }
+        }
+        break;
+
+    case OP_READ_MODIFY_WRITE:
+        rc = seek_row(ctx, perf_keygen_next(&run->keys));
+        if (DB_OK == rc) {
+            rc = db_fetch(ctx->t_ordered_cursor, ctx->t_row, NULL);
+        }
+        if (DB_OK == rc) {
+            perf_modify_row(ctx);
+            rc = db_update(ctx->t_ordered_cursor, ctx->t_row, NULL);
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    if (DB_OK == rc) {
+        db_commit_tx(ctx->database, 0);
+    }
+    else {
+        printf("%s error: %d\n", perf_op_names[op], (int)get_db_error());
+        db_abort_tx(ctx->database, 0);
+    }
+    return rc;
+}
+
+/* Run the operation sequence once, recording into stats[] if not NULL. */
+static int
+run_workload(ycsb_run_t * run, perf_stats_t * stats)
+{
+    const perf_options_t * options = run->options;
+    uint64_t run_start = perf_clock_ns();
+    uint64_t deadline = run_start + (uint64_t)options->duration * 1000000000u;
+    int operations = options->operations != 0 ? options->operations : options->row_count;
+    uint64_t now = run_start;
+    int i;
+    int op;
+
+    for (i = 0; options->duration != 0 ? now < deadline : i < operations; i++) {
+        perf_op_t chosen = choose_operation(run);
+        uint64_t start = perf_clock_ns();
+
+        if (DB_OK != run_operation(run, chosen)) {
+            return -1;
+        }
+
+        now = perf_clock_ns();
+        if (stats) {
+            perf_stats_record(&stats[chosen], now - start);
+        }
+    }
+
+    if (stats) {
+        for (op = 0; op < OP_COUNT; op++) {
+            stats[op].elapsed_ns += now - run_start;
+        }
+    }
+    return 0;
+}
+
+/* Reports. */
+
+static void
+print_mix(FILE * out, const perf_options_t * options)
+{
+    const char * separator = "";
+    int op;
+
+    for (op = 0; op < OP_COUNT; op++) {
+        if (options->op_mix[op] != 0) {
+            fprintf(out, "%s%s=%d", separator, perf_op_names[op], options->op_mix[op]);
+            separator = ",";
+        }
+    }
+}
+
+static int
+write_json_report(const perf_options_t * options, const perf_stats_t * load,
+                  const perf_stats_t * stats, const perf_stats_t * total)
+{
+    FILE * out = 0 == strcmp(options->json_file, "-") ? stdout : fopen(options->json_file, "w");
+    int op;
+
+    if (out == NULL) {
+        printf("Unable to open JSON report file: %s\n", options->json_file);
+        return -1;
+    }
+
+    fprintf(out, "{\n  \"benchmark\": \"performance\",\n  \"mode\": \"ycsb\",\n  \"config\": { \"database\": ");
+    perf_report_json_string(out, options->database);
+    fprintf(out, ", \"storage\": \"%s\", \"rows\": %d, \"operations\": %d, \"duration_s\": %d, \"mix\": \"",
+            options->storage == PERF_STORAGE_MEMORY ? "memory" : "file",
+            options->row_count,
+            options->operations != 0 ? options->operations : options->row_count,
+            options->duration);
+    print_mix(out, options);
+    fprintf(out, "\", \"request_keys\": \"%s\", \"scan_length\": %d, \"iterations\": %d, \"warmup\": %d },\n",
+            perf_keys_names[options->request_keys], options->scan_length,
+            options->iterations, options->warmup);
+    fprintf(out, "  \"load\": ");
+    perf_report_json_stats(out, load);
+    fprintf(out, ",\n  \"total\": ");
+    perf_report_json_stats(out, total);
+    fprintf(out, ",\n  \"operations\": [");
+    for (op = 0; op < OP_COUNT; op++) {
+        fprintf(out, op == 0 ? "\n    " : ",\n    ");
+        perf_report_json_stats(out, &stats[op]);
+    }
+    fprintf(out, "\n  ]\n}\n");
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
+
+int
+perf_run_ycsb(const perf_options_t * options)
+{
+    perf_stats_t * stats;
+    perf_stats_t * load;
+    perf_stats_t * total;
+    perf_context_t ctx;
+    perf_range_t range;
+    ycsb_run_t run;
+    db_t database;
+    int rc = 0;
+    int op;
+    int i;
+
+    /* One histogram per operation, then the load and the merged total. */
+    stats = (perf_stats_t *)malloc((OP_COUNT + 2) * sizeof(perf_stats_t));
+    if (stats == NULL) {
+        printf("Out of memory for statistics\n");
+        return -1;
+    }
+    load = &stats[OP_COUNT];
+    total = &stats[OP_COUNT + 1];
+    for (op = 0; op < OP_COUNT; op++) {
+        perf_stats_init(&stats[op], perf_op_names[op]);
+    }
+    perf_stats_init(load, "load");
+    perf_stats_init(total, "total");
+
+    memset(&run, 0, sizeof(run));
+    run.options = options;
+    for (op = 0; op < OP_COUNT; op++) {
+        run.mix_total += options->op_mix[op];
+    }
+    if (run.mix_total == 0) {
+        printf("Operation mix is empty\n");
+        free(stats);
+        return -1;
+    }
+
+    database = perf_create_database(options);
+    if (database == NULL || perf_open_context(&ctx, database) != 0) {
+        if (database != NULL) {
+            db_shutdown(database, 0, NULL);
+        }
+        free(stats);
+        return -1;
+    }
+    run.ctx = &ctx;
+
+    printf("YCSB benchmark %d rows, mix ", options->row_count);
+    print_mix(stdout, options);
+    printf(", %s keys", perf_keys_names[options->request_keys]);
+    if (options->duration != 0) {
+        printf(", %d seconds", options->duration);
+    }
+    else {
+        printf(", %d operations", options->operations != 0 ? options->operations : options->row_count);
+    }
+    printf(", %d iterations, %d warmup\n", options->iterations, options->warmup);
+    fflush(stdout);
+
+    /* Load phase. */
+    range.first = 1;
+    range.count = options->row_count;
+    range.stride = 1;
+    range.row_count = options->row_count;
+    range.keys = NULL;
+    rc = perf_run_insert(&ctx, &range, load);
+
+    run.row_count = options->row_count;
+    perf_keygen_init(&run.keys, options->request_keys, run.row_count, options);
+    perf_keygen_init(&run.choice, KEYS_UNIFORM, 1, options);
+    /* Use a different random sequence for choices than for keys. */
+    run.choice.state ^= 0xD1B54A32D192ED03u;
+
+    for (i = 0; i < options->warmup && rc == 0; i++) {
+        rc = run_workload(&run, NULL);
+    }
+    for (i = 0; i < options->iterations && rc == 0; i++) {
+        rc = run_workload(&run, stats);
+    }
+
+    if (rc == 0) {
+        for (op = 0; op < OP_COUNT; op++) {
+            perf_stats_merge(total, &stats[op]);
+        }
+        /* Every operation histogram covers the same wall-clock time. */
+        total->elapsed_ns = stats[0].elapsed_ns;
+
+        perf_report_table_header(stdout);
+        perf_report_table_row(stdout, load);
+        for (op = 0; op < OP_COUNT; op++) {
+            if (stats[op].count != 0) {
+                perf_report_table_row(stdout, &stats[op]);
+            }
+        }
+        perf_report_table_row(stdout, total);
+
+        if (options->json_file != NULL) {
+            rc = write_json_report(options, load, stats, total);
+        }
+    }
+
+    perf_close_context(&ctx);
+    db_shutdown(database, 0, NULL);
+
+    free(stats);
+
+    return rc;
+}
@@ -23,184 +23,1891 @@
 
 #include "dbs_sql_line_shell.h"
 
+#include <ctype.h>
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 
+/* Statement cache.
+ *
+ * Prepared cursors are kept in a least recently used list, keyed by the
+ * normalized statement text, so a statement that repeats in a script is
+ * parsed and planned only once. A cached cursor is returned to the
+ * prepared state with db_unexecute() after each use and its parameter row
+ * is reused, so only the parameter values are set again.
+ *
+ * The cache is limited both by entry count and by an estimate of its
+ * memory use: the statement text plus DBS_SQL_CACHE_ENTRY_COST bytes for
+ * the cursor and parameter row held by the database. Statements that
+ * change the schema are never cached, and they close every cached cursor
+ * first, because a cached plan may refer to the objects they change.
+ */
+
+#ifndef DBS_SQL_CACHE_ENTRIES
+#define DBS_SQL_CACHE_ENTRIES 64
+#endif
+
+#ifndef DBS_SQL_CACHE_BYTES
+#define DBS_SQL_CACHE_BYTES (256 * 1024)
+#endif
+
+#define DBS_SQL_CACHE_ENTRY_COST 2048
+
+typedef struct statement_s {
+    struct statement_s * prev;  ///< More recently used statement
+    struct statement_s * next;  ///< Less recently used statement
+    unsigned long hash;
+    size_t cost;                ///< Estimated memory use
+    int cached;
+    db_cursor_t cursor;
+    db_row_t param_row;
+    int param_count;
+    char sql[1];                ///< Normalized statement text
+} statement_t;
+
+typedef struct {
+    statement_t * head;         ///< Most recently used
+    statement_t * tail;         ///< Least recently used
+    int entries;
+    size_t bytes;
+    int max_entries;
+    size_t max_bytes;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+} statement_cache_t;
+
+/* Statement timing.
+ *
+ * Each statement is timed in stages: prepare, execute, the database time
+ * spent fetching rows, and the time spent formatting them. With .timing
+ * on, the times are printed after every statement. Independent of that,
+ * statements that take longer than a threshold are kept in a slow
+ * statement log, which .slow prints.
+ */
+
+#ifndef DBS_SQL_SLOW_THRESHOLD_MS
+#define DBS_SQL_SLOW_THRESHOLD_MS 100
+#endif
+
+#ifndef DBS_SQL_SLOW_LOG_ENTRIES
+#define DBS_SQL_SLOW_LOG_ENTRIES 32
+#endif
+
+typedef struct {
+    uint64_t prepare_ns;
+    uint64_t execute_ns;
+    uint64_t first_row_ns;      ///< From the start of execute to the first fetched row
+    uint64_t fetch_ns;          ///< Seek and fetch of all rows
+    uint64_t render_ns;         ///< Formatting and output of all rows
+    unsigned long rows;
+    int cached;                 ///< Prepared statement came from the cache
+} timing_t;
+
+typedef struct {
+    timing_t timing;
+    char * sql;
+} slow_statement_t;
+
+/* Ring buffer of the most recent slow statements. */
+typedef struct {
+    slow_statement_t * entries;
+    int capacity;
+    int count;
+    int next;
+    unsigned long total;        ///< Slow statements seen, including those overwritten
+    unsigned long threshold_ms;
+} slow_log_t;
+
+/* Scripts.
+ *
+ * A script is read in large blocks and split into statements at each
+ * semicolon outside of quotes and comments, so statements can span lines.
+ * Every script_batch statements are run in one transaction, instead of
+ * one transaction per statement, which is what makes reloading a large
+ * dump fast.
+ */
+
+#ifndef DBS_SQL_SCRIPT_BATCH
+#define DBS_SQL_SCRIPT_BATCH 1000
+#endif
+
+#ifndef DBS_SQL_SCRIPT_BLOCK
+#define DBS_SQL_SCRIPT_BLOCK (64 * 1024)
+#endif
+
+/* Position of the statement splitter in the script text. */
+typedef enum {
+    SCRIPT_SQL,
+    SCRIPT_QUOTE,
+    SCRIPT_LINE_COMMENT,
+    SCRIPT_BLOCK_COMMENT
+} script_state_t;
+
+/* Result rendering.
+ *
+ * Results are formatted into an output buffer that is written out in
+ * large blocks. Integer and floating point fields are fetched as native
+ * values and formatted without the C library, which avoids both the
+ * conversion to a string inside the database and the cost of printf for
+ * every field. Other types are converted to UTF-8 by the database.
+ */
+
+#ifndef DBS_SQL_OUTPUT_BUFFER
+#define DBS_SQL_OUTPUT_BUFFER (64 * 1024)
+#endif
+
+typedef struct {
+    FILE * out;
+    char * data;
+    size_t length;
+    size_t size;
+} output_t;
+
+/* How a result column is fetched and formatted. */
+typedef enum {
+    COLUMN_SIGNED,
+    COLUMN_UNSIGNED,
+    COLUMN_FLOAT32,
+    COLUMN_FLOAT64,
+    COLUMN_DATE,
+    COLUMN_TIME,
+    COLUMN_DATETIME,
+    COLUMN_TIMESTAMP,
+    COLUMN_TEXT
+} column_class_t;
+
+typedef struct {
+    column_class_t column_class;
+    char * name;
+} column_t;
+
+/* State of one shell session. */
+typedef struct {
+    db_t database;
+    FILE * in;
+    FILE * out;
+    FILE * err;
+    char * buffer;              ///< Input line, then field text
+    size_t buffer_size;
+    statement_cache_t cache;
+    output_t output;
+    dbs_sql_output_mode_t output_mode;
+    int timing;                 ///< Print the time of each statement
+    slow_log_t slow_log;
+    int script;                 ///< Running a script rather than reading lines
+    int script_batch;
+    dbs_sql_error_policy_t script_on_error;
+} shell_t;
+
+static const char * const output_mode_names[] = { "list", "csv", "tsv", "json" };
+static const char * const error_policy_names[] = { "stop", "skip", "savepoint" };
+
 static void grow_buffer(char ** buffer, size_t * size, size_t requested_size);
+static int run_script(shell_t * shell, FILE * script, const char * name);
+
+/// Initialize shell settings with default values.
+void
+dbs_sql_shell_config_init(dbs_sql_shell_config_t * config)
+{
+    config->cache_entries = DBS_SQL_CACHE_ENTRIES;
+    config->cache_bytes = DBS_SQL_CACHE_BYTES;
+    config->output_mode = DBS_SQL_OUTPUT_LIST;
+    config->output_buffer_size = DBS_SQL_OUTPUT_BUFFER;
+    config->timing = 0;
+    config->slow_threshold_ms = DBS_SQL_SLOW_THRESHOLD_MS;
+    config->slow_log_entries = DBS_SQL_SLOW_LOG_ENTRIES;
+    config->script_batch = DBS_SQL_SCRIPT_BATCH;
+    config->script_on_error = DBS_SQL_ON_ERROR_STOP;
+}
+
+/* Collapse runs of whitespace outside of quotes into one space, and remove
+ * leading and trailing whitespace and a trailing semicolon, in place. */
+static void
+normalize_sql(char * sql)
+{
+    char * in = sql;
+    char * out = sql;
+    char quote = '\0';
+
+    while (*in != '\0') {
+        char c = *in++;
+
+        if (quote != '\0') {
+            if (c == quote) {
+                quote = '\0';
+            }
+        }
+        else if (c == '\'' || c == '"') {
+            quote = c;
+        }
+        else if (isspace((unsigned char)c)) {
+            while (isspace((unsigned char)*in)) {
+                in++;
+            }
+            if (out == sql || *in == '\0') {
+                continue;
+            }
+            c = ' ';
+        }
+        *out++ = c;
+    }
+
+    /* Trailing semicolon, possibly followed by the whitespace removed above. */
+    if (quote == '\0' && out > sql && out[-1] == ';') {
+        out--;
+        while (out > sql && out[-1] == ' ') {
+            out--;
+        }
+    }
+    *out = '\0';
+}
+
+static unsigned long
+hash_sql(const char * sql)
+{
+    unsigned long hash = 2166136261u;
+
+    /* FNV-1a */
+    while (*sql != '\0') {
+        hash = (hash ^ (unsigned char)*sql++) * 16777619u;
+    }
+    return hash;
+}
+
+/* True for statements that create, drop, or alter database objects. */
+static int
+is_schema_change(const char * sql)
+{
+    static const char * const keywords[] = { "CREATE", "DROP", "ALTER", "RENAME" };
+    size_t i;
+
+    for (i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++) {
+        size_t len = strlen(keywords[i]);
+        size_t j;
+
+        for (j = 0; j < len && toupper((unsigned char)sql[j]) == keywords[i][j]; j++) {
+        }
+        if (j == len && !isalnum((unsigned char)sql[len]) && sql[len] != '_') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void
+free_statement(statement_t * statement)
+{
+    db_free_row(statement->param_row);
+    db_close_cursor(statement->cursor);
+    free(statement);
+}
+
+static void
+cache_unlink(statement_cache_t * cache, statement_t * statement)
+{
+    if (statement->prev != NULL) {
+        statement->prev->next = statement->next;
+    }
+    else {
+        cache->head = statement->next;
+    }
+    if (statement->next != NULL) {
+        statement->next->prev = statement->prev;
+    }
+    else {
+        cache->tail = statement->prev;
+    }
+    statement->prev = NULL;
+    statement->next = NULL;
+}
+
+static void
+cache_push_front(statement_cache_t * cache, statement_t * statement)
+{
+    statement->prev = NULL;
+    statement->next = cache->head;
+    if (cache->head != NULL) {
+        cache->head->prev = statement;
+    }
+    else {
+        cache->tail = statement;
+    }
+    cache->head = statement;
+}
+
+static void
+cache_remove(statement_cache_t * cache, statement_t * statement)
+{
+    cache_unlink(cache, statement);
+    cache->entries--;
+    cache->bytes -= statement->cost;
+    free_statement(statement);
+}
+
+static void
+cache_clear(statement_cache_t * cache)
+{
+    while (cache->head != NULL) {
+        cache_remove(cache, cache->head);
+    }
+}
+
+/* Find a prepared statement, or prepare it and add it to the cache. */
+static statement_t *
+prepare_statement(statement_cache_t * cache, db_t database, const char * sql)
+{
+    unsigned long hash = hash_sql(sql);
+    size_t length = strlen(sql);
+    statement_t * statement;
+    int cacheable;
+
+    for (statement = cache->head; statement != NULL; statement = statement->next) {
+        if (statement->hash == hash && 0 == strcmp(statement->sql, sql)) {
+            cache->hits++;
+            cache_unlink(cache, statement);
+            cache_push_front(cache, statement);
+            return statement;
+        }
+    }
+
+    cacheable = cache->max_entries > 0 && !is_schema_change(sql);
+    if (!cacheable) {
+        /* Release cached cursors that could refer to changed objects. */
+        cache_clear(cache);
+    }
+
+    statement = (statement_t *)malloc(sizeof(statement_t) + length);
+    if (statement == NULL) {
+        return NULL;
+    }
+    memcpy(statement->sql, sql, length + 1);
+    statement->prev = NULL;
+    statement->next = NULL;
+    statement->hash = hash;
+    statement->cost = sizeof(statement_t) + length + DBS_SQL_CACHE_ENTRY_COST;
+    statement->cached = 0;
+    statement->param_row = NULL;
+    statement->param_count = 0;
+
+    statement->cursor = db_prepare_sql_cursor(database, sql, DB_CURSOR_ENCODING_UTF8);
+    if (db_is_prepared(statement->cursor) <= 0) {
+        /* Keep the error of the failed prepare for the caller to report. */
+        return statement;
+    }
+
+    statement->param_count = db_get_param_count(statement->cursor);
+    if (statement->param_count > 0) {
+        statement->param_row = db_alloc_param_row(statement->cursor);
+    }
+
+    if (cacheable && statement->cost <= cache->max_bytes) {
+        cache->misses++;
+        while (cache->entries > 0
+               && (cache->entries >= cache->max_entries || cache->bytes + statement->cost > cache->max_bytes))
+        {
+            cache->evictions++;
+            cache_remove(cache, cache->tail);
+        }
+        statement->cached = 1;
+        cache_push_front(cache, statement);
+        cache->entries++;
+        cache->bytes += statement->cost;
+    }
+
+    return statement;
+}
+
+/* Return a statement to the cache after use, or free it if it is not cached. */
+static void
+release_statement(statement_t * statement)
+{
+    if (statement->cached) {
+        db_unexecute(statement->cursor);
+    }
+    else {
+        free_statement(statement);
+    }
+}
+
+static void
+print_cache_statistics(FILE * out, const statement_cache_t * cache)
+{
+    fprintf(out, "Statement cache: %lu hits, %lu misses, %lu evictions, %d entries, %lu bytes\n",
+            cache->hits, cache->misses, cache->evictions, cache->entries, (unsigned long)cache->bytes);
+}
+
+/* Monotonic clock. */
+
+#if defined(_WIN32)
+#include <windows.h>
+
+static uint64_t
+clock_ns(void)
+{
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+
+    if (frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&counter);
+
+    /* Split the conversion to avoid overflow of counter * 10^9. */
+    return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000u
+        + (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000u / (uint64_t)frequency.QuadPart;
+}
+#elif defined(OS_UCOS_III)
+#include <os.h>
+
+static uint64_t
+clock_ns(void)
+{
+    OS_ERR err;
+    /* Resolution is limited to the kernel tick rate. */
+    return (uint64_t)OSTimeGet(&err) * (1000000000u / OS_CFG_TICK_RATE_HZ);
+}
+#else
+#include <time.h>
+
+static uint64_t
+clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+#endif
+
+#define NS_TO_MS(ns) ((double)(ns) / 1e6)
+
+static uint64_t
+timing_total_ns(const timing_t * timing)
+{
+    return timing->prepare_ns + timing->execute_ns + timing->fetch_ns + timing->render_ns;
+}
+
+static void
+print_timing(FILE * out, const timing_t * timing)
+{
+    uint64_t total_ns = timing_total_ns(timing);
+
+    fprintf(out, "Time: prepare %.3f ms%s, execute %.3f ms, first row %.3f ms, fetch %.3f ms, render %.3f ms, total %.3f ms\n",
+            NS_TO_MS(timing->prepare_ns), timing->cached ? " (cached)" : "",
+            NS_TO_MS(timing->execute_ns),
+            NS_TO_MS(timing->first_row_ns),
+            NS_TO_MS(timing->fetch_ns),
+            NS_TO_MS(timing->render_ns),
+            NS_TO_MS(total_ns));
+    fprintf(out, "Rows: %lu, %.0f rows/sec\n",
+            timing->rows,
+            total_ns > 0 ? (double)timing->rows * 1e9 / (double)total_ns : 0.0);
+}
+
+static void
+slow_log_clear(slow_log_t * log)
+{
+    int i;
+
+    for (i = 0; i < log->count; i++) {
+        free(log->entries[i].sql);
+    }
+    log->count = 0;
+    log->next = 0;
+    log->total = 0;
+}
+
+/* Record a statement if it took longer than the threshold. */
+static void
+slow_log_add(slow_log_t * log, const char * sql, const timing_t * timing)
+{
+    slow_statement_t * entry;
+    char * copy;
+
+    if (log->capacity == 0 || timing_total_ns(timing) < (uint64_t)log->threshold_ms * 1000000u) {
+        return;
+    }
+
+    copy = (char *)malloc(strlen(sql) + 1);
+    if (copy == NULL) {
+        return;
+    }
+    strcpy(copy, sql);
+
+    entry = &log->entries[log->next];
+    if (log->count == log->capacity) {
+        free(entry->sql);
+    }
+    else {
+        log->count++;
+    }
+    entry->sql = copy;
+    entry->timing = *timing;
+    log->next = (log->next + 1) % log->capacity;
+    log->total++;
+}
+
+/* Print the slow statement log, oldest first. */
+static void
+print_slow_log(FILE * out, const slow_log_t * log)
+{
+    int i;
+
+    fprintf(out, "Slow statements over %lu ms: %lu, last %d shown\n",
+            log->threshold_ms, log->total, log->count);
+    if (log->count == 0) {
+        return;
+    }
+
+    fprintf(out, "%10s %10s %10s %10s %10s %10s %10s  %s\n",
+            "total ms", "prepare", "execute", "first row", "fetch", "render", "rows", "statement");
+    for (i = 0; i < log->count; i++) {
+        const slow_statement_t * entry = &log->entries[(log->next - log->count + i + log->capacity) % log->capacity];
+
+        fprintf(out, "%10.3f %10.3f %10.3f %10.3f %10.3f %10.3f %10lu  %s\n",
+                NS_TO_MS(timing_total_ns(&entry->timing)),
+                NS_TO_MS(entry->timing.prepare_ns),
+                NS_TO_MS(entry->timing.execute_ns),
+                NS_TO_MS(entry->timing.first_row_ns),
+                NS_TO_MS(entry->timing.fetch_ns),
+                NS_TO_MS(entry->timing.render_ns),
+                entry->timing.rows,
+                entry->sql);
+    }
+}
+
+/* Output buffer. */
+
+static void
+output_flush(output_t * output)
+{
+    if (output->length > 0) {
+        fwrite(output->data, 1, output->length, output->out);
+        output->length = 0;
+    }
+}
+
+/* Make room for length more bytes. Returns a pointer to the free space. */
+static char *
+output_reserve(output_t * output, size_t length)
+{
+    if (output->size - output->length < length) {
+        output_flush(output);
+        if (output->size < length) {
+            grow_buffer(&output->data, &output->size, length);
+            if (output->data == NULL) {
+                return NULL;
+            }
+        }
+    }
+    return output->data + output->length;
+}
+
+static void
+output_write(output_t * output, const char * data, size_t length)
+{
+    char * p = output_reserve(output, length);
+
+    if (p == NULL) {
+        /* Too large to buffer, so write it directly. */
+        fwrite(data, 1, length, output->out);
+        return;
+    }
+    memcpy(p, data, length);
+    output->length += length;
+}
+
+static void
+output_string(output_t * output, const char * text)
+{
+    output_write(output, text, strlen(text));
+}
+
+/* Returns -1 if out of memory. */
+static int
+output_char(output_t * output, char c)
+{
+    char * p = output_reserve(output, 1);
+
+    if (p == NULL) {
+        return -1;
+    }
+    *p = c;
+    output->length++;
+    return 0;
+}
+
+/* Number, date and time formatting.
+ *
+ * These do not depend on the C library locale, so the decimal separator
+ * is always a period. */
+
+static const char digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+/* Write the decimal digits of value to p. Returns the number of digits,
+ * at most 20. */
+static int
+format_uint64(char * p, uint64_t value)
+{
+    char digits[20];
+    char * end = digits + sizeof(digits);
+    char * d = end;
+    int length;
+
+    while (value >= 100) {
+        const char * pair = digit_pairs + (value % 100) * 2;
+        value /= 100;
+        *--d = pair[1];
+        *--d = pair[0];
+    }
+    if (value >= 10) {
+        const char * pair = digit_pairs + value * 2;
+        *--d = pair[1];
+        *--d = pair[0];
+    }
+    else {
+        *--d = (char)('0' + value);
+    }
+
+    length = (int)(end - d);
+    memcpy(p, d, length);
+    return length;
+}
+
+static int
+format_int64(char * p, int64_t value)
+{
+    if (value < 0) {
+        *p = '-';
+        /* Negate as unsigned so INT64_MIN does not overflow. */
+        return 1 + format_uint64(p + 1, (uint64_t)0 - (uint64_t)value);
+    }
+    return format_uint64(p, (uint64_t)value);
+}
+
+/* Replace the decimal separator of the C library locale, which may be
+ * more than one byte, with a period in a number of length bytes at p.
+ * Returns the new length. */
+static int
+decimal_point_to_period(char * p, int length)
+{
+    int i;
+    int end;
+
+    for (i = 0; i < length; i++) {
+        if (!isdigit((unsigned char)p[i]) && p[i] != '-' && p[i] != '+' && p[i] != 'e') {
+            break;
+        }
+    }
+    if (i == length || p[i] == '.') {
+        return length;
+    }
+    for (end = i + 1; end < length && !isdigit((unsigned char)p[end]); end++) {
+    }
+    p[i] = '.';
+    memmove(p + i + 1, p + end, (size_t)(length - end));
+    return length - (end - i - 1);
+}
+
+/* Write value with the fewest significant digits that read back as the
+ * same value, using the C library, with its decimal separator replaced.
+ * single compares the value read back in single precision. */
+static int
+format_double_text(char * p, double value, int single)
+{
+    int digits;
+    int length = 0;
+
+    for (digits = single ? 6 : 15; digits <= (single ? 9 : 17); digits++) {
+        double parsed;
+
+        length = sprintf(p, "%.*g", digits, value);
+        parsed = strtod(p, NULL);
+        if (single ? (float)parsed == (float)value : parsed == value) {
+            break;
+        }
+    }
+    return decimal_point_to_period(p, length);
+}
+
+/* Write value like the %g format of printf, with the fewest significant
+ * digits that read back as the same value, to p. single is set for
+ * values of single precision. Returns the length, at most 32. Values
+ * with very large or very small magnitudes, and double precision values
+ * that need more than 15 digits, use the C library. */
+static int
+format_double(char * p, double value, int single)
+{
+    static const double powers[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+        1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20
+    };
+    char * start = p;
+    double magnitude = fabs(value);
+    uint64_t scaled;
+    char text[24];
+    int length;
+    int exponent;
+    int digits;
+    int fraction_digits;
+    int i;
+
+    if (value != value) {
+        memcpy(p, "nan", 3);
+        return 3;
+    }
+    if (magnitude < 1e-5 || magnitude >= 1e15) {
+        if (magnitude == 0.0) {
+            *p = '0';
+            return 1;
+        }
+        if (magnitude > 1.7976931348623157e308) {
+            strcpy(p, value < 0 ? "-inf" : "inf");
+            return (int)strlen(p);
+        }
+        return format_double_text(p, value, single);
+    }
+
+    /* Decimal exponent of the leading digit. */
+    for (exponent = 0; exponent < 15 && magnitude >= powers[exponent + 1]; exponent++) {
+    }
+    for (; exponent > -5 && magnitude < 1.0 / powers[-exponent]; exponent--) {
+    }
+
+    /* Scale to an integer holding the significant digits and round it.
+     * The integer and the power of ten are exact, so dividing them gives
+     * the value that the digits read back as. */
+    for (digits = single ? 6 : 15; ; digits++) {
+        double parsed;
+
+        fraction_digits = digits - 1 - exponent;
+        if (fraction_digits < 0) {
+            fraction_digits = 0;
+        }
+        scaled = (uint64_t)(magnitude * powers[fraction_digits] + 0.5);
+        parsed = (double)scaled / powers[fraction_digits];
+        if (single ? (float)parsed == (float)magnitude : parsed == magnitude) {
+            break;
+        }
+        if (digits == (single ? 9 : 15)) {
+            return format_double_text(p, value, single);
+        }
+    }
+
+    if (value < 0) {
+        *p++ = '-';
+    }
+
+    length = format_uint64(text, scaled);
+    if (length <= fraction_digits) {
+        /* Leading zeros of a value below 1. */
+        *p++ = '0';
+        *p++ = '.';
+        for (i = length; i < fraction_digits; i++) {
+            *p++ = '0';
+        }
+        memcpy(p, text, length);
+        p += length;
+    }
+    else {
+        memcpy(p, text, length - fraction_digits);
+        p += length - fraction_digits;
+        if (fraction_digits > 0) {
+            *p++ = '.';
+            memcpy(p, text + length - fraction_digits, fraction_digits);
+            p += fraction_digits;
+        }
+    }
+
+    /* Remove trailing zeros of the fraction, and the period if no digits remain. */
+    if (fraction_digits > 0) {
+        while (p[-1] == '0') {
+            p--;
+        }
+        if (p[-1] == '.') {
+            p--;
+        }
+    }
+
+    return (int)(p - start);
+}
+
+/* Write a number from 0 to 99 as two digits. */
+static char *
+format_2digits(char * p, int value)
+{
+    memcpy(p, digit_pairs + (unsigned)value % 100 * 2, 2);
+    return p + 2;
+}
+
+/* Write a date as YYYY-MM-DD. Returns a pointer past the date. */
+static char *
+format_date(char * p, const db_date_t * date)
+{
+    if (date->year >= 0 && date->year <= 9999) {
+        p = format_2digits(p, date->year / 100);
+        p = format_2digits(p, date->year % 100);
+    }
+    else {
+        p += format_int64(p, date->year);
+    }
+    *p++ = '-';
+    p = format_2digits(p, date->month);
+    *p++ = '-';
+    return format_2digits(p, date->day);
+}
+
+/* Write a time as HH:MM:SS. Returns a pointer past the time. */
+static char *
+format_time(char * p, const db_time_t * time)
+{
+    p = format_2digits(p, time->hour);
+    *p++ = ':';
+    p = format_2digits(p, time->minute);
+    *p++ = ':';
+    return format_2digits(p, time->second);
+}
+
+/* Write a timestamp as YYYY-MM-DD HH:MM:SS, followed by the microseconds
+ * as a six digit fraction if there are any. Returns the length. */
+static int
+format_timestamp(char * p, const db_timestamp_t * timestamp)
+{
+    char * start = p;
+
+    p = format_date(p, &timestamp->date);
+    *p++ = ' ';
+    p = format_time(p, &timestamp->time);
+    if (timestamp->usec > 0 && timestamp->usec < 1000000) {
+        *p++ = '.';
+        p = format_2digits(p, timestamp->usec / 10000);
+        p = format_2digits(p, timestamp->usec / 100 % 100);
+        p = format_2digits(p, timestamp->usec % 100);
+    }
+    return (int)(p - start);
+}
+
+/* Quoting of text fields. These return -1 if out of memory. */
+
+static int
+output_csv_text(output_t * output, const char * text, size_t length)
+{
+    size_t i;
+
+    if (strcspn(text, ",\"\r\n") >= length) {
+        output_write(output, text, length);
+        return 0;
+    }
+
+    if (output_char(output, '"') != 0) {
+        return -1;
+    }
+    for (i = 0; i < length; i++) {
+        if (text[i] == '"' && output_char(output, '"') != 0) {
+            return -1;
+        }
+        if (output_char(output, text[i]) != 0) {
+            return -1;
+        }
+    }
+    return output_char(output, '"');
+}
+
+static int
+output_tsv_text(output_t * output, const char * text, size_t length)
+{
+    size_t i;
+
+    for (i = 0; i < length; i++) {
+        switch (text[i]) {
+        case '\t': output_write(output, "\\t", 2); break;
+        case '\n': output_write(output, "\\n", 2); break;
+        case '\r': output_write(output, "\\r", 2); break;
+        case '\\': output_write(output, "\\\\", 2); break;
+        default:
+            if (output_char(output, text[i]) != 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static int
+output_json_text(output_t * output, const char * text, size_t length)
+{
+    size_t i;
+
+    if (output_char(output, '"') != 0) {
+        return -1;
+    }
+    for (i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)text[i];
+
+        switch (c) {
+        case '"':  output_write(output, "\\\"", 2); break;
+        case '\\': output_write(output, "\\\\", 2); break;
+        case '\n': output_write(output, "\\n", 2); break;
+        case '\r': output_write(output, "\\r", 2); break;
+        case '\t': output_write(output, "\\t", 2); break;
+        default:
+            if (c < 0x20) {
+                char escape[8];
+                sprintf(escape, "\\u%04x", c);
+                output_write(output, escape, 6);
+            }
+            else if (output_char(output, (char)c) != 0) {
+                return -1;
+            }
+        }
+    }
+    return output_char(output, '"');
+}
+
+static int
+output_text(shell_t * shell, const char * text, size_t length)
+{
+    switch (shell->output_mode) {
+    case DBS_SQL_OUTPUT_CSV:  return output_csv_text(&shell->output, text, length);
+    case DBS_SQL_OUTPUT_TSV:  return output_tsv_text(&shell->output, text, length);
+    case DBS_SQL_OUTPUT_JSON: return output_json_text(&shell->output, text, length);
+    default:                  output_write(&shell->output, text, length); return 0;
+    }
+}
+
+/* Result sets. */
+
+static column_class_t
+get_column_class(const db_fielddef_t * fielddef)
+{
+    switch ((intptr_t)fielddef->field_type) {
+    case (intptr_t)DB_COLTYPE_SINT8:
+    case (intptr_t)DB_COLTYPE_UINT8:
+    case (intptr_t)DB_COLTYPE_SINT16:
+    case (intptr_t)DB_COLTYPE_UINT16:
+    case (intptr_t)DB_COLTYPE_SINT32:
+    case (intptr_t)DB_COLTYPE_UINT32:
+    case (intptr_t)DB_COLTYPE_SINT64:
+        return COLUMN_SIGNED;
+    case (intptr_t)DB_COLTYPE_UINT64:
+        return COLUMN_UNSIGNED;
+    case (intptr_t)DB_COLTYPE_FLOAT32:
+        return COLUMN_FLOAT32;
+    case (intptr_t)DB_COLTYPE_FLOAT64:
+        return COLUMN_FLOAT64;
+    case (intptr_t)DB_COLTYPE_DATE:
+        return COLUMN_DATE;
+    case (intptr_t)DB_COLTYPE_TIME:
+        return COLUMN_TIME;
+    case (intptr_t)DB_COLTYPE_DATETIME:
+        return COLUMN_DATETIME;
+    case (intptr_t)DB_COLTYPE_TIMESTAMP:
+        return COLUMN_TIMESTAMP;
+    default:
+        return COLUMN_TEXT;
+    }
+}
+
+static void
+free_columns(column_t * columns, db_fieldno_t field_count)
+{
+    db_fieldno_t fieldno;
+
+    for (fieldno = 0; fieldno < field_count; ++fieldno) {
+        free(columns[fieldno].name);
+    }
+    free(columns);
+}
 
-/// Execute a SQL query for each line of input
-void
-dbs_sql_line_shell(db_t database, const char * prompt, FILE * in, FILE * out, FILE * err)
+/* Read the name and type of each field in the result set. */
+static column_t *
+get_columns(db_cursor_t sql_cursor, db_fieldno_t field_count)
 {
-    char * buffer;
-    size_t buffer_size = 128;
+    column_t * columns = (column_t *)calloc(field_count > 0 ? field_count : 1, sizeof(column_t));
+    db_fielddef_t fielddef;
+    db_fieldno_t fieldno;
 
-    buffer = (char *)malloc(buffer_size);
+    if (columns == NULL) {
+        return NULL;
+    }
 
-    while (!feof(in) && !ferror(in)) {
-        size_t statement_length = 0;
-        db_cursor_t sql_cursor;
+    db_fielddef_init(&fielddef);
+    for (fieldno = 0; fieldno < field_count; ++fieldno) {
+        const char * name = "";
 
-        fprintf(out, "%s> ", prompt);
-        fflush(out);
+        columns[fieldno].column_class = COLUMN_TEXT;
+        if (DB_OK == db_get_field(sql_cursor, fieldno, &fielddef)) {
+            columns[fieldno].column_class = get_column_class(&fielddef);
+            name = fielddef.field_name;
+        }
+        columns[fieldno].name = (char *)malloc(strlen(name) + 1);
+        if (columns[fieldno].name == NULL) {
+            db_fielddef_destroy(&fielddef);
+            free_columns(columns, field_count);
+            return NULL;
+        }
+        strcpy(columns[fieldno].name, name);
+    }
+    db_fielddef_destroy(&fielddef);
 
-        // Read line in
-        do {
-            grow_buffer(&buffer, &buffer_size, buffer_size + statement_length);
-            if (buffer == NULL) {
-                fprintf(err, "Out of memory for SQL statement\n");
-                return;
-            }
+    return columns;
+}
 
-            fgets(buffer + statement_length, (int)(buffer_size - statement_length), in);
-            statement_length += strlen(buffer + statement_length);
-        } while (statement_length > 0 && buffer[statement_length - 1] != '\n');
+/* Returns -1 if out of memory. */
+static int
+render_header(shell_t * shell, const column_t * columns, db_fieldno_t field_count)
+{
+    const char * separator;
+    db_fieldno_t fieldno;
 
-        // Continue until a blank line is entered
-        if (buffer[0] == '\n') {
-            db_commit_tx(database, 0);
+    switch (shell->output_mode) {
+    case DBS_SQL_OUTPUT_JSON: return 0;
+    case DBS_SQL_OUTPUT_CSV:  separator = ","; break;
+    case DBS_SQL_OUTPUT_TSV:  separator = "\t"; break;
+    default:                  separator = ", "; break;
+    }
+
+    for (fieldno = 0; fieldno < field_count; ++fieldno) {
+        if (fieldno > 0) {
+            output_string(&shell->output, separator);
+        }
+        if (output_text(shell, columns[fieldno].name, strlen(columns[fieldno].name)) != 0) {
+            return -1;
+        }
+    }
+    return output_char(&shell->output, '\n');
+}
+
+/* Format one field of the current row. Returns -1 if out of memory. */
+static int
+render_field(shell_t * shell, db_row_t row, db_fieldno_t fieldno, const column_t * column)
+{
+    output_t * output = &shell->output;
+    char * p;
+    db_len_t len;
+
+    if (db_is_null(row, fieldno) > 0) {
+        switch (shell->output_mode) {
+        case DBS_SQL_OUTPUT_CSV:  break;
+        case DBS_SQL_OUTPUT_TSV:  output_write(output, "\\N", 2); break;
+        default:                  output_write(output, "null", 4); break;
+        }
+        return 0;
+    }
+
+    switch (column->column_class) {
+    case COLUMN_SIGNED: {
+        int64_t value;
+        if (db_get_field_data(row, fieldno, DB_VARTYPE_SINT64, &value, sizeof(value)) < 0) {
+            break;
+        }
+        if ((p = output_reserve(output, 24)) == NULL) {
+            return -1;
+        }
+        output->length += format_int64(p, value);
+        return 0;
+    }
+    case COLUMN_UNSIGNED: {
+        uint64_t value;
+        if (db_get_field_data(row, fieldno, DB_VARTYPE_UINT64, &value, sizeof(value)) < 0) {
+            break;
+        }
+        if ((p = output_reserve(output, 24)) == NULL) {
+            return -1;
+        }
+        output->length += format_uint64(p, value);
+        return 0;
+    }
+    case COLUMN_FLOAT32:
+    case COLUMN_FLOAT64: {
+        double value;
+        if (db_get_field_data(row, fieldno, DB_VARTYPE_FLOAT64, &value, sizeof(value)) < 0) {
             break;
         }
+        /* JSON has no representation of infinity or not-a-number. */
+        if (shell->output_mode == DBS_SQL_OUTPUT_JSON && (value != value || fabs(value) > 1.7976931348623157e308)) {
+            output_write(output, "null", 4);
+            return 0;
+        }
+        if ((p = output_reserve(output, 40)) == NULL) {
+            return -1;
+        }
+        output->length += format_double(p, value, column->column_class == COLUMN_FLOAT32);
+        return 0;
+    }
+    case COLUMN_DATE:
+    case COLUMN_TIME:
+    case COLUMN_DATETIME:
+    case COLUMN_TIMESTAMP: {
+        /* Fetched in the column's own type and written as text, so that
+         * JSON quotes it. */
+        db_timestamp_t value;
+        char text[48];
+        int length;
+
+        memset(&value, 0, sizeof(value));
+        if (column->column_class == COLUMN_DATE) {
+            if (db_get_field_data(row, fieldno, DB_VARTYPE_DATE, &value.date, sizeof(value.date)) < 0) {
+                break;
+            }
+            length = (int)(format_date(text, &value.date) - text);
+        }
+        else if (column->column_class == COLUMN_TIME) {
+            if (db_get_field_data(row, fieldno, DB_VARTYPE_TIME, &value.time, sizeof(value.time)) < 0) {
+                break;
+            }
+            length = (int)(format_time(text, &value.time) - text);
+        }
+        else if (column->column_class == COLUMN_DATETIME) {
+            db_datetime_t datetime;
+            if (db_get_field_data(row, fieldno, DB_VARTYPE_DATETIME, &datetime, sizeof(datetime)) < 0) {
+                break;
+            }
+            value.date = datetime.date;
+            value.time = datetime.time;
+            length = format_timestamp(text, &value);
+        }
+        else {
+            if (db_get_field_data(row, fieldno, DB_VARTYPE_TIMESTAMP, &value, sizeof(value)) < 0) {
+                break;
+            }
+            length = format_timestamp(text, &value);
+        }
+        return output_text(shell, text, (size_t)length);
+    }
+    default:
+        break;
+    }
 
-        // Remove trailing semicolon, if present
-        if (statement_length >= 2 && buffer[statement_length - 2] == ';') {
-            buffer[statement_length - 2] = '\0';
+    /* Any other type, or a native conversion that failed: convert to text. */
+    len = db_get_field_data(row, fieldno, DB_VARTYPE_UTF8STR, NULL, 0);
+    if (len > 0) {
+        grow_buffer(&shell->buffer, &shell->buffer_size, (size_t)len + 1);
+        if (shell->buffer == NULL) {
+            return -1;
         }
+        len = db_get_field_data(row, fieldno, DB_VARTYPE_UTF8STR, shell->buffer, (db_len_t)shell->buffer_size);
+    }
+
+    if (len >= 0) {
+        return output_text(shell, shell->buffer, len > 0 ? (size_t)len : 0);
+    }
+    else if (len == DB_FIELD_NULL) {
+        output_write(output, "null", 4);
+    }
+    else {
+        output_flush(output);
+        fprintf(shell->err, "Type conversion error: %d\n", get_db_error());
+    }
+    return 0;
+}
 
-        // Prepare the SQL statement
-        sql_cursor = db_prepare_sql_cursor(database, buffer, DB_CURSOR_ENCODING_UTF8);
+/* Print every row of an executed cursor, and add the time spent fetching
+ * and formatting rows to timing. Returns -1 if out of memory. */
+static int
+render_result_set(shell_t * shell, db_cursor_t sql_cursor, uint64_t execute_start, timing_t * timing)
+{
+    output_t * output = &shell->output;
+    const char * separator;
+    db_fieldno_t field_count = db_get_field_count(sql_cursor);
+    db_fieldno_t fieldno;
+    column_t * columns;
+    db_row_t row;
+    uint64_t start = clock_ns();
+    uint64_t fetched;
+    int rc = 0;
 
-        if (db_is_prepared(sql_cursor) > 0) {
-            int param_count = db_get_param_count(sql_cursor);
-            db_row_t param_row;
+    columns = get_columns(sql_cursor, field_count);
+    if (columns == NULL) {
+        return -1;
+    }
 
-            if (param_count > 0) {
-                db_fieldno_t paramno;
-                param_row = db_alloc_param_row(sql_cursor);
+    switch (shell->output_mode) {
+    case DBS_SQL_OUTPUT_CSV:  separator = ","; break;
+    case DBS_SQL_OUTPUT_TSV:  separator = "\t"; break;
+    case DBS_SQL_OUTPUT_JSON: separator = ","; break;
+    default:                  separator = ", "; break;
+    }
 
-                for (paramno = 0; paramno < param_count; ++paramno) {
-                    size_t param_length = 0;
+    rc = render_header(shell, columns, field_count);
 
-                    fprintf(out, "param[%d]=", (int)paramno);
-                    fflush(out);
+    row = rc == 0 ? db_alloc_cursor_row(sql_cursor) : NULL;
+    if (row != NULL) {
+        uint64_t now = clock_ns();
 
-                    // Read line in
-                    do {
-                        grow_buffer(&buffer, &buffer_size, buffer_size + param_length);
-                        if (buffer == NULL) {
-                            fprintf(err, "Out of memory for SQL parameter\n");
-                            return;
-                        }
+        /* Time alternates between the database (seek and fetch) and
+         * formatting, so read the clock at each switch. */
+        timing->render_ns += now - start;
+        start = now;
+        for (db_seek_first(sql_cursor); !db_eof(sql_cursor) && rc == 0; db_seek_next(sql_cursor)) {
+            if (DB_OK != db_fetch(sql_cursor, row, NULL)) {
+                output_flush(output);
+                fprintf(shell->err, "Fetch error: %d\n", get_db_error());
+                continue;
+            }
 
-                        fgets(buffer + param_length, (int)(buffer_size - param_length), in);
-                        param_length += strlen(buffer + param_length);
-                    } while (param_length > 0 && buffer[param_length - 1] != '\n');
+            fetched = clock_ns();
+            timing->fetch_ns += fetched - start;
+            if (timing->rows++ == 0) {
+                timing->first_row_ns = fetched - execute_start;
+            }
 
-                    if (param_length > 0) {
-                        if (DB_OK != db_set_field_data(param_row, paramno, DB_VARTYPE_UTF8STR, buffer, (db_len_t)param_length - 1)) {
-                            fprintf(err, "Type conversion error: %d\n", get_db_error());
-                        }
-                    }
+            if (shell->output_mode == DBS_SQL_OUTPUT_JSON) {
+                rc = output_char(output, '{');
+            }
+            for (fieldno = 0; fieldno < field_count && rc == 0; ++fieldno) {
+                if (fieldno > 0) {
+                    output_string(output, separator);
+                }
+                if (shell->output_mode == DBS_SQL_OUTPUT_JSON) {
+                    rc = output_json_text(output, columns[fieldno].name, strlen(columns[fieldno].name));
+                    rc = rc == 0 ? output_char(output, ':') : rc;
                 }
+                rc = rc == 0 ? render_field(shell, row, fieldno, &columns[fieldno]) : rc;
+            }
+            if (rc == 0 && shell->output_mode == DBS_SQL_OUTPUT_JSON) {
+                rc = output_char(output, '}');
+            }
+            rc = rc == 0 ? output_char(output, '\n') : rc;
+
+            start = clock_ns();
+            timing->render_ns += start - fetched;
+        }
+        now = clock_ns();
+        timing->fetch_ns += now - start;
+        start = now;
+        db_free_row(row);
+    }
+
+    output_flush(output);
+    free_columns(columns, field_count);
+    timing->render_ns += clock_ns() - start;
+    return rc;
+}
+
+/* Input. */
+
+/* Read one line, including its line break, into the shell buffer.
+ * Returns -1 if out of memory. */
+static int
+read_line(shell_t * shell, size_t * length)
+{
+    *length = 0;
+    do {
+        grow_buffer(&shell->buffer, &shell->buffer_size, shell->buffer_size + *length);
+        if (shell->buffer == NULL) {
+            return -1;
+        }
+
+        if (fgets(shell->buffer + *length, (int)(shell->buffer_size - *length), shell->in) == NULL) {
+            shell->buffer[*length] = '\0';
+            break;
+        }
+        *length += strlen(shell->buffer + *length);
+    } while (*length > 0 && shell->buffer[*length - 1] != '\n');
+
+    return 0;
+}
+
+/* True if prompts and row counts are written along with results. */
+static int
+is_interactive(const shell_t * shell)
+{
+    return shell->output_mode == DBS_SQL_OUTPUT_LIST && !shell->script;
+}
+
+/* Stream for messages that are not results. */
+static FILE *
+message_stream(const shell_t * shell)
+{
+    return shell->output_mode == DBS_SQL_OUTPUT_LIST ? shell->out : shell->err;
+}
+
+/* Shell commands. */
+
+static void
+run_command(shell_t * shell, const char * command)
+{
+    if (0 == strcmp(command, ".cache")) {
+        print_cache_statistics(shell->out, &shell->cache);
+    }
+    else if (0 == strcmp(command, ".timing on")) {
+        shell->timing = 1;
+    }
+    else if (0 == strcmp(command, ".timing off")) {
+        shell->timing = 0;
+    }
+    else if (0 == strcmp(command, ".slow")) {
+        print_slow_log(shell->out, &shell->slow_log);
+    }
+    else if (0 == strcmp(command, ".slow clear")) {
+        slow_log_clear(&shell->slow_log);
+    }
+    else if (0 == strncmp(command, ".slow ", 6) && isdigit((unsigned char)command[6])) {
+        shell->slow_log.threshold_ms = strtoul(command + 6, NULL, 10);
+    }
+    else if (0 == strncmp(command, ".read ", 6)) {
+        /* The command is in the shell buffer, which the script reuses. */
+        char * name = (char *)malloc(strlen(command + 6) + 1);
+        FILE * script;
+
+        if (name == NULL) {
+            fprintf(shell->err, "Out of memory for SQL script\n");
+            return;
+        }
+        strcpy(name, command + 6);
+
+        script = fopen(name, "rb");
+        if (script != NULL) {
+            run_script(shell, script, name);
+            fclose(script);
+        }
+        else {
+            fprintf(shell->err, "Cannot open %s\n", name);
+        }
+        free(name);
+    }
+    else if (0 == strncmp(command, ".batch ", 7) && isdigit((unsigned char)command[7])) {
+        shell->script_batch = atoi(command + 7);
+    }
+    else if (0 == strncmp(command, ".onerror ", 9)) {
+        size_t policy;
+
+        for (policy = 0; policy < sizeof(error_policy_names) / sizeof(error_policy_names[0]); policy++) {
+            if (0 == strcmp(command + 9, error_policy_names[policy])) {
+                shell->script_on_error = (dbs_sql_error_policy_t)policy;
+                return;
+            }
+        }
+        fprintf(shell->err, "Unknown error policy: %s\n", command + 9);
+    }
+    else if (0 == strncmp(command, ".mode ", 6)) {
+        size_t mode;
+
+        for (mode = 0; mode < sizeof(output_mode_names) / sizeof(output_mode_names[0]); mode++) {
+            if (0 == strcmp(command + 6, output_mode_names[mode])) {
+                shell->output_mode = (dbs_sql_output_mode_t)mode;
+                return;
+            }
+        }
+        fprintf(shell->err, "Unknown output mode: %s\n", command + 6);
+    }
+    else {
+        fprintf(shell->err, "Unknown command: %s\n", command);
+    }
+}
+
+/* Statements. */
+
+/* Read a value for each parameter of a statement. Returns 1 if the
+ * statement has parameters that cannot be read or converted, in which
+ * case it is not executed, or -1 if out of memory. */
+static int
+read_parameters(shell_t * shell, statement_t * statement)
+{
+    db_fieldno_t paramno;
+
+    if (shell->script && statement->param_count > 0) {
+        fprintf(shell->err, "Parameters are not supported in scripts\n");
+        return 1;
+    }
+
+    for (paramno = 0; paramno < statement->param_count; ++paramno) {
+        size_t param_length;
+
+        if (is_interactive(shell)) {
+            fprintf(shell->out, "param[%d]=", (int)paramno);
+            fflush(shell->out);
+        }
+
+        // A cached statement keeps the values of its last run
+        db_set_null(statement->param_row, paramno);
+
+        if (read_line(shell, &param_length) != 0) {
+            return -1;
+        }
+
+        if (param_length == 0) {
+            fprintf(shell->err, "Missing value for parameter %d\n", (int)paramno);
+            return 1;
+        }
+        if (DB_OK != db_set_field_data(statement->param_row, paramno, DB_VARTYPE_UTF8STR, shell->buffer, (db_len_t)param_length - 1)) {
+            fprintf(shell->err, "Type conversion error: %d\n", get_db_error());
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Prepare, execute, and print the results of a statement. Returns 1 if
+ * the statement failed, or -1 if out of memory. */
+static int
+run_statement(shell_t * shell, const char * sql)
+{
+    statement_t * statement;
+    db_cursor_t sql_cursor;
+    timing_t timing;
+    uint64_t start;
+    unsigned long hits = shell->cache.hits;
+    int rc = 0;
+
+    memset(&timing, 0, sizeof(timing));
+
+    // Prepare the SQL statement, or reuse it from the cache
+    start = clock_ns();
+    statement = prepare_statement(&shell->cache, shell->database, sql);
+    timing.prepare_ns = clock_ns() - start;
+    if (statement == NULL) {
+        return -1;
+    }
+    timing.cached = shell->cache.hits != hits;
+    sql_cursor = statement->cursor;
+
+    if (db_is_prepared(sql_cursor) > 0) {
+        rc = read_parameters(shell, statement);
+        if (rc != 0) {
+            release_statement(statement);
+            return rc;
+        }
+
+        // Execute the SQL statement
+        start = clock_ns();
+        if (DB_OK == db_execute(sql_cursor, statement->param_row, NULL)) {
+            timing.execute_ns = clock_ns() - start;
+            if (db_is_browsable(sql_cursor) > 0) {
+                rc = render_result_set(shell, sql_cursor, start, &timing);
             }
             else {
-                param_row = NULL;
-            }
-
-            // Execute the SQL statement
-            if (DB_OK == db_execute(sql_cursor, param_row, NULL)) {
-                if (db_is_browsable(sql_cursor) > 0) {
-                    db_fieldno_t fieldno;
-                    db_fieldno_t field_count;
-                    db_fielddef_t fielddef;
-                    db_row_t row;
-
-                    // Print list of fields in the result set
-                    field_count = db_get_field_count(sql_cursor);
-                    db_fielddef_init(&fielddef);
-                    for (fieldno = 0; fieldno < field_count; ++fieldno) {
-                        if (fieldno > 0) {
-                            fprintf(out, ", ");
-                        }
-                        if (DB_OK == db_get_field(sql_cursor, fieldno, &fielddef)) {
-                            fprintf(out, "%s", fielddef.field_name);
-                        }
-                    }
-                    db_fielddef_destroy(&fielddef);
-                    fprintf(out, "\n");
-
-                    // Print result set
-                    row = db_alloc_cursor_row(sql_cursor);
-                    if (row != NULL) {
-                        for (db_seek_first(sql_cursor); !db_eof(sql_cursor); db_seek_next(sql_cursor)) {
-                            // Print the current row
-                            if (DB_OK == db_fetch(sql_cursor, row, NULL)) {
-                                for (fieldno = 0; fieldno < field_count; ++fieldno) {
-                                    if (fieldno > 0) {
-                                        fprintf(out, ", ");
-                                    }
-                                    db_len_t len;
-
-                                    // Grow buffer, if required
-                                    len = db_get_field_data(row, fieldno, DB_VARTYPE_UTF8STR, NULL, 0);
-
-                                    if (len > 0) {
-                                        grow_buffer(&buffer, &buffer_size, (size_t)len + 1);
-                                        if (buffer == NULL) {
-                                            fprintf(err, "Out of memory for field\n");
-                                            return;
-                                        }
-
-                                        // Print field as a string
-                                        len = db_get_field_data(row, fieldno, DB_VARTYPE_UTF8STR, buffer, (db_len_t)buffer_size);
-                                        if (len > 0) {
-                                            fprintf(out, "%*s", (int)len, buffer);
-                                        }
-                                    }
-
-                                    if (len == DB_FIELD_NULL) {
-                                        fprintf(out, "null");
-                                    }
-                                    else if (len == DB_LEN_FAIL) {
-                                        fprintf(err, "Type conversion error: %d\n", get_db_error());
-                                    }
-                                }
-                                fprintf(out, "\n");
-                            }
-                            else {
-                                fprintf(err, "Fetch error: %d\n", get_db_error());
-                            }
-                        }
-                        db_free_row(row);
+                int32_t modified_rows;
+                if (DB_OK == db_get_row_count_ex(sql_cursor, &modified_rows) && modified_rows >= 0) {
+                    timing.rows = (unsigned long)modified_rows;
+                    if (is_interactive(shell)) {
+                        fprintf(shell->out, "%ld rows modified\n", (long int)modified_rows);
                     }
                 }
-                else {
-                    int32_t modified_rows;
-                    if (DB_OK == db_get_row_count_ex(sql_cursor, &modified_rows) && modified_rows >= 0) {
-                        fprintf(out, "%ld rows modified\n", (long int)modified_rows);
+            }
+
+            // Keep results and the time report separate in machine readable output
+            if (shell->timing) {
+                print_timing(message_stream(shell), &timing);
+            }
+            slow_log_add(&shell->slow_log, statement->sql, &timing);
+        }
+        else {
+            fprintf(shell->err, "Execute error: %d\n", get_db_error());
+            rc = 1;
+        }
+    }
+    else {
+        fprintf(shell->err, "Prepare error: %d\n", get_db_error());
+        rc = 1;
+    }
+
+    release_statement(statement);
+    return rc;
+}
+
+/* Scripts. */
+
+/* Commit the current batch after every script_batch statements, or at the
+ * end of the script. */
+static void
+commit_script_batch(shell_t * shell)
+{
+    if (db_is_active_tx(shell->database) && DB_OK != db_commit_tx(shell->database, 0)) {
+        fprintf(shell->err, "Commit error: %d\n", get_db_error());
+    }
+}
+
+/* Run one statement of a script, inside the current batch. Returns 1 if
+ * the script must stop, or -1 if out of memory. */
+static int
+run_script_statement(shell_t * shell, const char * sql, unsigned long line, unsigned long * failed)
+{
+    db_savepoint_t savepoint = NULL;
+    int own_tx = 0;
+    int rc;
+
+    if (!db_is_active_tx(shell->database)) {
+        if (shell->script_batch > 0) {
+            db_begin_tx(shell->database, 0);
+        }
+        else if (shell->script_on_error == DBS_SQL_ON_ERROR_SAVEPOINT) {
+            /* No batch: the statement gets a transaction of its own to roll back. */
+            own_tx = DB_OK == db_begin_tx(shell->database, 0);
+        }
+    }
+    if (shell->script_on_error == DBS_SQL_ON_ERROR_SAVEPOINT && !own_tx && db_is_active_tx(shell->database)) {
+        savepoint = db_set_savepoint(shell->database, "dbs_sql_script", DB_SAVEPOINT_OVERRIDE);
+    }
+
+    rc = run_statement(shell, sql);
+    if (rc <= 0) {
+        if (own_tx && rc == 0) {
+            commit_script_batch(shell);
+        }
+        else if (own_tx && db_is_active_tx(shell->database)) {
+            db_abort_tx(shell->database, 0);
+        }
+        return rc;
+    }
+
+    ++*failed;
+    output_flush(&shell->output);
+    fprintf(shell->err, "Line %lu: %s\n", line, sql);
+
+    switch (shell->script_on_error) {
+    case DBS_SQL_ON_ERROR_SKIP:
+        return 0;
+    case DBS_SQL_ON_ERROR_SAVEPOINT:
+        if (own_tx) {
+            if (db_is_active_tx(shell->database)) {
+                db_abort_tx(shell->database, 0);
+            }
+            return 0;
+        }
+        if (savepoint != NULL && DB_OK == db_rollback_savepoint(shell->database, savepoint)) {
+            return 0;
+        }
+        fprintf(shell->err, "Rollback to savepoint failed: %d\n", get_db_error());
+        /* fall through */
+    default:
+        if (db_is_active_tx(shell->database)) {
+            db_abort_tx(shell->database, 0);
+            fprintf(shell->err, "Rolled back statements since the last commit\n");
+        }
+        return 1;
+    }
+}
+
+/* Read and run every statement in a script. Returns 0 if all statements
+ * succeeded. */
+static int
+run_script(shell_t * shell, FILE * script, const char * name)
+{
+    script_state_t state = SCRIPT_SQL;
+    char * block;
+    char * text = NULL;
+    size_t text_size = 0;
+    size_t length = 0;
+    char quote = '\0';
+    char prev = '\0';
+    unsigned long line = 1;
+    unsigned long start_line = 1;
+    unsigned long statements = 0;
+    unsigned long failed = 0;
+    int batch = 0;
+    int rc = 0;
+    int nested = shell->script;
+    uint64_t start = clock_ns();
+    uint64_t elapsed_ns;
+    size_t block_length;
+
+    block = (char *)malloc(DBS_SQL_SCRIPT_BLOCK);
+    grow_buffer(&text, &text_size, 256);
+    if (block == NULL || text == NULL) {
+        fprintf(shell->err, "Out of memory for SQL script\n");
+        free(block);
+        free(text);
+        return -1;
+    }
+
+    shell->script = 1;
+    while (rc == 0 && (block_length = fread(block, 1, DBS_SQL_SCRIPT_BLOCK, script)) > 0) {
+        size_t i;
+
+        for (i = 0; i < block_length && rc == 0; i++) {
+            char c = block[i];
+
+            if (c == '\n') {
+                line++;
+            }
+
+            switch (state) {
+            case SCRIPT_LINE_COMMENT:
+                if (c == '\n') {
+                    state = SCRIPT_SQL;
+                    c = ' ';
+                    break;
+                }
+                continue;
+            case SCRIPT_BLOCK_COMMENT:
+                if (c == '/' && prev == '*') {
+                    state = SCRIPT_SQL;
+                    c = ' ';
+                    break;
+                }
+                prev = c;
+                continue;
+            case SCRIPT_QUOTE:
+                /* A doubled quote ends and restarts the quoted text. */
+                if (c == quote) {
+                    state = SCRIPT_SQL;
+                }
+                break;
+            default:
+                if (c == '\'' || c == '"') {
+                    state = SCRIPT_QUOTE;
+                    quote = c;
+                }
+                else if (c == '-' && prev == '-') {
+                    state = SCRIPT_LINE_COMMENT;
+                    length--;
+                    continue;
+                }
+                else if (c == '*' && prev == '/') {
+                    state = SCRIPT_BLOCK_COMMENT;
+                    length--;
+                    prev = '\0';
+                    continue;
+                }
+                break;
+            }
+            prev = c;
+
+            if (length == 0 && isspace((unsigned char)c)) {
+                start_line = line;
+                continue;
+            }
+
+            if (c != ';' || state != SCRIPT_SQL) {
+                if (length + 1 >= text_size) {
+                    grow_buffer(&text, &text_size, length + 2);
+                    if (text == NULL) {
+                        rc = -1;
+                        break;
                     }
                 }
+                text[length++] = c;
+                continue;
             }
-            else {
-                fprintf(err, "Execute error: %d\n", get_db_error());
+
+            // End of statement
+            text[length] = '\0';
+            length = 0;
+            prev = '\0';
+            normalize_sql(text);
+            if (text[0] == '\0') {
+                continue;
             }
 
-            db_free_row(param_row);
+            statements++;
+            rc = run_script_statement(shell, text, start_line, &failed);
+            if (rc == 0 && shell->script_batch > 0 && ++batch >= shell->script_batch) {
+                commit_script_batch(shell);
+                batch = 0;
+            }
         }
-        else {
-            fprintf(err, "Prepare error: %d\n", get_db_error());
+    }
+
+    // A last statement without a semicolon
+    if (rc == 0 && text != NULL && length > 0) {
+        text[length] = '\0';
+        normalize_sql(text);
+        if (text[0] != '\0') {
+            statements++;
+            rc = run_script_statement(shell, text, start_line, &failed);
+        }
+    }
+    if (rc == 0) {
+        commit_script_batch(shell);
+    }
+    if (ferror(script)) {
+        fprintf(shell->err, "Error reading %s\n", name);
+        rc = 1;
+    }
+    if (rc < 0) {
+        fprintf(shell->err, "Out of memory for SQL script\n");
+    }
+    shell->script = nested;
+
+    elapsed_ns = clock_ns() - start;
+    output_flush(&shell->output);
+    fprintf(message_stream(shell), "%s: %lu statements, %lu failed, %.3f s, %.0f statements/sec%s\n",
+            name, statements, failed, (double)elapsed_ns / 1e9,
+            elapsed_ns > 0 ? (double)statements * 1e9 / (double)elapsed_ns : 0.0,
+            rc != 0 ? ", stopped" : "");
+
+    free(block);
+    free(text);
+    return rc == 0 && failed == 0 ? 0 : -1;
+}
+
+/* Shell setup. */
+
+static int
+shell_init(shell_t * shell, db_t database, FILE * in, FILE * out, FILE * err,
+           const dbs_sql_shell_config_t * config)
+{
+    memset(shell, 0, sizeof(*shell));
+    shell->database = database;
+    shell->in = in;
+    shell->out = out;
+    shell->err = err;
+    shell->cache.max_entries = config->cache_entries;
+    shell->cache.max_bytes = config->cache_bytes;
+    shell->output_mode = config->output_mode;
+    shell->output.out = out;
+    shell->timing = config->timing;
+    shell->slow_log.threshold_ms = config->slow_threshold_ms;
+    shell->script_batch = config->script_batch;
+    shell->script_on_error = config->script_on_error;
+
+    shell->buffer_size = 128;
+    shell->buffer = (char *)malloc(shell->buffer_size);
+    shell->output.size = config->output_buffer_size > 0 ? config->output_buffer_size : DBS_SQL_OUTPUT_BUFFER;
+    shell->output.data = (char *)malloc(shell->output.size);
+    if (config->slow_log_entries > 0) {
+        shell->slow_log.capacity = config->slow_log_entries;
+        shell->slow_log.entries = (slow_statement_t *)calloc(config->slow_log_entries, sizeof(slow_statement_t));
+    }
+    if (shell->buffer == NULL || shell->output.data == NULL || (shell->slow_log.capacity > 0 && shell->slow_log.entries == NULL)) {
+        fprintf(err, "Out of memory for SQL shell\n");
+        free(shell->slow_log.entries);
+        free(shell->output.data);
+        free(shell->buffer);
+        return -1;
+    }
+    return 0;
+}
+
+static void
+shell_destroy(shell_t * shell)
+{
+    output_flush(&shell->output);
+    fflush(shell->out);
+    cache_clear(&shell->cache);
+    slow_log_clear(&shell->slow_log);
+    free(shell->slow_log.entries);
+    free(shell->output.data);
+    free(shell->buffer);
+}
+
+/// Execute a SQL query for each line of input
+void
+dbs_sql_line_shell(db_t database, const char * prompt, FILE * in, FILE * out, FILE * err)
+{
+    dbs_sql_shell_config_t config;
+
+    dbs_sql_shell_config_init(&config);
+    dbs_sql_line_shell_ex(database, prompt, in, out, err, &config);
+}
+
+/// Execute a SQL query for each line of input, with the given settings
+/** Lines that start with a period are shell commands instead of SQL:
+ *
+ *    .cache        print statement cache hits and misses
+ *    .mode MODE    set the result format: list, csv, tsv, or json
+ *    .timing on    print prepare, execute, fetch, and output times of
+ *                  each statement; .timing off to stop
+ *    .slow         print the statements that took longer than the slow
+ *                  statement threshold
+ *    .slow MS      set the slow statement threshold in milliseconds
+ *    .slow clear   empty the slow statement log
+ *    .read FILE    run a SQL script, see dbs_sql_run_script()
+ *    .batch N      statements per transaction in scripts, 0 for one
+ *                  transaction per statement
+ *    .onerror P    when a script statement fails: stop and roll back the
+ *                  current batch, skip the statement, or roll back only
+ *                  the statement to a savepoint
+ *
+ *  list is the default format: the field names, then each row, with
+ *  fields separated by commas. The csv format follows RFC 4180, tsv
+ *  escapes tabs and line breaks with backslashes and writes \N for null,
+ *  and json writes one JSON object per row. In the csv, tsv, and json
+ *  formats nothing but the results is written to out, so the output can be
+ *  piped to other tools. */
+void
+dbs_sql_line_shell_ex(db_t database, const char * prompt, FILE * in, FILE * out, FILE * err,
+                      const dbs_sql_shell_config_t * config)
+{
+    shell_t shell;
+
+    if (shell_init(&shell, database, in, out, err, config) != 0) {
+        return;
+    }
+
+    while (!feof(in) && !ferror(in)) {
+        size_t statement_length;
+
+        if (is_interactive(&shell)) {
+            fprintf(out, "%s> ", prompt);
+            fflush(out);
+        }
+
+        // Read line in
+        if (read_line(&shell, &statement_length) != 0) {
+            fprintf(err, "Out of memory for SQL statement\n");
+            break;
+        }
+
+        // Continue until a blank line is entered
+        if (shell.buffer[0] == '\n') {
+            db_commit_tx(database, 0);
+            break;
+        }
+
+        normalize_sql(shell.buffer);
+        if (shell.buffer[0] == '\0') {
+            continue;
+        }
+
+        if (shell.buffer[0] == '.') {
+            run_command(&shell, shell.buffer);
+        }
+        else if (run_statement(&shell, shell.buffer) < 0) {
+            fprintf(err, "Out of memory for SQL statement\n");
+            break;
         }
+    }
+
+    shell_destroy(&shell);
+}
 
-        db_close_cursor(sql_cursor);
+/// Run every statement in a SQL script
+/** Statements end with a semicolon and can span several lines; -- and
+ *  C style comments are ignored. Every config->script_batch statements
+ *  are committed as one transaction, and config->script_on_error selects
+ *  what happens when a statement fails. The number of statements and the
+ *  statements per second are printed when the script ends.
+ *
+ *  @return 0 if every statement succeeded, -1 otherwise. */
+int
+dbs_sql_run_script(db_t database, FILE * script, const char * name, FILE * out, FILE * err,
+                   const dbs_sql_shell_config_t * config)
+{
+    shell_t shell;
+    int rc;
+
+    if (shell_init(&shell, database, NULL, out, err, config) != 0) {
+        return -1;
     }
+    rc = run_script(&shell, script, name);
+    shell_destroy(&shell);
 
-    free(buffer);
+    return rc;
 }
 
 void grow_buffer(char ** buffer, size_t * size, size_t requested_size)
 {
     if (requested_size > *size) {
         char * buffer_grown;
+
+        /* Grow at least twice as large, so long input is copied only
+         * a logarithmic number of times. */
+        if (requested_size < *size * 2) {
+            requested_size = *size * 2;
+        }
         buffer_grown = realloc(*buffer, requested_size);
 
         if (buffer_grown != NULL) {
@@ -31,7 +31,41 @@
 extern "C" {
 #endif
 
+/// Result formats of the SQL line shell.
+typedef enum {
+    DBS_SQL_OUTPUT_LIST,        ///< Comma and space separated, with prompts
+    DBS_SQL_OUTPUT_CSV,         ///< RFC 4180 comma separated values
+    DBS_SQL_OUTPUT_TSV,         ///< Tab separated values
+    DBS_SQL_OUTPUT_JSON         ///< One JSON object per line
+} dbs_sql_output_mode_t;
+
+/// What a script does when a statement fails.
+typedef enum {
+    DBS_SQL_ON_ERROR_STOP,      ///< Roll back the current batch and stop
+    DBS_SQL_ON_ERROR_SKIP,      ///< Report the statement and continue
+    DBS_SQL_ON_ERROR_SAVEPOINT  ///< Roll back only the failed statement and continue
+} dbs_sql_error_policy_t;
+
+/// Settings of dbs_sql_line_shell_ex() and dbs_sql_run_script().
+typedef struct {
+    int cache_entries;          ///< Prepared statements kept for reuse, 0 to disable the cache
+    size_t cache_bytes;         ///< Estimated memory limit of the statement cache
+    dbs_sql_output_mode_t output_mode;
+    size_t output_buffer_size;  ///< Bytes of results buffered before they are written
+    int timing;                 ///< Print the time of each statement, as with .timing on
+    unsigned long slow_threshold_ms;  ///< Statements slower than this are kept in the slow statement log
+    int slow_log_entries;       ///< Slow statements kept, 0 to disable the log
+    int script_batch;           ///< Script statements per transaction, 0 for one transaction per statement
+    dbs_sql_error_policy_t script_on_error;
+} dbs_sql_shell_config_t;
+
+void dbs_sql_shell_config_init(dbs_sql_shell_config_t * config);
+
 void dbs_sql_line_shell(db_t database, const char * prompt, FILE * in, FILE * out, FILE * err);
+void dbs_sql_line_shell_ex(db_t database, const char * prompt, FILE * in, FILE * out, FILE * err,
+                           const dbs_sql_shell_config_t * config);
+int dbs_sql_run_script(db_t database, FILE * script, const char * name, FILE * out, FILE * err,
+                       const dbs_sql_shell_config_t * config);
 
 #ifdef __cplusplus
 }
@@ -25,8 +25,69 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
+#include <stdarg.h>
+#include <ctype.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(OS_UCOS_III)
+#include <os.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "csv_import_export.h"
+#include "dbs_schema.h"
+#include "../shared_access/thread_utils.h"
+
+/* Compressed files are optional: define CSV_WITH_ZLIB and link zlib to
+ * read and write .gz files, or CSV_WITH_ZSTD and libzstd for .zst. */
+#ifdef CSV_WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef CSV_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+/* SSE2 is part of the x86-64 baseline. AVX2 is compiled for a single
+ * function and used only when the processor supports it. */
+#if !defined(CSV_NO_SIMD)
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#include <immintrin.h>
+#define CSV_SCAN_SSE2
+#define CSV_SCAN_AVX2
+#define CSV_TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#include <intrin.h>
+#include <immintrin.h>
+#define CSV_SCAN_SSE2
+#if _MSC_VER >= 1800
+#define CSV_SCAN_AVX2
+#define CSV_TARGET_AVX2
+#endif
+#endif
+#endif
+
+#include <time.h>
+
+/// Bytes of a csv file mapped into memory at a time, a multiple of the
+/// page size and of the Windows allocation granularity (64K)
+#ifndef CSV_MAP_WINDOW
+#define CSV_MAP_WINDOW (64 * 1024 * 1024)
+#endif
+
+/// Bytes read at a time from a csv file that cannot be mapped
+#ifndef CSV_READ_BUFFER
+#define CSV_READ_BUFFER (1024 * 1024)
+#endif
+
+/// Rows per transaction in BATCH_COMMIT mode when no limit is given
+#ifndef CSV_BATCH_ROWS
+#define CSV_BATCH_ROWS 10000
+#endif
 
 const char *EOL = "\r\n";
 const char FIELD_DELIM = ',';
@@ -39,6 +100,10 @@ typedef int (*got_field_callback_t)( int lineno, int fieldno, size_t pos, const
 /// Callback to call to storee just parsed line
 typedef int (*got_line_callback_t)( int lineno, int fields, size_t pos, void * db_context);
 
+/// Find the first occurrence of any of three characters in [data, end)
+/** Returns end if none of the characters is found. */
+typedef const char * (*scan_callback_t)( const char * data, const char * end, char a, char b, char c );
+
 /// Internal data to use in read_more_data_callback_t callback of 'In-mem string buffer' type
 typedef struct {
     const char * buffer;    ///< Input buffer
@@ -46,11 +111,33 @@ typedef struct {
     size_t read_size;       ///< Overall read size
 } read_more_inmem_data_context_t;
 
+/// Internal data to use in read_more_data_callback_t callback of 'File' type
+/** Regular files are mapped into memory one window at a time, and the
+ *  parser reads the mapped pages directly. Other files, such as pipes,
+ *  are read into a buffer in large blocks. */
+typedef struct {
+#if defined(_WIN32)
+    HANDLE file;
+    HANDLE mapping;         ///< NULL if the file is read instead
+#elif defined(OS_UCOS_III)
+    FILE * file;
+#else
+    int fd;
+#endif
+    uint64_t file_size;
+    uint64_t offset;        ///< File offset of the next window
+    char * view;            ///< Mapped window returned by the last call
+    size_t view_size;
+    char * buffer;          ///< Read buffer, NULL if the file is mapped
+} read_more_file_data_context_t;
+
 /// Utility DB error log function
 extern void print_error_message(char * message, ...);
 
 /// Method to prepare DB context (row, cursor, fields binding ...) and launch csv parser
 static int do_import( db_t hdb, const char *tname, const csv_import_options_t *, read_more_data_callback_t cb, void *cb_data );
+/// Method to import with parser threads and writer connections
+static int do_parallel_import( db_t hdb, const char *tname, const csv_import_options_t *, read_more_data_callback_t cb, void *cb_data );
 
 /// Callback to call by parse_input() csv parser to store in DB row just parsed field data
 static int got_field_cb( int lineno, int fieldno, size_t pos, const char * data, size_t len, void * db_context);
@@ -60,562 +147,4528 @@ static int got_line_cb( int lineno, int fields, size_t pos, void * db_context);
 /// Callback to call by parser_input() to fetch more csv data from input 'stream'
 static ptrdiff_t get_more_inmem_data_cb( char **data, void * cb_data );
 
+/// Callback to call by parser_input() to fetch more csv data from a file
+static ptrdiff_t get_more_file_data_cb( char **data, void * cb_data );
+
+/// Compression format of a file, chosen by its name
+typedef enum {
+    CODEC_NONE,
+    CODEC_GZIP,     ///< .gz
+    CODEC_ZSTD      ///< .zst
+} codec_t;
+
+static codec_t file_codec( const char * file_name );
+
+/// Source decompressing a file on a pipeline thread
+typedef struct inflate_source_s inflate_source_t;
+
+static inflate_source_t * open_inflate_source( const char * file_name, read_more_data_callback_t cb, void * cb_data );
+static void close_inflate_source( inflate_source_t * src );
+/// Callback to call by parser_input() to fetch more decompressed csv data
+static ptrdiff_t get_more_inflated_data_cb( char **data, void * cb_data );
+
 /// Csv parser function
 static void parse_input( read_more_data_callback_t cb, void *cb_data, got_field_callback_t got_field_cb, got_line_callback_t got_line_cb, void *db_cb_data );
+/// Csv parser function using the given scanner to find special characters
+static void parse_tokens( scan_callback_t scan, read_more_data_callback_t cb, void *cb_data, got_field_callback_t got_field_cb, got_line_callback_t got_line_cb, void *db_cb_data );
+/// Reference csv parser that inspects one character at a time
+static void parse_input_bytewise( read_more_data_callback_t cb, void *cb_data, got_field_callback_t got_field_cb, got_line_callback_t got_line_cb, void *db_cb_data );
 
 /// Callback that fetch more data from input data_provider (in-memory string buffer)
 /** Returns size of data read in call or -1 if some error */
 static ptrdiff_t
 get_more_inmem_data_cb( char ** data, void * cb_data )
 {
-    int chunk_len;
+    size_t chunk_len;
     read_more_inmem_data_context_t * ctx = (read_more_inmem_data_context_t *)cb_data;
 
     if( ctx->read_size >= ctx->buffer_size ) {
         return 0;
     }
     *data = (char *)ctx->buffer + ctx->read_size;
-    // Just to emulate file io do reading in 10byte chunks
-#define CHUNK_SIZE 10
-    chunk_len = ( ctx->buffer_size - ctx->read_size > CHUNK_SIZE ) ? CHUNK_SIZE : ( ctx->buffer_size - ctx->read_size );
-#undef CHUNK_SIZE
+    // The whole buffer is already in memory, so return it in one chunk
+    chunk_len = ctx->buffer_size - ctx->read_size;
     ctx->read_size += chunk_len;
 
     return chunk_len;
 }
 
+/// Reject options that the selected import path would ignore
+static int
+check_import_options( const csv_import_options_t * ioptions )
+{
+    if( ioptions->threads <= 0 ) {
+        if( ioptions->writers > 1 || ioptions->preserve_order ) {
+            print_error_message( "writers and preserve_order need parser threads" );
+            return -1;
+        }
+        return 0;
+    }
+
+    /* Writers commit batches of rows on their own, and a failed line
+     * aborts its batch and stops the import. */
+    if( BATCH_COMMIT != ioptions->commit_mode ) {
+        print_error_message( "parallel import commits in batches and needs BATCH_COMMIT" );
+        return -1;
+    }
+    if( ioptions->batch_ms || ioptions->resume_file ) {
+        print_error_message( "parallel import supports batch_rows, but not batch_ms or resume_file" );
+        return -1;
+    }
+    return 0;
+}
+
 /// Perform import from inmem buffer
 int
 csv_import(
     db_t hdb, const char * table_name, const char * buffer, size_t buffer_size,
     csv_import_options_t * import_options )
 {
-    csv_import_options_t ioptions = { LINE_COMMIT, USE_HEADER };
+    csv_import_options_t ioptions;
     read_more_inmem_data_context_t cb_data = { buffer, buffer_size, 0 };
 
+    memset( &ioptions, 0, sizeof( ioptions ) );
+    ioptions.commit_mode = LINE_COMMIT;
+    ioptions.header_mode = USE_HEADER;
     if( import_options ) {
         ioptions = *import_options;
     }
+    if( ioptions.threads > 0 ) {
+        print_error_message( "parser threads need csv_import_file()" );
+        return EXIT_FAILURE;
+    }
+    if( 0 != check_import_options( &ioptions ) ) {
+        return EXIT_FAILURE;
+    }
 
     return do_import( hdb, table_name, &ioptions, get_more_inmem_data_cb, &cb_data );
 }
 
+/* File data source */
+
+#if defined(_WIN32)
+
+static int
+open_file_source( read_more_file_data_context_t * ctx, const char * file_name )
+{
+    LARGE_INTEGER size;
+
+    memset( ctx, 0, sizeof( *ctx ) );
+    ctx->file = CreateFileA( file_name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                             FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+    if( INVALID_HANDLE_VALUE == ctx->file ) {
+        return -1;
+    }
+
+    if( GetFileSizeEx( ctx->file, &size ) && size.QuadPart > 0 ) {
+        ctx->file_size = (uint64_t)size.QuadPart;
+        ctx->mapping = CreateFileMappingA( ctx->file, NULL, PAGE_READONLY, 0, 0, NULL );
+    }
+    if( NULL == ctx->mapping ) {
+        ctx->buffer = (char *)malloc( CSV_READ_BUFFER );
+        if( NULL == ctx->buffer ) {
+            CloseHandle( ctx->file );
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void
+close_file_source( read_more_file_data_context_t * ctx )
+{
+    if( ctx->view ) {
+        UnmapViewOfFile( ctx->view );
+    }
+    if( ctx->mapping ) {
+        CloseHandle( ctx->mapping );
+    }
+    CloseHandle( ctx->file );
+    free( ctx->buffer );
+}
+
+static ptrdiff_t
+get_more_file_data_cb( char ** data, void * cb_data )
+{
+    read_more_file_data_context_t * ctx = (read_more_file_data_context_t *)cb_data;
+    DWORD read_size;
+
+    if( ctx->view ) {
+        UnmapViewOfFile( ctx->view );
+        ctx->view = NULL;
+    }
+
+    if( NULL == ctx->buffer ) {
+        if( ctx->offset >= ctx->file_size ) {
+            return 0;
+        }
+        ctx->view_size = ctx->file_size - ctx->offset > CSV_MAP_WINDOW
+            ? CSV_MAP_WINDOW : (size_t)( ctx->file_size - ctx->offset );
+        ctx->view = (char *)MapViewOfFile( ctx->mapping, FILE_MAP_READ,
+                                           (DWORD)( ctx->offset >> 32 ), (DWORD)ctx->offset,
+                                           ctx->view_size );
+        if( NULL == ctx->view ) {
+            return -1;
+        }
+        ctx->offset += ctx->view_size;
+        *data = ctx->view;
+        return (ptrdiff_t)ctx->view_size;
+    }
+
+    if( !ReadFile( ctx->file, ctx->buffer, CSV_READ_BUFFER, &read_size, NULL ) ) {
+        return -1;
+    }
+    *data = ctx->buffer;
+    return (ptrdiff_t)read_size;
+}
+
+#elif defined(OS_UCOS_III)
+
+static int
+open_file_source( read_more_file_data_context_t * ctx, const char * file_name )
+{
+    memset( ctx, 0, sizeof( *ctx ) );
+    ctx->file = fopen( file_name, "rb" );
+    if( NULL == ctx->file ) {
+        return -1;
+    }
+    ctx->buffer = (char *)malloc( CSV_READ_BUFFER );
+    if( NULL == ctx->buffer ) {
+        fclose( ctx->file );
+        return -1;
+    }
+    return 0;
+}
+
+static void
+close_file_source( read_more_file_data_context_t * ctx )
+{
+    fclose( ctx->file );
+    free( ctx->buffer );
+}
+
+static ptrdiff_t
+get_more_file_data_cb( char ** data, void * cb_data )
+{
+    read_more_file_data_context_t * ctx = (read_more_file_data_context_t *)cb_data;
+    size_t read_size = fread( ctx->buffer, 1, CSV_READ_BUFFER, ctx->file );
+
+    if( 0 == read_size && ferror( ctx->file ) ) {
+        return -1;
+    }
+    *data = ctx->buffer;
+    return (ptrdiff_t)read_size;
+}
+
+#else
+
+static int
+open_file_source( read_more_file_data_context_t * ctx, const char * file_name )
+{
+    struct stat st;
+
+    memset( ctx, 0, sizeof( *ctx ) );
+    ctx->fd = open( file_name, O_RDONLY );
+    if( ctx->fd < 0 ) {
+        return -1;
+    }
+
+#ifdef POSIX_FADV_SEQUENTIAL
+    /* Ask for aggressive read-ahead, for both mapped and read access. */
+    posix_fadvise( ctx->fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+#endif
+
+    if( 0 == fstat( ctx->fd, &st ) && S_ISREG( st.st_mode ) && st.st_size > 0 ) {
+        ctx->file_size = (uint64_t)st.st_size;
+    }
+    else {
+        ctx->buffer = (char *)malloc( CSV_READ_BUFFER );
+        if( NULL == ctx->buffer ) {
+            close( ctx->fd );
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void
+close_file_source( read_more_file_data_context_t * ctx )
+{
+    if( ctx->view ) {
+        munmap( ctx->view, ctx->view_size );
+    }
+    close( ctx->fd );
+    free( ctx->buffer );
+}
+
+static ptrdiff_t
+get_more_file_data_cb( char ** data, void * cb_data )
+{
+    read_more_file_data_context_t * ctx = (read_more_file_data_context_t *)cb_data;
+    ssize_t read_size;
+
+    /* The parser has copied what it needs from the previous window. */
+    if( ctx->view ) {
+        munmap( ctx->view, ctx->view_size );
+        ctx->view = NULL;
+    }
+
+    if( NULL == ctx->buffer ) {
+        void * view;
+
+        if( ctx->offset >= ctx->file_size ) {
+            return 0;
+        }
+        ctx->view_size = ctx->file_size - ctx->offset > CSV_MAP_WINDOW
+            ? CSV_MAP_WINDOW : (size_t)( ctx->file_size - ctx->offset );
+        view = mmap( NULL, ctx->view_size, PROT_READ, MAP_PRIVATE, ctx->fd, (off_t)ctx->offset );
+        if( MAP_FAILED == view ) {
+            return -1;
+        }
+#ifdef MADV_SEQUENTIAL
+        madvise( view, ctx->view_size, MADV_SEQUENTIAL );
+#endif
+        ctx->view = (char *)view;
+        ctx->offset += ctx->view_size;
+        *data = ctx->view;
+        return (ptrdiff_t)ctx->view_size;
+    }
+
+    do {
+        read_size = read( ctx->fd, ctx->buffer, CSV_READ_BUFFER );
+    } while( read_size < 0 && EINTR == errno );
+    *data = ctx->buffer;
+    return (ptrdiff_t)read_size;
+}
+
+#endif
+
+/// Perform import from a csv file
+int
+csv_import_file(
+    db_t hdb, const char * table_name, const char * file_name,
+    csv_import_options_t * import_options )
+{
+    csv_import_options_t ioptions;
+    read_more_file_data_context_t cb_data;
+    read_more_data_callback_t cb = get_more_file_data_cb;
+    void * data = &cb_data;
+    inflate_source_t * inflate = NULL;
+    int rc;
+
+    memset( &ioptions, 0, sizeof( ioptions ) );
+    ioptions.commit_mode = LINE_COMMIT;
+    ioptions.header_mode = USE_HEADER;
+    if( import_options ) {
+        ioptions = *import_options;
+    }
+    if( 0 != check_import_options( &ioptions ) ) {
+        return EXIT_FAILURE;
+    }
+
+    if( 0 != open_file_source( &cb_data, file_name ) ) {
+        print_error_message( "unable to open file '%s': %s", file_name, strerror(errno) );
+        return EXIT_FAILURE;
+    }
+
+    if( CODEC_NONE != file_codec( file_name ) ) {
+        /* Decompress on a thread of its own while the data is imported. */
+        inflate = open_inflate_source( file_name, get_more_file_data_cb, &cb_data );
+        if( NULL == inflate ) {
+            close_file_source( &cb_data );
+            return EXIT_FAILURE;
+        }
+        cb = get_more_inflated_data_cb;
+        data = inflate;
+    }
+
+    if( ioptions.threads > 0 ) {
+        rc = do_parallel_import( hdb, table_name, &ioptions, cb, data );
+    }
+    else {
+        rc = do_import( hdb, table_name, &ioptions, cb, data );
+    }
+    if( inflate ) {
+        close_inflate_source( inflate );
+    }
+    close_file_source( &cb_data );
+
+    return rc;
+}
+
+/// How a csv field is converted for its target column
+typedef enum {
+    FIELD_TEXT,     ///< Bound as ANSI text, converted by the engine
+    FIELD_UTF8,     ///< Bound as UTF-8 text
+    FIELD_SINT,     ///< Parsed by the importer and bound as a 64-bit integer
+    FIELD_UINT,     ///< Parsed by the importer and bound as a 64-bit unsigned integer
+    FIELD_FLOAT,    ///< Parsed by the importer and bound as a double
+    FIELD_DATE,     ///< ISO 8601 YYYY-MM-DD, parsed by the importer
+    FIELD_TIME,     ///< ISO 8601 HH:MM:SS, parsed by the importer
+    FIELD_DATETIME, ///< Date and time separated by a space or 'T', parsed by the importer
+    FIELD_TIMESTAMP ///< Date and time with up to 6 fraction digits, parsed by the importer
+} field_kind_t;
+
 typedef struct {
     db_t hdb;
     db_cursor_t tab;
     db_row_t hrow;
     db_fielddef_t * fields;
+    field_kind_t * kinds;       ///< Conversion for each entry in fields
     int num_fields;
     int have_tx;
     csv_import_options_t ioptions;
     int failed;
+
+    /* BATCH_COMMIT state */
+    int resume_line;            ///< Lines before this one were committed by an earlier import
+    int batch_lines;            ///< Lines inserted in the current transaction
+    int last_line;              ///< Last line inserted in the current transaction
+    unsigned long batches;      ///< Transactions committed so far
+    unsigned long total_lines;  ///< Lines committed so far
+    uint64_t start_ms;          ///< Time the import started
+    uint64_t batch_start_ms;    ///< Time the current transaction started
 } db_context_t;
 
-/// Put extracted field data into DB row (db_context->hrow)
-static int got_field_cb( int lineno, int fieldno, size_t in_csv_pos, const char * data, size_t len, void * db_context)
+static void close_import_context( db_context_t * ctx );
+
+/* Typed field conversion. */
+
+/// Select the conversion for a column type
+static field_kind_t
+field_kind( db_coltype_t field_type )
 {
-    db_context_t * ctx = (db_context_t *)db_context;
-    if( lineno == 0 ) {
-        switch( ctx->ioptions.header_mode ) {
-        case IGNORE_HEADER: return 0;
-        case NO_HEADER: break;
-        case USE_HEADER: {
-            int j;
-            /// Handle column name got from csv header
-            db_fieldno_t col_num = db_find_field( ctx->tab, data );
-            if (col_num < 0) {
-                print_error_message("unable to find column %s in target table\n", data);
-                return -1;
-            }
-            for (j = fieldno; j < ctx->num_fields; j++) {
-                if (ctx->fields[j].fieldno == col_num) {
-                    /* mapping found */
-                    if (fieldno != j) {
-                        db_fielddef_t t = ctx->fields[ fieldno ];
-                        ctx->fields[ fieldno ] = ctx->fields[j];
-                        ctx->fields[j] = t;
-                    }
-                    break;
-                }
-            }
+    switch( (intptr_t)field_type ) {
+    case (intptr_t)DB_COLTYPE_SINT8:
+    case (intptr_t)DB_COLTYPE_SINT16:
+    case (intptr_t)DB_COLTYPE_SINT32:
+    case (intptr_t)DB_COLTYPE_SINT64:
+        return FIELD_SINT;
+    case (intptr_t)DB_COLTYPE_UINT8:
+    case (intptr_t)DB_COLTYPE_UINT16:
+    case (intptr_t)DB_COLTYPE_UINT32:
+    case (intptr_t)DB_COLTYPE_UINT64:
+        return FIELD_UINT;
+    case (intptr_t)DB_COLTYPE_FLOAT32:
+    case (intptr_t)DB_COLTYPE_FLOAT64:
+        return FIELD_FLOAT;
+    case (intptr_t)DB_COLTYPE_DATE:
+        return FIELD_DATE;
+    case (intptr_t)DB_COLTYPE_TIME:
+        return FIELD_TIME;
+    case (intptr_t)DB_COLTYPE_DATETIME:
+        return FIELD_DATETIME;
+    case (intptr_t)DB_COLTYPE_TIMESTAMP:
+        return FIELD_TIMESTAMP;
+    case (intptr_t)DB_COLTYPE_UTF8STR:
+    case (intptr_t)DB_COLTYPE_UTF16STR:
+    case (intptr_t)DB_COLTYPE_UTF32STR:
+        return FIELD_UTF8;
+    default:
+        return FIELD_TEXT;
+    }
+}
 
-            if (j == ctx->num_fields) {
-                print_error_message("column %s mapped twice\n", data);
-                return -1;
-            }
+/// Parse decimal digits, returning 0 if all of [data, end) are digits that fit
+static int
+parse_digits( const char * data, const char * end, uint64_t * value )
+{
+    uint64_t v = 0;
 
-            return 0;
-        }
+    if( data == end ) {
+        return -1;
+    }
+    for( ; data != end; ++data ) {
+        unsigned int digit = (unsigned char)*data - '0';
+        if( digit > 9 || v > ( UINT64_MAX - digit ) / 10 ) {
+            return -1;
         }
+        v = v * 10 + digit;
     }
+    *value = v;
+    return 0;
+}
 
-    if( !ctx->failed && ctx->num_fields > fieldno ) {
-        db_result_t res = DB_OK;
-        if (len == 0 && (ctx->fields[ fieldno ].field_flags & DB_NULL_MASK) == DB_NULLABLE) {
-            res = db_set_null(ctx->hrow, ctx->fields[ fieldno ].fieldno);
-            fprintf( stdout, "line.field: %d.%d = <null>\n", lineno, fieldno );
-        } else {
-            switch((intptr_t)ctx->fields[ fieldno ].field_type) {
-            case (intptr_t)DB_COLTYPE_UTF8STR:
-            case (intptr_t)DB_COLTYPE_UTF16STR:
-            case (intptr_t)DB_COLTYPE_UTF32STR:
-                res = db_set_field_data( ctx->hrow, ctx->fields[ fieldno ].fieldno,
-                                         DB_VARTYPE_UTF8STR, data, len);
-                break;
-            default:
-                res = db_set_field_data( ctx->hrow, ctx->fields[ fieldno ].fieldno,
-                                         DB_VARTYPE_ANSISTR, data, len);
-            }
-            //fprintf( stdout, "line.field: %d.%d = [%s]\n", lineno, fieldno, data );
-        }
-        if (res == DB_FAIL) {
-            print_error_message("while importing into column '%s', line %d. Input pos: %d(b)",
-                                ctx->fields[ fieldno ].field_name, lineno, in_csv_pos );
-            ctx->failed = 1;
+static int
+parse_sint64( const char * data, size_t len, int64_t * value )
+{
+    const char * end = data + len;
+    int negative = 0;
+    uint64_t v;
+
+    if( data != end && ( '-' == *data || '+' == *data ) ) {
+        negative = '-' == *data++;
+    }
+    if( 0 != parse_digits( data, end, &v ) ) {
+        return -1;
+    }
+    if( negative ) {
+        if( v > (uint64_t)INT64_MAX + 1 ) {
+            return -1;
         }
-        if (ctx->failed ) {
-            fprintf( stderr, "Line %d. %s\n", lineno,
-                     ctx->ioptions.commit_mode == LINE_COMMIT ? "Skip whole line" : "Cancel processing"
-                     );
+        *value = (int64_t)( 0 - v );
+    }
+    else {
+        if( v > INT64_MAX ) {
+            return -1;
         }
+        *value = (int64_t)v;
     }
     return 0;
 }
 
-/// Insert prepared row (db_context->hrow) in DB table (db_context->tab)
-static int got_line_cb( int lineno, int fields, size_t pos, void * db_context)
+static int
+parse_uint64( const char * data, size_t len, uint64_t * value )
 {
-    int fieldno;
-    db_context_t * ctx = (db_context_t *)db_context;
+    const char * end = data + len;
 
-    if( lineno == 0 && ( USE_HEADER == ctx->ioptions.header_mode || IGNORE_HEADER == ctx->ioptions.header_mode ) ) {
-        return 0;
+    if( data != end && '+' == *data ) {
+        ++data;
     }
+    return parse_digits( data, end, value );
+}
 
-    if( fields ) {
-        if( !ctx->failed && !ctx->have_tx ) {
-            if ( db_begin_tx( ctx->hdb, 0) == DB_FAIL ) {
-                print_error_message("unable to start transaction for importing line %d", lineno);
-                ctx->failed = 1;
-            }
-            else {
-                ctx->have_tx = 1;
-            }
+/// Parse a decimal floating point number
+/** Numbers with at most 15 significant digits and a decimal exponent
+ *  within 22 are converted exactly with one multiplication or division.
+ *  Anything else is left to strtod(). data must be NUL-terminated. */
+static int
+parse_float64( const char * data, size_t len, double * value )
+{
+    static const double powers[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    const char * p = data;
+    const char * end = data + len;
+    int negative = 0;
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int any_digits = 0;
+    int exponent = 0;
+    double v;
+    char * stop;
+
+    if( p != end && ( '-' == *p || '+' == *p ) ) {
+        negative = '-' == *p++;
+    }
+    for( ; p != end && (unsigned int)( (unsigned char)*p - '0' ) <= 9; ++p ) {
+        any_digits = 1;
+        if( ( mantissa || '0' != *p ) && ++digits > 15 ) {
+            goto slow;
         }
-        if( !ctx->failed ) {
-            if (db_insert(ctx->tab, ctx->hrow, NULL, 0) == DB_FAIL) {
-                print_error_message("while importing line %d", lineno);
-                ctx->failed = 1;
+        mantissa = mantissa * 10 + ( *p - '0' );
+    }
+    if( p != end && '.' == *p ) {
+        for( ++p; p != end && (unsigned int)( (unsigned char)*p - '0' ) <= 9; ++p ) {
+            any_digits = 1;
+            if( ( mantissa || '0' != *p ) && ++digits > 15 ) {
+                goto slow;
             }
+            mantissa = mantissa * 10 + ( *p - '0' );
+            --exponent;
         }
     }
+    if( !any_digits ) {
+        goto slow;
+    }
+    if( p != end && ( 'e' == *p || 'E' == *p ) ) {
+        int exp_negative = 0;
+        int exp_value = 0;
 
-    if (ctx->ioptions.commit_mode == LINE_COMMIT) {
-
-        if (ctx->have_tx) {
-            if(ctx->failed) {
-                db_abort_tx( ctx->hdb, 0 );
-            } else if (db_commit_tx( ctx->hdb, 0 ) == DB_FAIL) {
-                print_error_message("unable to finalize transaction for importing line %d", lineno);
+        if( ++p != end && ( '-' == *p || '+' == *p ) ) {
+            exp_negative = '-' == *p++;
+        }
+        if( p == end ) {
+            return -1;
+        }
+        for( ; p != end && (unsigned int)( (unsigned char)*p - '0' ) <= 9; ++p ) {
+            if( exp_value > 1000 ) {
+                goto slow;
             }
-            ctx->have_tx = 0;
+            exp_value = exp_value * 10 + ( *p - '0' );
         }
-        /* next line might be more successful */
-        ctx->failed = 0;
-    } else if (ctx->failed) {
+        exponent += exp_negative ? -exp_value : exp_value;
+    }
+    if( p != end ) {
         return -1;
     }
 
-    /* prepare the next row */
-    for ( fieldno = 0; fieldno < ctx->num_fields; fieldno++ ) {
-        db_set_null(ctx->hrow, ctx->fields[fieldno].fieldno);
+    if( exponent < -22 || exponent > 22 ) {
+        goto slow;
+    }
+    v = exponent < 0 ? (double)mantissa / powers[ -exponent ] : (double)mantissa * powers[ exponent ];
+    *value = negative ? -v : v;
+    return 0;
+
+slow:
+    v = strtod( data, &stop );
+    if( stop == data || stop != end ) {
+        return -1;
     }
+    *value = v;
     return 0;
 }
 
-static void parse_input(
-    read_more_data_callback_t cb, void *cb_data,
-    got_field_callback_t got_field_cb, got_line_callback_t got_line_cb,
-    void *db_cb_data
-    )
+/// Parse exactly count digits at p
+static int
+parse_fixed( const char * p, int count, int * value )
 {
-    typedef enum {
-        SIMPLE_ACCUM, QUOTED_ACCUM, CHECK_EOL, CHECK_QUOTE
-    } parse_state_t;
+    int v = 0;
 
-    parse_state_t parse_state = SIMPLE_ACCUM;
+    for( ; count > 0; --count, ++p ) {
+        if( (unsigned int)( (unsigned char)*p - '0' ) > 9 ) {
+            return -1;
+        }
+        v = v * 10 + ( *p - '0' );
+    }
+    *value = v;
+    return 0;
+}
 
-    size_t hw_pos = 0;
-    int lines = 0;
-    int fieldno = 0;
-    int eof = 0;
-    char * ch = 0;
-    char * ep = 0;
-    char * c_buffer = 0;
-    size_t c_buffer_size = 5;
-    size_t symb_len = 0;
-    int EOL_LEN = strlen( EOL );
-    int eol_idx = 0;
-    int do_fetch;
-    int got_field = 0;
-    int got_line = 0;
-    int line_len = 0;
+/// Parse an ISO 8601 date, YYYY-MM-DD, from the 10 bytes at data
+static int
+parse_date( const char * data, db_date_t * value )
+{
+    static const int month_days[] = { 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    int year, month, day;
 
-    c_buffer = (char *)malloc(c_buffer_size);
+    if( 0 != parse_fixed( data, 4, &year ) || '-' != data[4]
+        || 0 != parse_fixed( data + 5, 2, &month ) || '-' != data[7]
+        || 0 != parse_fixed( data + 8, 2, &day ) ) {
+        return -1;
+    }
+    if( month < 1 || month > 12 || day < 1 || day > month_days[ month - 1 ]
+        || ( 2 == month && 29 == day && ( year % 4 || ( 0 == year % 100 && year % 400 ) ) ) ) {
+        return -1;
+    }
+    value->year = (int16_t)year;
+    value->month = (int8_t)month;
+    value->day = (int8_t)day;
+    return 0;
+}
 
-    while( !eof ) {
-        // Read more data from csv-source
-        if( ep == ch && !eof ) {
-            ptrdiff_t sz = (*cb)( &ch, cb_data );
+/// Parse an ISO 8601 time, HH:MM:SS, from the 8 bytes at data
+static int
+parse_time( const char * data, db_time_t * value )
+{
+    int hour, minute, second;
 
-            if( 0 > sz ) {
-                fprintf( stderr, "Error to read csv data source. Position in source(byte): %d\n", hw_pos );
+    if( 0 != parse_fixed( data, 2, &hour ) || ':' != data[2]
+        || 0 != parse_fixed( data + 3, 2, &minute ) || ':' != data[5]
+        || 0 != parse_fixed( data + 6, 2, &second ) ) {
+        return -1;
+    }
+    if( hour > 23 || minute > 59 || second > 59 ) {
+        return -1;
+    }
+    value->hour = (int8_t)hour;
+    value->minute = (int8_t)minute;
+    value->second = (int8_t)second;
+    return 0;
+}
+
+/// Parse a date and time separated by a space or 'T', from the 19 bytes at data
+static int
+parse_datetime( const char * data, db_date_t * date, db_time_t * time )
+{
+    if( ' ' != data[10] && 'T' != data[10] ) {
+        return -1;
+    }
+    return parse_date( data, date ) || parse_time( data + 11, time ) ? -1 : 0;
+}
+
+/// Parse a date and time with an optional fraction of 1 to 6 digits
+static int
+parse_timestamp( const char * data, size_t len, db_timestamp_t * value )
+{
+    int usec = 0;
+    size_t i;
+
+    if( len < 19 || 20 == len || len > 26 || 0 != parse_datetime( data, &value->date, &value->time ) ) {
+        return -1;
+    }
+    if( len > 19 ) {
+        if( '.' != data[19] ) {
+            return -1;
+        }
+        for( i = 20; i < 26; ++i ) {
+            if( i < len ) {
+                if( (unsigned int)( (unsigned char)data[i] - '0' ) > 9 ) {
+                    return -1;
+                }
+                usec = usec * 10 + ( data[i] - '0' );
+            }
+            else {
+                usec *= 10;
             }
+        }
+    }
+    value->usec = usec;
+    return 0;
+}
 
-            ep = ch + sz;
-            eof = 0 >= sz;
+/// Native value of a field parsed by the importer
+typedef union {
+    int64_t sint;
+    uint64_t uint;
+    double real;
+    db_date_t date;
+    db_time_t time;
+    db_datetime_t datetime;
+    db_timestamp_t timestamp;
+} native_value_t;
+
+/// Convert a field in the importer
+/** Returns 0 if the field was converted, or -1 to bind it as text instead. */
+static int
+parse_native( field_kind_t kind, const char * data, size_t len, native_value_t * value )
+{
+    switch( kind ) {
+    case FIELD_SINT:
+        return parse_sint64( data, len, &value->sint );
+    case FIELD_UINT:
+        return parse_uint64( data, len, &value->uint );
+    case FIELD_FLOAT:
+        return parse_float64( data, len, &value->real );
+    case FIELD_DATE:
+        return 10 == len ? parse_date( data, &value->date ) : -1;
+    case FIELD_TIME:
+        return 8 == len ? parse_time( data, &value->time ) : -1;
+    case FIELD_DATETIME:
+        return 19 == len ? parse_datetime( data, &value->datetime.date, &value->datetime.time ) : -1;
+    case FIELD_TIMESTAMP:
+        return parse_timestamp( data, len, &value->timestamp );
+    default:
+        return -1;
+    }
+}
+
+/// Bind a value converted by parse_native() to the row
+static db_result_t
+bind_native( db_row_t hrow, db_fieldno_t fieldno, field_kind_t kind, const native_value_t * value )
+{
+    switch( kind ) {
+    case FIELD_SINT:
+        return db_set_field_data( hrow, fieldno, DB_VARTYPE_SINT64, &value->sint, sizeof( value->sint ) );
+    case FIELD_UINT:
+        return db_set_field_data( hrow, fieldno, DB_VARTYPE_UINT64, &value->uint, sizeof( value->uint ) );
+    case FIELD_DATE:
+        return db_set_field_data( hrow, fieldno, DB_VARTYPE_DATE, &value->date, sizeof( value->date ) );
+    case FIELD_TIME:
+        return db_set_field_data( hrow, fieldno, DB_VARTYPE_TIME, &value->time, sizeof( value->time ) );
+    case FIELD_DATETIME:
+        return db_set_field_data( hrow, fieldno, DB_VARTYPE_DATETIME, &value->datetime, sizeof( value->datetime ) );
+    case FIELD_TIMESTAMP:
+        return db_set_field_data( hrow, fieldno, DB_VARTYPE_TIMESTAMP, &value->timestamp, sizeof( value->timestamp ) );
+    default:
+        return db_set_field_data( hrow, fieldno, DB_VARTYPE_FLOAT64, &value->real, sizeof( value->real ) );
+    }
+}
+
+/* Wall-clock time in milliseconds, for batch limits and progress. */
+
+#if defined(_WIN32)
+
+static uint64_t
+clock_ms( void )
+{
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+
+    if( 0 == frequency.QuadPart ) {
+        QueryPerformanceFrequency( &frequency );
+    }
+    QueryPerformanceCounter( &counter );
+    return (uint64_t)( counter.QuadPart / ( frequency.QuadPart / 1000 ) );
+}
+
+#elif defined(OS_UCOS_III)
+
+static uint64_t
+clock_ms( void )
+{
+    OS_ERR err;
+    return (uint64_t)OSTimeGet( &err ) * 1000u / OS_CFG_TICK_RATE_HZ;
+}
+
+#else
+
+static uint64_t
+clock_ms( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+#endif
+
+/// Read the line to resume from, or 0 if there is no resume file yet
+static int
+read_resume_line( const char * resume_file )
+{
+    FILE * f = fopen( resume_file, "r" );
+    int line = 0;
+
+    if( f ) {
+        if( 1 != fscanf( f, "%d", &line ) || line < 0 ) {
+            line = 0;
         }
+        fclose( f );
+    }
+    return line;
+}
 
-        //printf("Input to subcycle. ch=%c\n", *ch);
-        while( !eof && ch != ep ) {
-            do_fetch = 0;
-            got_field = got_line = 0;
-            //printf("ch=[%c]; parse_state: %d\n", *ch, parse_state);
-            switch(parse_state) {
-            case QUOTED_ACCUM:
-                if( FIELD_QUOTE == *ch ) {
-                    parse_state = CHECK_QUOTE;
-                }
-                else {
-                    do_fetch = 1;
-                }
-                break;
-            case CHECK_QUOTE:
-                if( FIELD_QUOTE == *ch ) {
-                    do_fetch = 1;
-                    parse_state = QUOTED_ACCUM;
-                    break;
-                }
-                else {
-                    parse_state = SIMPLE_ACCUM;
-                }
-            // NO break INTENTIONALLY HERE;
-            case SIMPLE_ACCUM:
-                if( FIELD_DELIM == *ch ) {got_field = 1; }
-                else if( FIELD_QUOTE == *ch ) {parse_state = QUOTED_ACCUM; }
-                else if( EOL[0] == *ch ) {
-                    if( EOL_LEN > 1 ) {
-                        parse_state =  CHECK_EOL;
-                        do_fetch = 1;
-                        eol_idx = 0;
-                    }
-                    else {
-                        got_field = 1;
-                    }
-                }
-                else {
-                    do_fetch = 1;
-                }
-                break;
-            case CHECK_EOL:
-                do_fetch = 1;
-                if( *ch != EOL[ ++eol_idx ] ) {
-                    parse_state = SIMPLE_ACCUM;
-                } else if( EOL_LEN - 1 == eol_idx ) {
-                    parse_state = SIMPLE_ACCUM;
-                    got_field = got_line = 1;
-                    do_fetch = -eol_idx;
-                }
-                break;
+/// Record the first line that has not been committed yet
+static int
+write_resume_line( const char * resume_file, int line )
+{
+    FILE * f = fopen( resume_file, "w" );
+
+    if( NULL == f ) {
+        print_error_message( "unable to write resume file '%s': %s", resume_file, strerror(errno) );
+        return -1;
+    }
+    fprintf( f, "%d\n", line );
+    return 0 == fclose( f ) ? 0 : -1;
+}
+
+/// Commit the current transaction in BATCH_COMMIT mode and report progress
+static int
+commit_batch( db_context_t * ctx )
+{
+    uint64_t now;
+    uint64_t batch_ms;
+    uint64_t total_ms;
+
+    /* Force the commit to disk before recording it as resumable. */
+    if( db_commit_tx( ctx->hdb, ctx->ioptions.resume_file ? DB_FORCED_COMPLETION : 0 ) == DB_FAIL ) {
+        print_error_message( "unable to commit lines up to %d", ctx->last_line );
+        db_abort_tx( ctx->hdb, 0 );
+        ctx->have_tx = 0;
+        ctx->failed = 1;
+        return -1;
+    }
+    ctx->have_tx = 0;
+
+    now = clock_ms();
+    batch_ms = now - ctx->batch_start_ms;
+    total_ms = now - ctx->start_ms;
+    ctx->batches++;
+    ctx->total_lines += ctx->batch_lines;
+
+    fprintf( stdout, "batch %lu: %d lines, committed through line %d, %.0f lines/s (total %lu lines, %.0f lines/s)\n",
+             ctx->batches, ctx->batch_lines, ctx->last_line,
+             batch_ms ? ctx->batch_lines * 1000.0 / batch_ms : 0.0,
+             ctx->total_lines,
+             total_ms ? ctx->total_lines * 1000.0 / total_ms : 0.0 );
+
+    ctx->batch_lines = 0;
+    if( ctx->ioptions.resume_file ) {
+        return write_resume_line( ctx->ioptions.resume_file, ctx->last_line + 1 );
+    }
+    return 0;
+}
+
+/// Put extracted field data into DB row (db_context->hrow)
+static int got_field_cb( int lineno, int fieldno, size_t in_csv_pos, const char * data, size_t len, void * db_context)
+{
+    db_context_t * ctx = (db_context_t *)db_context;
+    if( lineno < ctx->resume_line && ( lineno > 0 || NO_HEADER == ctx->ioptions.header_mode ) ) {
+        return 0;
+    }
+    if( lineno == 0 ) {
+        switch( ctx->ioptions.header_mode ) {
+        case IGNORE_HEADER: return 0;
+        case NO_HEADER: break;
+        case USE_HEADER: {
+            int j;
+            /// Handle column name got from csv header
+            db_fieldno_t col_num = db_find_field( ctx->tab, data );
+            if (col_num < 0) {
+                print_error_message("unable to find column %s in target table\n", data);
+                return -1;
             }
-            if( 0 < do_fetch ) {
-                if( symb_len >= c_buffer_size ) {
-                    c_buffer_size *= 2;
-                    c_buffer = (char*)realloc(c_buffer, c_buffer_size);
-                    if( NULL == c_buffer ) {
-                        print_error_message("out of memory during import");
-                        return;
+            for (j = fieldno; j < ctx->num_fields; j++) {
+                if (ctx->fields[j].fieldno == col_num) {
+                    /* mapping found */
+                    if (fieldno != j) {
+                        db_fielddef_t t = ctx->fields[ fieldno ];
+                        field_kind_t k = ctx->kinds[ fieldno ];
+                        ctx->fields[ fieldno ] = ctx->fields[j];
+                        ctx->fields[j] = t;
+                        ctx->kinds[ fieldno ] = ctx->kinds[j];
+                        ctx->kinds[j] = k;
                     }
+                    break;
                 }
-                c_buffer[ symb_len++ ] = *ch;
-            } else if( 0 > do_fetch ) {
-                symb_len += do_fetch;
-                c_buffer[ symb_len ] = 0;
             }
-            line_len += do_fetch;
-            ++ch, ++hw_pos; //,++line_len;
-            if( got_field || got_line ) {
-                break;
+
+            if (j == ctx->num_fields) {
+                print_error_message("column %s mapped twice\n", data);
+                return -1;
             }
+
+            return 0;
+        }
+        }
+    }
+
+    if( !ctx->failed && ctx->num_fields > fieldno ) {
+        db_result_t res = DB_OK;
+        native_value_t value;
+        if (len == 0 && (ctx->fields[ fieldno ].field_flags & DB_NULL_MASK) == DB_NULLABLE) {
+            res = db_set_null(ctx->hrow, ctx->fields[ fieldno ].fieldno);
+            fprintf( stdout, "line.field: %d.%d = <null>\n", lineno, fieldno );
+        } else if (ctx->ioptions.binding_mode == TEXT_BINDING
+                   || 0 != parse_native( ctx->kinds[ fieldno ], data, len, &value )) {
+            /* Let the engine convert anything the importer cannot parse */
+            res = db_set_field_data( ctx->hrow, ctx->fields[ fieldno ].fieldno,
+                                     FIELD_UTF8 == ctx->kinds[ fieldno ] ? DB_VARTYPE_UTF8STR : DB_VARTYPE_ANSISTR,
+                                     data, len);
+        } else {
+            res = bind_native( ctx->hrow, ctx->fields[ fieldno ].fieldno, ctx->kinds[ fieldno ], &value );
+            //fprintf( stdout, "line.field: %d.%d = [%s]\n", lineno, fieldno, data );
+        }
+        if (res == DB_FAIL) {
+            print_error_message("while importing into column '%s', line %d. Input pos: %d(b)",
+                                ctx->fields[ fieldno ].field_name, lineno, in_csv_pos );
+            ctx->failed = 1;
+        }
+        if (ctx->failed ) {
+            fprintf( stderr, "Line %d. %s\n", lineno,
+                     ctx->ioptions.commit_mode == LINE_COMMIT ? "Skip whole line" : "Cancel processing"
+                     );
         }
+    }
+    return 0;
+}
+
+/// Insert prepared row (db_context->hrow) in DB table (db_context->tab)
+static int got_line_cb( int lineno, int fields, size_t pos, void * db_context)
+{
+    int fieldno;
+    db_context_t * ctx = (db_context_t *)db_context;
+
+    (void)pos;
+    if( lineno == 0 && ( USE_HEADER == ctx->ioptions.header_mode || IGNORE_HEADER == ctx->ioptions.header_mode ) ) {
+        return 0;
+    }
+    if( lineno < ctx->resume_line ) {
+        return 0;
+    }
+
+    if( fields ) {
+        if( !ctx->failed && !ctx->have_tx ) {
+            if ( db_begin_tx( ctx->hdb, 0) == DB_FAIL ) {
+                print_error_message("unable to start transaction for importing line %d", lineno);
+                ctx->failed = 1;
+            }
+            else {
+                ctx->have_tx = 1;
+                ctx->batch_start_ms = clock_ms();
+            }
+        }
+        if( !ctx->failed ) {
+            if (db_insert(ctx->tab, ctx->hrow, NULL, 0) == DB_FAIL) {
+                print_error_message("while importing line %d", lineno);
+                ctx->failed = 1;
+            }
+        }
+    }
+
+    if (ctx->ioptions.commit_mode == LINE_COMMIT) {
+
+        if (ctx->have_tx) {
+            if(ctx->failed) {
+                db_abort_tx( ctx->hdb, 0 );
+            } else if (db_commit_tx( ctx->hdb, 0 ) == DB_FAIL) {
+                print_error_message("unable to finalize transaction for importing line %d", lineno);
+            }
+            ctx->have_tx = 0;
+        }
+        /* next line might be more successful */
+        ctx->failed = 0;
+    } else if (ctx->failed) {
+        return -1;
+    } else if (ctx->ioptions.commit_mode == BATCH_COMMIT && ctx->have_tx && fields) {
+        ctx->batch_lines++;
+        ctx->last_line = lineno;
+        if( ( ctx->ioptions.batch_rows && (unsigned long)ctx->batch_lines >= ctx->ioptions.batch_rows )
+            || ( ctx->ioptions.batch_ms && clock_ms() - ctx->batch_start_ms >= ctx->ioptions.batch_ms ) ) {
+            if( 0 != commit_batch( ctx ) ) {
+                return -1;
+            }
+        }
+    }
+
+    /* prepare the next row */
+    for ( fieldno = 0; fieldno < ctx->num_fields; fieldno++ ) {
+        db_set_null(ctx->hrow, ctx->fields[fieldno].fieldno);
+    }
+    return 0;
+}
+
+/* Tokenizer */
+
+static const char *
+scan_scalar( const char * data, const char * end, char a, char b, char c )
+{
+    for( ; data != end; ++data ) {
+        if( *data == a || *data == b || *data == c ) {
+            break;
+        }
+    }
+    return data;
+}
+
+#ifdef CSV_SCAN_SSE2
+
+static int
+lowest_bit( unsigned int mask )
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward( &index, mask );
+    return (int)index;
+#else
+    return __builtin_ctz( mask );
+#endif
+}
+
+static const char *
+scan_sse2( const char * data, const char * end, char a, char b, char c )
+{
+    const __m128i va = _mm_set1_epi8( a );
+    const __m128i vb = _mm_set1_epi8( b );
+    const __m128i vc = _mm_set1_epi8( c );
+
+    for( ; end - data >= 16; data += 16 ) {
+        __m128i v = _mm_loadu_si128( (const __m128i *)data );
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(
+            _mm_or_si128( _mm_or_si128( _mm_cmpeq_epi8( v, va ), _mm_cmpeq_epi8( v, vb ) ),
+                          _mm_cmpeq_epi8( v, vc ) ) );
+        if( mask ) {
+            return data + lowest_bit( mask );
+        }
+    }
+    return scan_scalar( data, end, a, b, c );
+}
+
+#endif
+
+#ifdef CSV_SCAN_AVX2
+
+CSV_TARGET_AVX2 static const char *
+scan_avx2( const char * data, const char * end, char a, char b, char c )
+{
+    const __m256i va = _mm256_set1_epi8( a );
+    const __m256i vb = _mm256_set1_epi8( b );
+    const __m256i vc = _mm256_set1_epi8( c );
+
+    for( ; end - data >= 32; data += 32 ) {
+        __m256i v = _mm256_loadu_si256( (const __m256i *)data );
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(
+            _mm256_or_si256( _mm256_or_si256( _mm256_cmpeq_epi8( v, va ), _mm256_cmpeq_epi8( v, vb ) ),
+                             _mm256_cmpeq_epi8( v, vc ) ) );
+        if( mask ) {
+            return data + lowest_bit( mask );
+        }
+    }
+    return scan_sse2( data, end, a, b, c );
+}
+
+static int
+cpu_has_avx2( void )
+{
+#ifdef _MSC_VER
+    int info[4];
+
+    __cpuid( info, 0 );
+    if( info[0] < 7 ) {
+        return 0;
+    }
+    /* The OS must save the AVX registers on context switch. */
+    __cpuid( info, 1 );
+    if( ( info[2] & ( 1 << 27 ) ) == 0 || ( info[2] & ( 1 << 28 ) ) == 0
+        || ( _xgetbv( 0 ) & 6 ) != 6 ) {
+        return 0;
+    }
+    __cpuidex( info, 7, 0 );
+    return ( info[1] & ( 1 << 5 ) ) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports( "avx2" );
+#endif
+}
+
+#endif
+
+/// Select the fastest scanner supported by this processor
+static scan_callback_t
+select_scanner( void )
+{
+#ifdef CSV_SCAN_AVX2
+    if( cpu_has_avx2() ) {
+        return scan_avx2;
+    }
+#endif
+#ifdef CSV_SCAN_SSE2
+    return scan_sse2;
+#else
+    return scan_scalar;
+#endif
+}
+
+/// Parser buffer for the current field
+typedef struct {
+    char * data;
+    size_t len;
+    size_t size;
+} field_buffer_t;
+
+/// Append a span of field data, keeping room for a terminator
+static int
+field_append( field_buffer_t * field, const char * data, size_t len )
+{
+    if( field->len + len >= field->size ) {
+        size_t size = field->size;
+        char * p;
+
+        while( field->len + len >= size ) {
+            size *= 2;
+        }
+        p = (char *)realloc( field->data, size );
+        if( NULL == p ) {
+            return -1;
+        }
+        field->data = p;
+        field->size = size;
+    }
+    memcpy( field->data + field->len, data, len );
+    field->len += len;
+    return 0;
+}
+
+static void parse_input(
+    read_more_data_callback_t cb, void *cb_data,
+    got_field_callback_t got_field_cb, got_line_callback_t got_line_cb,
+    void *db_cb_data
+    )
+{
+    static scan_callback_t scan = NULL;
+
+    /* Every thread selects the same scanner, so a race here is harmless. */
+    if( NULL == scan ) {
+        scan = select_scanner();
+    }
+    parse_tokens( scan, cb, cb_data, got_field_cb, got_line_cb, db_cb_data );
+}
+
+/// Split csv data into fields and lines
+/** Follows the same state machine as parse_input_bytewise(), but moves
+ *  from one special character to the next with scan() and appends the
+ *  plain data in between as a single span. */
+static void parse_tokens(
+    scan_callback_t scan,
+    read_more_data_callback_t cb, void *cb_data,
+    got_field_callback_t got_field_cb, got_line_callback_t got_line_cb,
+    void *db_cb_data
+    )
+{
+    typedef enum {
+        SIMPLE_ACCUM, QUOTED_ACCUM, CHECK_EOL, CHECK_QUOTE
+    } parse_state_t;
+
+    parse_state_t parse_state = SIMPLE_ACCUM;
+
+    size_t hw_pos = 0;
+    int lines = 0;
+    int fieldno = 0;
+    int eof = 0;
+    char * ch = 0;
+    char * ep = 0;
+    field_buffer_t field;
+    int EOL_LEN = strlen( EOL );
+    int eol_idx = 0;
+    int got_field = 0;
+    int got_line = 0;
+    size_t line_len = 0;
+
+    field.len = 0;
+    field.size = 256;
+    field.data = (char *)malloc( field.size );
+    if( NULL == field.data ) {
+        print_error_message("out of memory during import");
+        return;
+    }
+
+    while( !eof ) {
+        // Read more data from csv-source
+        if( ep == ch ) {
+            ptrdiff_t sz = (*cb)( &ch, cb_data );
+
+            if( 0 > sz ) {
+                fprintf( stderr, "Error to read csv data source. Position in source(byte): %lu\n", (unsigned long)hw_pos );
+            }
+
+            ep = ch + sz;
+            eof = 0 >= sz;
+        }
+
+        got_field = got_line = 0;
+        while( !eof && ch != ep && !got_field ) {
+            char * span_end;
+            char c;
+
+            if( CHECK_EOL == parse_state ) {
+                if( *ch != EOL[ ++eol_idx ] ) {
+                    parse_state = SIMPLE_ACCUM;
+                }
+                else if( EOL_LEN - 1 == eol_idx ) {
+                    /* Drop the EOL characters accumulated so far */
+                    parse_state = SIMPLE_ACCUM;
+                    got_field = got_line = 1;
+                    field.len -= eol_idx;
+                    line_len -= eol_idx;
+                    ++ch, ++hw_pos;
+                    break;
+                }
+                if( 0 != field_append( &field, ch, 1 ) ) {
+                    break;
+                }
+                ++line_len;
+                ++ch, ++hw_pos;
+                continue;
+            }
+
+            if( CHECK_QUOTE == parse_state ) {
+                if( FIELD_QUOTE == *ch ) {
+                    /* Escaped quote inside a quoted field */
+                    if( 0 != field_append( &field, ch, 1 ) ) {
+                        break;
+                    }
+                    parse_state = QUOTED_ACCUM;
+                    ++line_len;
+                    ++ch, ++hw_pos;
+                    continue;
+                }
+                parse_state = SIMPLE_ACCUM;
+            }
+
+            if( QUOTED_ACCUM == parse_state ) {
+                span_end = (char *)scan( ch, ep, FIELD_QUOTE, FIELD_QUOTE, FIELD_QUOTE );
+            }
+            else {
+                span_end = (char *)scan( ch, ep, FIELD_DELIM, FIELD_QUOTE, EOL[0] );
+            }
+
+            if( span_end != ch ) {
+                if( 0 != field_append( &field, ch, span_end - ch ) ) {
+                    break;
+                }
+                line_len += span_end - ch;
+                hw_pos += span_end - ch;
+                ch = span_end;
+                if( ch == ep ) {
+                    break;
+                }
+            }
+
+            c = *ch;
+            ++ch, ++hw_pos;
+            if( QUOTED_ACCUM == parse_state ) {
+                parse_state = CHECK_QUOTE;
+            }
+            else if( FIELD_DELIM == c ) {
+                got_field = 1;
+            }
+            else if( FIELD_QUOTE == c ) {
+                parse_state = QUOTED_ACCUM;
+            }
+            else if( EOL_LEN > 1 ) {
+                if( 0 != field_append( &field, &c, 1 ) ) {
+                    break;
+                }
+                parse_state = CHECK_EOL;
+                eol_idx = 0;
+                ++line_len;
+            }
+            else {
+                got_field = 1;
+            }
+        }
+
+        if( !eof && ch != ep && !got_field ) {
+            /* The inner loop stopped on a failed append */
+            print_error_message("out of memory during import");
+            break;
+        }
+
+        if( ( eof || got_field ) && line_len ) {
+            field.data[ field.len ] = 0;
+            if( 0 != got_field_cb( lines, fieldno, hw_pos, field.data, field.len, db_cb_data ) ) {
+                break;
+            }
+            field.len = 0;
+            ++fieldno;
+        }
+
+        if( ( eof || got_line ) && line_len ) {
+            line_len = 0;
+            if( 0 != got_line_cb( lines, fieldno, hw_pos, db_cb_data ) ) {
+                break;
+            }
+            ++lines;
+            fieldno = 0;
+        }
+    }
+
+    free( field.data );
+}
+
+static void parse_input_bytewise(
+    read_more_data_callback_t cb, void *cb_data,
+    got_field_callback_t got_field_cb, got_line_callback_t got_line_cb,
+    void *db_cb_data
+    )
+{
+    typedef enum {
+        SIMPLE_ACCUM, QUOTED_ACCUM, CHECK_EOL, CHECK_QUOTE
+    } parse_state_t;
+
+    parse_state_t parse_state = SIMPLE_ACCUM;
+
+    size_t hw_pos = 0;
+    int lines = 0;
+    int fieldno = 0;
+    int eof = 0;
+    char * ch = 0;
+    char * ep = 0;
+    char * c_buffer = 0;
+    size_t c_buffer_size = 5;
+    size_t symb_len = 0;
+    int EOL_LEN = strlen( EOL );
+    int eol_idx = 0;
+    int do_fetch;
+    int got_field = 0;
+    int got_line = 0;
+    int line_len = 0;
+
+    c_buffer = (char *)malloc(c_buffer_size);
+
+    while( !eof ) {
+        // Read more data from csv-source
+        if( ep == ch && !eof ) {
+            ptrdiff_t sz = (*cb)( &ch, cb_data );
+
+            if( 0 > sz ) {
+                fprintf( stderr, "Error to read csv data source. Position in source(byte): %d\n", hw_pos );
+            }
+
+            ep = ch + sz;
+            eof = 0 >= sz;
+        }
+
+        //printf("Input to subcycle. ch=%c\n", *ch);
+        while( !eof && ch != ep ) {
+            do_fetch = 0;
+            got_field = got_line = 0;
+            //printf("ch=[%c]; parse_state: %d\n", *ch, parse_state);
+            switch(parse_state) {
+            case QUOTED_ACCUM:
+                if( FIELD_QUOTE == *ch ) {
+                    parse_state = CHECK_QUOTE;
+                }
+                else {
+                    do_fetch = 1;
+                }
+                break;
+            case CHECK_QUOTE:
+                if( FIELD_QUOTE == *ch ) {
+                    do_fetch = 1;
+                    parse_state = QUOTED_ACCUM;
+                    break;
+                }
+                else {
+                    parse_state = SIMPLE_ACCUM;
+                }
+            // NO break INTENTIONALLY HERE;
+            case SIMPLE_ACCUM:
+                if( FIELD_DELIM == *ch ) {got_field = 1; }
+                else if( FIELD_QUOTE == *ch ) {parse_state = QUOTED_ACCUM; }
+                else if( EOL[0] == *ch ) {
+                    if( EOL_LEN > 1 ) {
+                        parse_state =  CHECK_EOL;
+                        do_fetch = 1;
+                        eol_idx = 0;
+                    }
+                    else {
+                        got_field = 1;
+                    }
+                }
+                else {
+                    do_fetch = 1;
+                }
+                break;
+            case CHECK_EOL:
+                do_fetch = 1;
+                if( *ch != EOL[ ++eol_idx ] ) {
+                    parse_state = SIMPLE_ACCUM;
+                } else if( EOL_LEN - 1 == eol_idx ) {
+                    parse_state = SIMPLE_ACCUM;
+                    got_field = got_line = 1;
+                    do_fetch = -eol_idx;
+                }
+                break;
+            }
+            if( 0 < do_fetch ) {
+                if( symb_len + 1 >= c_buffer_size ) {
+                    c_buffer_size *= 2;
+                    c_buffer = (char*)realloc(c_buffer, c_buffer_size);
+                    if( NULL == c_buffer ) {
+                        print_error_message("out of memory during import");
+                        return;
+                    }
+                }
+                c_buffer[ symb_len++ ] = *ch;
+            } else if( 0 > do_fetch ) {
+                symb_len += do_fetch;
+                c_buffer[ symb_len ] = 0;
+            }
+            line_len += do_fetch;
+            ++ch, ++hw_pos; //,++line_len;
+            if( got_field || got_line ) {
+                break;
+            }
+        }
+
+        if( ( eof || got_field ) && line_len ) {
+            c_buffer[symb_len] = 0;
+            if( 0 != got_field_cb( lines, fieldno, hw_pos, c_buffer, symb_len, db_cb_data ) ) {
+                break;
+            }
+            symb_len = 0;
+            ++fieldno;
+        }
+
+        if( ( eof || got_line ) && line_len ) {
+            line_len = 0;
+            if( 0 != got_line_cb( lines, fieldno, hw_pos, db_cb_data ) ) {
+                break;
+            }
+            ++lines;
+            fieldno = 0;
+        }
+    }
+
+    free(c_buffer);
+}
+
+/// Open the target table and describe its fields
+static int
+open_import_context( db_context_t * ctx, db_t hdb, const char * table_name, const csv_import_options_t * ioptions )
+{
+    int fieldno;
+
+    memset( ctx, 0, sizeof( db_context_t ) );
+    ctx->hdb = hdb;
+    ctx->ioptions = *ioptions;
+
+    if ((ctx->tab = db_open_table_cursor(hdb, table_name, NULL)) == NULL) {
+        print_error_message("unable to open table '%s'", table_name);
+        return -1;
+    }
+
+    ctx->num_fields = db_get_field_count( ctx->tab );
+    ctx->fields = (db_fielddef_t*) malloc( ctx->num_fields * sizeof(db_fielddef_t) );
+    ctx->kinds = (field_kind_t*) malloc( ctx->num_fields * sizeof(field_kind_t) );
+    if (ctx->fields == NULL || ctx->kinds == NULL) {
+        print_error_message("out of memory");
+        close_import_context( ctx );
+        return -1;
+    }
+
+    for (fieldno = 0; fieldno < ctx->num_fields; fieldno++) {
+        db_get_field( ctx->tab, fieldno, &ctx->fields[fieldno] );
+        ctx->kinds[fieldno] = field_kind( ctx->fields[fieldno].field_type );
+    }
+
+    ctx->hrow = db_alloc_cursor_row( ctx->tab );
+    if (ctx->hrow == NULL) {
+        print_error_message("unable to allocate row");
+        close_import_context( ctx );
+        return -1;
+    }
+    return 0;
+}
+
+static void
+close_import_context( db_context_t * ctx )
+{
+    if (ctx->hrow) {
+        db_free_row( ctx->hrow );
+    }
+    free(ctx->fields);
+    free(ctx->kinds);
+    if (ctx->tab) {
+        db_close_cursor( ctx->tab );
+    }
+}
+
+static int
+do_import( db_t hdb, const char *table_name, const csv_import_options_t * ioptions, read_more_data_callback_t cb, void *cb_data )
+{
+    db_context_t dbctx;
+
+    if( 0 != open_import_context( &dbctx, hdb, table_name, ioptions ) ) {
+        return EXIT_FAILURE;
+    }
+
+    if( BATCH_COMMIT == dbctx.ioptions.commit_mode ) {
+        if( 0 == dbctx.ioptions.batch_rows && 0 == dbctx.ioptions.batch_ms ) {
+            dbctx.ioptions.batch_rows = CSV_BATCH_ROWS;
+        }
+        if( dbctx.ioptions.resume_file ) {
+            dbctx.resume_line = read_resume_line( dbctx.ioptions.resume_file );
+            if( dbctx.resume_line > 0 ) {
+                fprintf( stdout, "Resuming import at line %d\n", dbctx.resume_line );
+            }
+        }
+        dbctx.start_ms = clock_ms();
+    }
+
+    parse_input( cb, cb_data, got_field_cb, got_line_cb, &dbctx );
+
+    if (dbctx.have_tx) {
+        if (dbctx.failed) {
+            db_abort_tx( dbctx.hdb, 0 );
+        } else if (dbctx.ioptions.commit_mode == BATCH_COMMIT) {
+            commit_batch( &dbctx );
+        } else if (db_commit_tx( dbctx.hdb, 0 ) == DB_FAIL) {
+            print_error_message("unable to finalize transaction for importing file");
+            dbctx.failed = 1;
+        }
+    }
+
+    /* A complete import leaves nothing to resume, so the next one starts over. */
+    if( !dbctx.failed && dbctx.ioptions.resume_file ) {
+        remove( dbctx.ioptions.resume_file );
+    }
+
+    close_import_context( &dbctx );
+    return dbctx.failed;
+}
+
+//----------------------- PARALLEL IMPORT
+/*
+ * Parser threads take chunks of whole lines from the input in turn, parse
+ * them into columnar batches and queue the batches. Writer connections
+ * take batches from the queue and insert them in large transactions. The
+ * threads only share a mutex, so waiting threads poll with a short sleep.
+ */
+
+/// Input bytes parsed by a thread at a time
+#ifndef CSV_PARALLEL_CHUNK
+#define CSV_PARALLEL_CHUNK (4 * 1024 * 1024)
+#endif
+
+/// Chunks each parser thread may have queued or in progress
+#ifndef CSV_PARALLEL_QUEUE
+#define CSV_PARALLEL_QUEUE 2
+#endif
+
+/// Rows per writer transaction when batch_rows is not set
+#ifndef CSV_PARALLEL_TX_ROWS
+#define CSV_PARALLEL_TX_ROWS 100000
+#endif
+
+/// Milliseconds a thread sleeps while waiting for work
+#ifndef CSV_PARALLEL_POLL_MS
+#define CSV_PARALLEL_POLL_MS 1
+#endif
+
+enum {
+    VALUE_UNSET,    ///< The line has no field for the column
+    VALUE_NULL,
+    VALUE_NATIVE,
+    VALUE_TEXT
+};
+
+/// One parsed field of a batch
+typedef struct {
+    unsigned char state;
+    size_t len;                 ///< VALUE_TEXT: length of the text
+    union {
+        native_value_t native;
+        size_t offset;          ///< VALUE_TEXT: offset of the text in the batch arena
+    } v;
+} import_value_t;
+
+/// Lines parsed from one chunk of the input, stored column by column
+typedef struct import_batch_s {
+    struct import_batch_s * next;
+    unsigned long seq;          ///< Position of the chunk in the input
+    int rows;
+    int capacity;               ///< Rows allocated in each column
+    import_value_t ** columns;  ///< Values of each table field, in csv column order
+    size_t * row_end;           ///< Input offset of the end of each line
+    char * text;                ///< Arena for text values
+    size_t text_len;
+    size_t text_size;
+} import_batch_t;
+
+typedef struct {
+    /* Read-only once the threads start */
+    csv_import_options_t ioptions;
+    const char * table_name;
+    db_fielddef_t * fields;     ///< Table fields in csv column order
+    field_kind_t * kinds;
+    int num_fields;
+    scan_callback_t scan;
+    uint64_t start_ms;
+
+    mutex_t lock;               ///< Protects everything below
+    read_more_data_callback_t cb;
+    void * cb_data;
+    char * src;                 ///< Source data not yet copied into a chunk
+    size_t src_len;
+    int source_eof;
+    char * carry;               ///< Partial line left over from the last chunk
+    size_t carry_len;
+    char * first;               ///< First chunk, read before the threads start
+    size_t first_size;
+    size_t first_len;
+    unsigned long next_seq;     ///< Sequence number of the next chunk
+    size_t next_offset;         ///< Input offset of the next chunk
+    int in_flight;              ///< Chunks being parsed or queued
+    int max_in_flight;
+    int parsers_running;
+    import_batch_t * queue;
+    import_batch_t * free_batches;  ///< Written batches kept for reuse
+    unsigned long next_write;   ///< Next sequence number to write when preserving order
+    unsigned long lines;        ///< Lines committed by all writers
+    int failed;
+} parallel_import_t;
+
+typedef struct {
+    parallel_import_t * imp;
+    import_batch_t * batch;
+    size_t offset;              ///< Input offset of the chunk
+    int skip_header;
+    int failed;
+} chunk_context_t;
+
+typedef struct {
+    parallel_import_t * imp;
+    int index;
+    db_t hdb;
+    db_cursor_t tab;
+    db_row_t hrow;
+    os_thread_t * thread;
+} import_writer_t;
+
+#if defined(_WIN32)
+static void sleep_ms( unsigned int ms ) { Sleep( ms ); }
+#elif defined(OS_UCOS_III)
+static void sleep_ms( unsigned int ms )
+{
+    OS_ERR err;
+    OSTimeDly( ms * OS_CFG_TICK_RATE_HZ / 1000 + 1, OS_OPT_TIME_DLY, &err );
+}
+#else
+static void sleep_ms( unsigned int ms )
+{
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long)( ms % 1000 ) * 1000000L;
+    nanosleep( &ts, NULL );
+}
+#endif
+
+/// Find the end of the last complete line, or 0 if there is none
+/** Quotes are counted from the start of the data, which must be the
+ *  start of a line. A partial EOL sequence is consumed together with the
+ *  next character, as parse_input() does. */
+static size_t
+last_line_end( scan_callback_t scan, const char * data, size_t len )
+{
+    const char * p = data;
+    const char * end = data + len;
+    size_t eol_len = strlen( EOL );
+    size_t last = 0;
+    int quoted = 0;
+
+    for( ;; ) {
+        size_t i;
+
+        p = quoted ? scan( p, end, FIELD_QUOTE, FIELD_QUOTE, FIELD_QUOTE )
+                   : scan( p, end, FIELD_QUOTE, EOL[0], EOL[0] );
+        if( p == end ) {
+            break;
+        }
+        if( FIELD_QUOTE == *p ) {
+            quoted = !quoted;
+            ++p;
+            continue;
+        }
+        for( i = 1; i < eol_len && p + i < end && p[i] == EOL[i]; i++ ) {
+        }
+        if( i == eol_len ) {
+            p += eol_len;
+            last = p - data;
+        }
+        else if( p + i < end ) {
+            p += i + 1;
+        }
+        else {
+            break;
+        }
+    }
+    return last;
+}
+
+/// Take the next chunk of whole lines from the input, with imp->lock held
+/** The chunk is read into *buffer, which is reused from call to call.
+ *  Returns 0, 1 at the end of the input, or -1. */
+static int
+next_chunk( parallel_import_t * imp, char ** buffer, size_t * buffer_size, size_t * chunk_len )
+{
+    size_t target = CSV_PARALLEL_CHUNK;
+    size_t len = imp->carry_len;
+    size_t boundary;
+
+    if( imp->first ) {
+        /* Hand over the chunk read before the threads started. */
+        free( *buffer );
+        *buffer = imp->first;
+        *buffer_size = imp->first_size;
+        *chunk_len = imp->first_len;
+        imp->first = NULL;
+        return 0;
+    }
+    if( imp->source_eof && 0 == imp->carry_len ) {
+        return 1;
+    }
+
+    for( ;; ) {
+        if( *buffer_size < target || *buffer_size < len ) {
+            size_t size = target > len ? target : len;
+            char * p = (char *)realloc( *buffer, size );
+            if( NULL == p ) {
+                return -1;
+            }
+            *buffer = p;
+            *buffer_size = size;
+        }
+        if( imp->carry_len ) {
+            memcpy( *buffer, imp->carry, imp->carry_len );
+            imp->carry_len = 0;
+        }
+
+        while( len < target && !imp->source_eof ) {
+            size_t n;
+
+            if( 0 == imp->src_len ) {
+                ptrdiff_t sz = (*imp->cb)( &imp->src, imp->cb_data );
+                if( 0 > sz ) {
+                    print_error_message( "unable to read csv data source at byte %lu",
+                                         (unsigned long)( imp->next_offset + len ) );
+                    return -1;
+                }
+                imp->src_len = sz;
+                imp->source_eof = 0 == sz;
+                continue;
+            }
+            n = target - len < imp->src_len ? target - len : imp->src_len;
+            memcpy( *buffer + len, imp->src, n );
+            imp->src += n;
+            imp->src_len -= n;
+            len += n;
+        }
+
+        boundary = imp->source_eof ? len : last_line_end( imp->scan, *buffer, len );
+        if( boundary > 0 || 0 == len ) {
+            break;
+        }
+
+        /* No line ends in this chunk, so read a larger one. */
+        target *= 2;
+    }
+
+    if( 0 == len ) {
+        return 1;
+    }
+
+    if( len > boundary ) {
+        char * p = (char *)realloc( imp->carry, len - boundary );
+        if( NULL == p ) {
+            return -1;
+        }
+        imp->carry = p;
+        imp->carry_len = len - boundary;
+        memcpy( imp->carry, *buffer + boundary, imp->carry_len );
+    }
+    *chunk_len = boundary;
+    return 0;
+}
+
+static void
+free_batch( import_batch_t * batch, int num_fields )
+{
+    int c;
+
+    if( batch ) {
+        if( batch->columns ) {
+            for( c = 0; c < num_fields; c++ ) {
+                free( batch->columns[c] );
+            }
+        }
+        free( batch->columns );
+        free( batch->row_end );
+        free( batch->text );
+        free( batch );
+    }
+}
+
+/// Make room for one more row in every column
+static int
+grow_batch( import_batch_t * batch, int num_fields )
+{
+    int capacity = batch->capacity ? batch->capacity * 2 : 1024;
+    size_t * row_end;
+    int c;
+
+    for( c = 0; c < num_fields; c++ ) {
+        import_value_t * column = (import_value_t *)realloc( batch->columns[c], capacity * sizeof( import_value_t ) );
+        if( NULL == column ) {
+            return -1;
+        }
+        memset( column + batch->capacity, 0, ( capacity - batch->capacity ) * sizeof( import_value_t ) );
+        batch->columns[c] = column;
+    }
+    row_end = (size_t *)realloc( batch->row_end, capacity * sizeof( size_t ) );
+    if( NULL == row_end ) {
+        return -1;
+    }
+    batch->row_end = row_end;
+    batch->capacity = capacity;
+    return 0;
+}
+
+/// Mark every column of a row as not set
+static void
+clear_row( import_batch_t * batch, int row, int num_fields )
+{
+    int c;
+
+    for( c = 0; c < num_fields; c++ ) {
+        batch->columns[c][row].state = VALUE_UNSET;
+    }
+}
+
+static int
+chunk_field_cb( int lineno, int fieldno, size_t pos, const char * data, size_t len, void * context )
+{
+    chunk_context_t * ctx = (chunk_context_t *)context;
+    const parallel_import_t * imp = ctx->imp;
+    import_batch_t * batch = ctx->batch;
+    import_value_t * value;
+
+    (void)pos;
+    if( ( 0 == lineno && ctx->skip_header ) || fieldno >= imp->num_fields ) {
+        return 0;
+    }
+    if( batch->rows == batch->capacity && 0 != grow_batch( batch, imp->num_fields ) ) {
+        ctx->failed = 1;
+        return -1;
+    }
+
+    value = &batch->columns[ fieldno ][ batch->rows ];
+    if( len == 0 && ( imp->fields[ fieldno ].field_flags & DB_NULL_MASK ) == DB_NULLABLE ) {
+        value->state = VALUE_NULL;
+        return 0;
+    }
+    if( imp->ioptions.binding_mode != TEXT_BINDING
+        && 0 == parse_native( imp->kinds[ fieldno ], data, len, &value->v.native ) ) {
+        value->state = VALUE_NATIVE;
+        return 0;
+    }
+
+    if( batch->text_len + len > batch->text_size ) {
+        size_t size = batch->text_size ? batch->text_size : 64 * 1024;
+        char * p;
+
+        while( batch->text_len + len > size ) {
+            size *= 2;
+        }
+        p = (char *)realloc( batch->text, size );
+        if( NULL == p ) {
+            ctx->failed = 1;
+            return -1;
+        }
+        batch->text = p;
+        batch->text_size = size;
+    }
+    memcpy( batch->text + batch->text_len, data, len );
+    value->state = VALUE_TEXT;
+    value->len = len;
+    value->v.offset = batch->text_len;
+    batch->text_len += len;
+    return 0;
+}
+
+static int
+chunk_line_cb( int lineno, int fields, size_t pos, void * context )
+{
+    chunk_context_t * ctx = (chunk_context_t *)context;
+    import_batch_t * batch = ctx->batch;
+
+    (void)fields;
+    if( 0 == lineno && ctx->skip_header ) {
+        return 0;
+    }
+    if( batch->rows == batch->capacity && 0 != grow_batch( batch, ctx->imp->num_fields ) ) {
+        ctx->failed = 1;
+        return -1;
+    }
+    batch->row_end[ batch->rows++ ] = ctx->offset + pos;
+    if( batch->rows < batch->capacity ) {
+        clear_row( batch, batch->rows, ctx->imp->num_fields );
+    }
+    return 0;
+}
+
+/// Parse a chunk of whole lines into a new batch
+static import_batch_t *
+parse_chunk( parallel_import_t * imp, const char * chunk, size_t chunk_len, unsigned long seq, size_t offset )
+{
+    read_more_inmem_data_context_t source = { chunk, chunk_len, 0 };
+    chunk_context_t ctx;
+
+    ctx.imp = imp;
+    ctx.offset = offset;
+    ctx.skip_header = 0 == seq && NO_HEADER != imp->ioptions.header_mode;
+    ctx.failed = 0;
+
+    mutex_lock( &imp->lock );
+    ctx.batch = imp->free_batches;
+    if( ctx.batch ) {
+        imp->free_batches = ctx.batch->next;
+    }
+    mutex_unlock( &imp->lock );
+
+    if( ctx.batch ) {
+        ctx.batch->rows = 0;
+        ctx.batch->text_len = 0;
+        clear_row( ctx.batch, 0, imp->num_fields );
+    }
+    else {
+        ctx.batch = (import_batch_t *)calloc( 1, sizeof( import_batch_t ) );
+        if( NULL == ctx.batch ) {
+            return NULL;
+        }
+        ctx.batch->columns = (import_value_t **)calloc( imp->num_fields, sizeof( import_value_t * ) );
+        if( NULL == ctx.batch->columns || 0 != grow_batch( ctx.batch, imp->num_fields ) ) {
+            free_batch( ctx.batch, imp->num_fields );
+            return NULL;
+        }
+    }
+    ctx.batch->seq = seq;
+
+    parse_tokens( imp->scan, get_more_inmem_data_cb, &source, chunk_field_cb, chunk_line_cb, &ctx );
+    if( ctx.failed ) {
+        free_batch( ctx.batch, imp->num_fields );
+        return NULL;
+    }
+    return ctx.batch;
+}
+
+static void
+parser_proc( parallel_import_t * imp )
+{
+    char * buffer = NULL;
+    size_t buffer_size = 0;
+
+    for( ;; ) {
+        import_batch_t * batch;
+        unsigned long seq;
+        size_t offset;
+        size_t chunk_len;
+        int rc;
+
+        mutex_lock( &imp->lock );
+        while( !imp->failed && imp->in_flight >= imp->max_in_flight ) {
+            mutex_unlock( &imp->lock );
+            sleep_ms( CSV_PARALLEL_POLL_MS );
+            mutex_lock( &imp->lock );
+        }
+        rc = imp->failed ? 1 : next_chunk( imp, &buffer, &buffer_size, &chunk_len );
+        if( 0 != rc ) {
+            if( 0 > rc ) {
+                print_error_message( "out of memory during import" );
+                imp->failed = 1;
+            }
+            imp->parsers_running--;
+            mutex_unlock( &imp->lock );
+            free( buffer );
+            return;
+        }
+        seq = imp->next_seq++;
+        offset = imp->next_offset;
+        imp->next_offset += chunk_len;
+        imp->in_flight++;
+        mutex_unlock( &imp->lock );
+
+        batch = parse_chunk( imp, buffer, chunk_len, seq, offset );
+
+        mutex_lock( &imp->lock );
+        if( NULL == batch ) {
+            print_error_message( "out of memory during import" );
+            imp->failed = 1;
+        }
+        else {
+            batch->next = imp->queue;
+            imp->queue = batch;
+        }
+        mutex_unlock( &imp->lock );
+    }
+}
+
+/// Take the next batch to write, or NULL when there are no more
+static import_batch_t *
+take_batch( parallel_import_t * imp )
+{
+    import_batch_t * batch = NULL;
+
+    mutex_lock( &imp->lock );
+    while( !imp->failed ) {
+        import_batch_t ** link = &imp->queue;
+
+        /* The queue is in reverse order of completion. */
+        if( imp->ioptions.preserve_order ) {
+            while( *link && (*link)->seq != imp->next_write ) {
+                link = &(*link)->next;
+            }
+        }
+        else {
+            while( *link && (*link)->next ) {
+                link = &(*link)->next;
+            }
+        }
+        if( *link ) {
+            batch = *link;
+            *link = batch->next;
+            imp->in_flight--;
+            imp->next_write++;
+            break;
+        }
+        if( 0 == imp->parsers_running ) {
+            break;
+        }
+        mutex_unlock( &imp->lock );
+        sleep_ms( CSV_PARALLEL_POLL_MS );
+        mutex_lock( &imp->lock );
+    }
+    mutex_unlock( &imp->lock );
+    return batch;
+}
+
+/// Commit a writer transaction and report progress
+static int
+commit_writer( import_writer_t * writer, unsigned long lines )
+{
+    parallel_import_t * imp = writer->imp;
+    unsigned long total;
+    uint64_t elapsed;
+
+    if( db_commit_tx( writer->hdb, 0 ) == DB_FAIL ) {
+        print_error_message( "writer %d: unable to commit %lu lines", writer->index, lines );
+        db_abort_tx( writer->hdb, 0 );
+        return -1;
+    }
+
+    mutex_lock( &imp->lock );
+    imp->lines += lines;
+    total = imp->lines;
+    mutex_unlock( &imp->lock );
+
+    elapsed = clock_ms() - imp->start_ms;
+    fprintf( stdout, "writer %d: committed %lu lines (total %lu lines, %.0f lines/s)\n",
+             writer->index, lines, total, elapsed ? total * 1000.0 / elapsed : 0.0 );
+    return 0;
+}
+
+/// Insert the rows of one batch
+static int
+write_batch( import_writer_t * writer, const import_batch_t * batch )
+{
+    const parallel_import_t * imp = writer->imp;
+    int r;
+    int c;
+
+    for( r = 0; r < batch->rows; r++ ) {
+        for( c = 0; c < imp->num_fields; c++ ) {
+            const import_value_t * value = &batch->columns[c][r];
+            db_fieldno_t fieldno = imp->fields[c].fieldno;
+            db_result_t res;
+
+            switch( value->state ) {
+            case VALUE_NATIVE:
+                res = bind_native( writer->hrow, fieldno, imp->kinds[c], &value->v.native );
+                break;
+            case VALUE_TEXT:
+                res = db_set_field_data( writer->hrow, fieldno,
+                                         FIELD_UTF8 == imp->kinds[c] ? DB_VARTYPE_UTF8STR : DB_VARTYPE_ANSISTR,
+                                         batch->text + value->v.offset, value->len );
+                break;
+            default:
+                res = db_set_null( writer->hrow, fieldno );
+            }
+            if( res == DB_FAIL ) {
+                print_error_message( "while importing into column '%s', line ending at byte %lu",
+                                     imp->fields[c].field_name, (unsigned long)batch->row_end[r] );
+                return -1;
+            }
+        }
+        if( db_insert( writer->tab, writer->hrow, NULL, 0 ) == DB_FAIL ) {
+            print_error_message( "while importing line ending at byte %lu", (unsigned long)batch->row_end[r] );
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void
+writer_proc( import_writer_t * writer )
+{
+    parallel_import_t * imp = writer->imp;
+    unsigned long tx_rows = imp->ioptions.batch_rows ? imp->ioptions.batch_rows : CSV_PARALLEL_TX_ROWS;
+    unsigned long lines = 0;
+    int have_tx = 0;
+    int failed = 0;
+    import_batch_t * batch;
+
+    while( !failed && NULL != ( batch = take_batch( imp ) ) ) {
+        if( !have_tx ) {
+            if( db_begin_tx( writer->hdb, 0 ) == DB_FAIL ) {
+                print_error_message( "writer %d: unable to start transaction", writer->index );
+                failed = 1;
+            }
+            else {
+                have_tx = 1;
+            }
+        }
+        if( !failed && 0 != write_batch( writer, batch ) ) {
+            failed = 1;
+        }
+        lines += batch->rows;
+
+        mutex_lock( &imp->lock );
+        batch->next = imp->free_batches;
+        imp->free_batches = batch;
+        mutex_unlock( &imp->lock );
+
+        if( !failed && lines >= tx_rows ) {
+            have_tx = 0;
+            failed = 0 != commit_writer( writer, lines );
+            lines = 0;
+        }
+    }
+
+    if( have_tx ) {
+        if( failed ) {
+            db_abort_tx( writer->hdb, 0 );
+        }
+        else {
+            failed = 0 != commit_writer( writer, lines );
+        }
+    }
+
+    if( failed ) {
+        mutex_lock( &imp->lock );
+        imp->failed = 1;
+        mutex_unlock( &imp->lock );
+    }
+}
+
+/// Writer thread with its own connection to the database
+static void
+writer_thread_proc( import_writer_t * writer )
+{
+    parallel_import_t * imp = writer->imp;
+
+    writer->hdb = db_open_file_storage( imp->ioptions.database_name, NULL );
+    if( writer->hdb ) {
+        writer->tab = db_open_table_cursor( writer->hdb, imp->table_name, NULL );
+        if( writer->tab ) {
+            writer->hrow = db_alloc_cursor_row( writer->tab );
+            if( writer->hrow ) {
+                writer_proc( writer );
+                db_free_row( writer->hrow );
+            }
+            db_close_cursor( writer->tab );
+        }
+    }
+    if( NULL == writer->hdb || NULL == writer->tab || NULL == writer->hrow ) {
+        print_error_message( "writer %d: unable to open table '%s' in '%s'",
+                             writer->index, imp->table_name, imp->ioptions.database_name );
+        mutex_lock( &imp->lock );
+        imp->failed = 1;
+        mutex_unlock( &imp->lock );
+    }
+    if( writer->hdb ) {
+        db_shutdown( writer->hdb, DB_SOFT_SHUTDOWN, NULL );
+    }
+}
+
+static int
+header_field_cb( int lineno, int fieldno, size_t pos, const char * data, size_t len, void * db_context )
+{
+    if( 0 != got_field_cb( lineno, fieldno, pos, data, len, db_context ) ) {
+        ((db_context_t *)db_context)->failed = 1;
+        return -1;
+    }
+    return 0;
+}
+
+static int
+header_line_cb( int lineno, int fields, size_t pos, void * db_context )
+{
+    (void)lineno;
+    (void)fields;
+    (void)pos;
+    (void)db_context;
+
+    /* Stop after the header line */
+    return 1;
+}
+
+/// Import with parser threads and one or more writer connections
+static int
+do_parallel_import( db_t hdb, const char * table_name, const csv_import_options_t * ioptions,
+                    read_more_data_callback_t cb, void * cb_data )
+{
+    parallel_import_t imp;
+    db_context_t dbctx;
+    os_thread_t ** parsers;
+    import_writer_t * writers;
+    int writer_count = ioptions->writers > 1 ? ioptions->writers : 1;
+    int started_parsers = 0;
+    int started_writers = 1;
+    uint64_t elapsed;
+    int rc;
+    int i;
+
+    if( ioptions->preserve_order && writer_count > 1 ) {
+        fprintf( stdout, "Preserving input order with a single writer\n" );
+        writer_count = 1;
+    }
+    if( writer_count > 1 && NULL == ioptions->database_name ) {
+        print_error_message( "database name needed for %d writers", writer_count );
+        return EXIT_FAILURE;
+    }
+
+    if( 0 != open_import_context( &dbctx, hdb, table_name, ioptions ) ) {
+        return EXIT_FAILURE;
+    }
+
+    memset( &imp, 0, sizeof( imp ) );
+    imp.ioptions = *ioptions;
+    imp.table_name = table_name;
+    imp.fields = dbctx.fields;
+    imp.kinds = dbctx.kinds;
+    imp.num_fields = dbctx.num_fields;
+    imp.scan = select_scanner();
+    imp.cb = cb;
+    imp.cb_data = cb_data;
+    imp.max_in_flight = ioptions->threads * CSV_PARALLEL_QUEUE;
+    imp.start_ms = clock_ms();
+
+    parsers = (os_thread_t **)calloc( ioptions->threads, sizeof( os_thread_t * ) );
+    writers = (import_writer_t *)calloc( writer_count, sizeof( import_writer_t ) );
+    if( NULL == parsers || NULL == writers || 0 != mutex_init( &imp.lock ) ) {
+        print_error_message( "out of memory" );
+        free( parsers );
+        free( writers );
+        close_import_context( &dbctx );
+        return EXIT_FAILURE;
+    }
+
+    /* Read the header on this thread to map csv columns to table fields. */
+    rc = next_chunk( &imp, &imp.first, &imp.first_size, &imp.first_len );
+    if( 0 > rc ) {
+        imp.failed = 1;
+    }
+    else if( 0 == rc && USE_HEADER == ioptions->header_mode ) {
+        read_more_inmem_data_context_t source = { imp.first, imp.first_len, 0 };
+        parse_tokens( imp.scan, get_more_inmem_data_cb, &source, header_field_cb, header_line_cb, &dbctx );
+        imp.failed = dbctx.failed;
+    }
+
+    if( !imp.failed ) {
+        imp.parsers_running = ioptions->threads;
+        for( i = 0; i < ioptions->threads; i++ ) {
+            if( 0 != thread_spawn( (thread_proc_t)parser_proc, &imp, THREAD_JOINABLE, &parsers[i] ) ) {
+                print_error_message( "unable to start parser thread" );
+                mutex_lock( &imp.lock );
+                imp.failed = 1;
+                imp.parsers_running -= ioptions->threads - i;
+                mutex_unlock( &imp.lock );
+                break;
+            }
+            started_parsers++;
+        }
+
+        for( i = 0; i < writer_count; i++ ) {
+            writers[i].imp = &imp;
+            writers[i].index = i;
+        }
+        for( i = 1; i < writer_count; i++ ) {
+            if( 0 != thread_spawn( (thread_proc_t)writer_thread_proc, &writers[i], THREAD_JOINABLE, &writers[i].thread ) ) {
+                print_error_message( "unable to start writer thread" );
+                mutex_lock( &imp.lock );
+                imp.failed = 1;
+                mutex_unlock( &imp.lock );
+                break;
+            }
+            started_writers++;
+        }
+
+        /* This thread is the first writer, on the caller's connection. */
+        writers[0].hdb = hdb;
+        writers[0].tab = dbctx.tab;
+        writers[0].hrow = dbctx.hrow;
+        writer_proc( &writers[0] );
+
+        for( i = 0; i < started_parsers; i++ ) {
+            thread_join( parsers[i] );
+        }
+        for( i = 1; i < started_writers; i++ ) {
+            thread_join( writers[i].thread );
+        }
+    }
+
+    while( imp.queue ) {
+        import_batch_t * batch = imp.queue;
+        imp.queue = batch->next;
+        free_batch( batch, imp.num_fields );
+    }
+    while( imp.free_batches ) {
+        import_batch_t * batch = imp.free_batches;
+        imp.free_batches = batch->next;
+        free_batch( batch, imp.num_fields );
+    }
+    free( imp.first );
+    free( imp.carry );
+    mutex_destroy( &imp.lock );
+    free( parsers );
+    free( writers );
+    close_import_context( &dbctx );
+
+    elapsed = clock_ms() - imp.start_ms;
+    fprintf( stdout, "Imported %lu lines with %d parser threads and %d writers in %.1f s (%.0f lines/s)\n",
+             imp.lines, ioptions->threads, writer_count, elapsed / 1000.0,
+             elapsed ? imp.lines * 1000.0 / elapsed : 0.0 );
+
+    return imp.failed;
+}
+
+//----------------------- PARSER BENCHMARK
+
+#ifndef CSV_BENCHMARK_RUNS
+#define CSV_BENCHMARK_RUNS 5
+#endif
+
+typedef struct {
+    size_t lines;
+    size_t fields;
+    size_t bytes;
+} benchmark_counts_t;
+
+static int
+benchmark_field_cb( int lineno, int fieldno, size_t pos, const char * data, size_t len, void * context )
+{
+    benchmark_counts_t * counts = (benchmark_counts_t *)context;
+
+    (void)lineno;
+    (void)fieldno;
+    (void)pos;
+    (void)data;
+    counts->fields++;
+    counts->bytes += len;
+    return 0;
+}
+
+static int
+benchmark_line_cb( int lineno, int fields, size_t pos, void * context )
+{
+    (void)lineno;
+    (void)fields;
+    (void)pos;
+    ((benchmark_counts_t *)context)->lines++;
+    return 0;
+}
+
+/// Parse a csv file with each available tokenizer and report throughput
+/** The file is loaded into memory first, so only parsing is timed. Each
+ *  tokenizer must produce the same fields as the bytewise parser. */
+int
+csv_parser_benchmark( const char * file_name, FILE * out )
+{
+    struct {
+        const char * name;
+        scan_callback_t scan;   ///< NULL for the bytewise parser
+    } tokenizers[4];
+    int tokenizer_count = 0;
+    read_more_file_data_context_t file;
+    benchmark_counts_t expected;
+    char * buffer = NULL;
+    size_t size = 0;
+    size_t capacity = 0;
+    int rc = EXIT_SUCCESS;
+    int i;
+
+    if( 0 != open_file_source( &file, file_name ) ) {
+        print_error_message( "unable to open file '%s': %s", file_name, strerror(errno) );
+        return EXIT_FAILURE;
+    }
+    for( ;; ) {
+        char * data;
+        ptrdiff_t len = get_more_file_data_cb( &data, &file );
+
+        if( len <= 0 ) {
+            rc = len < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+            break;
+        }
+        if( size + (size_t)len > capacity ) {
+            char * p;
+
+            capacity = ( size + (size_t)len ) * 2;
+            p = (char *)realloc( buffer, capacity );
+            if( NULL == p ) {
+                rc = EXIT_FAILURE;
+                break;
+            }
+            buffer = p;
+        }
+        memcpy( buffer + size, data, len );
+        size += len;
+    }
+    close_file_source( &file );
+    if( EXIT_SUCCESS != rc ) {
+        print_error_message( "unable to read file '%s'", file_name );
+        free( buffer );
+        return rc;
+    }
+
+    tokenizers[tokenizer_count].name = "bytewise";
+    tokenizers[tokenizer_count++].scan = NULL;
+    tokenizers[tokenizer_count].name = "scalar";
+    tokenizers[tokenizer_count++].scan = scan_scalar;
+#ifdef CSV_SCAN_SSE2
+    tokenizers[tokenizer_count].name = "sse2";
+    tokenizers[tokenizer_count++].scan = scan_sse2;
+#endif
+#ifdef CSV_SCAN_AVX2
+    if( cpu_has_avx2() ) {
+        tokenizers[tokenizer_count].name = "avx2";
+        tokenizers[tokenizer_count++].scan = scan_avx2;
+    }
+#endif
+
+    fprintf( out, "%lu bytes, best of %d runs\n", (unsigned long)size, CSV_BENCHMARK_RUNS );
+    fprintf( out, "%-10s %10s %12s %12s\n", "tokenizer", "MB/s", "lines", "fields" );
+
+    for( i = 0; i < tokenizer_count; i++ ) {
+        benchmark_counts_t counts;
+        clock_t best = 0;
+        int run;
+
+        for( run = 0; run < CSV_BENCHMARK_RUNS; run++ ) {
+            read_more_inmem_data_context_t source = { buffer, size, 0 };
+            clock_t start = clock();
+            clock_t elapsed;
+
+            memset( &counts, 0, sizeof( counts ) );
+            if( NULL == tokenizers[i].scan ) {
+                parse_input_bytewise( get_more_inmem_data_cb, &source, benchmark_field_cb, benchmark_line_cb, &counts );
+            }
+            else {
+                parse_tokens( tokenizers[i].scan, get_more_inmem_data_cb, &source, benchmark_field_cb, benchmark_line_cb, &counts );
+            }
+            elapsed = clock() - start;
+            if( 0 == run || elapsed < best ) {
+                best = elapsed;
+            }
+        }
+
+        if( 0 == i ) {
+            expected = counts;
+        }
+        fprintf( out, "%-10s %10.1f %12lu %12lu%s\n", tokenizers[i].name,
+                 best > 0 ? (double)size / 1e6 / ( (double)best / CLOCKS_PER_SEC ) : 0.0,
+                 (unsigned long)counts.lines, (unsigned long)counts.fields,
+                 0 == memcmp( &counts, &expected, sizeof( counts ) ) ? "" : "  MISMATCH" );
+        if( 0 != memcmp( &counts, &expected, sizeof( counts ) ) ) {
+            rc = EXIT_FAILURE;
+        }
+    }
+
+    free( buffer );
+    return rc;
+}
+
+//----------------------- EXPORT
+
+/// Bytes of csv output collected before each write to the file
+#ifndef CSV_WRITE_BUFFER
+#define CSV_WRITE_BUFFER (1024 * 1024)
+#endif
+
+/// Shortest field searched with the SIMD scanner; shorter fields are
+/// scanned a byte at a time, which is faster for them
+#ifndef CSV_SCAN_MIN_LEN
+#define CSV_SCAN_MIN_LEN 64
+#endif
+
+/// Bytes of a blob field read at a time
+#ifndef CSV_BLOB_CHUNK
+#define CSV_BLOB_CHUNK (64 * 1024)
+#endif
+
+/// Callback to store a block of csv output
+typedef int (*export_sink_t)( const char * data, size_t len, void * context );
+
+/// Output buffer for the exporter
+typedef struct {
+    export_sink_t sink;
+    void * sink_data;
+    char * data;
+    size_t len;
+    size_t size;
+} export_buffer_t;
+
+/// Sink writing csv output to a file, which may be compressed
+static int
+export_output_sink( const char * data, size_t len, void * context )
+{
+    return csv_output_write( (csv_output_t *)context, data, len );
+}
+
+/// Pass the buffered output to the sink
+static int
+export_flush( export_buffer_t * out )
+{
+    if( out->len && 0 != (*out->sink)( out->data, out->len, out->sink_data ) ) {
+        return -1;
+    }
+    out->len = 0;
+    return 0;
+}
+
+/// Reserve room for n bytes, n <= out->size, at the end of the output buffer
+static char *
+export_reserve( export_buffer_t * out, size_t n )
+{
+    if( out->size - out->len < n && 0 != export_flush( out ) ) {
+        return NULL;
+    }
+    return out->data + out->len;
+}
+
+static int
+export_write( export_buffer_t * out, const char * data, size_t len )
+{
+    if( out->size - out->len < len ) {
+        if( 0 != export_flush( out ) ) {
+            return -1;
+        }
+        if( len >= out->size ) {
+            /* Large values bypass the buffer. */
+            return (*out->sink)( data, len, out->sink_data );
+        }
+    }
+    memcpy( out->data + out->len, data, len );
+    out->len += len;
+    return 0;
+}
+
+static int
+export_char( export_buffer_t * out, char ch )
+{
+    if( out->len == out->size && 0 != export_flush( out ) ) {
+        return -1;
+    }
+    out->data[ out->len++ ] = ch;
+    return 0;
+}
+
+/// Check if a field must be quoted in QUOTE_MINIMAL mode
+static int
+export_needs_quotes( scan_callback_t scan, const char * data, size_t len, char quote )
+{
+    const char * end = data + len;
+
+    if( len < CSV_SCAN_MIN_LEN ) {
+        scan = scan_scalar;
+    }
+
+    /* An empty string is quoted to tell it apart from null. */
+    return 0 == len
+        || scan( data, end, quote, FIELD_DELIM, '\n' ) != end
+        || memchr( data, '\r', len ) != NULL;
+}
+
+/// Write a field enclosed in quotes, doubling the quotes it contains
+static int
+export_quoted( export_buffer_t * out, const char * data, size_t len, char quote )
+{
+    const char * end = data + len;
+
+    if( 0 != export_char( out, quote ) ) {
+        return -1;
+    }
+    while( data != end ) {
+        const char * q = (const char *)memchr( data, quote, end - data );
+
+        if( NULL == q ) {
+            if( 0 != export_write( out, data, end - data ) ) {
+                return -1;
+            }
+            break;
+        }
+        if( 0 != export_write( out, data, q - data + 1 ) || 0 != export_char( out, quote ) ) {
+            return -1;
+        }
+        data = q + 1;
+    }
+    return export_char( out, quote );
+}
+
+/// Read a field as text into a buffer that grows to fit the value
+static db_len_t
+export_field_text( db_row_t row, db_fieldno_t fieldno, int vartype, field_buffer_t * field )
+{
+    db_len_t len = db_get_field_data( row, fieldno, vartype, field->data, (db_len_t)field->size );
+
+    if( 0 <= len && (size_t)len + 1 >= field->size ) {
+        /* The value may have been cut short: ask for its length and read it again. */
+        len = db_get_field_data( row, fieldno, vartype, NULL, 0 );
+        if( 0 > len ) {
+            return len;
+        }
+        if( (size_t)len + 1 > field->size ) {
+            char * p = (char *)realloc( field->data, (size_t)len + 1 );
+            if( NULL == p ) {
+                print_error_message( "out of memory" );
+                return DB_LEN_FAIL;
+            }
+            field->data = p;
+            field->size = (size_t)len + 1;
+        }
+        len = db_get_field_data( row, fieldno, vartype, field->data, (db_len_t)field->size );
+    }
+    return len;
+}
+
+/// Stream a blob field as hexadecimal digits, one chunk at a time
+static int
+export_blob( export_buffer_t * out, db_cursor_t tab, db_row_t blob_row, db_blob_t * blob, char * chunk )
+{
+    static const char digits[] = "0123456789abcdef";
+
+    /* Fetch the size of the blob, then its contents. */
+    memset( blob, 0, sizeof( *blob ) );
+    if( DB_FAIL == db_fetch( tab, blob_row, NULL ) ) {
+        return -1;
+    }
+
+    blob->chunk_data = chunk;
+    blob->chunk_size = CSV_BLOB_CHUNK;
+    for( blob->offset = 0; blob->offset < blob->blob_size; blob->offset += CSV_BLOB_CHUNK ) {
+        const unsigned char * data = (const unsigned char *)chunk;
+        size_t left;
+
+        if( DB_FAIL == db_fetch( tab, blob_row, NULL ) ) {
+            return -1;
+        }
+
+        for( left = (size_t)blob->actual_size; left > 0; ) {
+            size_t n = left < out->size / 2 ? left : out->size / 2;
+            char * p = export_reserve( out, 2 * n );
+            size_t i;
+
+            if( NULL == p ) {
+                return -1;
+            }
+            for( i = 0; i < n; i++ ) {
+                *p++ = digits[ data[i] >> 4 ];
+                *p++ = digits[ data[i] & 15 ];
+            }
+            out->len += 2 * n;
+            data += n;
+            left -= n;
+        }
+    }
+    return 0;
+}
+
+/// Execute the export query, selecting the next page in paged mode
+/** Pages are selected by OFFSET, or, with a page key, by the key of the
+ *  last row of the previous page (NULL for the first page). */
+static int
+export_execute( db_cursor_t tab, db_row_t params, const csv_export_options_t * eoptions, const char * sql,
+                int64_t offset, const char * last_key, db_len_t last_key_len )
+{
+    if( eoptions->page_rows ) {
+        int64_t rows = (int64_t)eoptions->page_rows;
+        int rows_param = eoptions->param_count;
+        db_result_t rc = DB_OK;
+
+        if( NULL == eoptions->page_key ) {
+            rc = db_set_field_data( params, rows_param++, DB_VARTYPE_SINT64, &offset, sizeof( offset ) );
+        }
+        else if( last_key ) {
+            rc = db_set_field_data( params, rows_param++, DB_VARTYPE_UTF8STR, last_key, last_key_len );
+        }
+        if( DB_OK != rc
+            || DB_OK != db_set_field_data( params, rows_param, DB_VARTYPE_SINT64, &rows, sizeof( rows ) ) ) {
+            print_error_message( "unable to set page parameters" );
+            return -1;
+        }
+    }
+    if( DB_FAIL == db_execute( tab, params, NULL ) ) {
+        print_error_message( "unable to execute SQL statement '%s'", sql );
+        return -1;
+    }
+    return 0;
+}
+
+/// Prepare the export query and bind its parameters
+/** In paged mode, OFFSET and FETCH FIRST clauses are appended to the
+ *  query, which should have an ORDER BY clause to make the pages stable.
+ *  With a page key, the query is wrapped instead to select the rows that
+ *  follow the previous page in key order; after_key selects the form that
+ *  takes the last key of that page as a parameter. A trailing semicolon
+ *  is dropped so that the clauses can follow the query. */
+static db_cursor_t
+export_prepare( db_t hdb, const char * sql, const csv_export_options_t * eoptions, int after_key, db_row_t * params )
+{
+    const char * key = eoptions->page_key;
+    int page_params = 0;
+    int expected;
+    size_t sql_len = strlen( sql );
+    char * paged_sql = NULL;
+    db_cursor_t tab;
+    int i;
+
+    *params = NULL;
+
+    while( sql_len > 0 && ( ';' == sql[sql_len - 1] || isspace( (unsigned char)sql[sql_len - 1] ) ) ) {
+        sql_len--;
+    }
+
+    paged_sql = (char *)malloc( sql_len + ( key ? 2 * strlen( key ) : 0 ) + 128 );
+    if( NULL == paged_sql ) {
+        print_error_message( "out of memory" );
+        return NULL;
+    }
+    if( 0 == eoptions->page_rows ) {
+        sprintf( paged_sql, "%.*s", (int)sql_len, sql );
+    }
+    else if( NULL == key ) {
+        sprintf( paged_sql, "%.*s offset ? rows fetch first ? rows only", (int)sql_len, sql );
+        page_params = 2;
+    }
+    else if( after_key ) {
+        sprintf( paged_sql, "select * from ( %.*s ) page_source where %s > ? order by %s fetch first ? rows only",
+                 (int)sql_len, sql, key, key );
+        page_params = 2;
+    }
+    else {
+        sprintf( paged_sql, "select * from ( %.*s ) page_source order by %s fetch first ? rows only",
+                 (int)sql_len, sql, key );
+        page_params = 1;
+    }
+    expected = eoptions->param_count + page_params;
+
+    tab = db_prepare_sql_cursor( hdb, paged_sql, 0 );
+    free( paged_sql );
+    if( tab == NULL || db_is_prepared( tab ) <= 0 ) {
+        print_error_message( "unable to prepare SQL statement '%s'", sql );
+        goto error;
+    }
+
+    if( db_get_param_count( tab ) != expected ) {
+        print_error_message( "SQL statement '%s' expects %d parameters, %d given",
+                             sql, db_get_param_count( tab ) - page_params,
+                             eoptions->param_count );
+        goto error;
+    }
+    if( 0 == expected ) {
+        return tab;
+    }
+
+    *params = db_alloc_param_row( tab );
+    if( NULL == *params ) {
+        print_error_message( "unable to allocate row" );
+        goto error;
+    }
+
+    /* Parameters are given as text and converted by the database. */
+    for( i = 0; i < eoptions->param_count; i++ ) {
+        const char * value = eoptions->params[i];
+        db_result_t rc = value
+            ? db_set_field_data( *params, i, DB_VARTYPE_UTF8STR, value, (db_len_t)strlen( value ) )
+            : db_set_null( *params, i );
+
+        if( DB_OK != rc ) {
+            print_error_message( "unable to set parameter %d to '%s'", i, value ? value : "null" );
+            goto error;
+        }
+    }
+    return tab;
+
+error:
+    if( *params ) {
+        db_free_row( *params );
+        *params = NULL;
+    }
+    if( tab ) {
+        db_close_cursor( tab );
+    }
+    return NULL;
+}
+
+/// Export a table or the result of a query into an output buffer
+static int
+export_rows( db_t hdb, const char * table_name, const csv_export_options_t * export_options, export_buffer_t * out )
+{
+    int rc = EXIT_FAILURE;
+    db_cursor_t tab = NULL;
+    db_row_t    row = NULL;
+    int fieldno;
+    int field_count = 0;
+    field_buffer_t field = { NULL, 0, 0 };
+
+    csv_export_options_t eoptions = *export_options;
+    db_row_t params = NULL;
+    int64_t offset = 0;
+    field_buffer_t last_key = { NULL, 0, 0 };
+    db_fieldno_t key_fieldno = -1;
+    int after_key = 0;
+    int have_tx = 0;
+    scan_callback_t scan = select_scanner();
+    db_fielddef_t * fields = NULL;
+    db_row_t * blob_rows = NULL;
+    db_blob_t blob;
+    char * blob_chunk = NULL;
+
+    field.size = 4096;
+    field.data = (char *)malloc(field.size);
+    if (field.data == NULL) {
+        print_error_message("out of memory");
+        goto cleanup;
+    }
+
+    if (eoptions.source_mode == SQL_SOURCE) {
+
+        /* Read every page in one transaction, so that rows written
+         * meanwhile are neither repeated nor skipped between pages. If the
+         * caller has a transaction open already, the pages are read in it. */
+        if (eoptions.page_rows) {
+            have_tx = DB_OK == db_begin_tx(hdb, DB_REPEATABLE_READ);
+            if (!have_tx) {
+                clear_db_error();
+            }
+        }
+
+        /* table_name holds the query; rows are streamed from the cursor as it is read. */
+        tab = export_prepare(hdb, table_name, &eoptions, after_key, &params);
+        if (tab == NULL) {
+            goto cleanup;
+        }
+
+        if (eoptions.page_rows && eoptions.page_key) {
+            key_fieldno = db_find_field(tab, eoptions.page_key);
+            if (key_fieldno < 0) {
+                print_error_message("unable to find page key column %s in query result", eoptions.page_key);
+                goto cleanup;
+            }
+        }
+
+        if (0 != export_execute(tab, params, &eoptions, table_name, offset, NULL, 0)) {
+            goto cleanup;
+        }
+    } else {
+        eoptions.page_rows = 0;
+
+
+        tab = db_open_table_cursor(hdb, table_name, NULL);
+        if (tab == NULL) {
+            print_error_message("unable to open table '%s'", table_name);
+            goto cleanup;
+        }
+    }
+    row = db_alloc_cursor_row( tab );
+    if (row == NULL) {
+        print_error_message("unable to allocate row");
+        goto cleanup;
+    }
+
+    field_count = db_get_field_count( tab );
+    fields = (db_fielddef_t*) malloc( sizeof(db_fielddef_t) * field_count);
+    blob_rows = (db_row_t*) calloc( field_count, sizeof(db_row_t) );
+    if (fields == NULL || blob_rows == NULL) {
+        print_error_message("out of memory");
+        goto cleanup;
+    }
+
+    for (fieldno = 0; fieldno < field_count; fieldno++) {
+        db_fielddef_init(&fields[fieldno]);
+        db_get_field( tab, fieldno, &fields[fieldno]);
+
+        /* Blob fields are read in chunks through a row of their own. */
+        if ((intptr_t)fields[fieldno].field_type == (intptr_t)DB_COLTYPE_BLOB) {
+            blob_rows[fieldno] = db_alloc_row( NULL, 1 );
+            if (blob_rows[fieldno] == NULL) {
+                print_error_message("unable to allocate row");
+                goto cleanup;
+            }
+            dbs_bind_addr( blob_rows[fieldno], fieldno, DB_VARTYPE_BLOB, &blob, sizeof(blob), NULL );
+            if (blob_chunk == NULL && (blob_chunk = (char *)malloc(CSV_BLOB_CHUNK)) == NULL) {
+                print_error_message("out of memory");
+                goto cleanup;
+            }
+        }
+    }
+
+    /* export header */
+    if (eoptions.header_mode == USE_HEADER) {
+
+        for (fieldno = 0; fieldno < field_count; fieldno++) {
+            if (fieldno > 0 && 0 != export_char( out, FIELD_DELIM )) {
+                goto cleanup;
+            }
+            if (0 != export_write( out, fields[fieldno].field_name, strlen( fields[fieldno].field_name ) )) {
+                goto cleanup;
+            }
+        }
+
+        if (0 != export_char( out, '\n' )) {
+            goto cleanup;
+        }
+    }
+
+    /* export data, one page at a time in paged mode */
+    for (;;) {
+        unsigned long page_lines = 0;
+
+        if (db_seek_first( tab ) == DB_FAIL) {
+            print_error_message("unable to read table");
+            goto cleanup;
+        }
+
+        while (1) {
+            int rc = db_eof(tab);
+
+            if (rc < 0) {
+                print_error_message("unable to read table");
+                goto cleanup;
+            }
+
+            if (rc) {
+                break;
+            }
+
+            if (db_fetch( tab, row, NULL ) == DB_FAIL) {
+                print_error_message("unable to read table");
+                goto cleanup;
+            }
+
+            if( eoptions.line_prefix && eoptions.line_prefix[0] ) {
+                if( 0 != export_write( out, eoptions.line_prefix, strlen( eoptions.line_prefix ) ) ) {
+                    goto cleanup;
+                }
+            }
+            for (fieldno = 0; fieldno < field_count; fieldno++) {
+                db_len_t len;
+
+                if (fieldno > 0 && 0 != export_char( out, FIELD_DELIM )) {
+                    goto cleanup;
+                }
+
+                if (db_is_null(row, fieldno)) {
+                    /* null is an empty field, quoted only in QUOTE_ALL mode */
+                    if (eoptions.quote_mode == QUOTE_ALL
+                        && 0 != export_quoted( out, "", 0, eoptions.field_quote )) {
+                        goto cleanup;
+                    }
+                    continue;
+                }
+
+                if (blob_rows[fieldno]) {
+                    if (eoptions.quote_mode == QUOTE_ALL && 0 != export_char( out, eoptions.field_quote )) {
+                        goto cleanup;
+                    }
+                    if (0 != export_blob( out, tab, blob_rows[fieldno], &blob, blob_chunk )) {
+                        print_error_message("unable to get field %d data", fieldno);
+                        goto cleanup;
+                    }
+                    if (eoptions.quote_mode == QUOTE_ALL && 0 != export_char( out, eoptions.field_quote )) {
+                        goto cleanup;
+                    }
+                    continue;
+                }
+
+                switch((intptr_t)fields[fieldno].field_type) {
+                case (intptr_t)DB_COLTYPE_UTF8STR:
+                case (intptr_t)DB_COLTYPE_UTF16STR:
+                case (intptr_t)DB_COLTYPE_UTF32STR:
+                    len = export_field_text(row, fieldno, DB_VARTYPE_UTF8STR, &field);
+                    break;
+                default:
+                    len = export_field_text(row, fieldno, DB_VARTYPE_ANSISTR, &field);
+                }
+
+                if (len < 0) {
+                    print_error_message("unable to get field %d data", fieldno);
+                    goto cleanup;
+                }
+
+                if (eoptions.quote_mode == QUOTE_ALL
+                    || export_needs_quotes( scan, field.data, (size_t)len, eoptions.field_quote )) {
+                    if (0 != export_quoted( out, field.data, (size_t)len, eoptions.field_quote )) {
+                        goto cleanup;
+                    }
+                }
+                else if (0 != export_write( out, field.data, (size_t)len )) {
+                    goto cleanup;
+                }
+            }
+
+            if( eoptions.line_suffix && eoptions.line_suffix[0] ) {
+                if( 0 != export_write( out, eoptions.line_suffix, strlen( eoptions.line_suffix ) ) ) {
+                    goto cleanup;
+                }
+            }
+            if (0 != export_write( out, EOL, strlen( EOL ) )) {
+                goto cleanup;
+            }
+            page_lines++;
+
+            if (db_seek_next(tab) == DB_FAIL) {
+                print_error_message("unable to read table");
+                goto cleanup;
+            }
+        }
+
+        if (eoptions.page_rows == 0 || page_lines < eoptions.page_rows) {
+            break;
+        }
+
+        /* A full page: read the next one. */
+        if (key_fieldno >= 0) {
+            /* The next page starts after the key of the last row read. */
+            db_len_t len = export_field_text(row, key_fieldno, DB_VARTYPE_UTF8STR, &last_key);
+
+            if (len < 0) {
+                print_error_message("unable to get field %d data", (int)key_fieldno);
+                goto cleanup;
+            }
+            last_key.len = (size_t)len;
+        }
+        db_unexecute(tab);
+
+        if (key_fieldno >= 0 && !after_key) {
+            /* Switch to the form of the query that continues after a key. */
+            db_free_row(row);
+            row = NULL;
+            db_free_row(params);
+            params = NULL;
+            db_close_cursor(tab);
+            after_key = 1;
+            tab = export_prepare(hdb, table_name, &eoptions, after_key, &params);
+            if (tab == NULL) {
+                goto cleanup;
+            }
+            row = db_alloc_cursor_row(tab);
+            if (row == NULL) {
+                print_error_message("unable to allocate row");
+                goto cleanup;
+            }
+        }
+        offset += (int64_t)page_lines;
+        if (0 != export_execute(tab, params, &eoptions, table_name, offset,
+                                last_key.data, (db_len_t)last_key.len)) {
+            goto cleanup;
+        }
+    }
+
+    rc = EXIT_SUCCESS;
+
+cleanup:
+
+    if (blob_rows) {
+        for (fieldno = 0; fieldno < field_count; fieldno++) {
+            if (blob_rows[fieldno]) {
+                db_free_row( blob_rows[fieldno] );
+            }
+        }
+        free(blob_rows);
+    }
+
+    if (fields) {
+        free(fields);
+    }
+
+    if (row) {
+        db_free_row( row );
+    }
+
+    if (params) {
+        db_free_row( params );
+    }
+
+    if (tab) {
+        db_close_cursor( tab );
+    }
+
+    if (have_tx) {
+        db_commit_tx( hdb, 0 );
+    }
+
+    free(field.data);
+    free(last_key.data);
+    free(blob_chunk);
+
+    return rc;
+}
+
+int export_data(db_t hdb, const char *table_name, const char * file_name, const csv_export_options_t * export_options )
+{
+    int rc = EXIT_FAILURE;
+    csv_export_options_t eoptions = { USE_HEADER, TABLE_SOURCE, '\'', 0, 0, QUOTE_ALL, NULL, 0, 0, NULL, 0, NULL };
+    csv_output_t * output;
+    export_buffer_t out = { export_output_sink, NULL, NULL, 0, 0 };
+
+    if( export_options ) {
+        eoptions = *export_options;
+    }
+
+    if (table_name == NULL) {
+        print_error_message("table name expected");
+        return EXIT_FAILURE;
+    }
+
+    output = eoptions.output;
+    if (output == NULL) {
+        output = csv_output_open(file_name, eoptions.compression_level);
+        if (output == NULL) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    out.sink_data = output;
+    out.size = CSV_WRITE_BUFFER;
+    out.data = (char *)malloc(out.size);
+    if (out.data == NULL) {
+        print_error_message("out of memory");
+    }
+    else if (EXIT_SUCCESS == export_rows(hdb, table_name, &eoptions, &out) && 0 == export_flush(&out)) {
+        rc = EXIT_SUCCESS;
+    }
+
+    /* An output given by the caller stays open. */
+    if (output != eoptions.output && 0 != csv_output_close(output)) {
+        rc = EXIT_FAILURE;
+    }
+
+    free(out.data);
+
+    return rc;
+}
+
+//----------------------- PARALLEL EXPORT
+
+/// Bytes of output the parallel exporter holds for ranges that are not
+/// written yet; ranges after the current one wait above this limit
+#ifndef CSV_REORDER_LIMIT
+#define CSV_REORDER_LIMIT (64 * 1024 * 1024)
+#endif
+
+/// Block of output of a range, waiting for its turn in the single output
+typedef struct export_block_s {
+    struct export_block_s * next;
+    size_t len;
+    char data[1];
+} export_block_t;
+
+typedef struct export_range_s export_range_t;
+
+/// State shared by the workers of a parallel export, guarded by lock
+typedef struct {
+    mutex_t lock;
+    const char * database_name;
+    export_range_t * ranges;
+    int range_count;
+    int current;                ///< Range being written to the single output
+    size_t held;                ///< Bytes of output in queued blocks
+    int failed;
+} parallel_export_t;
+
+/// Key range and the worker exporting it
+struct export_range_s {
+    parallel_export_t * exp;
+    int index;
+    char * query;
+    const char * params[2];
+    csv_export_options_t options;
+    char * file_name;           ///< PER_RANGE_OUTPUT file, NULL for the single output
+    export_block_t * head;      ///< Output not written yet, oldest first
+    export_block_t * tail;
+    int done;
+    int rc;
+    os_thread_t * thread;
+};
+
+/// Find the first column of the primary key of a table
+static int
+primary_key_column( db_t hdb, const char * table_name, char * name, size_t size )
+{
+    db_tabledef_t tdef = { DB_ALLOC_INITIALIZER() };
+    int rc = -1;
+    int i;
+
+    if( DB_OK != db_describe_table( hdb, table_name, &tdef, DB_DESCRIBE_TABLE_FIELDS | DB_DESCRIBE_TABLE_INDEXES ) ) {
+        print_error_message( "unable to describe table '%s'", table_name );
+        return -1;
+    }
+    for( i = 0; i < tdef.nindexes; i++ ) {
+        const db_indexdef_t * idef = &tdef.indexes[i];
+
+        if( ( idef->index_mode & DB_PRIMARY_INDEX ) != 0 && idef->nfields > 0 ) {
+            strncpy( name, tdef.fields[ idef->fields[0].fieldno ].field_name, size - 1 );
+            name[ size - 1 ] = 0;
+            rc = 0;
+            break;
+        }
+    }
+    if( 0 != rc ) {
+        print_error_message( "table '%s' has no primary key to split on", table_name );
+    }
+    db_tabledef_destroy( &tdef );
+    return rc;
+}
+
+/// Prepare and execute a query with a single integer parameter, or none
+static db_cursor_t
+open_query( db_t hdb, const char * sql, const int64_t * param )
+{
+    db_cursor_t c = db_prepare_sql_cursor( hdb, sql, 0 );
+    db_row_t params = NULL;
+    db_result_t rc;
+
+    if( c == NULL || db_is_prepared( c ) <= 0 ) {
+        print_error_message( "unable to prepare SQL statement '%s'", sql );
+        goto error;
+    }
+    if( param ) {
+        params = db_alloc_param_row( c );
+        if( NULL == params
+            || DB_OK != db_set_field_data( params, 0, DB_VARTYPE_SINT64, param, sizeof( *param ) ) ) {
+            print_error_message( "unable to set parameters of '%s'", sql );
+            goto error;
+        }
+    }
+    rc = db_execute( c, params, NULL );
+    if( params ) {
+        db_free_row( params );
+        params = NULL;
+    }
+    if( DB_FAIL == rc ) {
+        print_error_message( "unable to execute SQL statement '%s'", sql );
+        goto error;
+    }
+    return c;
+
+error:
+    if( params ) {
+        db_free_row( params );
+    }
+    if( c ) {
+        db_close_cursor( c );
+    }
+    return NULL;
+}
+
+/// Select keys that split a table into ranges with about the same number of rows
+/** Each boundary is the key at a multiple of count / ranges rows in key
+ *  order, read as text. Repeated keys are dropped, so fewer boundaries
+ *  than ranges - 1 may be returned. Returns the number of boundaries, or -1. */
+static int
+select_boundaries( db_t hdb, const char * table_name, const char * key, int ranges, char ** boundaries )
+{
+    size_t sql_size = 4 * strlen( key ) + strlen( table_name ) + 100;
+    char * sql = (char *)malloc( sql_size );
+    field_buffer_t field = { NULL, 0, 0 };
+    db_cursor_t c = NULL;
+    db_row_t row = NULL;
+    int64_t count = 0;
+    int n = 0;
+    int i;
+
+    field.size = 256;
+    field.data = (char *)malloc( field.size );
+    if( NULL == sql || NULL == field.data ) {
+        print_error_message( "out of memory" );
+        goto error;
+    }
+
+    sprintf( sql, "select count(*) from %s where %s is not null", table_name, key );
+    c = open_query( hdb, sql, NULL );
+    if( NULL == c ) {
+        goto error;
+    }
+    row = db_alloc_cursor_row( c );
+    if( NULL == row || DB_FAIL == db_seek_first( c ) || db_eof( c )
+        || DB_FAIL == db_fetch( c, row, NULL )
+        || DB_LEN_FAIL == db_get_field_data( row, 0, DB_VARTYPE_SINT64, &count, sizeof( count ) ) ) {
+        print_error_message( "unable to count rows of '%s'", table_name );
+        goto error;
+    }
+    db_free_row( row );
+    row = NULL;
+    db_close_cursor( c );
+    c = NULL;
+
+    sprintf( sql, "select %s from %s where %s is not null order by %s offset ? rows fetch first 1 rows only",
+             key, table_name, key, key );
+    for( i = 1; i < ranges; i++ ) {
+        int64_t offset = count * i / ranges;
+        db_len_t len;
+
+        c = open_query( hdb, sql, &offset );
+        if( NULL == c ) {
+            goto error;
+        }
+        row = db_alloc_cursor_row( c );
+        if( NULL == row || DB_FAIL == db_seek_first( c ) ) {
+            print_error_message( "unable to read keys of '%s'", table_name );
+            goto error;
+        }
+        if( !db_eof( c ) ) {
+            if( DB_FAIL == db_fetch( c, row, NULL )
+                || 0 > ( len = export_field_text( row, 0, DB_VARTYPE_UTF8STR, &field ) ) ) {
+                print_error_message( "unable to read keys of '%s'", table_name );
+                goto error;
+            }
+            if( 0 == n || 0 != strcmp( boundaries[n - 1], field.data ) ) {
+                boundaries[n] = (char *)malloc( (size_t)len + 1 );
+                if( NULL == boundaries[n] ) {
+                    print_error_message( "out of memory" );
+                    goto error;
+                }
+                memcpy( boundaries[n], field.data, (size_t)len + 1 );
+                n++;
+            }
+        }
+        db_free_row( row );
+        row = NULL;
+        db_close_cursor( c );
+        c = NULL;
+    }
+
+    free( sql );
+    free( field.data );
+    return n;
+
+error:
+    while( n > 0 ) {
+        free( boundaries[--n] );
+    }
+    if( row ) {
+        db_free_row( row );
+    }
+    if( c ) {
+        db_close_cursor( c );
+    }
+    free( sql );
+    free( field.data );
+    return -1;
+}
+
+/// Sink queueing the output of a range until the ranges before it are written
+static int
+range_sink( const char * data, size_t len, void * context )
+{
+    export_range_t * range = (export_range_t *)context;
+    parallel_export_t * exp = range->exp;
+    export_block_t * block = (export_block_t *)malloc( sizeof( export_block_t ) + len );
+
+    if( NULL == block ) {
+        print_error_message( "out of memory" );
+        return -1;
+    }
+    memcpy( block->data, data, len );
+    block->len = len;
+    block->next = NULL;
+
+    mutex_lock( &exp->lock );
+    /* The range being written never waits, so the output keeps moving. */
+    while( range->index != exp->current && exp->held >= CSV_REORDER_LIMIT && !exp->failed ) {
+        mutex_unlock( &exp->lock );
+        sleep_ms( CSV_PARALLEL_POLL_MS );
+        mutex_lock( &exp->lock );
+    }
+    if( exp->failed ) {
+        mutex_unlock( &exp->lock );
+        free( block );
+        return -1;
+    }
+    if( range->tail ) {
+        range->tail->next = block;
+    }
+    else {
+        range->head = block;
+    }
+    range->tail = block;
+    exp->held += len;
+    mutex_unlock( &exp->lock );
+    return 0;
+}
+
+/// Export one key range on a connection of its own
+static void
+export_range_proc( export_range_t * range )
+{
+    parallel_export_t * exp = range->exp;
+    db_t hdb = db_open_file_storage( exp->database_name, NULL );
+    int rc = EXIT_FAILURE;
+
+    if( NULL == hdb ) {
+        print_error_message( "range %d: unable to open database '%s'", range->index, exp->database_name );
+    }
+    else if( range->file_name ) {
+        rc = export_data( hdb, range->query, range->file_name, &range->options );
+    }
+    else {
+        export_buffer_t out = { range_sink, NULL, NULL, 0, 0 };
+
+        out.sink_data = range;
+        out.size = CSV_WRITE_BUFFER;
+        out.data = (char *)malloc( out.size );
+        if( NULL == out.data ) {
+            print_error_message( "out of memory" );
+        }
+        else if( EXIT_SUCCESS == export_rows( hdb, range->query, &range->options, &out ) && 0 == export_flush( &out ) ) {
+            rc = EXIT_SUCCESS;
+        }
+        free( out.data );
+    }
+    if( hdb ) {
+        /* End the read transaction before closing the connection. */
+        db_commit_tx( hdb, 0 );
+        db_shutdown( hdb, DB_SOFT_SHUTDOWN, NULL );
+    }
+
+    mutex_lock( &exp->lock );
+    range->rc = rc;
+    range->done = 1;
+    if( EXIT_SUCCESS != rc ) {
+        exp->failed = 1;
+    }
+    mutex_unlock( &exp->lock );
+}
+
+/// Write the output of the ranges to a file in range order, as it is produced
+static int
+write_ranges( parallel_export_t * exp, csv_output_t * output )
+{
+    for( ;; ) {
+        export_range_t * range;
+        export_block_t * blocks;
+        size_t written = 0;
+        int done;
+
+        mutex_lock( &exp->lock );
+        if( exp->failed ) {
+            mutex_unlock( &exp->lock );
+            return -1;
+        }
+        if( exp->current == exp->range_count ) {
+            mutex_unlock( &exp->lock );
+            return 0;
+        }
+        range = &exp->ranges[ exp->current ];
+        blocks = range->head;
+        range->head = range->tail = NULL;
+        done = range->done;
+        if( NULL == blocks && done ) {
+            exp->current++;
+        }
+        mutex_unlock( &exp->lock );
+
+        if( NULL == blocks ) {
+            if( !done ) {
+                sleep_ms( CSV_PARALLEL_POLL_MS );
+            }
+            continue;
+        }
+
+        while( blocks ) {
+            export_block_t * next = blocks->next;
+            int rc = csv_output_write( output, blocks->data, blocks->len );
+
+            written += blocks->len;
+            free( blocks );
+            blocks = next;
+            if( 0 != rc ) {
+                mutex_lock( &exp->lock );
+                exp->failed = 1;
+                mutex_unlock( &exp->lock );
+                while( blocks ) {
+                    next = blocks->next;
+                    free( blocks );
+                    blocks = next;
+                }
+                return -1;
+            }
+        }
+
+        mutex_lock( &exp->lock );
+        exp->held -= written;
+        mutex_unlock( &exp->lock );
+    }
+}
+
+/// Name of the file of a range: FILE.N, or FILE.N.gz for FILE.gz
+static char *
+range_file_name( const char * file_name, int index )
+{
+    size_t len = strlen( file_name );
+    size_t suffix = 0;
+    char * name = (char *)malloc( len + 16 );
+
+    if( CODEC_GZIP == file_codec( file_name ) ) {
+        suffix = 3;
+    }
+    else if( CODEC_ZSTD == file_codec( file_name ) ) {
+        suffix = 4;
+    }
+    if( name ) {
+        sprintf( name, "%.*s.%d%s", (int)( len - suffix ), file_name, index, file_name + len - suffix );
+    }
+    return name;
+}
+
+/// Build the query and parameters that select one key range
+static int
+init_range( export_range_t * range, const char * table_name, const char * key,
+            char ** boundaries, int boundary_count )
+{
+    size_t size = strlen( table_name ) + 4 * strlen( key ) + 100;
+    int i = range->index;
+
+    range->query = (char *)malloc( size );
+    if( NULL == range->query ) {
+        return -1;
+    }
+    range->options.source_mode = SQL_SOURCE;
+    range->options.params = range->params;
+    range->options.param_count = 0;
+
+    /* Rows with a null key go to the first range. */
+    if( 0 == boundary_count ) {
+        sprintf( range->query, "select * from %s order by %s", table_name, key );
+    }
+    else if( 0 == i ) {
+        sprintf( range->query, "select * from %s where %s is null or %s < ? order by %s",
+                 table_name, key, key, key );
+        range->params[ range->options.param_count++ ] = boundaries[0];
+    }
+    else if( boundary_count == i ) {
+        sprintf( range->query, "select * from %s where %s >= ? order by %s",
+                 table_name, key, key );
+        range->params[ range->options.param_count++ ] = boundaries[i - 1];
+    }
+    else {
+        sprintf( range->query, "select * from %s where %s >= ? and %s < ? order by %s",
+                 table_name, key, key, key );
+        range->params[ range->options.param_count++ ] = boundaries[i - 1];
+        range->params[ range->options.param_count++ ] = boundaries[i];
+    }
+    return 0;
+}
+
+int
+export_data_parallel( db_t hdb, const char * table_name, const char * file_name,
+                      const csv_export_options_t * export_options,
+                      const csv_parallel_export_options_t * parallel_options )
+{
+    static const db_table_cursor_t lock_def = { NULL, DB_LOCK_SHARED };
+    csv_export_options_t eoptions = { USE_HEADER, TABLE_SOURCE, '\'', 0, 0, QUOTE_ALL, NULL, 0, 0, NULL, 0, NULL };
+    parallel_export_t exp;
+    db_cursor_t lock_cursor = NULL;
+    char key[ DB_MAX_OBJECT_NAME + 1 ];
+    char ** boundaries = NULL;
+    int boundary_count = 0;
+    int have_tx = 0;
+    int spawned = 0;
+    csv_output_t * output = NULL;
+    int rc = EXIT_FAILURE;
+    unsigned long start_ms = clock_ms();
+    int i;
+
+    if( export_options ) {
+        eoptions = *export_options;
+    }
+    memset( &exp, 0, sizeof( exp ) );
+    exp.database_name = parallel_options->database_name;
+
+    if( NULL == table_name || NULL == exp.database_name || parallel_options->threads < 1 ) {
+        print_error_message( "table name, database name and thread count expected" );
+        return EXIT_FAILURE;
+    }
+    if( PER_RANGE_OUTPUT == parallel_options->output && NULL == file_name ) {
+        print_error_message( "per-range output needs a file name" );
+        return EXIT_FAILURE;
+    }
+    if( 0 != mutex_init( &exp.lock ) ) {
+        print_error_message( "unable to create mutex" );
+        return EXIT_FAILURE;
+    }
+
+    /* Hold a shared lock on the table until every range has been read,
+     * so that all workers see the same rows. Writers wait meanwhile. If the
+     * caller has a transaction open already, the lock is taken in it and
+     * lasts until the caller ends it. */
+    have_tx = DB_OK == db_begin_tx( hdb, DB_REPEATABLE_READ );
+    if( !have_tx ) {
+        clear_db_error();
+    }
+    lock_cursor = db_open_table_cursor( hdb, table_name, &lock_def );
+    if( NULL == lock_cursor ) {
+        print_error_message( "unable to open table '%s'", table_name );
+        goto cleanup;
+    }
+
+    if( parallel_options->key_column ) {
+        strncpy( key, parallel_options->key_column, sizeof( key ) - 1 );
+        key[ sizeof( key ) - 1 ] = 0;
+    }
+    else if( 0 != primary_key_column( hdb, table_name, key, sizeof( key ) ) ) {
+        goto cleanup;
+    }
+
+    boundaries = (char **)calloc( parallel_options->threads, sizeof( char * ) );
+    if( NULL == boundaries ) {
+        print_error_message( "out of memory" );
+        goto cleanup;
+    }
+    boundary_count = select_boundaries( hdb, table_name, key, parallel_options->threads, boundaries );
+    if( 0 > boundary_count ) {
+        boundary_count = 0;
+        goto cleanup;
+    }
+
+    exp.range_count = boundary_count + 1;
+    exp.ranges = (export_range_t *)calloc( exp.range_count, sizeof( export_range_t ) );
+    if( NULL == exp.ranges ) {
+        print_error_message( "out of memory" );
+        goto cleanup;
+    }
+    for( i = 0; i < exp.range_count; i++ ) {
+        export_range_t * range = &exp.ranges[i];
+
+        range->exp = &exp;
+        range->index = i;
+        range->options = eoptions;
+        range->options.output = NULL;
+        if( PER_RANGE_OUTPUT == parallel_options->output ) {
+            range->file_name = range_file_name( file_name, i );
+        }
+        else if( i > 0 ) {
+            /* Only the first range writes the header of the single output. */
+            range->options.header_mode = NO_HEADER;
+        }
+        if( ( PER_RANGE_OUTPUT == parallel_options->output && NULL == range->file_name )
+            || 0 != init_range( range, table_name, key, boundaries, boundary_count ) ) {
+            print_error_message( "out of memory" );
+            goto cleanup;
+        }
+    }
+
+    if( PER_RANGE_OUTPUT != parallel_options->output ) {
+        output = eoptions.output ? eoptions.output : csv_output_open( file_name, eoptions.compression_level );
+        if( NULL == output ) {
+            goto cleanup;
+        }
+    }
+
+    for( ; spawned < exp.range_count; spawned++ ) {
+        export_range_t * range = &exp.ranges[ spawned ];
+
+        if( 0 != thread_spawn( (thread_proc_t)export_range_proc, range, THREAD_JOINABLE, &range->thread ) ) {
+            print_error_message( "unable to start thread" );
+            mutex_lock( &exp.lock );
+            exp.failed = 1;
+            mutex_unlock( &exp.lock );
+            break;
+        }
+    }
+
+    if( output ) {
+        write_ranges( &exp, output );
+    }
+    for( i = 0; i < spawned; i++ ) {
+        thread_join( exp.ranges[i].thread );
+    }
+    rc = exp.failed || spawned < exp.range_count ? EXIT_FAILURE : EXIT_SUCCESS;
+
+    if( EXIT_SUCCESS == rc ) {
+        fprintf( stderr, "Exported '%s' in %d ranges of '%s' in %.1f s\n",
+                 table_name, exp.range_count, key, ( clock_ms() - start_ms ) / 1000.0 );
+    }
+
+cleanup:
+    if( exp.ranges ) {
+        for( i = 0; i < exp.range_count; i++ ) {
+            export_range_t * range = &exp.ranges[i];
+
+            while( range->head ) {
+                export_block_t * next = range->head->next;
+                free( range->head );
+                range->head = next;
+            }
+            free( range->query );
+            free( range->file_name );
+        }
+        free( exp.ranges );
+    }
+    if( boundaries ) {
+        for( i = 0; i < boundary_count; i++ ) {
+            free( boundaries[i] );
+        }
+        free( boundaries );
+    }
+    if( output && output != eoptions.output && 0 != csv_output_close( output ) ) {
+        rc = EXIT_FAILURE;
+    }
+    if( lock_cursor ) {
+        db_close_cursor( lock_cursor );
+    }
+    if( have_tx ) {
+        db_commit_tx( hdb, 0 );
+    }
+    mutex_destroy( &exp.lock );
+    return rc;
+}
+
+//----------------------- COMPRESSION
+
+/* Compressed files pass through a pipeline of a few large blocks: one
+ * thread fills blocks while another compresses or consumes them, so the
+ * codec runs beside the parser or the exporter instead of in turn. */
+
+#ifndef CSV_PIPELINE_BLOCK
+#define CSV_PIPELINE_BLOCK (1024 * 1024)
+#endif
+
+#ifndef CSV_PIPELINE_BLOCKS
+#define CSV_PIPELINE_BLOCKS 4
+#endif
+
+#define CSV_GZIP_LEVEL 6
+#define CSV_ZSTD_LEVEL 3
+
+static const char * const codec_names[] = { "none", "gzip", "zstd" };
+
+static codec_t
+file_codec( const char * file_name )
+{
+    size_t len = file_name ? strlen( file_name ) : 0;
+
+    if( len > 3 && 0 == strcmp( file_name + len - 3, ".gz" ) ) {
+        return CODEC_GZIP;
+    }
+    if( len > 4 && 0 == strcmp( file_name + len - 4, ".zst" ) ) {
+        return CODEC_ZSTD;
+    }
+    return CODEC_NONE;
+}
+
+/// Check that support for a codec is built in
+static int
+codec_supported( codec_t codec, const char * file_name )
+{
+#ifndef CSV_WITH_ZLIB
+    if( CODEC_GZIP == codec ) {
+        print_error_message( "unable to open '%s': build with CSV_WITH_ZLIB and link zlib for .gz files", file_name );
+        return 0;
+    }
+#endif
+#ifndef CSV_WITH_ZSTD
+    if( CODEC_ZSTD == codec ) {
+        print_error_message( "unable to open '%s': build with CSV_WITH_ZSTD and link libzstd for .zst files", file_name );
+        return 0;
+    }
+#endif
+    (void)codec;
+    (void)file_name;
+    return 1;
+}
+
+/// Ring of blocks passed from a producer thread to a consumer thread
+typedef struct {
+    mutex_t lock;
+    char * blocks[CSV_PIPELINE_BLOCKS];
+    size_t lens[CSV_PIPELINE_BLOCKS];
+    int head;               ///< Oldest block held or not yet taken by the consumer
+    int count;              ///< Blocks submitted from head on
+    int done;               ///< Producer has submitted its last block
+    int failed;             ///< Producer stopped on an error
+    int stopped;            ///< Consumer wants no more blocks
+} pipeline_t;
+
+static int
+pipeline_init( pipeline_t * pipe )
+{
+    int i;
 
-        if( ( eof || got_field ) && line_len ) {
-            c_buffer[symb_len] = 0;
-            if( 0 != got_field_cb( lines, fieldno, hw_pos, c_buffer, symb_len, db_cb_data ) ) {
-                break;
+    memset( pipe, 0, sizeof( *pipe ) );
+    for( i = 0; i < CSV_PIPELINE_BLOCKS; i++ ) {
+        pipe->blocks[i] = (char *)malloc( CSV_PIPELINE_BLOCK );
+        if( NULL == pipe->blocks[i] ) {
+            while( i-- > 0 ) {
+                free( pipe->blocks[i] );
             }
-            symb_len = 0;
-            ++fieldno;
+            return -1;
         }
+    }
+    mutex_init( &pipe->lock );
+    return 0;
+}
 
-        if( ( eof || got_line ) && line_len ) {
-            line_len = 0;
-            if( 0 != got_line_cb( lines, fieldno, hw_pos, db_cb_data ) ) {
-                break;
-            }
-            ++lines;
-            fieldno = 0;
+static void
+pipeline_destroy( pipeline_t * pipe )
+{
+    int i;
+
+    for( i = 0; i < CSV_PIPELINE_BLOCKS; i++ ) {
+        free( pipe->blocks[i] );
+    }
+    mutex_destroy( &pipe->lock );
+}
+
+/// Wait for a block to fill, or NULL if the consumer has stopped
+static char *
+pipeline_free_block( pipeline_t * pipe )
+{
+    char * block = NULL;
+
+    for( ;; ) {
+        mutex_lock( &pipe->lock );
+        if( pipe->stopped ) {
+            break;
+        }
+        if( pipe->count < CSV_PIPELINE_BLOCKS ) {
+            block = pipe->blocks[( pipe->head + pipe->count ) % CSV_PIPELINE_BLOCKS];
+            break;
         }
+        mutex_unlock( &pipe->lock );
+        sleep_ms( CSV_PARALLEL_POLL_MS );
     }
+    mutex_unlock( &pipe->lock );
+    return block;
+}
 
-    free(c_buffer);
+/// Pass the block returned by pipeline_free_block() to the consumer
+static void
+pipeline_submit( pipeline_t * pipe, size_t len )
+{
+    mutex_lock( &pipe->lock );
+    pipe->lens[( pipe->head + pipe->count ) % CSV_PIPELINE_BLOCKS] = len;
+    pipe->count++;
+    mutex_unlock( &pipe->lock );
+}
+
+/// Producer is done; failed if it stopped on an error
+static void
+pipeline_close( pipeline_t * pipe, int failed )
+{
+    mutex_lock( &pipe->lock );
+    pipe->done = 1;
+    pipe->failed = failed;
+    mutex_unlock( &pipe->lock );
+}
+
+/// Consumer is done, whether or not all blocks were taken
+static void
+pipeline_stop( pipeline_t * pipe )
+{
+    mutex_lock( &pipe->lock );
+    pipe->stopped = 1;
+    mutex_unlock( &pipe->lock );
 }
 
+/// Wait for the next block and return its index, -1 at the end or -2 on failure
+/** The block stays with the consumer until pipeline_release(). */
 static int
-do_import( db_t hdb, const char *table_name, const csv_import_options_t * ioptions, read_more_data_callback_t cb, void *cb_data )
+pipeline_next( pipeline_t * pipe )
 {
-    typedef enum {
-        SIMPLE_ACCUM, QUOTED_ACCUM, CHECK_EOL, CHECK_QUOTE
-    } parse_state_t;
+    int index;
 
-    db_context_t dbctx;
-    memset( &dbctx, 0, sizeof( db_context_t ) );
+    for( ;; ) {
+        mutex_lock( &pipe->lock );
+        if( pipe->failed ) {
+            index = -2;
+            break;
+        }
+        if( pipe->count > 0 ) {
+            index = pipe->head;
+            break;
+        }
+        if( pipe->done ) {
+            index = -1;
+            break;
+        }
+        mutex_unlock( &pipe->lock );
+        sleep_ms( CSV_PARALLEL_POLL_MS );
+    }
+    mutex_unlock( &pipe->lock );
+    return index;
+}
 
-    dbctx.hdb = hdb;
-    dbctx.ioptions = *ioptions;
+static void
+pipeline_release( pipeline_t * pipe )
+{
+    mutex_lock( &pipe->lock );
+    pipe->head = ( pipe->head + 1 ) % CSV_PIPELINE_BLOCKS;
+    pipe->count--;
+    mutex_unlock( &pipe->lock );
+}
 
-    if ((dbctx.tab = db_open_table_cursor(hdb, table_name, NULL)) != NULL) {
+/// Print codec statistics at the end of a stream
+static void
+report_codec( FILE * out, const char * action, const char * file_name, codec_t codec, int level,
+              uint64_t raw_bytes, uint64_t packed_bytes, uint64_t elapsed_ms, uint64_t busy_ms )
+{
+    double seconds = elapsed_ms ? (double)elapsed_ms / 1000.0 : 0.001;
 
-        dbctx.num_fields = db_get_field_count( dbctx.tab );
-        dbctx.fields = (db_fielddef_t*) malloc( dbctx.num_fields * sizeof(db_fielddef_t) );
+    fprintf( out, "%s '%s' with %s", action, file_name, codec_names[codec] );
+    if( level ) {
+        fprintf( out, " level %d", level );
+    }
+    fprintf( out, ": %.1f MB csv, %.1f MB compressed (%.2f:1) in %.1f s, %.1f MB/s, codec busy %d%%\n",
+             (double)raw_bytes / 1048576.0, (double)packed_bytes / 1048576.0,
+             packed_bytes ? (double)raw_bytes / (double)packed_bytes : 0.0,
+             (double)elapsed_ms / 1000.0, (double)raw_bytes / 1048576.0 / seconds,
+             elapsed_ms ? (int)( busy_ms * 100 / elapsed_ms ) : 0 );
+}
 
-        if (dbctx.fields) {
+/* Output side: csv_output_write() fills pipeline blocks and a compressor
+ * thread deflates them into the file. Plain files are written directly. */
 
-            int fieldno;
-            for (fieldno = 0; fieldno < dbctx.num_fields; fieldno++) {
-                db_get_field( dbctx.tab, fieldno, &dbctx.fields[fieldno] );
-            }
-            fieldno = 0;
+struct csv_output_s {
+    FILE * file;
+    char * file_name;       ///< NULL for stdout
+    codec_t codec;
+    int level;
+    pipeline_t pipe;
+    char * block;           ///< Block being filled, NULL until the first write
+    size_t block_len;
+    char * packed;          ///< Compressor output buffer
+    os_thread_t * thread;
+    int failed;             ///< Compressor failed
+    uint64_t raw_bytes;
+    uint64_t packed_bytes;
+    uint64_t start_ms;
+    uint64_t busy_ms;
+#ifdef CSV_WITH_ZLIB
+    z_stream z;
+#endif
+#ifdef CSV_WITH_ZSTD
+    ZSTD_CCtx * zstd;
+#endif
+};
 
-            dbctx.hrow = db_alloc_cursor_row( dbctx.tab );
-            if (dbctx.hrow ) {
-                parse_input( cb, cb_data, got_field_cb, got_line_cb, &dbctx );
-                db_free_row( dbctx.hrow );
-            }
+static int
+write_packed( csv_output_t * output, size_t len )
+{
+    if( len && fwrite( output->packed, 1, len, output->file ) != len ) {
+        print_error_message( "unable to write file '%s': %s", output->file_name, strerror( errno ) );
+        return -1;
+    }
+    output->packed_bytes += len;
+    return 0;
+}
 
-            if (dbctx.have_tx) {
-                db_abort_tx( dbctx.hdb, 0 );
-            }
+/// Compress data into the file, and end the stream if finish is set
+static int
+compress_data( csv_output_t * output, const char * data, size_t len, int finish )
+{
+#ifdef CSV_WITH_ZLIB
+    if( CODEC_GZIP == output->codec ) {
+        int zrc;
 
-            free(dbctx.fields);
-        }
-        db_close_cursor( dbctx.tab );
-    } else {
-        print_error_message("unable to open table '%s'", table_name);
+        output->z.next_in = (Bytef *)data;
+        output->z.avail_in = (uInt)len;
+        do {
+            output->z.next_out = (Bytef *)output->packed;
+            output->z.avail_out = CSV_PIPELINE_BLOCK;
+            zrc = deflate( &output->z, finish ? Z_FINISH : Z_NO_FLUSH );
+            if( Z_STREAM_ERROR == zrc ) {
+                print_error_message( "unable to compress '%s'", output->file_name );
+                return -1;
+            }
+            if( 0 != write_packed( output, CSV_PIPELINE_BLOCK - output->z.avail_out ) ) {
+                return -1;
+            }
+        } while( 0 == output->z.avail_out || ( finish && Z_STREAM_END != zrc ) );
+        return 0;
     }
+#endif
+#ifdef CSV_WITH_ZSTD
+    if( CODEC_ZSTD == output->codec ) {
+        ZSTD_inBuffer in;
+        size_t remaining;
 
-    return dbctx.failed;
+        in.src = data;
+        in.size = len;
+        in.pos = 0;
+        do {
+            ZSTD_outBuffer out;
+
+            out.dst = output->packed;
+            out.size = CSV_PIPELINE_BLOCK;
+            out.pos = 0;
+            remaining = ZSTD_compressStream2( output->zstd, &out, &in, finish ? ZSTD_e_end : ZSTD_e_continue );
+            if( ZSTD_isError( remaining ) ) {
+                print_error_message( "unable to compress '%s': %s", output->file_name, ZSTD_getErrorName( remaining ) );
+                return -1;
+            }
+            if( 0 != write_packed( output, out.pos ) ) {
+                return -1;
+            }
+        } while( finish ? 0 != remaining : in.pos < in.size );
+        return 0;
+    }
+#endif
+    (void)output;
+    (void)data;
+    (void)len;
+    (void)finish;
+    return -1;
 }
 
-//----------------------- EXPORT
-int export_data(db_t hdb, const char *table_name, const char * file_name, const csv_export_options_t * export_options )
+static void
+compress_proc( csv_output_t * output )
 {
-    int rc = EXIT_FAILURE;
-    db_cursor_t tab = NULL;
-    db_row_t    row = NULL;
-    int fieldno;
-    int field_count;
-    char field_buf[4096];
-    int argno = 1;
-
-    csv_export_options_t eoptions = { USE_HEADER, TABLE_SOURCE, '\'', 0, 0 };
-    FILE * out_file = NULL;
-    const char * sep = NULL;
-    const char * begin;
-    db_fielddef_t * fields = NULL;
+    int index;
+    int rc = 0;
 
-    if( export_options ) {
-        eoptions = *export_options;
+    while( 0 == rc && ( index = pipeline_next( &output->pipe ) ) >= 0 ) {
+        uint64_t start = clock_ms();
+
+        rc = compress_data( output, output->pipe.blocks[index], output->pipe.lens[index], 0 );
+        output->busy_ms += clock_ms() - start;
+        pipeline_release( &output->pipe );
     }
+    if( 0 == rc ) {
+        uint64_t start = clock_ms();
 
-    if (table_name == NULL) {
-        print_error_message("table name expected");
-        return EXIT_FAILURE;
+        rc = compress_data( output, NULL, 0, 1 );
+        output->busy_ms += clock_ms() - start;
     }
+    if( 0 != rc ) {
+        output->failed = 1;
+        pipeline_stop( &output->pipe );
+    }
+}
 
-    if (file_name == NULL) {
-        out_file = stdout;
+static void
+free_output( csv_output_t * output )
+{
+#ifdef CSV_WITH_ZLIB
+    if( CODEC_GZIP == output->codec ) {
+        deflateEnd( &output->z );
     }
-    else {
-        out_file = fopen(file_name, "wt");
-        if (out_file == NULL) {
-            print_error_message("unable to open file '%s': %s", file_name, strerror(errno));
-            goto cleanup;
-        }
+#endif
+#ifdef CSV_WITH_ZSTD
+    if( output->zstd ) {
+        ZSTD_freeCCtx( output->zstd );
     }
+#endif
+    if( output->packed ) {
+        free( output->packed );
+        pipeline_destroy( &output->pipe );
+    }
+    free( output->file_name );
+    free( output );
+}
 
-    if (eoptions.source_mode == SQL_SOURCE) {
+/// Open a csv output file, or stdout if file_name is NULL
+/** Files named *.gz or *.zst are compressed at the given level, or at the
+ *  codec's default level if it is 0. */
+csv_output_t *
+csv_output_open( const char * file_name, int level )
+{
+    csv_output_t * output;
+    codec_t codec = file_codec( file_name );
 
-        /* todo: SQL_SOURCE needs some way to make an argument with spaces.
-         * fix extract_arg() to handle quotes
-         */
-        print_error_message("SQL mode is not supported yet");
-        goto cleanup;
+    if( !codec_supported( codec, file_name ) ) {
+        return NULL;
+    }
 
-        tab = db_prepare_sql_cursor(hdb, table_name, 0);
-        if (tab == NULL) {
-            print_error_message("unable to prepare SQL statement '%s'", table_name);
-            goto cleanup;
-        }
+    output = (csv_output_t *)calloc( 1, sizeof( csv_output_t ) );
+    if( NULL == output ) {
+        print_error_message( "out of memory during export" );
+        return NULL;
+    }
+    output->codec = codec;
 
-        /* todo: support parameters */
-        if (db_execute( tab, NULL, 0 ) == DB_FAIL) {
-            print_error_message("unable to execute SQL statement '%s'", table_name);
-            goto cleanup;
+    if( NULL == file_name ) {
+        output->file = stdout;
+        return output;
+    }
+
+    output->file_name = (char *)malloc( strlen( file_name ) + 1 );
+    if( NULL == output->file_name ) {
+        print_error_message( "out of memory during export" );
+        free( output );
+        return NULL;
+    }
+    strcpy( output->file_name, file_name );
+
+    if( CODEC_NONE == codec ) {
+        output->file = fopen( file_name, "wt" );
+        if( NULL == output->file ) {
+            print_error_message( "unable to open file '%s': %s", file_name, strerror( errno ) );
+            free_output( output );
+            return NULL;
         }
-    } else {
+        /* Output is collected in the export buffer. */
+        setvbuf( output->file, NULL, _IONBF, 0 );
+        return output;
+    }
 
-        tab = db_open_table_cursor(hdb, table_name, NULL);
-        if (tab == NULL) {
-            print_error_message("unable to open table '%s'", table_name);
-            goto cleanup;
+    output->level = level ? level : CODEC_GZIP == codec ? CSV_GZIP_LEVEL : CSV_ZSTD_LEVEL;
+    output->packed = (char *)malloc( CSV_PIPELINE_BLOCK );
+    if( NULL == output->packed || 0 != pipeline_init( &output->pipe ) ) {
+        free( output->packed );
+        output->packed = NULL;
+        print_error_message( "out of memory during export" );
+        free_output( output );
+        return NULL;
+    }
+
+#ifdef CSV_WITH_ZLIB
+    if( CODEC_GZIP == codec ) {
+        /* 16 more window bits write a gzip header and trailer. */
+        if( Z_OK != deflateInit2( &output->z, output->level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY ) ) {
+            print_error_message( "unable to compress '%s' at level %d", file_name, output->level );
+            output->codec = CODEC_NONE;
+            free_output( output );
+            return NULL;
         }
     }
-    row = db_alloc_cursor_row( tab );
-    if (row == NULL) {
-        print_error_message("unable to allocate row");
-        goto cleanup;
+#endif
+#ifdef CSV_WITH_ZSTD
+    if( CODEC_ZSTD == codec ) {
+        output->zstd = ZSTD_createCCtx();
+        if( NULL == output->zstd
+            || ZSTD_isError( ZSTD_CCtx_setParameter( output->zstd, ZSTD_c_compressionLevel, output->level ) ) ) {
+            print_error_message( "unable to compress '%s' at level %d", file_name, output->level );
+            free_output( output );
+            return NULL;
+        }
     }
+#endif
 
-    field_count = db_get_field_count( tab );
-    fields = (db_fielddef_t*) malloc( sizeof(db_fielddef_t) * field_count);
-    if (fields == NULL) {
-        print_error_message("out of memory");
-        goto cleanup;
+    output->file = fopen( file_name, "wb" );
+    if( NULL == output->file ) {
+        print_error_message( "unable to open file '%s': %s", file_name, strerror( errno ) );
+        free_output( output );
+        return NULL;
     }
+    setvbuf( output->file, NULL, _IONBF, 0 );
 
-    for (fieldno = 0; fieldno < field_count; fieldno++) {
-        db_fielddef_init(&fields[fieldno]);
-        db_get_field( tab, fieldno, &fields[fieldno]);
+    output->start_ms = clock_ms();
+    if( 0 != thread_spawn( (thread_proc_t)compress_proc, output, THREAD_JOINABLE, &output->thread ) ) {
+        print_error_message( "unable to start compressor thread" );
+        fclose( output->file );
+        free_output( output );
+        return NULL;
     }
+    return output;
+}
 
-    sep = ",";
+/// Write csv data, returns 0 on success
+int
+csv_output_write( csv_output_t * output, const char * data, size_t len )
+{
+    if( CODEC_NONE == output->codec ) {
+        if( fwrite( data, 1, len, output->file ) != len ) {
+            print_error_message( "unable to write csv output: %s", strerror( errno ) );
+            return -1;
+        }
+        return 0;
+    }
 
-    /* export header */
-    if (eoptions.header_mode == USE_HEADER) {
+    output->raw_bytes += len;
+    while( len ) {
+        size_t n;
 
-        for (fieldno = 0; fieldno < field_count; fieldno++) {
-            if (fieldno > 0) {
-                fputs(sep, out_file);
+        if( NULL == output->block ) {
+            output->block = pipeline_free_block( &output->pipe );
+            output->block_len = 0;
+            if( NULL == output->block ) {
+                /* The compressor has reported its error. */
+                return -1;
             }
-
-            fputs(fields[fieldno].field_name, out_file);
         }
+        n = CSV_PIPELINE_BLOCK - output->block_len;
+        if( n > len ) {
+            n = len;
+        }
+        memcpy( output->block + output->block_len, data, n );
+        output->block_len += n;
+        data += n;
+        len -= n;
+        if( CSV_PIPELINE_BLOCK == output->block_len ) {
+            pipeline_submit( &output->pipe, output->block_len );
+            output->block = NULL;
+        }
+    }
+    return 0;
+}
+
+/// Write formatted text, returns 0 on success
+int
+csv_output_printf( csv_output_t * output, const char * format, ... )
+{
+    char text[256];
+    char * buffer = text;
+    va_list args;
+    int len;
+    int rc;
 
-        fputc('\n', out_file);
+    va_start( args, format );
+#if defined(_MSC_VER) && _MSC_VER < 1900
+    len = _vscprintf( format, args );
+#else
+    len = vsnprintf( NULL, 0, format, args );
+#endif
+    va_end( args );
+    if( len < 0 ) {
+        return -1;
     }
 
-    /* export data */
-    if (db_seek_first( tab ) == DB_FAIL) {
-        print_error_message("unable to read table");
-        goto cleanup;
+    if( (size_t)len >= sizeof( text ) ) {
+        buffer = (char *)malloc( (size_t)len + 1 );
+        if( NULL == buffer ) {
+            print_error_message( "out of memory during export" );
+            return -1;
+        }
     }
+    va_start( args, format );
+    vsprintf( buffer, format, args );
+    va_end( args );
 
-    while (1) {
-        int rc = db_eof(tab);
+    rc = csv_output_write( output, buffer, (size_t)len );
+    if( buffer != text ) {
+        free( buffer );
+    }
+    return rc;
+}
 
-        if (rc < 0) {
-            print_error_message("unable to read table");
-            goto cleanup;
-        }
+/// Finish and close the output, returns 0 if all data was written
+int
+csv_output_close( csv_output_t * output )
+{
+    int rc = 0;
 
-        if (rc) {
-            break;
+    if( CODEC_NONE == output->codec ) {
+        if( stdout == output->file ) {
+            fflush( output->file );
         }
-
-        if (db_fetch( tab, row, NULL ) == DB_FAIL) {
-            print_error_message("unable to read table");
-            goto cleanup;
+        else if( 0 != fclose( output->file ) ) {
+            print_error_message( "unable to write file '%s': %s", output->file_name, strerror( errno ) );
+            rc = -1;
         }
+        free_output( output );
+        return rc;
+    }
 
-        if( export_options && export_options->line_prefix && export_options->line_prefix[0] ) {
-            fprintf( out_file, "%s", export_options->line_prefix );
-        }
-        for (fieldno = 0; fieldno < field_count; fieldno++) {
-            db_len_t len;
+    if( output->block && output->block_len ) {
+        pipeline_submit( &output->pipe, output->block_len );
+    }
+    pipeline_close( &output->pipe, 0 );
+    thread_join( output->thread );
 
+    if( 0 != fclose( output->file ) && !output->failed ) {
+        print_error_message( "unable to write file '%s': %s", output->file_name, strerror( errno ) );
+        output->failed = 1;
+    }
+    if( output->failed ) {
+        rc = -1;
+    }
+    else {
+        report_codec( stderr, "Compressed", output->file_name, output->codec, output->level,
+                      output->raw_bytes, output->packed_bytes, clock_ms() - output->start_ms, output->busy_ms );
+    }
+    free_output( output );
+    return rc;
+}
 
-            if (db_is_null(row, fieldno)) {
-                field_buf[0] = 0;
-                len = DB_FIELD_NULL;
-            } else {
-                switch((intptr_t)fields[fieldno].field_type) {
-                case (intptr_t)DB_COLTYPE_UTF8STR:
-                case (intptr_t)DB_COLTYPE_UTF16STR:
-                case (intptr_t)DB_COLTYPE_UTF32STR:
-                    len = db_get_field_data(row, fieldno, DB_VARTYPE_UTF8STR, &field_buf, sizeof(field_buf));
-                    break;
-                default:
-                    len = db_get_field_data(row, fieldno, DB_VARTYPE_ANSISTR, &field_buf, sizeof(field_buf));
-                }
+/* Input side: a decompressor thread pulls the file through its source
+ * callback and fills pipeline blocks that the parser reads in place. */
 
-                if (len == DB_LEN_FAIL) {
-                    print_error_message("unable to get field %d data", fieldno);
-                    goto cleanup;
-                }
-            }
+struct inflate_source_s {
+    read_more_data_callback_t cb;
+    void * cb_data;
+    const char * file_name;
+    codec_t codec;
+    pipeline_t pipe;
+    int held;               ///< Block index returned to the parser, -1 if none
+    int in_frame;           ///< Input so far ends inside a compressed frame
+    int more_output;        ///< Codec may hold output that did not fit the last block
+    os_thread_t * thread;
+    uint64_t raw_bytes;
+    uint64_t packed_bytes;
+    uint64_t start_ms;
+    uint64_t busy_ms;
+#ifdef CSV_WITH_ZLIB
+    z_stream z;
+#endif
+#ifdef CSV_WITH_ZSTD
+    ZSTD_DCtx * zstd;
+#endif
+};
 
-            if (fieldno > 0) {
-                fputs(sep, out_file);
-            }
+/// Decompress the next part of the input into a block
+/** Returns the length filled, 0 at the end of the input or -1 on error.
+ *  in and in_len track input returned by the source callback. Output the
+ *  codec held back when the previous block filled up is drained before
+ *  more input is read. */
+static ptrdiff_t
+inflate_block( inflate_source_t * src, char * block, char ** in, size_t * in_len )
+{
+    size_t filled = 0;
 
-            fputc(eoptions.field_quote, out_file);
+    (void)block;    /* unused when built without a codec */
+    while( filled < CSV_PIPELINE_BLOCK ) {
+        uint64_t start;
+        size_t used = 0;
 
-            begin = field_buf;
-            while(1) {
-                const char * e = strchr(begin, eoptions.field_quote);
+        if( 0 == *in_len && !src->more_output ) {
+            ptrdiff_t n = src->cb( in, src->cb_data );
 
-                if (e == NULL) {
-                    fwrite(begin, 1, strlen(begin), out_file);
-                    break;
-                } else {
-                    fwrite(begin, 1, e - begin + 1, out_file);
-                    fputc(eoptions.field_quote, out_file);
-                    begin = e + 1;
-                }
+            if( n < 0 ) {
+                return -1;
+            }
+            if( 0 == n ) {
+                break;
             }
-            fputc(eoptions.field_quote, out_file);
+            *in_len = (size_t)n;
+            src->packed_bytes += (size_t)n;
         }
 
-        if( export_options && export_options->line_suffix && export_options->line_suffix[0] ) {
-            fprintf( out_file, "%s", export_options->line_suffix );
+        start = clock_ms();
+#ifdef CSV_WITH_ZLIB
+        if( CODEC_GZIP == src->codec ) {
+            int zrc;
+
+            src->z.next_in = (Bytef *)*in;
+            src->z.avail_in = (uInt)*in_len;
+            src->z.next_out = (Bytef *)block + filled;
+            src->z.avail_out = (uInt)( CSV_PIPELINE_BLOCK - filled );
+            zrc = inflate( &src->z, Z_NO_FLUSH );
+            if( Z_OK != zrc && Z_STREAM_END != zrc && Z_BUF_ERROR != zrc ) {
+                print_error_message( "unable to decompress '%s': %s", src->file_name,
+                                     src->z.msg ? src->z.msg : "corrupt data" );
+                return -1;
+            }
+            used = *in_len - src->z.avail_in;
+            filled = CSV_PIPELINE_BLOCK - src->z.avail_out;
+            src->more_output = 0 == src->z.avail_out;
+            src->in_frame = Z_STREAM_END != zrc;
+            if( Z_STREAM_END == zrc ) {
+                /* Concatenated gzip files continue with another member. */
+                inflateReset( &src->z );
+                src->more_output = 0;
+            }
         }
-        fputs(EOL, out_file);
+#endif
+#ifdef CSV_WITH_ZSTD
+        if( CODEC_ZSTD == src->codec ) {
+            ZSTD_inBuffer zin;
+            ZSTD_outBuffer zout;
+            size_t zrc;
 
-        if (db_seek_next(tab) == DB_FAIL) {
-            print_error_message("unable to read table");
-            goto cleanup;
+            zin.src = *in;
+            zin.size = *in_len;
+            zin.pos = 0;
+            zout.dst = block;
+            zout.size = CSV_PIPELINE_BLOCK;
+            zout.pos = filled;
+            zrc = ZSTD_decompressStream( src->zstd, &zout, &zin );
+            if( ZSTD_isError( zrc ) ) {
+                print_error_message( "unable to decompress '%s': %s", src->file_name, ZSTD_getErrorName( zrc ) );
+                return -1;
+            }
+            used = zin.pos;
+            filled = zout.pos;
+            /* A decoded frame has been flushed in full; asking for more
+             * output then would start reading the next frame. */
+            src->more_output = zout.pos == zout.size && 0 != zrc;
+            src->in_frame = 0 != zrc;
         }
+#endif
+        src->busy_ms += clock_ms() - start;
+        *in += used;
+        *in_len -= used;
     }
-    rc = EXIT_SUCCESS;
 
-cleanup:
+    if( 0 == filled && src->in_frame ) {
+        print_error_message( "unable to decompress '%s': file is truncated", src->file_name );
+        return -1;
+    }
+    src->raw_bytes += filled;
+    return (ptrdiff_t)filled;
+}
 
-    if (fields) {
-        free(fields);
+static void
+inflate_proc( inflate_source_t * src )
+{
+    char * in = NULL;
+    size_t in_len = 0;
+    int failed = 0;
+
+    for( ;; ) {
+        char * block = pipeline_free_block( &src->pipe );
+        ptrdiff_t len;
+
+        if( NULL == block ) {
+            /* The parser has stopped reading. */
+            break;
+        }
+        len = inflate_block( src, block, &in, &in_len );
+        if( len <= 0 ) {
+            failed = len < 0;
+            break;
+        }
+        pipeline_submit( &src->pipe, (size_t)len );
     }
+    pipeline_close( &src->pipe, failed );
+}
 
-    if (row) {
-        db_free_row( row );
+static void
+free_inflate_source( inflate_source_t * src )
+{
+#ifdef CSV_WITH_ZLIB
+    if( CODEC_GZIP == src->codec ) {
+        inflateEnd( &src->z );
     }
+#endif
+#ifdef CSV_WITH_ZSTD
+    if( src->zstd ) {
+        ZSTD_freeDCtx( src->zstd );
+    }
+#endif
+    pipeline_destroy( &src->pipe );
+    free( src );
+}
 
-    if (tab) {
-        db_close_cursor( tab );
+static inflate_source_t *
+open_inflate_source( const char * file_name, read_more_data_callback_t cb, void * cb_data )
+{
+    inflate_source_t * src;
+    codec_t codec = file_codec( file_name );
+
+    if( !codec_supported( codec, file_name ) ) {
+        return NULL;
     }
 
-    if (out_file && out_file != stdout) {
-        fclose(out_file);
+    src = (inflate_source_t *)calloc( 1, sizeof( inflate_source_t ) );
+    if( NULL == src || 0 != pipeline_init( &src->pipe ) ) {
+        print_error_message( "out of memory during import" );
+        free( src );
+        return NULL;
     }
+    src->cb = cb;
+    src->cb_data = cb_data;
+    src->file_name = file_name;
+    src->held = -1;
 
-    return rc;
+#ifdef CSV_WITH_ZLIB
+    if( CODEC_GZIP == codec ) {
+        /* 32 more window bits accept both gzip and zlib headers. */
+        if( Z_OK != inflateInit2( &src->z, 15 + 32 ) ) {
+            print_error_message( "unable to decompress '%s'", file_name );
+            free_inflate_source( src );
+            return NULL;
+        }
+    }
+#endif
+#ifdef CSV_WITH_ZSTD
+    if( CODEC_ZSTD == codec ) {
+        src->zstd = ZSTD_createDCtx();
+        if( NULL == src->zstd ) {
+            print_error_message( "unable to decompress '%s'", file_name );
+            free_inflate_source( src );
+            return NULL;
+        }
+    }
+#endif
+    src->codec = codec;
+
+    src->start_ms = clock_ms();
+    if( 0 != thread_spawn( (thread_proc_t)inflate_proc, src, THREAD_JOINABLE, &src->thread ) ) {
+        print_error_message( "unable to start decompressor thread" );
+        free_inflate_source( src );
+        return NULL;
+    }
+    return src;
+}
+
+static void
+close_inflate_source( inflate_source_t * src )
+{
+    int complete;
+
+    pipeline_stop( &src->pipe );
+    thread_join( src->thread );
+
+    complete = src->pipe.done && !src->pipe.failed && 0 == src->pipe.count;
+    if( complete ) {
+        report_codec( stdout, "Decompressed", src->file_name, src->codec, 0,
+                      src->raw_bytes, src->packed_bytes, clock_ms() - src->start_ms, src->busy_ms );
+    }
+    free_inflate_source( src );
+}
+
+static ptrdiff_t
+get_more_inflated_data_cb( char ** data, void * cb_data )
+{
+    inflate_source_t * src = (inflate_source_t *)cb_data;
+
+    if( src->held >= 0 ) {
+        pipeline_release( &src->pipe );
+        src->held = -1;
+    }
+
+    src->held = pipeline_next( &src->pipe );
+    if( -2 == src->held ) {
+        src->held = -1;
+        return -1;
+    }
+    if( -1 == src->held ) {
+        return 0;
+    }
+    *data = src->pipe.blocks[src->held];
+    return (ptrdiff_t)src->pipe.lens[src->held];
 }
@@ -25,35 +25,89 @@
 #define CSV_IMPORT_EXPORT_H_INCLUDED
 
 #include <ittia/db.h>
+#include <stdio.h>
 
 typedef enum {
     LINE_COMMIT,
     FILE_COMMIT,
+    BATCH_COMMIT,   ///< Commit every batch_rows lines or batch_ms milliseconds
 } csv_commit_mode_t;
 
 typedef enum {
     NO_HEADER, IGNORE_HEADER, USE_HEADER
 } csv_header_mode_t;
 
+typedef enum {
+    NATIVE_BINDING,     ///< Parse numeric fields in the importer and bind native values
+    TEXT_BINDING        ///< Bind every field as text and let the engine convert it
+} csv_binding_mode_t;
+
 typedef struct {
     csv_commit_mode_t commit_mode;
     csv_header_mode_t header_mode;
+    unsigned long batch_rows;   ///< BATCH_COMMIT: lines per transaction, 0 for no limit
+    unsigned long batch_ms;     ///< BATCH_COMMIT: milliseconds per transaction, 0 for no limit
+    const char * resume_file;   ///< BATCH_COMMIT: records the first uncommitted line, or NULL
+    csv_binding_mode_t binding_mode;
+    int threads;                ///< csv_import_file(): parser threads, 0 to parse on the calling thread; needs BATCH_COMMIT without batch_ms or resume_file
+    int writers;                ///< Parallel import: connections inserting rows, 1 if not set
+    const char * database_name; ///< Parallel import: database opened by each additional writer
+    int preserve_order;         ///< Parallel import: insert lines in input order, with a single writer
 } csv_import_options_t;
 
 int csv_import( db_t hdb, const char * table_name, const char * buffer, size_t buffer_size, csv_import_options_t * import_options );
+int csv_import_file( db_t hdb, const char * table_name, const char * file_name, csv_import_options_t * import_options );
+int csv_parser_benchmark( const char * file_name, FILE * out );
 
 typedef enum {
     SQL_SOURCE, TABLE_SOURCE
 } csv_source_mode_t;
 
+typedef enum {
+    QUOTE_ALL,      ///< Enclose every field in quotes
+    QUOTE_MINIMAL   ///< Quote only fields that contain a quote, separator or line break
+} csv_quote_mode_t;
+
+/// Output file of the exporter, compressed on a pipeline thread when its
+/// name ends in .gz or .zst
+typedef struct csv_output_s csv_output_t;
+
+csv_output_t * csv_output_open( const char * file_name, int level );
+int csv_output_write( csv_output_t * output, const char * data, size_t len );
+int csv_output_printf( csv_output_t * output, const char * format, ... );
+int csv_output_close( csv_output_t * output );
+
 typedef struct {
     csv_header_mode_t header_mode;
     csv_source_mode_t source_mode;
     char field_quote;
     char * line_prefix;
     char * line_suffix;
+    csv_quote_mode_t quote_mode;
+    const char * const * params;    ///< SQL_SOURCE: parameter values as text, NULL for null
+    int param_count;
+    unsigned long page_rows;        ///< SQL_SOURCE: fetch the result in pages of this many rows, 0 to fetch it at once
+    const char * page_key;          ///< SQL_SOURCE: unique column that orders the pages, NULL to page by OFFSET
+    int compression_level;          ///< Level for .gz and .zst files, 0 for the default
+    csv_output_t * output;          ///< Write to this open output instead of file_name
 } csv_export_options_t;
 
 int export_data(db_t hdb, const char *table_name, const char * file_name, const csv_export_options_t * export_options );
 
+typedef enum {
+    SINGLE_OUTPUT,      ///< One file with the ranges in key order
+    PER_RANGE_OUTPUT    ///< One file per range, named FILE.N
+} csv_range_output_t;
+
+typedef struct {
+    const char * database_name; ///< Database opened by the connection of each range
+    const char * key_column;    ///< Indexed column to split on, NULL for the primary key
+    int threads;                ///< Number of key ranges, each exported on its own thread
+    csv_range_output_t output;
+} csv_parallel_export_options_t;
+
+int export_data_parallel( db_t hdb, const char * table_name, const char * file_name,
+                          const csv_export_options_t * export_options,
+                          const csv_parallel_export_options_t * parallel_options );
+
 #endif
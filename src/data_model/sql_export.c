@@ -126,44 +126,47 @@ execute_command( db_t hdb, const char* stmt, db_cursor_t* cursor, db_row_t param
     return EXIT_SUCCESS;
 }
 
+/* Output of the export, stdout unless --output names a file. */
+static csv_output_t * output = NULL;
+
 /*
  *  Export field definition
  */
 static int
 export_field( db_fielddef_t * fdef )
 {
-    fprintf( stdout, "\t%s\t", fdef->field_name );
+    csv_output_printf( output, "\t%s\t", fdef->field_name );
 
     switch((int)(fdef->field_type)) {
-    case DB_COLTYPE_SINT8_TAG:      fprintf( stdout, "sint8" ); break;
-    case DB_COLTYPE_UINT8_TAG:      fprintf( stdout, "uint8" ); break;
-    case DB_COLTYPE_SINT16_TAG:     fprintf( stdout, "sint16" ); break;
-    case DB_COLTYPE_UINT16_TAG:     fprintf( stdout, "uint16" ); break;
-    case DB_COLTYPE_SINT32_TAG:     fprintf( stdout, "sint32" ); break;
-    case DB_COLTYPE_UINT32_TAG:     fprintf( stdout, "uint32" ); break;
-    case DB_COLTYPE_SINT64_TAG:     fprintf( stdout, "sint64" ); break;
-    case DB_COLTYPE_UINT64_TAG:     fprintf( stdout, "sint64" ); break;
-    case DB_COLTYPE_FLOAT32_TAG:    fprintf( stdout, "float32" ); break;
-    case DB_COLTYPE_FLOAT64_TAG:    fprintf( stdout, "float64" ); break;
+    case DB_COLTYPE_SINT8_TAG:      csv_output_printf( output, "sint8" ); break;
+    case DB_COLTYPE_UINT8_TAG:      csv_output_printf( output, "uint8" ); break;
+    case DB_COLTYPE_SINT16_TAG:     csv_output_printf( output, "sint16" ); break;
+    case DB_COLTYPE_UINT16_TAG:     csv_output_printf( output, "uint16" ); break;
+    case DB_COLTYPE_SINT32_TAG:     csv_output_printf( output, "sint32" ); break;
+    case DB_COLTYPE_UINT32_TAG:     csv_output_printf( output, "uint32" ); break;
+    case DB_COLTYPE_SINT64_TAG:     csv_output_printf( output, "sint64" ); break;
+    case DB_COLTYPE_UINT64_TAG:     csv_output_printf( output, "sint64" ); break;
+    case DB_COLTYPE_FLOAT32_TAG:    csv_output_printf( output, "float32" ); break;
+    case DB_COLTYPE_FLOAT64_TAG:    csv_output_printf( output, "float64" ); break;
     // case DB_COLTYPE_FIXED_TAG:
-    case DB_COLTYPE_CURRENCY_TAG:   fprintf( stdout, "currency" ); break;
-    case DB_COLTYPE_DATE_TAG:       fprintf( stdout, "date" ); break;
-    case DB_COLTYPE_TIME_TAG:       fprintf( stdout, "time" ); break;
-    case DB_COLTYPE_DATETIME_TAG:   fprintf( stdout, "datetime" ); break;
-    case DB_COLTYPE_TIMESTAMP_TAG:  fprintf( stdout, "timestamp" ); break;
-    case DB_COLTYPE_ANSISTR_TAG:    fprintf( stdout, "ansistr(%d)", (int)fdef->field_size ); break;
+    case DB_COLTYPE_CURRENCY_TAG:   csv_output_printf( output, "currency" ); break;
+    case DB_COLTYPE_DATE_TAG:       csv_output_printf( output, "date" ); break;
+    case DB_COLTYPE_TIME_TAG:       csv_output_printf( output, "time" ); break;
+    case DB_COLTYPE_DATETIME_TAG:   csv_output_printf( output, "datetime" ); break;
+    case DB_COLTYPE_TIMESTAMP_TAG:  csv_output_printf( output, "timestamp" ); break;
+    case DB_COLTYPE_ANSISTR_TAG:    csv_output_printf( output, "ansistr(%d)", (int)fdef->field_size ); break;
 #ifndef DB_EXCLUDE_UNICODE
-    case DB_COLTYPE_UTF8STR_TAG:    fprintf( stdout, "utf8str(%d)", (int)fdef->field_size ); break;
-    case DB_COLTYPE_UTF16STR_TAG:   fprintf( stdout, "utf16str(%d)", (int)fdef->field_size ); break;
-    case DB_COLTYPE_UTF32STR_TAG:   fprintf( stdout, "utf32str(%d)", (int)fdef->field_size ); break;
+    case DB_COLTYPE_UTF8STR_TAG:    csv_output_printf( output, "utf8str(%d)", (int)fdef->field_size ); break;
+    case DB_COLTYPE_UTF16STR_TAG:   csv_output_printf( output, "utf16str(%d)", (int)fdef->field_size ); break;
+    case DB_COLTYPE_UTF32STR_TAG:   csv_output_printf( output, "utf32str(%d)", (int)fdef->field_size ); break;
 #endif
-    case DB_COLTYPE_BINARY_TAG:     fprintf( stdout, "varbinary(%d)", (int)fdef->field_size ); break;
-    case DB_COLTYPE_BLOB_TAG:       fprintf( stdout, "blob" ); break;
+    case DB_COLTYPE_BINARY_TAG:     csv_output_printf( output, "varbinary(%d)", (int)fdef->field_size ); break;
+    case DB_COLTYPE_BLOB_TAG:       csv_output_printf( output, "blob" ); break;
     default:
         return EXIT_FAILURE;
     }
     if( DB_NOT_NULL && fdef->field_flags ) {
-        fprintf( stdout, " NOT NULL" );
+        csv_output_printf( output, " NOT NULL" );
     }
 
     return EXIT_SUCCESS;
@@ -174,6 +177,13 @@ typedef enum {
     POST_DATA
 } export_stage_t;
 
+/* Database file, opened again by each thread of a parallel table export. */
+static const char * database_name = NULL;
+/* Key ranges per table, when greater than one. */
+static int export_threads = 0;
+/* Level for a compressed --output file, 0 for the default. */
+static int export_level = 0;
+
 typedef enum {
     ALL_INDEXES,
     PKEYS_ONLY,
@@ -194,31 +204,46 @@ export_indexes( db_tabledef_t * tdef, export_stage_t stage, index_export_filter_
         if( (idef->index_mode & DB_PRIMARY_INDEX) != 0 ) {
             if( filter != ALL_BUT_PKEYS ) {
                 if( POST_DATA == stage ) {
-                    fprintf( stdout, "ALTER TABLE %s ADD ", tdef->table_name );
+                    csv_output_printf( output, "ALTER TABLE %s ADD ", tdef->table_name );
                 }
                 if( idef->index_name[0] ) {
-                    fprintf( stdout, "CONSTRAINT %s ", idef->index_name );
+                    csv_output_printf( output, "CONSTRAINT %s ", idef->index_name );
                 }
 
-                fprintf( stdout, "PRIMARY KEY ( " );
+                csv_output_printf( output, "PRIMARY KEY ( " );
                 for( fidx = 0; fidx < idef->nfields; ++fidx ) {
-                    if( fidx ) {fputs( ", ", stdout ); }
-                    fprintf( stdout, "%s", tdef->fields[ idef->fields[fidx].fieldno ].field_name  );
+                    if( fidx ) {csv_output_printf( output, ", " ); }
+                    csv_output_printf( output, "%s", tdef->fields[ idef->fields[fidx].fieldno ].field_name  );
                 }
-                fprintf( stdout, " )%s", stage == POST_DATA ? ";\n" : "" );
+                csv_output_printf( output, " )%s", stage == POST_DATA ? ";\n" : "" );
             }
         } else if( ALL_INDEXES == filter || ALL_BUT_PKEYS == filter ) {
-            fprintf( stdout, "CREATE INDEX %s ON %s( ", idef->index_name, tdef->table_name );
+            csv_output_printf( output, "CREATE INDEX %s ON %s( ", idef->index_name, tdef->table_name );
             for( fidx = 0; fidx < idef->nfields; ++fidx ) {
-                if( fidx ) {fputs( ", ", stdout ); }
-                fprintf( stdout, "%s", tdef->fields[ idef->fields[fidx].fieldno ].field_name  );
+                if( fidx ) {csv_output_printf( output, ", " ); }
+                csv_output_printf( output, "%s", tdef->fields[ idef->fields[fidx].fieldno ].field_name  );
             }
-            fprintf( stdout, " );\n" );
+            csv_output_printf( output, " );\n" );
         }
     }
     return rc;
 }
 
+/*
+ *  Check if a table has a primary key to split it into key ranges.
+ */
+static int
+has_primary_key( const db_tabledef_t * tdef )
+{
+    int idx;
+    for( idx = 0; idx < tdef->nindexes; ++idx ) {
+        if( (tdef->indexes[ idx ].index_mode & DB_PRIMARY_INDEX) != 0 ) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
 /*
  *  Export table schema & data.
  *  Export table's data before foreign keys, indexes and primary keys ( except clustered tables ).
@@ -232,30 +257,39 @@ export_table( db_t hdb, const char * tname, export_stage_t stage )
 
     if( DB_OK == db_describe_table( hdb, tname, &tdef, DB_DESCRIBE_TABLE_FIELDS | DB_DESCRIBE_TABLE_INDEXES ) ) {
         if( SCHEMA_AND_DATA == stage ) {
-            fprintf( stdout, "-- ==== Schema of table %s\n", tname );
-            fprintf( stdout, "CREATE %s TABLE %s (\n",
+            csv_output_printf( output, "-- ==== Schema of table %s\n", tname );
+            csv_output_printf( output, "CREATE %s TABLE %s (\n",
                      tdef.table_type == DB_TABLETYPE_MEMORY ? "MEMORY" : "", tname
                      );
             for( fieldno = 0, rc = 0; fieldno < tdef.nfields && 0 == rc; ++fieldno ) {
                 db_fielddef_t *fdef = &tdef.fields[fieldno];
                 if( fieldno ) {
-                    fputs( ",\n", stdout );
+                    csv_output_printf( output, ",\n" );
                 }
                 rc = export_field( fdef );
             }
             if( EXIT_SUCCESS == rc ) {
                 if( DB_TABLETYPE_CLUSTERED == tdef.table_type ) {
-                    fputs( ",\n\t", stdout );
+                    csv_output_printf( output, ",\n\t" );
                     rc = export_indexes( &tdef, stage, PKEYS_ONLY );
                 }
-                fprintf( stdout, "\n) %s;\n", DB_TABLETYPE_CLUSTERED == tdef.table_type ? "CLUSTER BY PRIMARY KEY" : "" );
+                csv_output_printf( output, "\n) %s;\n", DB_TABLETYPE_CLUSTERED == tdef.table_type ? "CLUSTER BY PRIMARY KEY" : "" );
             }
             if( EXIT_SUCCESS == rc && DB_TABLETYPE_MEMORY != tdef.table_type ) {
                 char lprefix[ DB_MAX_OBJECT_NAME + 20 ];
                 csv_export_options_t opts = { NO_HEADER, TABLE_SOURCE, '\'', lprefix, " );" };
 
+                opts.output = output;
+
                 snprintf( lprefix, DB_MAX_OBJECT_NAME + 20, "INSERT INTO %s VALUES( ", tdef.table_name );
-                rc = export_data( hdb, tname, 0, &opts );
+                if( export_threads > 1 && has_primary_key( &tdef ) ) {
+                    /* Scan key ranges of the table in parallel; rows keep their key order. */
+                    csv_parallel_export_options_t popts = { database_name, NULL, export_threads, SINGLE_OUTPUT };
+                    rc = export_data_parallel( hdb, tname, 0, &opts, &popts );
+                }
+                else {
+                    rc = export_data( hdb, tname, 0, &opts );
+                }
             }
 
         } else {
@@ -290,7 +324,7 @@ export_tables( db_t hdb, export_stage_t stage )
         for( rc = 0, db_seek_first( sql_cursor ); !db_eof( sql_cursor ) && 0 == rc; db_seek_next( sql_cursor ), ++tables ) {
             db_fetch( sql_cursor, r, NULL );
             rc = export_table( hdb, tname, stage );
-            fputs( "\n", stdout );
+            csv_output_printf( output, "\n" );
         }
 
         db_free_row( r );
@@ -320,7 +354,7 @@ export_sequences( db_t hdb )
             db_seqdef_t seq_def;
             db_fetch( sql_cursor, r, NULL );
             if( DB_OK == db_describe_sequence( hdb, sname, &seq_def ) ) {
-                fprintf( stdout, "CREATE SEQUENCE %s START WITH %" PRId64 ";\n", sname, seq_def.seq_start.int64 );
+                csv_output_printf( output, "CREATE SEQUENCE %s START WITH %" PRId64 ";\n", sname, seq_def.seq_start.int64 );
             }
         }
 
@@ -337,20 +371,44 @@ example_main(int argc, char **argv)
 {
     int rc = EXIT_FAILURE;
     db_t hdb;
-    if( argc < 2 ) {
+    int argi = 1;
+    const char * output_name = NULL;
+
+    for( ; argi + 1 < argc && 0 == strncmp( argv[argi], "--", 2 ); argi += 2 ) {
+        if( 0 == strcmp( argv[argi], "--threads" ) ) {
+            export_threads = atoi( argv[argi + 1] );
+        }
+        else if( 0 == strcmp( argv[argi], "--output" ) ) {
+            output_name = argv[argi + 1];
+        }
+        else if( 0 == strcmp( argv[argi], "--level" ) ) {
+            export_level = atoi( argv[argi + 1] );
+        }
+        else {
+            break;
+        }
+    }
+    if( argc != argi + 1 ) {
         fprintf(
             stdout, "Usage:\n"
-            " %s <existing ittia database>\n",
+            " %s [--threads N] [--output FILE[.gz|.zst]] [--level N] <existing ittia database>\n",
             argv[0]
             );
         return EXIT_FAILURE;
     }
+    database_name = argv[argi];
 
     /* Open an existing file storage database with default parameters. */
-    hdb = db_open_file_storage(argv[1], NULL);
+    hdb = db_open_file_storage(database_name, NULL);
 
     if (hdb == NULL) {
-        fprintf(stderr, "Couldn't open database file: %s\n", argv[1]);
+        fprintf(stderr, "Couldn't open database file: %s\n", database_name);
+        return EXIT_FAILURE;
+    }
+
+    output = csv_output_open( output_name, export_level );
+    if( NULL == output ) {
+        db_shutdown(hdb, DB_SOFT_SHUTDOWN, NULL);
         return EXIT_FAILURE;
     }
 
@@ -359,6 +417,9 @@ example_main(int argc, char **argv)
         || export_sequences( hdb )
     ;
 
+    if( 0 != csv_output_close( output ) ) {
+        rc = EXIT_FAILURE;
+    }
 
     db_shutdown(hdb, DB_SOFT_SHUTDOWN, NULL);
 
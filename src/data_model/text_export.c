@@ -157,16 +157,99 @@ create_database(char* database_name, dbs_schema_def_t *schema)
 }
 
 
+static void
+print_usage( const char * program )
+{
+    fprintf( stderr,
+             "Usage: %s [options]\n"
+             "\n"
+             "Export the storage table, or the result of a query, as csv.\n"
+             "\n"
+             "  --query SQL       export the result of SQL instead of the table\n"
+             "  --param VALUE     value of the next ? parameter of the query\n"
+             "  --page-rows N     fetch the result N rows at a time\n"
+             "  --page-key COLUMN unique column of the result to page on\n"
+             "  --minimal-quotes  quote only fields that need it\n"
+             "  --output FILE     write to FILE instead of the console,\n"
+             "                    compressed if FILE ends in .gz or .zst\n"
+             "  --level N         compression level of a .gz or .zst FILE\n"
+             "  --threads N       export the table in N key ranges on N threads\n"
+             "  --key COLUMN      indexed column to split the table on\n"
+             "  --per-range       write each range to FILE.N instead of one file\n",
+             program );
+}
+
 int
 example_main(int argc, char **argv)
 {
-    db_t hdb = create_database( EXAMPLE_DATABASE, &db_schema );
-
+    db_t hdb;
     int rc = EXIT_FAILURE;
+    csv_export_options_t options = { USE_HEADER, TABLE_SOURCE, '\'', 0, 0, QUOTE_ALL, NULL, 0, 0, NULL, 0, NULL };
+    csv_parallel_export_options_t poptions = { EXAMPLE_DATABASE, NULL, 0, SINGLE_OUTPUT };
+    const char * source = STORAGE_TABLE;
+    const char * output = NULL;
+    const char ** params;
+    int i;
+
+    params = (const char **)malloc( sizeof( const char * ) * argc );
+    if( NULL == params ) {
+        return EXIT_FAILURE;
+    }
+    options.params = params;
+
+    for( i = 1; i < argc; i++ ) {
+        if( 0 == strcmp( argv[i], "--query" ) && i + 1 < argc ) {
+            options.source_mode = SQL_SOURCE;
+            source = argv[++i];
+        }
+        else if( 0 == strcmp( argv[i], "--param" ) && i + 1 < argc ) {
+            params[ options.param_count++ ] = argv[++i];
+        }
+        else if( 0 == strcmp( argv[i], "--page-rows" ) && i + 1 < argc ) {
+            options.page_rows = strtoul( argv[++i], NULL, 10 );
+        }
+        else if( 0 == strcmp( argv[i], "--page-key" ) && i + 1 < argc ) {
+            options.page_key = argv[++i];
+        }
+        else if( 0 == strcmp( argv[i], "--minimal-quotes" ) ) {
+            options.quote_mode = QUOTE_MINIMAL;
+        }
+        else if( 0 == strcmp( argv[i], "--output" ) && i + 1 < argc ) {
+            output = argv[++i];
+        }
+        else if( 0 == strcmp( argv[i], "--level" ) && i + 1 < argc ) {
+            options.compression_level = atoi( argv[++i] );
+        }
+        else if( 0 == strcmp( argv[i], "--threads" ) && i + 1 < argc ) {
+            poptions.threads = atoi( argv[++i] );
+        }
+        else if( 0 == strcmp( argv[i], "--key" ) && i + 1 < argc ) {
+            poptions.key_column = argv[++i];
+        }
+        else if( 0 == strcmp( argv[i], "--per-range" ) ) {
+            poptions.output = PER_RANGE_OUTPUT;
+        }
+        else {
+            print_usage( argv[0] );
+            free( params );
+            return EXIT_FAILURE;
+        }
+    }
+
+    hdb = create_database( EXAMPLE_DATABASE, &db_schema );
     if( hdb ) {
         rc = populate_data( hdb );
-        if ( EXIT_SUCCESS == rc ) {
-            rc = export_data( hdb, STORAGE_TABLE, 0, 0 );
+        if ( EXIT_SUCCESS == rc && poptions.threads > 0 ) {
+            if( SQL_SOURCE == options.source_mode ) {
+                print_error_message( "--threads exports a table, not a query" );
+                rc = EXIT_FAILURE;
+            }
+            else {
+                rc = export_data_parallel( hdb, source, output, &options, &poptions );
+            }
+        }
+        else if ( EXIT_SUCCESS == rc ) {
+            rc = export_data( hdb, source, output, &options );
         }
 
         printf("Enter SQL statements or an empty line to exit\n");
@@ -175,5 +258,6 @@ example_main(int argc, char **argv)
         db_shutdown(hdb, DB_SOFT_SHUTDOWN, NULL);
     }
 
+    free( params );
     return rc;
 }
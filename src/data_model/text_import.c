@@ -95,6 +95,21 @@ create_database(char* database_name, dbs_schema_def_t *schema)
     return hdb;
 }
 
+/* Open the database of an interrupted import, or create it if it does not exist yet. */
+static db_t
+open_database(char* database_name, dbs_schema_def_t *schema)
+{
+    db_t hdb;
+
+    hdb = db_open_file_storage(database_name, NULL);
+    if (hdb == NULL) {
+        clear_db_error();
+        hdb = create_database(database_name, schema);
+    }
+
+    return hdb;
+}
+
 static const char *csv =
     "int64_field,float64_field,ansi_field,utf8_field\r\n"
     "1,1.243,\"ansi_field\",\"utf8\"\r\n"
@@ -103,14 +118,93 @@ static const char *csv =
     "4,1.273,\"ansi_field\",\"utf8\""
 ;
 
+static void
+print_usage( const char * program )
+{
+    fprintf( stderr,
+             "Usage: %s [options] [FILE]\n"
+             "       %s --benchmark FILE\n"
+             "\n"
+             "Import FILE, or a built-in sample, into the storage table.\n"
+             "FILE is decompressed first if it ends in .gz or .zst.\n"
+             "\n"
+             "  --batch-rows N    commit every N lines\n"
+             "  --batch-ms MS     commit every MS milliseconds\n"
+             "  --resume FILE     record committed lines in FILE and resume from it\n"
+             "  --threads N       parse FILE on N threads\n"
+             "  --writers N       insert parsed lines on N connections\n"
+             "  --ordered         insert lines in input order when using threads\n",
+             program, program );
+}
+
 int
 example_main(int argc, char **argv)
 {
-    // Create database v1 schema
-    db_t hdb = create_database( EXAMPLE_DATABASE, &db_schema );
+    db_t hdb;
     int rc = EXIT_FAILURE;
+    csv_import_options_t options;
+    const char * file_name = NULL;
+    int i;
+
+    memset( &options, 0, sizeof( options ) );
+    options.commit_mode = LINE_COMMIT;
+    options.header_mode = USE_HEADER;
+
+    if( argc > 2 && 0 == strcmp( argv[1], "--benchmark" ) ) {
+        /* Measure csv parser throughput without a database */
+        return csv_parser_benchmark( argv[2], stdout );
+    }
+
+    for( i = 1; i < argc; i++ ) {
+        if( 0 == strcmp( argv[i], "--batch-rows" ) && i + 1 < argc ) {
+            options.commit_mode = BATCH_COMMIT;
+            options.batch_rows = strtoul( argv[++i], NULL, 10 );
+        }
+        else if( 0 == strcmp( argv[i], "--batch-ms" ) && i + 1 < argc ) {
+            options.commit_mode = BATCH_COMMIT;
+            options.batch_ms = strtoul( argv[++i], NULL, 10 );
+        }
+        else if( 0 == strcmp( argv[i], "--resume" ) && i + 1 < argc ) {
+            options.commit_mode = BATCH_COMMIT;
+            options.resume_file = argv[++i];
+        }
+        else if( 0 == strcmp( argv[i], "--threads" ) && i + 1 < argc ) {
+            /* Parallel import commits in batches of --batch-rows lines. */
+            options.commit_mode = BATCH_COMMIT;
+            options.threads = atoi( argv[++i] );
+        }
+        else if( 0 == strcmp( argv[i], "--writers" ) && i + 1 < argc ) {
+            options.writers = atoi( argv[++i] );
+            options.database_name = EXAMPLE_DATABASE;
+        }
+        else if( 0 == strcmp( argv[i], "--ordered" ) ) {
+            options.preserve_order = 1;
+        }
+        else if( '-' != argv[i][0] && NULL == file_name ) {
+            file_name = argv[i];
+        }
+        else {
+            print_usage( argv[0] );
+            return EXIT_FAILURE;
+        }
+    }
+
+    if( options.resume_file ) {
+        /* Keep the lines committed before the import was interrupted. */
+        hdb = open_database( EXAMPLE_DATABASE, &db_schema );
+    }
+    else {
+        // Create database v1 schema
+        hdb = create_database( EXAMPLE_DATABASE, &db_schema );
+    }
     if( hdb ) {
-        rc = csv_import( hdb, "storage", csv, strlen(csv), 0 );
+        if( file_name ) {
+            /* Import a csv file given on the command line */
+            rc = csv_import_file( hdb, "storage", file_name, &options );
+        }
+        else {
+            rc = csv_import( hdb, "storage", csv, strlen(csv), &options );
+        }
 
         printf("Enter SQL statements or an empty line to exit\n");
         dbs_sql_line_shell(hdb, EXAMPLE_DATABASE, stdin, stdout, stderr);
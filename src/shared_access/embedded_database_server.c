@@ -188,6 +188,7 @@ example_main( int argc, char **argv )
             hdb = db_open_file_storage( DB_FILENAME, NULL );
 
             printf("Enter SQL statements or an empty line to exit\n");
+            printf("Use .timing on to profile each statement, and .slow to list slow statements\n");
             dbs_sql_line_shell(hdb, DB_FILENAME, stdin, stdout, stderr);
 
             db_server_stop( 0 );